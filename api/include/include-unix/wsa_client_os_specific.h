@@ -2,4 +2,6 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <netdb.h>
\ No newline at end of file
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
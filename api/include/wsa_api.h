@@ -3,6 +3,7 @@
 
 
 #include "wsa_lib.h"
+#include "wsa_packet_log.h"
 
 
 // ////////////////////////////////////////////////////////////////////////////
@@ -11,6 +12,7 @@
 
 void wsa_debuglevel(int);
 void wsa_debugcallback(void(*callback)(void * pvoid, char const * pstring), void * pvoid);
+void wsa_debugflush(void);
 
 
 
@@ -33,6 +35,8 @@ int16_t wsa_do_scpi_command_file(struct wsa_device *dev, char const *file_name);
 int16_t wsa_query_scpi(struct wsa_device *dev, char const *command, char *response);
 int16_t wsa_send_scpi(struct wsa_device *dev, char const *command);
 
+int16_t wsa_get_stats(struct wsa_device *dev, struct wsa_stats *stats);
+
 
 // ////////////////////////////////////////////////////////////////////////////
 // PROBE SECTION                                                             //
@@ -99,6 +103,25 @@ int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 		int32_t samples_per_packet,
 		uint32_t timeout);
 
+int16_t wsa_read_if_packet(struct wsa_device * const dev,
+		struct wsa_vrt_packet_header * const header,
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_packet_context * const context,
+		int16_t * const i16_buffer,
+		int16_t * const q16_buffer,
+		int32_t * const i32_buffer,
+		int32_t samples_per_packet,
+		uint32_t timeout);
+
+int16_t wsa_read_block(struct wsa_device * const dev,
+		struct wsa_packet_log * const log,
+		int16_t * const i16_buffer,
+		int16_t * const q16_buffer,
+		int32_t * const i32_buffer,
+		int32_t samples_per_packet,
+		uint32_t packets,
+		uint32_t timeout);
+
 int16_t wsa_get_fft_size(int32_t const samples_per_packet, uint32_t const stream_id, int32_t *array_size);
 
 int16_t wsa_compute_fft(int32_t const samples_per_packet,
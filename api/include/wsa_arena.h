@@ -0,0 +1,56 @@
+#ifndef __WSA_ARENA_H__
+#define __WSA_ARENA_H__
+
+#include <stddef.h>
+
+#include "thinkrf_stdint.h"
+
+// *****
+// Arena allocator: memory is handed out from large blocks by moving a
+// cursor, and given back all at once, either to a mark taken earlier or
+// by freeing the whole arena.  Blocks are kept when the cursor moves back,
+// so an arena that is reused settles at its peak size and stops calling
+// the system allocator.  An arena is not thread safe.
+// *****
+
+// alignment of every allocation, enough for any SIMD load
+#define WSA_ARENA_ALIGNMENT 32
+
+// size of the first block when none is given
+#define WSA_ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+struct wsa_arena_block;
+
+struct wsa_arena {
+	/// first block of the chain
+	struct wsa_arena_block *first;
+
+	/// block the cursor is in
+	struct wsa_arena_block *current;
+
+	/// the cursor's offset in the current block
+	size_t offset;
+
+	/// minimum size of a new block
+	size_t block_size;
+
+	/// total bytes in all the blocks
+	size_t reserved;
+};
+
+/// a cursor position to return to with wsa_arena_release()
+struct wsa_arena_mark {
+	struct wsa_arena_block *block;
+	size_t offset;
+};
+
+void wsa_arena_init(struct wsa_arena *arena, size_t block_size);
+void *wsa_arena_alloc(struct wsa_arena *arena, size_t size);
+int16_t wsa_arena_reserve(struct wsa_arena *arena, size_t size);
+struct wsa_arena_mark wsa_arena_mark(struct wsa_arena *arena);
+void wsa_arena_release(struct wsa_arena *arena, struct wsa_arena_mark mark);
+void wsa_arena_reset(struct wsa_arena *arena);
+void wsa_arena_free(struct wsa_arena *arena);
+void wsa_arena_free_self(struct wsa_arena *arena);
+
+#endif
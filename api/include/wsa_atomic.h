@@ -0,0 +1,136 @@
+#ifndef __WSA_ATOMIC_H__
+#define __WSA_ATOMIC_H__
+
+#include "thinkrf_stdint.h"
+
+// *****
+// Minimal portable atomics for counters shared between threads.
+// All operations are full barriers.
+// *****
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define WSA_INLINE __inline
+#else
+#define WSA_INLINE __inline__
+#endif
+
+/**
+ * atomically adds to a 64-bit counter
+ *
+ * @param counter - a pointer to the counter
+ * @param value - the amount to add
+ */
+static WSA_INLINE void wsa_atomic_add64(volatile uint64_t *counter, uint64_t value)
+{
+#ifdef _MSC_VER
+	__int64 old;
+
+	do {
+		old = *((volatile __int64 *) counter);
+	} while (_InterlockedCompareExchange64((volatile __int64 *) counter,
+		old + (__int64) value, old) != old);
+#else
+	__sync_fetch_and_add(counter, value);
+#endif
+}
+
+/**
+ * atomically reads a 64-bit counter, without tearing on 32-bit hosts
+ *
+ * @param counter - a pointer to the counter
+ * @returns the counter value
+ */
+static WSA_INLINE uint64_t wsa_atomic_load64(volatile uint64_t *counter)
+{
+#ifdef _MSC_VER
+	return (uint64_t) _InterlockedCompareExchange64((volatile __int64 *) counter, 0, 0);
+#else
+	return __sync_fetch_and_add(counter, 0);
+#endif
+}
+
+/**
+ * atomically adds to a 32-bit counter
+ *
+ * @param counter - a pointer to the counter
+ * @param value - the amount to add
+ * @returns the new counter value
+ */
+static WSA_INLINE uint32_t wsa_atomic_add32(volatile uint32_t *counter, uint32_t value)
+{
+#ifdef _MSC_VER
+	return (uint32_t) _InterlockedExchangeAdd((volatile long *) counter, (long) value) + value;
+#else
+	return __sync_add_and_fetch(counter, value);
+#endif
+}
+
+/**
+ * atomically replaces a 32-bit value if it still holds the expected value
+ *
+ * @param target - a pointer to the value
+ * @param expected - the value \b target must hold
+ * @param desired - the value to store
+ * @returns 1 if the value was replaced, 0 otherwise
+ */
+static WSA_INLINE int wsa_atomic_cas32(volatile uint32_t *target, uint32_t expected, uint32_t desired)
+{
+#ifdef _MSC_VER
+	return _InterlockedCompareExchange((volatile long *) target, (long) desired,
+		(long) expected) == (long) expected;
+#else
+	return __sync_bool_compare_and_swap(target, expected, desired);
+#endif
+}
+
+/**
+ * reads a 32-bit value, ordering the read before any later memory access
+ *
+ * @param target - a pointer to the value
+ * @returns the value
+ */
+static WSA_INLINE uint32_t wsa_atomic_load32(volatile uint32_t *target)
+{
+#ifdef _MSC_VER
+	return (uint32_t) _InterlockedCompareExchange((volatile long *) target, 0, 0);
+#else
+	uint32_t value = *target;
+
+	__sync_synchronize();
+	return value;
+#endif
+}
+
+/**
+ * writes a 32-bit value, ordering any earlier memory access before the write
+ *
+ * @param target - a pointer to the value
+ * @param value - the value to store
+ */
+static WSA_INLINE void wsa_atomic_store32(volatile uint32_t *target, uint32_t value)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange((volatile long *) target, (long) value);
+#else
+	__sync_synchronize();
+	*target = value;
+#endif
+}
+
+/**
+ * orders every memory access before it before every one after it
+ */
+static WSA_INLINE void wsa_atomic_fence(void)
+{
+#ifdef _MSC_VER
+	// an interlocked operation is a full barrier on every target
+	volatile long barrier = 0;
+
+	_InterlockedExchange(&barrier, 0);
+#else
+	__sync_synchronize();
+#endif
+}
+
+#endif
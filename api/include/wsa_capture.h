@@ -0,0 +1,130 @@
+#ifndef __WSA_CAPTURE_H__
+#define __WSA_CAPTURE_H__
+
+#include <stdio.h>
+
+#include "thinkrf_stdint.h"
+#include "wsa_arena.h"
+#include "wsa_lib.h"
+
+// *****
+// Capture files: VRT packets recorded as they are read from the data
+// socket, in fixed size chunks, with an index of the chunks at the end:
+//
+//	<header><chunk 0><chunk 1>...<last chunk><index><footer>
+//
+// Chunk n starts at WSA_CAPTURE_HEADER_SIZE + n * chunk_size and holds
+// whole records, each a packet and how it is stored; every chunk but the
+// last is padded to the chunk size.  The index gives each chunk's first
+// time stamp, the last sweep started by its end and the streams it holds,
+// so a reader finds a time or a sweep with a binary search of the index
+// and reads only the chunk it lands in.  The file's own fields are little
+// endian; the packets keep their network byte order.
+// *****
+
+#define WSA_CAPTURE_HEADER_SIZE 32
+#define WSA_CAPTURE_RECORD_HEADER_SIZE 12
+#define WSA_CAPTURE_INDEX_ENTRY_SIZE 40
+#define WSA_CAPTURE_FOOTER_SIZE 24
+
+// a chunk must hold the largest packet, stored as is
+#define WSA_CAPTURE_MIN_CHUNK_SIZE \
+	(WSA_CAPTURE_RECORD_HEADER_SIZE + VRT_MAX_PACKET_WORDS * BYTES_PER_VRT_WORD)
+#define WSA_CAPTURE_DEFAULT_CHUNK_SIZE (1024 * 1024)
+
+// capture flags: compress the samples of IF packets with wsa_iq_codec.h,
+// keeping a packet as is when that doesn't make it smaller
+#define WSA_CAPTURE_COMPRESS 0x01
+
+// the bit of a stream in the streams of an index entry
+#define WSA_CAPTURE_STREAM_BIT(stream_id) (1U << ((stream_id) & 0x1f))
+
+/// what the index knows about a chunk
+struct wsa_capture_index_entry {
+	/// where the chunk starts in the file
+	uint64_t offset;
+
+	/// the bytes of records in the chunk, and how many there are
+	uint32_t bytes;
+	uint32_t packets;
+
+	/// the time stamp of the chunk's first packet
+	struct wsa_time first_time;
+
+	/// the last sweep start ID seen by the end of the chunk, 0 before any
+	uint32_t sweep_id;
+
+	/// WSA_CAPTURE_STREAM_BIT() of every stream in the chunk
+	uint32_t streams;
+};
+
+struct wsa_capture_writer {
+	FILE *fp;
+	uint32_t chunk_size;
+	uint32_t flags;
+
+	/// the chunk being filled, and its index entry
+	uint8_t *chunk;
+	struct wsa_capture_index_entry current;
+
+	/// the index of the chunks written, grown as needed
+	struct wsa_capture_index_entry *index;
+	uint32_t chunks;
+	uint32_t index_capacity;
+
+	/// the last sweep start ID written
+	uint32_t sweep_id;
+
+	/// scratch space to compress a packet
+	uint8_t *record;
+	int16_t *i16;
+	int16_t *q16;
+	int32_t *i32;
+
+	/// holds the writer, its chunk and scratch space
+	struct wsa_arena arena;
+};
+
+struct wsa_capture_reader {
+	FILE *fp;
+	uint32_t chunk_size;
+	uint32_t flags;
+
+	/// the index, from the end of the file
+	struct wsa_capture_index_entry *index;
+	uint32_t chunks;
+
+	/// the chunk held in memory, or chunks if none is
+	uint8_t *chunk;
+	uint32_t loaded;
+
+	/// where the next record is: a chunk and an offset in it
+	uint32_t next_chunk;
+	uint32_t next_offset;
+
+	/// scratch space to decompress a packet
+	int16_t *i16;
+	int16_t *q16;
+	int32_t *i32;
+
+	/// holds the reader, its index, chunk and scratch space
+	struct wsa_arena arena;
+};
+
+int16_t wsa_capture_create(char const *file_name, uint32_t chunk_size,
+		uint32_t flags, struct wsa_capture_writer **writer);
+int16_t wsa_capture_write_packet(struct wsa_capture_writer *writer,
+		uint8_t *packet, uint32_t packet_bytes);
+int16_t wsa_capture_close(struct wsa_capture_writer *writer);
+void wsa_capture_record(struct wsa_device *dev, struct wsa_capture_writer *writer);
+
+int16_t wsa_capture_open(char const *file_name, struct wsa_capture_reader **reader);
+void wsa_capture_reader_close(struct wsa_capture_reader *reader);
+int16_t wsa_capture_seek_time(struct wsa_capture_reader *reader,
+		struct wsa_time const *time);
+int16_t wsa_capture_seek_sweep(struct wsa_capture_reader *reader, uint32_t sweep_id);
+int16_t wsa_capture_read_packet(struct wsa_capture_reader *reader,
+		uint32_t stream_id, uint8_t *packet, uint32_t size,
+		uint32_t *packet_bytes);
+
+#endif
@@ -2,6 +2,7 @@
 #define __WSA_CLIENT_H__
 
 #include "thinkrf_stdint.h"
+#include "wsa_stats.h"
 
 #define MAX_STR_LEN 512
 #define MAX_BUF_SIZE 20
@@ -21,7 +22,8 @@ int32_t wsa_sock_send(int32_t sock_fd, char const *out_str, int32_t len);
 int16_t wsa_sock_recv(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
 					  uint32_t time_out, int32_t *bytes_received);
 int16_t wsa_sock_recv_data(int32_t sock_fd, uint8_t *rx_buf_ptr, 
-						   int32_t buf_size, uint32_t time_out, int32_t *total_bytes);
+						   int32_t buf_size, uint32_t time_out, int32_t *total_bytes,
+						   struct wsa_stats *stats);
 void wsa_initialize_client();
 void wsa_destroy_client();
 
@@ -10,6 +10,28 @@
 #define MAX_FILE_LINES 300
 #define SEP_CHARS "\n\r"
 
+// compiles a hot loop for AVX2 as well as the baseline SSE2, picking the
+// version to run when the library is loaded.  Needs gcc's ifunc support,
+// so other compilers get the baseline only.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 && \
+	defined(__linux__) && (defined(__x86_64__) || defined(__i386__)) && \
+	!defined(WSA_NO_TARGET_CLONES)
+#define WSA_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define WSA_TARGET_CLONES
+#endif
+
+// promises that a pointer's buffer overlaps no other the function is
+// given, which a loop gathering from one buffer into another needs to
+// vectorize
+#if defined(__GNUC__)
+#define WSA_RESTRICT __restrict__
+#elif defined(_MSC_VER)
+#define WSA_RESTRICT __restrict
+#else
+#define WSA_RESTRICT
+#endif
+
 int16_t wsa_tokenize_file(FILE *fptr, char *cmd_str[]);
 int16_t wsa_to_int(char const * num_str, int * val);
 int16_t wsa_to_double(char const * num_str, double * val);
@@ -20,12 +20,38 @@
 #define DMED  2
 #define DLOW  3
 
+// Messages of a level above this one are compiled out of the library, so they
+// cost nothing at run time.  Build with -DWSA_LOG_COMPILE_LEVEL=DHIGH to keep
+// only the error messages.
+#ifndef WSA_LOG_COMPILE_LEVEL
+#define WSA_LOG_COMPILE_LEVEL DLOW
+#endif
+
 #define WSA_API_LOG_FILE "wsa_api.log"
+#ifndef ENABLE_LOG_FILE
 #define ENABLE_LOG_FILE 0
+#endif
+
+// *****
+// Messages are queued as a format pointer plus their raw arguments, and are
+// only formatted and written out by a background thread.  A full queue drops
+// the message rather than blocking the caller; drops are reported in the log.
+// *****
+#define WSA_LOG_QUEUE_SIZE 1024		// messages, must be a power of two
+#define WSA_LOG_MAX_ARGS 12			// arguments kept per message
+#define WSA_LOG_STRING_BYTES 192	// bytes kept for a message's %s arguments
+#define WSA_LOG_LINE_LEN 1024		// longest formatted message
 
+// wsa_doutf() returns 1 if the message was logged and 0 if it was filtered
+// out or dropped, rather than the length of the message it used to format
+// in the caller; doutf() discards it, as every caller in the library does.
 int  wsa_doutf(int, const char *, ...);
+void wsa_debugflush(void);
 
-#define doutf wsa_doutf
+#define doutf(level, ...) do { \
+		if ((level) <= WSA_LOG_COMPILE_LEVEL) \
+			wsa_doutf((level), __VA_ARGS__); \
+	} while (0)
 
 #endif
     
\ No newline at end of file
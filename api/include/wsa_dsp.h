@@ -1,6 +1,7 @@
 
 #include "kiss_fft.h"
 #include "thinkrf_stdint.h"
+#include "wsa_commons.h"
 
 
 // ////////////////////////////////////////////////////////////////////////////
@@ -38,6 +39,15 @@ int rfft(kiss_fft_scalar *idata, kiss_fft_cpx *fftdata, int len);
 kiss_fft_scalar cpx_to_power(kiss_fft_cpx value);
 kiss_fft_scalar power_to_logpower(kiss_fft_scalar value);
 
+// ////////////////////////////////////////////////////////////////////////////
+// Stitching Section                                                         //
+// ////////////////////////////////////////////////////////////////////////////
+void stitch_block(float * WSA_RESTRICT sum, float * WSA_RESTRICT weight, int len,
+				float const * WSA_RESTRICT block, int block_len,
+				double offset, double step,
+				double left, double right, double ramp);
+void stitch_finish(float *spectrum, float const *sum, float const *weight, int len);
+
 // ////////////////////////////////////////////////////////////////////////////
 // Utility Functions                                                         //
 // ////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,61 @@
+#ifndef __WSA_EMISSION_MASK_H__
+#define __WSA_EMISSION_MASK_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_arena.h"
+
+// *****
+// Spectrum emission mask: a piecewise linear limit line over frequency,
+// resampled once onto the bin grid of a sweep, so checking a sweep's
+// spectrum against it is a single pass over the bins.  Bins outside the
+// limit line are not checked.
+// *****
+
+// limit of the bins the mask doesn't cover
+#define WSA_EMISSION_MASK_NO_LIMIT 1e30f
+
+// margin of a bin the mask covers whose level is NaN or +inf, which fails
+// the check
+#define WSA_EMISSION_MASK_NOT_FINITE (-1e30f)
+
+/// a corner of the limit line
+struct wsa_emission_mask_point {
+	uint64_t freq;
+	float level;
+};
+
+struct wsa_emission_mask {
+	/// the bin grid: bins values from fstart to fstop
+	uint64_t fstart;
+	uint64_t fstop;
+	uint32_t bins;
+
+	/// the limit of every bin, in dBm
+	float *limits;
+
+	/// holds the mask and its limits
+	struct wsa_arena arena;
+};
+
+/// the result of checking a spectrum
+struct wsa_emission_mask_result {
+	/// 1 if every bin is at or below its limit, and neither NaN nor +inf
+	uint8_t pass;
+
+	/// the smallest limit minus level, negative when the mask is violated
+	float worst_margin;
+
+	/// where the smallest margin is
+	uint32_t worst_bin;
+	uint64_t worst_freq;
+};
+
+int16_t wsa_emission_mask_alloc(struct wsa_emission_mask_point const *points,
+		uint32_t num_points, uint64_t fstart, uint64_t fstop, uint32_t bins,
+		struct wsa_emission_mask **mask);
+void wsa_emission_mask_free(struct wsa_emission_mask *mask);
+int16_t wsa_emission_mask_check(struct wsa_emission_mask const *mask,
+		float const *spectrum, uint32_t len,
+		struct wsa_emission_mask_result *result);
+
+#endif
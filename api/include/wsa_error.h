@@ -55,6 +55,7 @@
 #define WSA_ERR_SOCKETERROR	(LNEG_NUM - 212)
 #define WSA_ERR_SOCKETDROPPED (LNEG_NUM - 213)
 #define WSA_ERR_INVLANCONFIG (LNEG_NUM - 214)
+#define WSA_ERR_IOURINGFAILED (LNEG_NUM - 215)
 
 // ///////////////////////////////
 // AMPLITUDE ERRORS				//
@@ -75,6 +76,13 @@
 #define WSA_ERR_INVCAPTURESIZE (LNEG_NUM - 409)
 #define WSA_ERR_PACKETOUTOFORDER (LNEG_NUM - 410)
 #define WSA_ERR_CAPTUREACCESSDENIED  (LNEG_NUM - 411)
+#define WSA_ERR_BUFFERSHELD  (LNEG_NUM - 412)
+#define WSA_ERR_SHMFAILED  (LNEG_NUM - 413)
+#define WSA_ERR_SHMINVALID  (LNEG_NUM - 414)
+#define WSA_ERR_NOSPECTRUM  (LNEG_NUM - 415)
+#define WSA_ERR_NOPACKET  (LNEG_NUM - 416)
+#define WSA_ERR_SHMINUSE  (LNEG_NUM - 417)
+#define WSA_ERR_NOCONSUMERSLOT  (LNEG_NUM - 418)
 
 
 // ///////////////////////////////
@@ -140,6 +148,8 @@
 #define WSA_ERR_FILEOPENFAILED (LNEG_NUM - 1901)
 #define WSA_ERR_FILEREADFAILED (LNEG_NUM - 1902)
 #define WSA_ERR_FILEWRITEFAILED (LNEG_NUM - 1903)
+#define WSA_ERR_FILECORRUPT (LNEG_NUM - 1904)
+#define WSA_ERR_FILEEND (LNEG_NUM - 1905)
 
 
 // ///////////////////////////////
@@ -150,6 +160,7 @@
 #define WSA_ERR_MALLOCFAILED	(LNEG_NUM - 2002)
 #define WSA_ERR_UNKNOWN_ERROR	(LNEG_NUM - 2003)
 #define WSA_ERR_INVINPUT	(LNEG_NUM - 2004)
+#define WSA_ERR_THREADCREATEFAILED	(LNEG_NUM - 2005)
 
 // ///////////////////////////////
 // SWEEP ERRORS					//
@@ -0,0 +1,35 @@
+#ifndef __WSA_IQ_CODEC_H__
+#define __WSA_IQ_CODEC_H__
+
+#include "thinkrf_stdint.h"
+
+// *****
+// Lossless compression of recorded samples, one channel (I or Q) of one
+// packet at a time.  Each sample is replaced by its difference from the
+// previous one, zigzag coded so small differences of either sign become
+// small numbers, and every block of WSA_IQ_CODEC_BLOCK of them is bit
+// packed at the width of its largest value:
+//
+//	<1 byte width><width * samples bits, least significant bit first>...
+//
+// Blocks start on a byte boundary, and a packet starts from 0, so any
+// packet decodes on its own.  The sample count isn't stored; the container
+// records it.
+// *****
+
+#define WSA_IQ_CODEC_BLOCK 64
+
+// the most bytes encoding \b count samples of \b sample_bytes bytes can take
+#define WSA_IQ_CODEC_BOUND(count, sample_bytes) \
+	((count) * (sample_bytes) + ((count) + WSA_IQ_CODEC_BLOCK - 1) / WSA_IQ_CODEC_BLOCK)
+
+int32_t wsa_iq_encode_i16(int16_t const *samples, int32_t count,
+		uint8_t *out, int32_t out_size);
+int32_t wsa_iq_decode_i16(uint8_t const *in, int32_t in_size,
+		int16_t *samples, int32_t count);
+int32_t wsa_iq_encode_i32(int32_t const *samples, int32_t count,
+		uint8_t *out, int32_t out_size);
+int32_t wsa_iq_decode_i32(uint8_t const *in, int32_t in_size,
+		int32_t *samples, int32_t count);
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef __WSA_IQ_SHM_H__
+#define __WSA_IQ_SHM_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_arena.h"
+#include "wsa_lib.h"
+#include "wsa_shm.h"
+#include "wsa_packet_ring.h"
+
+// *****
+// IQ ring: the packets of a stream, received once from the data socket
+// straight into a ring of slots in a named shared memory segment, which
+// may be on huge pages, for any number of other local processes to
+// consume, such as a recorder, a demodulator and a detector.  Each slot
+// holds a whole VRT packet as received, with its decoded header, trailer
+// and the device's context, and is guarded by a sequence lock as the
+// spectrum ring's are (see wsa_spectrum_shm.h).
+//
+// Each consumer attaches to a cursor of its own in the segment, and reads
+// the packets in order from there.  A consumer whose process exits without
+// closing it stays attached until another needs its entry.  The receiver
+// never looks at the cursors: it writes over the oldest packet whether or
+// not every consumer has read it, so a slow consumer can't hold it up.
+// Such a consumer skips the packets written over before it got to them,
+// and counts them in its drop counter, which the receiver and anyone else
+// can see.
+//
+// The slots hold the library's own packet structs, so the processes
+// sharing a ring must be built for the same architecture; a consumer
+// checks that when it attaches.
+// *****
+
+#define WSA_IQ_SHM_MAGIC 0x57534151
+#define WSA_IQ_SHM_VERSION 1
+
+/// the consumers a ring has room for when none are given, and the room
+/// for a consumer's name
+#define WSA_IQ_SHM_DEFAULT_CONSUMERS 8
+#define WSA_IQ_SHM_CONSUMER_NAME_LEN 32
+
+/// the packet number a slot holds while nothing valid is in it
+#define WSA_IQ_SHM_EMPTY 0xffffffffffffffffULL
+
+/// the times a consumer copies a slot that keeps changing before giving up
+#define WSA_IQ_SHM_RETRIES 1000
+
+/// the start of the segment
+struct wsa_iq_shm_header {
+	/// written last, once the rest is set
+	volatile uint32_t magic;
+	uint32_t version;
+
+	/// the slots in the ring, the bytes from one to the next, the largest
+	/// packet one holds, and the size of a slot's header
+	uint32_t slots;
+	uint32_t slot_size;
+	uint32_t max_packet;
+	uint32_t slot_header;
+
+	/// the entries of the consumer table, which follows the header
+	uint32_t consumers;
+
+	/// whether the segment is on huge pages
+	uint32_t huge;
+
+	uint8_t reserved1[32];
+
+	/// the packets published so far, on a cache line of its own: packet n
+	/// is in slot n % slots.  The slot after the newest packet's is being
+	/// received into, so consumers see at most slots - 1 packets.
+	volatile uint64_t head;
+
+	uint8_t reserved2[56];
+};
+
+/// a consumer's entry in the consumer table
+struct wsa_iq_shm_consumer {
+	/// 1 while a consumer is attached to it, and the ID of the process it
+	/// is in, which a consumer attaching takes the entry over from once
+	/// that process has exited without closing it
+	volatile uint32_t attached;
+	volatile uint32_t pid;
+
+	/// the next packet the consumer reads, the packets it read, and those
+	/// written over before it could
+	volatile uint64_t cursor;
+	volatile uint64_t packets;
+	volatile uint64_t drops;
+
+	char name[WSA_IQ_SHM_CONSUMER_NAME_LEN];
+};
+
+/// a packet as published
+struct wsa_iq_packet {
+	/// its number in the stream, from 0 on, and its size in bytes
+	uint64_t number;
+	uint32_t bytes;
+
+	/// its decoded header, and trailer for an IF packet
+	struct wsa_vrt_packet_header header;
+	struct wsa_vrt_packet_trailer trailer;
+
+	/// the device's context when it was read
+	struct wsa_packet_context context;
+
+	/// where the payload of an IF packet starts in the packet, in network
+	/// byte order, and its size; 0 for any other packet
+	uint32_t payload_offset;
+	uint32_t payload_bytes;
+
+	/// the wsa_perf_now() time it was received at
+	uint64_t received_ns;
+};
+
+/// a slot, whose packet follows it from the next cache line on
+struct wsa_iq_shm_slot {
+	/// odd while the slot is written
+	volatile uint32_t seq;
+	uint32_t reserved;
+
+	struct wsa_iq_packet packet;
+};
+
+/// a consumer's counters, as anyone can see them
+struct wsa_iq_consumer_stats {
+	uint8_t attached;
+	char name[WSA_IQ_SHM_CONSUMER_NAME_LEN];
+
+	/// the packets read, those dropped, counting those the consumer will
+	/// find written over when it next reads, and those waiting for it
+	uint64_t packets;
+	uint64_t drops;
+	uint64_t behind;
+};
+
+/// the receiver's side of a ring
+struct wsa_iq_ring {
+	struct wsa_shm shm;
+	struct wsa_iq_shm_header *header;
+	struct wsa_iq_shm_consumer *consumers;
+	uint8_t *slot_base;
+
+	/// the packets published so far
+	uint64_t head;
+
+	/// holds the ring
+	struct wsa_arena arena;
+};
+
+/// a consumer's side of a ring
+struct wsa_iq_consumer {
+	struct wsa_shm shm;
+	struct wsa_iq_shm_header *header;
+	struct wsa_iq_shm_consumer *entry;
+	uint8_t *slot_base;
+
+	/// the layout of the ring, as checked when it was attached to
+	uint32_t slots;
+	uint32_t slot_size;
+	uint32_t max_packet;
+
+	/// the next packet to read, the packets read and those dropped
+	uint64_t cursor;
+	uint64_t packets;
+	uint64_t drops;
+
+	/// holds the consumer
+	struct wsa_arena arena;
+};
+
+int16_t wsa_iq_ring_new(char const *name, uint32_t slots, uint32_t max_packet,
+		uint32_t consumers, uint32_t flags, struct wsa_iq_ring **ring);
+void wsa_iq_ring_free(struct wsa_iq_ring *ring);
+int16_t wsa_iq_ring_read(struct wsa_device *dev, struct wsa_iq_ring *ring, uint32_t timeout);
+int16_t wsa_iq_ring_publish(struct wsa_iq_ring *ring, struct wsa_packet_slice const *slice);
+int16_t wsa_iq_ring_consumer_stats(struct wsa_iq_ring *ring, uint32_t index,
+		struct wsa_iq_consumer_stats *stats);
+
+int16_t wsa_iq_consumer_open(char const *name, char const *consumer_name,
+		struct wsa_iq_consumer **consumer);
+void wsa_iq_consumer_close(struct wsa_iq_consumer *consumer);
+int16_t wsa_iq_consumer_read(struct wsa_iq_consumer *consumer,
+		struct wsa_iq_packet *packet, uint8_t *buf, uint32_t buflen);
+
+#endif
@@ -2,6 +2,8 @@
 #define __WSA_LIB_H__
 
 #include "wsa_commons.h"
+#include "wsa_stats.h"
+#include "wsa_arena.h"
 
 #include <limits.h>
 #include <math.h>
@@ -18,6 +20,11 @@
 #define VRT_HEADER_SIZE 5
 #define VRT_TRAILER_SIZE 1
 #define BYTES_PER_VRT_WORD 4
+#define VRT_PROLOGUE_SIZE 2		// header words giving the packet size and stream
+#define VRT_MAX_PACKET_WORDS 65535	// the packet size field is 16 bits
+
+// block size of a device's arena: a whole packet plus its decoded payload
+#define WSA_DEVICE_ARENA_SIZE (2 * (VRT_MAX_PACKET_WORDS + 1) * BYTES_PER_VRT_WORD)
 
 #define MAX_VRT_PKT_COUNT 15
 #define MIN_VRT_PKT_COUNT 0
@@ -249,24 +256,36 @@ struct wsa_vrt_packet_header {
 	struct wsa_time time_stamp;
 };
 
-//structure to hold receiver packet data
+// VRT fixed point fields hold whole Hz in the high bits and a fraction in
+// the low VRT_FIXED_FRAC_BITS bits; gains are in 1/128 dB and temperatures
+// in 1/64 degrees C, as they are sent
+#define VRT_FIXED_FRAC_BITS 20
+#define VRT_FIXED_FRAC_MASK 0x000fffff
+#define VRT_GAIN_SCALE 128.0
+
+//structure to hold receiver packet data, see wsa_receiver_freq() and
+//wsa_receiver_gain_if()/wsa_receiver_gain_rf() for the values in Hz and dB
 struct wsa_receiver_packet {
+	int64_t freq;
+	uint32_t freq_frac;
 	int32_t indicator_field;
-	uint8_t pkt_count;
 	int32_t reference_point;
-	long double freq;
-	double gain_if;
-	double gain_rf;
-	double temperature;
+	int16_t gain_if;
+	int16_t gain_rf;
+	int16_t temperature;
+	uint8_t pkt_count;
 };
 
-//structure to hold digitizer packet data
+//structure to hold digitizer packet data, see wsa_digitizer_bandwidth()
+//and wsa_digitizer_rf_freq_offset() for the values in Hz
 struct wsa_digitizer_packet {
+	int64_t bandwidth;
+	int64_t rf_freq_offset;
+	uint32_t bandwidth_frac;
+	uint32_t rf_freq_offset_frac;
 	int32_t indicator_field;
-	uint8_t pkt_count;
-	long double bandwidth;
 	int16_t reference_level;
-	long double rf_freq_offset;
+	uint8_t pkt_count;
 };
 
 //structure to hold extension packet data
@@ -277,6 +296,30 @@ struct wsa_extension_packet {
 	uint32_t stream_start_id;
 };
 
+// bits of wsa_packet_context.valid, for the fields received so far
+#define WSA_CONTEXT_FREQ 0x01
+#define WSA_CONTEXT_BANDWIDTH 0x02
+#define WSA_CONTEXT_RF_FREQ_OFFSET 0x04
+#define WSA_CONTEXT_REFERENCE_LEVEL 0x08
+#define WSA_CONTEXT_SWEEP_START_ID 0x10
+#define WSA_CONTEXT_STREAM_START_ID 0x20
+
+//structure to hold the context of the IF packets read: the latest value of
+//each field sent in a context packet, with the fixed point fields as in the
+//receiver and digitizer packets
+struct wsa_packet_context {
+	uint32_t valid;
+	int64_t freq;
+	uint32_t freq_frac;
+	int64_t bandwidth;
+	uint32_t bandwidth_frac;
+	int64_t rf_freq_offset;
+	uint32_t rf_freq_offset_frac;
+	int16_t reference_level;	// in dBm, with the R5500 offset applied
+	uint32_t sweep_start_id;
+	uint32_t stream_start_id;
+};
+
 // These values will be defined in a future release
 struct wsa_vrt_packet_trailer {
 	uint8_t valid_data_indicator;
@@ -316,9 +359,20 @@ struct wsa_socket {
 	int32_t data;
 };
 
+// see wsa_capture.h
+struct wsa_capture_writer;
+
+// see wsa_uring.h
+struct wsa_uring;
+
 struct wsa_device {
 	struct wsa_descriptor descr;
 	struct wsa_socket sock;
+	struct wsa_stats stats;
+	struct wsa_arena arena;		// per-packet buffers, given back after each read
+	struct wsa_capture_writer *capture;	// records every packet read, or NULL
+	struct wsa_packet_context context;	// from the context packets read so far
+	struct wsa_uring *uring;	// receives the data socket, or NULL for select() and recv()
 };
 
 struct wsa_resp {
@@ -346,6 +400,35 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 		struct wsa_extension_packet * const extension,
 		uint8_t * const data_buffer,
 		uint32_t timeout);
+
+int16_t wsa_read_vrt_packet_into(struct wsa_device * const device, 
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t * const packet,
+		uint32_t packet_size,
+		uint32_t *packet_bytes,
+		uint32_t timeout);
+
+int16_t wsa_decode_vrt_prologue(uint8_t const *prologue,
+		struct wsa_vrt_packet_header * const header,
+		uint16_t *packet_size);
+
+int16_t wsa_decode_vrt_packet(uint8_t *packet,
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t * const data_buffer);
+
+double wsa_receiver_freq(struct wsa_receiver_packet const *receiver);
+double wsa_receiver_gain_if(struct wsa_receiver_packet const *receiver);
+double wsa_receiver_gain_rf(struct wsa_receiver_packet const *receiver);
+double wsa_digitizer_bandwidth(struct wsa_digitizer_packet const *digitizer);
+double wsa_digitizer_rf_freq_offset(struct wsa_digitizer_packet const *digitizer);
 		
 int32_t wsa_decode_zif_frame(uint8_t *data_buf, int16_t *i_buf, int16_t *q_buf, 
 						 int32_t sample_size);
@@ -0,0 +1,101 @@
+#ifndef __WSA_MASK_TRIGGER_H__
+#define __WSA_MASK_TRIGGER_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_lib.h"
+#include "wsa_spectrogram.h"
+
+// *****
+// Host side frequency mask trigger: streamed samples go through a
+// spectrogram, and every STFT frame is compared against a set of masks,
+// each a threshold in dB per bin.  A mask fires when any bin of a frame
+// rises above it, and re-arms once a frame is entirely below it again, so
+// several kinds of signal are caught at once without touching the
+// device's own trigger.  Recent samples are kept so the history before a
+// trigger can be copied out.
+// *****
+
+// threshold of the bins a mask doesn't look at
+#define WSA_MASK_TRIGGER_IGNORE 1e30f
+
+/// a mask firing
+struct wsa_mask_trigger_event {
+	/// the index of the mask that fired
+	uint32_t mask;
+
+	/// the first bin above the mask, and its level in dB
+	uint32_t bin;
+	float level;
+
+	/// the spectrogram row of the frame
+	uint64_t frame;
+
+	/// the number of the first sample of the frame, counting from the
+	/// first sample pushed
+	uint64_t sample;
+
+	/// the time of that sample, from the time stamps given with the samples
+	struct wsa_time time_stamp;
+};
+
+struct wsa_mask_trigger {
+	/// the spectrogram the frames are computed in
+	struct wsa_spectrogram *spectrogram;
+
+	/// the masks, bins thresholds each
+	float *thresholds;
+	uint8_t *armed;
+	uint32_t masks;
+	uint32_t max_masks;
+
+	/// events waiting to be read, in a ring
+	struct wsa_mask_trigger_event *events;
+	uint32_t max_events;
+	uint32_t event_head;
+	uint32_t event_count;
+	uint64_t events_dropped;
+
+	/// the last history_len samples, normalized, in a ring
+	kiss_fft_scalar *history_i;
+	kiss_fft_scalar *history_q;
+	uint32_t history_len;
+
+	/// samples pushed so far
+	uint64_t samples;
+
+	/// the sample rate, and a sample with a known time to count from
+	uint64_t sample_rate;
+	uint64_t anchor_sample;
+	struct wsa_time anchor_time;
+
+	/// holds everything but the spectrogram
+	struct wsa_arena arena;
+};
+
+int16_t wsa_mask_trigger_alloc(uint32_t fft_size, uint32_t hop,
+		uint8_t complex_input, uint64_t sample_rate, uint32_t max_masks,
+		uint32_t history_len, uint32_t max_events,
+		struct wsa_mask_trigger **trigger);
+void wsa_mask_trigger_free(struct wsa_mask_trigger *trigger);
+void wsa_mask_trigger_reset(struct wsa_mask_trigger *trigger);
+
+int32_t wsa_mask_trigger_add_mask(struct wsa_mask_trigger *trigger,
+		float const *thresholds);
+int32_t wsa_mask_trigger_add_range(struct wsa_mask_trigger *trigger,
+		uint32_t start_bin, uint32_t stop_bin, float level);
+
+int32_t wsa_mask_trigger_push_iq(struct wsa_mask_trigger *trigger,
+		uint32_t stream_id,
+		int16_t *i16_buffer,
+		int16_t *q16_buffer,
+		int32_t *i32_buffer,
+		int32_t samples,
+		struct wsa_time const *time_stamp);
+
+int16_t wsa_mask_trigger_next_event(struct wsa_mask_trigger *trigger,
+		struct wsa_mask_trigger_event *event);
+int16_t wsa_mask_trigger_copy_history(struct wsa_mask_trigger const *trigger,
+		uint64_t first_sample, uint32_t len,
+		kiss_fft_scalar *idata, kiss_fft_scalar *qdata);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __WSA_PACKET_LOG_H__
+#define __WSA_PACKET_LOG_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_arena.h"
+
+// *****
+// Packet metadata log for block captures: the time stamp, center frequency,
+// reference level and trailer flags of every IF packet, stored as one
+// contiguous column per field so a capture of thousands of packets can be
+// analyzed a column at a time.  Entry n describes the samples at offset
+// n * samples_per_packet of the capture's sample buffers.
+// *****
+
+// bits of the flags column, set from the packet's trailer
+#define WSA_PACKET_LOG_VALID_DATA 0x01
+#define WSA_PACKET_LOG_REF_LOCK 0x02
+#define WSA_PACKET_LOG_SPECTRAL_INVERSION 0x04
+#define WSA_PACKET_LOG_OVER_RANGE 0x08
+#define WSA_PACKET_LOG_SAMPLE_LOSS 0x10
+
+struct wsa_packet_log {
+	/// number of entries the columns hold
+	uint32_t capacity;
+
+	/// number of entries logged
+	uint32_t count;
+
+	/// integer seconds of the time stamps
+	uint32_t *sec;
+
+	/// picoseconds of the time stamps
+	uint64_t *psec;
+
+	/// center frequency in Hz, from the last receiver context packet
+	int64_t *freq;
+
+	/// reference level in dBm, from the last digitizer context packet
+	int16_t *reference_level;
+
+	/// the VRT packet counts, to spot lost packets
+	uint8_t *pkt_count;
+
+	/// WSA_PACKET_LOG_* trailer flags
+	uint8_t *flags;
+
+	/// holds the columns
+	struct wsa_arena arena;
+};
+
+int16_t wsa_packet_log_init(struct wsa_packet_log *log, uint32_t capacity);
+void wsa_packet_log_reset(struct wsa_packet_log *log);
+void wsa_packet_log_free(struct wsa_packet_log *log);
+int16_t wsa_packet_log_append(struct wsa_packet_log *log,
+		uint32_t sec, uint64_t psec, int64_t freq, int16_t reference_level,
+		uint8_t pkt_count, uint8_t flags);
+
+#endif
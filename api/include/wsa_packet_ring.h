@@ -0,0 +1,61 @@
+#ifndef __WSA_PACKET_RING_H__
+#define __WSA_PACKET_RING_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_arena.h"
+#include "wsa_lib.h"
+
+// *****
+// Packet ring: a fixed set of packet buffers that VRT packets are received
+// into straight off the data socket, and handed out as slices.  A slice is
+// held by every consumer it was given to, such as a recorder, a spectrum
+// and a detector, which all read the same packet; its buffer is read into
+// again once the last of them releases it.  Packets are read by one thread,
+// but slices may be held and released by any.
+// *****
+
+struct wsa_packet_ring;
+
+/// a packet in the ring
+struct wsa_packet_slice {
+	/// the whole packet as received, and its size in bytes
+	uint8_t *packet;
+	uint32_t bytes;
+
+	/// its decoded header, and trailer for an IF packet
+	struct wsa_vrt_packet_header header;
+	struct wsa_vrt_packet_trailer trailer;
+
+	/// the device's context when the packet was read
+	struct wsa_packet_context context;
+
+	/// the payload of an IF packet, in network byte order, or NULL
+	uint8_t *payload;
+	uint32_t payload_bytes;
+
+	/// the references held to the slice; its buffer is reused at 0
+	volatile uint32_t refs;
+};
+
+struct wsa_packet_ring {
+	/// the slices, each with a buffer of slice_size bytes
+	struct wsa_packet_slice *slices;
+	uint32_t slots;
+	uint32_t slice_size;
+
+	/// the slot to try first for the next packet
+	uint32_t next;
+
+	/// holds the ring, its slices and their buffers
+	struct wsa_arena arena;
+};
+
+int16_t wsa_packet_ring_alloc(uint32_t slots, uint32_t slice_size,
+		struct wsa_packet_ring **ring);
+void wsa_packet_ring_free(struct wsa_packet_ring *ring);
+int16_t wsa_packet_ring_read(struct wsa_device *dev, struct wsa_packet_ring *ring,
+		uint32_t timeout, struct wsa_packet_slice **slice);
+void wsa_packet_slice_hold(struct wsa_packet_slice *slice, uint32_t count);
+void wsa_packet_slice_release(struct wsa_packet_slice *slice);
+
+#endif
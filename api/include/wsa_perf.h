@@ -0,0 +1,53 @@
+#ifndef __WSA_PERF_H__
+#define __WSA_PERF_H__
+
+#include "thinkrf_stdint.h"
+
+// *****
+// Pipeline stages timed by the per-stage latency histograms
+// *****
+#define WSA_PERF_SOCKET_WAIT	0	// waiting on the data socket
+#define WSA_PERF_VRT_PARSE		1	// decoding VRT header, context and trailer fields
+#define WSA_PERF_DECODE			2	// unpacking raw sample words
+#define WSA_PERF_WINDOW			3	// windowing the time domain data
+#define WSA_PERF_FFT			4	// the FFT itself
+#define WSA_PERF_LOG_POWER		5	// converting FFT bins to dBm
+#define WSA_PERF_STITCH			6	// placing a block's usable bins into the spectrum
+#define WSA_PERF_NUM_STAGES		7
+
+// *****
+// Histogram layout: nanosecond values are grouped by power of two, and each
+// power of two is split into WSA_PERF_SUB_BUCKETS linear buckets, so every
+// recorded value is kept with a relative error below 1/WSA_PERF_SUB_BUCKETS
+// *****
+#define WSA_PERF_SUB_BUCKET_BITS 4
+#define WSA_PERF_SUB_BUCKETS (1 << WSA_PERF_SUB_BUCKET_BITS)
+#define WSA_PERF_MAGNITUDES 40	// covers up to 2^40 ns (about 18 minutes)
+#define WSA_PERF_BUCKETS (WSA_PERF_MAGNITUDES * WSA_PERF_SUB_BUCKETS)
+
+/// a summary of the latencies recorded for one stage
+struct wsa_perf_summary {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t max_ns;
+};
+
+extern int wsa_perf_enabled;
+extern int wsa_trace_enabled;	// set by wsa_trace_start(), see wsa_trace.h
+
+void wsa_perf_enable(int enable);
+void wsa_perf_reset(void);
+uint64_t wsa_perf_now(void);
+void wsa_perf_record(int stage, uint64_t start_ns);
+int16_t wsa_perf_get_summary(int stage, struct wsa_perf_summary *summary);
+const char *wsa_perf_stage_name(int stage);
+
+// Time stamp a stage.  When neither the histograms nor tracing are enabled,
+// the stamp is 0 and stopping it records nothing, so the cost is a single
+// branch.  While tracing, every stage is also recorded as a trace event.
+#define WSA_PERF_START(ts) ((ts) = (wsa_perf_enabled || wsa_trace_enabled) ? wsa_perf_now() : 0)
+#define WSA_PERF_STOP(stage, ts) do { if (ts) wsa_perf_record((stage), (ts)); } while (0)
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __WSA_SHM_H__
+#define __WSA_SHM_H__
+
+#include <stddef.h>
+#include "thinkrf_stdint.h"
+
+// *****
+// Named shared memory segments, for handing data to other local processes.
+// The creator of a segment removes its name when it closes it; processes
+// that opened it keep their mapping until they close it too.  A name is a
+// short plain word, which is made a POSIX shared memory name or a Windows
+// local object name.  The implementations live in src-unix and src-windows.
+//
+// Creating a segment on Unix replaces one of the same name, even one
+// others still map.  Windows can't do that: the name lasts as long as any
+// process maps the segment, so creating it again while, say, a consumer
+// of the last creator's is still attached fails with WSA_ERR_SHMINUSE
+// until that process closes it or exits.
+// *****
+
+#define WSA_SHM_NAME_LEN 64
+
+/// creation flags: back the segment with huge pages where the system has
+/// some to spare, which spares a ring of large packets most of its TLB
+/// misses.  On Linux that is a file in the hugetlbfs mount below, on
+/// Windows a large page section, which needs the lock pages in memory
+/// privilege; failing that, the segment gets ordinary pages.
+#define WSA_SHM_HUGEPAGES 0x1
+
+#define WSA_SHM_HUGETLBFS "/dev/hugepages"
+
+struct wsa_shm {
+	/// the mapping, and its size in bytes
+	void *addr;
+	size_t size;
+
+	/// whether this process created the segment, and whether it is on
+	/// huge pages
+	uint8_t owner;
+	uint8_t huge;
+
+	/// the segment's name as the OS knows it, which is a path for one on
+	/// huge pages on Linux
+	char name[WSA_SHM_NAME_LEN + 32];
+
+	/// the file mapping object on Windows
+	void *handle;
+};
+
+int16_t wsa_shm_create(struct wsa_shm *shm, char const *name, size_t size, uint32_t flags);
+int16_t wsa_shm_open(struct wsa_shm *shm, char const *name);
+void wsa_shm_close(struct wsa_shm *shm);
+
+uint32_t wsa_shm_process_id(void);
+uint8_t wsa_shm_process_alive(uint32_t pid);
+
+#endif
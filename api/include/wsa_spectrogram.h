@@ -0,0 +1,75 @@
+#ifndef __WSA_SPECTROGRAM_H__
+#define __WSA_SPECTROGRAM_H__
+
+#include "thinkrf_stdint.h"
+#include "kiss_fft.h"
+#include "wsa_arena.h"
+
+// *****
+// Spectrogram: a fixed ring of spectra for rendering waterfalls.  Rows are
+// either STFT frames computed from streamed IQ samples, one every \b hop
+// samples, or whole spectra such as the output of
+// wsa_capture_power_spectrum().  Every buffer is allocated when the
+// spectrogram is, so its memory stays the same however long it runs; once
+// the ring is full each new row overwrites the oldest one.
+// *****
+
+struct wsa_spectrogram {
+	/// samples in each STFT frame
+	uint32_t fft_size;
+
+	/// samples between the starts of consecutive frames
+	uint32_t hop;
+
+	/// values in each row: fft_size for IQ, fft_size / 2 for I-only
+	uint32_t bins;
+
+	/// rows in the ring
+	uint32_t rows;
+
+	/// rows written so far; the newest is row frames - 1
+	uint64_t frames;
+
+	/// the rows, in dB, with row n at ring + (n % rows) * bins
+	float *ring;
+
+	/// 1 for IQ (ZIF) samples, 0 for I-only samples
+	uint8_t complex_input;
+
+	/// the Hanning window, precomputed
+	kiss_fft_scalar *window;
+
+	/// normalized samples waiting for the next frame
+	kiss_fft_scalar *idata;
+	kiss_fft_scalar *qdata;
+	uint32_t pending;
+
+	/// samples still to drop when hop is larger than fft_size
+	uint32_t skip;
+
+	kiss_fft_cfg fft_cfg;
+	kiss_fft_cpx *fft_in;
+	kiss_fft_cpx *fft_out;
+
+	/// holds the ring and the workspaces
+	struct wsa_arena arena;
+};
+
+int16_t wsa_spectrogram_alloc(uint32_t fft_size, uint32_t hop, uint32_t rows,
+		uint8_t complex_input, struct wsa_spectrogram **spectrogram);
+void wsa_spectrogram_free(struct wsa_spectrogram *spectrogram);
+void wsa_spectrogram_reset(struct wsa_spectrogram *spectrogram);
+
+int32_t wsa_spectrogram_push_iq(struct wsa_spectrogram *spectrogram,
+		uint32_t stream_id,
+		int16_t *i16_buffer,
+		int16_t *q16_buffer,
+		int32_t *i32_buffer,
+		int32_t samples);
+int16_t wsa_spectrogram_push_spectrum(struct wsa_spectrogram *spectrogram,
+		float const *spectrum, uint32_t len);
+
+uint64_t wsa_spectrogram_oldest(struct wsa_spectrogram const *spectrogram);
+float *wsa_spectrogram_row(struct wsa_spectrogram const *spectrogram, uint64_t frame);
+
+#endif
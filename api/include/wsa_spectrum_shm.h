@@ -0,0 +1,140 @@
+#ifndef __WSA_SPECTRUM_SHM_H__
+#define __WSA_SPECTRUM_SHM_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_arena.h"
+#include "wsa_lib.h"
+#include "wsa_shm.h"
+
+struct wsa_power_spectrum_config;
+
+// *****
+// Spectrum publisher: puts each spectrum a sweep device completes into a
+// ring of slots in a named shared memory segment, with its frequency axis
+// and time stamps, for any number of other local processes to read.  Each
+// slot is guarded by a sequence lock: the publisher makes its count odd
+// while it writes the slot and even again after, and a reader copies the
+// slot and keeps the copy only if the count was even and unchanged
+// throughout.  Neither side ever waits for the other, and a reader too slow
+// to keep up misses the spectra written over before it got to them.
+// *****
+
+/// marks a segment as a spectrum ring, and the layout of this version
+#define WSA_SPECTRUM_SHM_MAGIC 0x57534153
+#define WSA_SPECTRUM_SHM_VERSION 1
+
+/// the latest slot before anything is published
+#define WSA_SPECTRUM_SHM_NONE 0xffffffff
+
+/// the times a reader copies a slot that keeps changing before giving up
+#define WSA_SPECTRUM_SHM_RETRIES 1000
+
+/// the start of the segment
+struct wsa_spectrum_shm_header {
+	/// written last, once the rest is set
+	volatile uint32_t magic;
+	uint32_t version;
+
+	/// the slots in the ring, the most bins a spectrum can have, and
+	/// the bytes from the start of one slot to the next
+	uint32_t slots;
+	uint32_t max_bins;
+	uint32_t slot_size;
+
+	/// the slot of the newest spectrum
+	volatile uint32_t latest;
+
+	uint8_t reserved[40];
+};
+
+/// a slot, whose bins follow it from WSA_SPECTRUM_SHM_DATA bytes on
+struct wsa_spectrum_shm_slot {
+	/// odd while the slot is written, 0 before its first spectrum
+	volatile uint32_t seq;
+
+	/// the number of bins
+	uint32_t bins;
+
+	/// the spectrum's number, from 1 on
+	uint64_t sweep;
+
+	/// the frequency axis: bin n is at fstart + n * rbw
+	uint64_t fstart;
+	uint64_t fstop;
+	uint64_t rbw;
+
+	/// the device time stamps of the first and the last step swept
+	uint32_t oldest_sec;
+	uint32_t newest_sec;
+	uint64_t oldest_psec;
+	uint64_t newest_psec;
+
+	/// the wsa_perf_now() time it was published at, which other local
+	/// processes can compare with theirs
+	uint64_t published_ns;
+};
+
+#define WSA_SPECTRUM_SHM_DATA 128
+
+/// what a reader gets with a spectrum
+struct wsa_spectrum_info {
+	uint64_t sweep;
+	uint64_t fstart;
+	uint64_t fstop;
+	uint64_t rbw;
+	uint32_t bins;
+	struct wsa_time oldest;
+	struct wsa_time newest;
+	uint64_t published_ns;
+
+	/// the spectra published since the last one read that were written
+	/// over before they could be
+	uint64_t missed;
+};
+
+struct wsa_spectrum_publisher {
+	struct wsa_shm shm;
+	struct wsa_spectrum_shm_header *header;
+
+	/// the spectra published so far
+	uint64_t sweeps;
+
+	/// holds the publisher
+	struct wsa_arena arena;
+};
+
+struct wsa_spectrum_reader {
+	struct wsa_shm shm;
+	struct wsa_spectrum_shm_header *header;
+
+	/// the layout of the ring, as checked when it was opened
+	uint32_t slots;
+	uint32_t max_bins;
+	uint32_t slot_size;
+
+	/// the last spectrum read, 0 if none, and the spectra missed so far
+	uint64_t last;
+	uint64_t missed;
+
+	/// holds the reader
+	struct wsa_arena arena;
+};
+
+int16_t wsa_spectrum_publisher_new(char const *name, uint32_t slots, uint32_t max_bins,
+		struct wsa_spectrum_publisher **publisher);
+void wsa_spectrum_publisher_free(struct wsa_spectrum_publisher *publisher);
+int16_t wsa_spectrum_publish(struct wsa_spectrum_publisher *publisher,
+		uint64_t fstart, uint64_t fstop, uint64_t rbw,
+		float const *data, uint32_t bins,
+		struct wsa_time const *oldest, struct wsa_time const *newest);
+int16_t wsa_spectrum_publish_config(struct wsa_spectrum_publisher *publisher,
+		struct wsa_power_spectrum_config const *cfg);
+
+int16_t wsa_spectrum_reader_open(char const *name, struct wsa_spectrum_reader **reader);
+void wsa_spectrum_reader_close(struct wsa_spectrum_reader *reader);
+int16_t wsa_spectrum_reader_latest(struct wsa_spectrum_reader *reader,
+		struct wsa_spectrum_info *info, float *buf, uint32_t buflen);
+int16_t wsa_spectrum_reader_next(struct wsa_spectrum_reader *reader,
+		struct wsa_spectrum_info *info, float *buf, uint32_t buflen);
+
+#endif
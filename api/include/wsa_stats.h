@@ -0,0 +1,52 @@
+#ifndef __WSA_STATS_H__
+#define __WSA_STATS_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_atomic.h"
+
+// one slot per VRT stream identifier (0x90000001 to 0x90000006),
+// plus one for any identifier outside of that range
+#define WSA_STATS_NUM_STREAMS 7
+#define WSA_STATS_OTHER_STREAM (WSA_STATS_NUM_STREAMS - 1)
+
+/// throughput counters of a single VRT stream
+struct wsa_stream_stats {
+	uint32_t stream_id;
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+/// monotonic throughput and health counters of a device, all updated atomically
+struct wsa_stats {
+	/// per stream identifier packet and byte counts
+	struct wsa_stream_stats streams[WSA_STATS_NUM_STREAMS];
+
+	/// context (receiver, digitizer and extension) packets received
+	uint64_t context_packets;
+
+	/// IF data packets received
+	uint64_t if_packets;
+
+	/// IF packets whose trailer flagged an over range
+	uint64_t over_range_packets;
+
+	/// IF packets whose trailer flagged a loss of samples
+	uint64_t sample_loss_packets;
+
+	/// data socket reads that timed out
+	uint64_t socket_timeouts;
+
+	/// data socket reads retried after an error or a time out
+	uint64_t socket_retries;
+
+	/// SCPI commands sent
+	uint64_t scpi_commands;
+
+	/// SCPI queries sent
+	uint64_t scpi_queries;
+
+	/// SYST:ERR? round trips made to verify commands
+	uint64_t error_queries;
+};
+
+#endif
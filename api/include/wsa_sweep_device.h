@@ -3,6 +3,17 @@
 
 #include "wsa_lib.h"
 #include "wsa_api.h"
+#include "wsa_arena.h"
+#include "kiss_fft.h"
+
+// block size of a power spectrum config's arena, which holds the config and
+// its sweep plan; the spectrum and capture buffers get a block of their own
+#define WSA_SWEEP_ARENA_BLOCK_SIZE 4096
+
+// the value of a spectrum bin the capture missed
+#define WSA_SPECTRUM_POISON 77
+
+struct wsa_spectrum_publisher;
 
 /// a struct for holding all the info about captured data being received
 
@@ -48,6 +59,43 @@ struct wsa_sweep_plan {
 
 };
 
+/// a step of a sweep plan, one block captured at one frequency, and the
+/// power it was last captured with
+struct wsa_sweep_step {
+	/// the plan entry the step is part of, and its center frequency; the
+	/// DD block is the first step, at 0
+	struct wsa_sweep_plan *plan;
+	uint64_t freq;
+
+	/// the band the step is usable over, in Hz
+	double left;
+	double right;
+
+	/// the power of the block's bins around that band, the first of
+	/// which is at origin Hz, in dB and in linear power, which the
+	/// steps are stitched in; room is kept for power_len of them
+	float *power;
+	float *linear;
+	uint32_t power_len;
+	uint32_t bins;
+	double origin;
+
+	/// the capture of the config that last swept the step, 0 if none
+	/// has, and the time stamp it was swept at
+	uint32_t swept;
+	struct wsa_time time_stamp;
+
+	/// the mean change of its power in dB since the sweep before, and a
+	/// running average of that which says how active the step is
+	float change;
+	float activity;
+
+	/// whether the next refresh sweeps the step, and whether the sweep
+	/// list on the device has it
+	uint8_t due;
+	uint8_t loaded;
+};
+
 /// this struct represents our sweep device object
 struct wsa_sweep_device {
 	/// a reference to the wsa we're connected to
@@ -57,6 +105,31 @@ struct wsa_sweep_device {
 	struct {
 		uint8_t attenuator;
 	} device_settings;
+
+	/// how sweeps are planned
+	struct {
+		uint8_t tune_blocks;
+
+		/// how far the bands of neighbouring steps overlap beyond one
+		/// RBW, in Hz, for their edges to be blended over
+		uint32_t stitch_overlap;
+	} plan_settings;
+
+	/// how wsa_refresh_power_spectrum() picks the steps it sweeps: a
+	/// quiet step is swept once every period refreshes, and one whose
+	/// power changes by threshold dB or more on average every time
+	struct {
+		uint32_t period;
+		float threshold;
+	} refresh_settings;
+
+	/// the ID the last sweep was started with, to tell its packets from
+	/// those of older sweeps
+	uint32_t sweep_start_id;
+
+	/// where each spectrum captured or refreshed is published for other
+	/// processes, or NULL
+	struct wsa_spectrum_publisher *publisher;
 };
 
 /// struct representing a configuration that we are going to sweep with and capture power spectrum data
@@ -96,12 +169,50 @@ struct wsa_power_spectrum_config {
 	uint8_t modify_ref;
 	/// the length of the float buffer
 	uint32_t buflen;
+
+	/// the capture buffers: one packet's samples, and a block's
+	int16_t *tmp_buffer;
+	kiss_fft_scalar *idata;
+	kiss_fft_cpx *fftout;
+
+	/// the steps of the sweep plan, in the order they are swept
+	struct wsa_sweep_step *steps;
+	uint32_t step_count;
+
+	/// the number of captures and refreshes so far, and whether the
+	/// last left only some of the steps loaded on the device
+	uint32_t captures;
+	uint8_t partial_load;
+
+	/// what loading a sweep entry and sweeping a packet took when last
+	/// measured, which a refresh weighs up to decide between loading a
+	/// list of the due steps and sweeping the whole plan
+	uint64_t entry_load_ns;
+	uint64_t packet_ns;
+
+	/// the width of a block's bins, of which rbw is the whole Hz part,
+	/// and how many bins of the spectrum the steps' edges blend over
+	double bin_width;
+	double stitch_ramp;
+
+	/// the stitching buffers: the weighted power and the weight of
+	/// each bin of the spectrum
+	float *stitch_sum;
+	float *stitch_weight;
+
+	/// the config, its sweep plan and all its buffers are allocated from
+	/// this arena, and freed together by wsa_power_spectrum_free()
+	struct wsa_arena arena;
 };
 
 
 struct wsa_sweep_device *wsa_sweep_device_new(struct wsa_device *device);
 void wsa_sweep_device_free(struct wsa_sweep_device *sweepdev);
 void wsa_sweep_device_set_attenuator(struct wsa_sweep_device *sweep_device, unsigned int val);
+void wsa_sweep_device_set_plan_tuning(struct wsa_sweep_device *sweep_device, unsigned int val);
+void wsa_sweep_device_set_stitch_overlap(struct wsa_sweep_device *sweep_device, uint32_t overlap);
+void wsa_sweep_device_set_refresh(struct wsa_sweep_device *sweep_device, uint32_t period, float threshold);
+void wsa_sweep_device_set_publisher(struct wsa_sweep_device *sweep_device, struct wsa_spectrum_publisher *publisher);
 int wsa_power_spectrum_alloc(
 	struct wsa_sweep_device *sweep_device,
 	uint64_t fstart,
@@ -112,9 +223,21 @@ int wsa_power_spectrum_alloc(
 );
 void wsa_power_spectrum_free(struct wsa_power_spectrum_config *cfg);
 void wsa_configure_sweep(struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg);
+int wsa_configure_sweeps(struct wsa_sweep_device *sweep_device,
+		struct wsa_power_spectrum_config **pscfgs, uint32_t count);
 int wsa_capture_power_spectrum(
 	struct wsa_sweep_device *sweep_device,
 	struct wsa_power_spectrum_config *pscfg,
 	float **buf
 );
+int wsa_capture_power_spectra(
+	struct wsa_sweep_device *sweep_device,
+	struct wsa_power_spectrum_config **pscfgs,
+	uint32_t count
+);
+int wsa_refresh_power_spectrum(
+	struct wsa_sweep_device *sweep_device,
+	struct wsa_power_spectrum_config *pscfg,
+	float **buf
+);
 #endif
@@ -0,0 +1,110 @@
+#ifndef __WSA_SWEEP_SCHEDULER_H__
+#define __WSA_SWEEP_SCHEDULER_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_arena.h"
+#include "wsa_thread.h"
+#include "wsa_sweep_device.h"
+
+// *****
+// Sweep scheduler: lets several clients share one sweep device.  Each
+// client asks for its own span and RBW with wsa_sweep_scheduler_capture(),
+// from its own thread.  Whichever asks first while the device is idle
+// sweeps for every request pending by then: overlapping and nearby spans
+// of a mode are merged into one region at the finest RBW any of them
+// asked for, the regions are loaded as one sweep list and swept once, and
+// each client's spectrum is rebinned from its region's to the RBW it
+// asked for.  Requests made meanwhile wait for the next such batch.
+// *****
+
+/// how a request's bins are rebinned from the finer bins swept: the peak
+/// keeps a tone's level whatever the RBW, the power sums what falls in
+/// the bin, as a wider RBW would measure noise
+#define WSA_REBIN_PEAK 0
+#define WSA_REBIN_POWER 1
+
+/// spans of a mode at most this far apart are swept as one, since a
+/// second sweep list costs more than sweeping the gap
+#define WSA_SWEEP_SCHEDULER_MERGE_GAP (40 * MHZ)
+
+/// room for a mode's name, such as "SH"
+#define WSA_SWEEP_MODE_LEN 16
+
+/// the batches a region's config is kept for without being swept, in case
+/// the requests that needed it come back
+#define WSA_SWEEP_SCHEDULER_KEEP 16
+
+/// a client's request for a spectrum
+struct wsa_sweep_request {
+	/// the span, RBW and mode asked for
+	uint64_t fstart;
+	uint64_t fstop;
+	uint32_t rbw;
+	char const *mode;
+	uint8_t rebin;
+
+	/// the spectrum, with a bin per rbw from fstart
+	float *buf;
+	uint32_t buflen;
+
+	/// the RBW the spectrum was swept at, and the result of the sweep
+	uint64_t swept_rbw;
+	int16_t result;
+
+	/// the next request pending, and whether this one has been swept
+	struct wsa_sweep_request *next;
+	uint8_t done;
+
+	/// holds the request and its spectrum
+	struct wsa_arena arena;
+};
+
+/// a merged span, the config that sweeps it, and the batch that last did
+struct wsa_sweep_region {
+	char mode[WSA_SWEEP_MODE_LEN];
+	uint64_t fstart;
+	uint64_t fstop;
+	uint32_t rbw;
+	struct wsa_power_spectrum_config *cfg;
+	uint32_t used;
+};
+
+struct wsa_sweep_scheduler {
+	struct wsa_sweep_device *sweep_device;
+
+	/// guards everything below, and wakes the clients when a batch is done
+	wsa_mutex_t lock;
+	wsa_cond_t batch_done;
+
+	/// the requests waiting for the next batch, oldest first
+	struct wsa_sweep_request *pending;
+	struct wsa_sweep_request *pending_tail;
+
+	/// whether a client is sweeping a batch
+	uint8_t running;
+
+	/// the regions of the batches before, whose configs a batch reuses for
+	/// any region one covers closely enough, and the configs of the sweep
+	/// list loaded on the device, in its order
+	struct wsa_sweep_region *regions;
+	uint32_t region_count;
+	struct wsa_power_spectrum_config **loaded;
+	uint32_t loaded_count;
+
+	/// the batches swept, the requests they held, and the sweeps they took
+	uint32_t batches;
+	uint32_t requests;
+	uint32_t sweeps;
+};
+
+int16_t wsa_sweep_request_alloc(uint64_t fstart, uint64_t fstop, uint32_t rbw,
+		char const *mode, uint8_t rebin, struct wsa_sweep_request **request);
+void wsa_sweep_request_free(struct wsa_sweep_request *request);
+
+int16_t wsa_sweep_scheduler_new(struct wsa_sweep_device *sweep_device,
+		struct wsa_sweep_scheduler **scheduler);
+void wsa_sweep_scheduler_free(struct wsa_sweep_scheduler *scheduler);
+int16_t wsa_sweep_scheduler_capture(struct wsa_sweep_scheduler *scheduler,
+		struct wsa_sweep_request *request);
+
+#endif
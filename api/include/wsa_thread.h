@@ -0,0 +1,40 @@
+#ifndef __WSA_THREAD_H__
+#define __WSA_THREAD_H__
+
+#include "thinkrf_stdint.h"
+
+// *****
+// Minimal portable threads, for the library's own background workers, and
+// the locks they share state with.  The implementations live in src-unix
+// and src-windows.
+// *****
+
+#ifdef _WIN32
+typedef void *wsa_thread_t;		// a HANDLE
+typedef void *wsa_mutex_t;		// an SRWLOCK
+typedef void *wsa_cond_t;		// a CONDITION_VARIABLE
+#else
+#include <pthread.h>
+typedef pthread_t wsa_thread_t;
+typedef pthread_mutex_t wsa_mutex_t;
+typedef pthread_cond_t wsa_cond_t;
+#endif
+
+/// the entry point of a thread
+typedef void (*wsa_thread_func)(void *arg);
+
+int16_t wsa_thread_create(wsa_thread_t *thread, wsa_thread_func func, void *arg);
+int16_t wsa_thread_join(wsa_thread_t thread);
+uint32_t wsa_thread_id(void);
+void wsa_sleep_ms(uint32_t milliseconds);
+
+int16_t wsa_mutex_init(wsa_mutex_t *mutex);
+void wsa_mutex_destroy(wsa_mutex_t *mutex);
+void wsa_mutex_lock(wsa_mutex_t *mutex);
+void wsa_mutex_unlock(wsa_mutex_t *mutex);
+int16_t wsa_cond_init(wsa_cond_t *cond);
+void wsa_cond_destroy(wsa_cond_t *cond);
+void wsa_cond_wait(wsa_cond_t *cond, wsa_mutex_t *mutex);
+void wsa_cond_broadcast(wsa_cond_t *cond);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __WSA_TRACE_H__
+#define __WSA_TRACE_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_perf.h"
+
+// *****
+// Trace events for profiling a capture session: each traced operation is
+// stored as a complete (begin + duration) event into a buffer allocated by
+// wsa_trace_start(), and wsa_trace_dump() writes the buffer out in the
+// Chrome trace event JSON format (chrome://tracing, ui.perfetto.dev).
+// *****
+#define WSA_TRACE_DEFAULT_EVENTS (1 << 18)
+#define WSA_TRACE_DETAIL_LEN 48
+
+/// a traced operation
+struct wsa_trace_event {
+	const char *name;
+	const char *category;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+	uint32_t thread_id;
+
+	// optional detail, such as the SCPI command sent
+	char detail[WSA_TRACE_DETAIL_LEN];
+};
+
+int16_t wsa_trace_start(uint32_t max_events);
+void wsa_trace_stop(void);
+void wsa_trace_free(void);
+int16_t wsa_trace_dump(const char *file_name);
+void wsa_trace_record(const char *name, const char *category, const char *detail,
+		uint64_t start_ns, uint64_t end_ns);
+
+// Time stamp a traced operation.  When tracing is off, the stamp is 0 and
+// ending it records nothing, so the cost is a single branch.
+#define WSA_TRACE_BEGIN(ts) ((ts) = wsa_trace_enabled ? wsa_perf_now() : 0)
+#define WSA_TRACE_END(ts, name, category, detail) do { \
+		if (ts) \
+			wsa_trace_record((name), (category), (detail), (ts), wsa_perf_now()); \
+	} while (0)
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __WSA_URING_H__
+#define __WSA_URING_H__
+
+#include "thinkrf_stdint.h"
+#include "wsa_lib.h"
+#include "wsa_stats.h"
+
+// *****
+// An io_uring receive path for the data socket, on Linux builds made with
+// IO_URING=1.  One multishot receive stays armed on the socket, and the
+// kernel copies the stream into a ring of provided buffers as it arrives;
+// reads are served from those buffers, and only wait in the kernel when
+// all of them have been used up.  That replaces a select() and a recv()
+// per read with about one io_uring_enter() per buffer filled.  Elsewhere,
+// opening it fails with WSA_ERR_IOURINGFAILED and the device keeps reading
+// with select() and recv().
+// *****
+
+// the buffers used when none are given
+#define WSA_URING_DEFAULT_BUFFERS 16
+#define WSA_URING_DEFAULT_BUFFER_SIZE (64 * 1024)
+
+struct wsa_uring;
+
+int16_t wsa_uring_open(struct wsa_device *dev, uint32_t buffers, uint32_t buffer_size);
+void wsa_uring_close(struct wsa_device *dev);
+int16_t wsa_uring_recv_data(struct wsa_uring *uring, uint8_t *rx_buf_ptr,
+		int32_t buf_size, uint32_t time_out, int32_t *total_bytes,
+		struct wsa_stats *stats);
+
+#endif
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#include "wsa_shm.h"
+#include "wsa_error.h"
+
+// the file system type of a hugetlbfs mount
+#define WSA_SHM_HUGETLBFS_MAGIC 0x958458f6
+
+
+/**
+ * checks a segment name, which must be a plain word
+ *
+ * @param name - the segment name
+ *
+ * @return 0 if it will do, or a negative number if not
+ */
+static int16_t wsa_shm_check_name(char const *name)
+{
+	if (name == NULL || name[0] == '\0' || strlen(name) > WSA_SHM_NAME_LEN ||
+			strchr(name, '/') != NULL)
+		return WSA_ERR_INVINPUT;
+
+	return 0;
+}
+
+
+/**
+ * maps a segment from an open file descriptor, which it closes
+ *
+ * @param shm - the segment, whose size is set
+ * @param fd - the file descriptor
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_shm_map(struct wsa_shm *shm, int fd)
+{
+	shm->addr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm->addr == MAP_FAILED)
+		return WSA_ERR_SHMFAILED;
+
+	return 0;
+}
+
+
+/**
+ * creates a segment as a file in the hugetlbfs mount, whose pages are all
+ * huge ones reserved when it's mapped
+ *
+ * @param shm - the segment
+ * @param name - the segment name
+ * @param size - the size in bytes, which is rounded up to whole huge pages
+ *
+ * @return 0 on success, or a negative number if the system has no huge
+ *		pages to spare
+ */
+static int16_t wsa_shm_create_huge(struct wsa_shm *shm, char const *name, size_t size)
+{
+#ifdef __linux__
+	struct statfs fs;
+	size_t page;
+	int fd;
+
+	sprintf(shm->name, WSA_SHM_HUGETLBFS "/%s", name);
+	fd = open(shm->name, O_CREAT | O_EXCL | O_RDWR, 0660);
+	if (fd < 0)
+		return WSA_ERR_SHMFAILED;
+
+	if (fstatfs(fd, &fs) != 0 || (uint32_t) fs.f_type != WSA_SHM_HUGETLBFS_MAGIC) {
+		close(fd);
+		unlink(shm->name);
+		return WSA_ERR_SHMFAILED;
+	}
+
+	page = (size_t) fs.f_bsize;
+	shm->size = (size + page - 1) / page * page;
+	if (ftruncate(fd, (off_t) shm->size) != 0) {
+		close(fd);
+		unlink(shm->name);
+		return WSA_ERR_SHMFAILED;
+	}
+	if (wsa_shm_map(shm, fd) < 0) {
+		unlink(shm->name);
+		return WSA_ERR_SHMFAILED;
+	}
+
+	shm->huge = 1;
+	return 0;
+#else
+	(void) shm;
+	(void) name;
+	(void) size;
+	return WSA_ERR_SHMFAILED;
+#endif
+}
+
+
+/**
+ * creates a shared memory segment, replacing any of the same name left
+ * by a process that didn't close it, and maps it
+ *
+ * @param shm - the segment
+ * @param name - the segment name
+ * @param size - the size in bytes
+ * @param flags - WSA_SHM_HUGEPAGES to back it with huge pages if possible
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_shm_create(struct wsa_shm *shm, char const *name, size_t size, uint32_t flags)
+{
+	int16_t result;
+	int fd;
+
+	result = wsa_shm_check_name(name);
+	if (result < 0)
+		return result;
+
+	shm->owner = 1;
+	shm->huge = 0;
+	shm->handle = NULL;
+
+	// readers look for a segment on huge pages first, so a stale one
+	// must go whichever kind this is
+#ifdef __linux__
+	sprintf(shm->name, WSA_SHM_HUGETLBFS "/%s", name);
+	unlink(shm->name);
+#endif
+	sprintf(shm->name, "/%s", name);
+	shm_unlink(shm->name);
+
+	if ((flags & WSA_SHM_HUGEPAGES) && wsa_shm_create_huge(shm, name, size) == 0)
+		return 0;
+
+	sprintf(shm->name, "/%s", name);
+	fd = shm_open(shm->name, O_CREAT | O_EXCL | O_RDWR, 0660);
+	if (fd < 0)
+		return WSA_ERR_SHMFAILED;
+
+	shm->size = size;
+	if (ftruncate(fd, (off_t) size) != 0) {
+		close(fd);
+		shm_unlink(shm->name);
+		return WSA_ERR_SHMFAILED;
+	}
+	if (wsa_shm_map(shm, fd) < 0) {
+		shm_unlink(shm->name);
+		return WSA_ERR_SHMFAILED;
+	}
+
+#ifdef MADV_HUGEPAGE
+	// let transparent huge pages back it, where shared memory may have them
+	if (flags & WSA_SHM_HUGEPAGES)
+		madvise(shm->addr, shm->size, MADV_HUGEPAGE);
+#endif
+
+	return 0;
+}
+
+
+/**
+ * opens a shared memory segment another process created, and maps all
+ * of it
+ *
+ * @param shm - the segment
+ * @param name - the segment name
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_shm_open(struct wsa_shm *shm, char const *name)
+{
+	struct stat st;
+	int16_t result;
+	int fd = -1;
+
+	result = wsa_shm_check_name(name);
+	if (result < 0)
+		return result;
+
+	shm->owner = 0;
+	shm->huge = 0;
+	shm->handle = NULL;
+
+#ifdef __linux__
+	sprintf(shm->name, WSA_SHM_HUGETLBFS "/%s", name);
+	fd = open(shm->name, O_RDWR);
+	if (fd >= 0)
+		shm->huge = 1;
+#endif
+	if (fd < 0) {
+		sprintf(shm->name, "/%s", name);
+		fd = shm_open(shm->name, O_RDWR, 0);
+	}
+	if (fd < 0)
+		return WSA_ERR_SHMFAILED;
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return WSA_ERR_SHMFAILED;
+	}
+
+	shm->size = (size_t) st.st_size;
+	return wsa_shm_map(shm, fd);
+}
+
+
+/**
+ * unmaps a shared memory segment, and removes its name if this process
+ * created it
+ *
+ * @param shm - the segment
+ */
+void wsa_shm_close(struct wsa_shm *shm)
+{
+	munmap(shm->addr, shm->size);
+	if (!shm->owner)
+		return;
+
+	if (shm->huge)
+		unlink(shm->name);
+	else
+		shm_unlink(shm->name);
+}
+
+
+/**
+ * gets the ID of the calling process
+ *
+ * @return the process ID
+ */
+uint32_t wsa_shm_process_id(void)
+{
+	return (uint32_t) getpid();
+}
+
+
+/**
+ * checks whether a process is still running
+ *
+ * @param pid - the process ID
+ *
+ * @return 1 if it is, 0 if it has exited
+ */
+uint8_t wsa_shm_process_alive(uint32_t pid)
+{
+	// a process that can't be signalled for want of permission is
+	// still running
+	return kill((pid_t) pid, 0) == 0 || errno != ESRCH;
+}
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "wsa_thread.h"
+#include "wsa_error.h"
+
+/// what a new thread needs to call its entry point
+struct wsa_thread_start {
+	wsa_thread_func func;
+	void *arg;
+};
+
+/**
+ * adapts a wsa_thread_func to the pthread entry point signature
+ *
+ * @param start - the malloc'ed wsa_thread_start, freed here
+ */
+static void *wsa_thread_trampoline(void *start)
+{
+	struct wsa_thread_start info = *((struct wsa_thread_start *) start);
+
+	free(start);
+	info.func(info.arg);
+
+	return NULL;
+}
+
+/**
+ * starts a new thread
+ *
+ * @param thread - a pointer to store the thread handle
+ * @param func - the function the thread runs
+ * @param arg - the argument passed to \b func
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_thread_create(wsa_thread_t *thread, wsa_thread_func func, void *arg)
+{
+	struct wsa_thread_start *start;
+
+	start = (struct wsa_thread_start *) malloc(sizeof(struct wsa_thread_start));
+	if (start == NULL)
+		return WSA_ERR_MALLOCFAILED;
+
+	start->func = func;
+	start->arg = arg;
+
+	if (pthread_create(thread, NULL, wsa_thread_trampoline, start) != 0) {
+		free(start);
+		return WSA_ERR_THREADCREATEFAILED;
+	}
+
+	return 0;
+}
+
+/**
+ * waits for a thread to return, and releases it
+ *
+ * @param thread - the thread handle
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_thread_join(wsa_thread_t thread)
+{
+	if (pthread_join(thread, NULL) != 0)
+		return WSA_ERR_UNKNOWN_ERROR;
+
+	return 0;
+}
+
+/**
+ * identifies the calling thread, e.g. for trace events
+ *
+ * @return the thread's id
+ */
+uint32_t wsa_thread_id(void)
+{
+#ifdef __linux__
+	return (uint32_t) syscall(SYS_gettid);
+#else
+	return (uint32_t) (uintptr_t) pthread_self();
+#endif
+}
+
+/**
+ * suspends the calling thread
+ *
+ * @param milliseconds - how long to sleep
+ */
+void wsa_sleep_ms(uint32_t milliseconds)
+{
+	struct timespec delay;
+
+	delay.tv_sec = milliseconds / 1000;
+	delay.tv_nsec = (long) (milliseconds % 1000) * 1000000L;
+	nanosleep(&delay, NULL);
+}
+
+
+/**
+ * initializes a mutex
+ *
+ * @param mutex - the mutex
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_mutex_init(wsa_mutex_t *mutex)
+{
+	if (pthread_mutex_init(mutex, NULL) != 0)
+		return WSA_ERR_UNKNOWN_ERROR;
+
+	return 0;
+}
+
+/**
+ * releases a mutex, which must not be locked
+ *
+ * @param mutex - the mutex
+ */
+void wsa_mutex_destroy(wsa_mutex_t *mutex)
+{
+	pthread_mutex_destroy(mutex);
+}
+
+/**
+ * locks a mutex, waiting for any other thread holding it
+ *
+ * @param mutex - the mutex
+ */
+void wsa_mutex_lock(wsa_mutex_t *mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+/**
+ * unlocks a mutex the calling thread holds
+ *
+ * @param mutex - the mutex
+ */
+void wsa_mutex_unlock(wsa_mutex_t *mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+/**
+ * initializes a condition variable
+ *
+ * @param cond - the condition variable
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_cond_init(wsa_cond_t *cond)
+{
+	if (pthread_cond_init(cond, NULL) != 0)
+		return WSA_ERR_UNKNOWN_ERROR;
+
+	return 0;
+}
+
+/**
+ * releases a condition variable no thread is waiting on
+ *
+ * @param cond - the condition variable
+ */
+void wsa_cond_destroy(wsa_cond_t *cond)
+{
+	pthread_cond_destroy(cond);
+}
+
+/**
+ * unlocks a mutex and waits for a condition variable to be signalled,
+ * then locks the mutex again.  The wait may also end spuriously, so the
+ * condition must be checked again.
+ *
+ * @param cond - the condition variable
+ * @param mutex - the mutex the calling thread holds
+ */
+void wsa_cond_wait(wsa_cond_t *cond, wsa_mutex_t *mutex)
+{
+	pthread_cond_wait(cond, mutex);
+}
+
+/**
+ * wakes every thread waiting on a condition variable
+ *
+ * @param cond - the condition variable
+ */
+void wsa_cond_broadcast(wsa_cond_t *cond)
+{
+	pthread_cond_broadcast(cond);
+}
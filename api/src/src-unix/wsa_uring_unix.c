@@ -0,0 +1,525 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsa_uring.h"
+#include "wsa_atomic.h"
+#include "wsa_error.h"
+#include "wsa_debug.h"
+
+#if defined(__linux__) && defined(WSA_IO_URING)
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// the buffer group the receive picks its buffers from
+#define WSA_URING_BUFFER_GROUP 0
+
+// the user data of the multishot receive's completions
+#define WSA_URING_RECV 1
+
+struct wsa_uring {
+	int ring_fd;
+	int32_t sock_fd;
+
+	/// the submission queue
+	void *sq_ptr;
+	size_t sq_size;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	/// the completion queue, in the same mapping as the submission queue
+	/// when the kernel has IORING_FEAT_SINGLE_MMAP
+	void *cq_ptr;
+	size_t cq_size;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/// the provided buffers and the ring they're handed to the kernel in;
+	/// the ring's tail overlays the reserved field of its first entry
+	struct io_uring_buf *buf_ring;
+	uint8_t *buffers;
+	uint32_t buffer_count;
+	uint32_t buffer_size;
+	uint16_t buf_tail;
+	int buf_registered;
+
+	/// whether the multishot receive is still armed
+	int armed;
+
+	/// the buffer being read from: its ID, and the bytes left in it
+	int32_t current;
+	uint8_t *data;
+	uint32_t left;
+};
+
+
+/**
+ * hands a buffer back to the kernel to receive into
+ *
+ * @param uring - the io_uring
+ * @param bid - the ID of the buffer
+ */
+static void wsa_uring_give_buffer(struct wsa_uring *uring, uint16_t bid)
+{
+	struct io_uring_buf *buf = &uring->buf_ring[uring->buf_tail & (uring->buffer_count - 1)];
+
+	buf->addr = (uint64_t) (uintptr_t) (uring->buffers + (size_t) bid * uring->buffer_size);
+	buf->len = uring->buffer_size;
+	buf->bid = bid;
+	uring->buf_tail++;
+
+	// the entry must be seen before the tail moves past it
+	__atomic_store_n(&uring->buf_ring[0].resv, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * queues the multishot receive on the data socket; it is submitted by
+ * the next wait
+ *
+ * @param uring - the io_uring
+ */
+static void wsa_uring_arm(struct wsa_uring *uring)
+{
+	uint32_t tail = *uring->sq_tail;
+	uint32_t index = tail & *uring->sq_mask;
+	struct io_uring_sqe *sqe = &uring->sqes[index];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = uring->sock_fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = WSA_URING_BUFFER_GROUP;
+	sqe->user_data = WSA_URING_RECV;
+
+	uring->sq_array[index] = index;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->armed = 1;
+}
+
+
+/**
+ * takes the next completion of the receive, waiting for it if there is
+ * none yet, and makes its buffer the current one
+ *
+ * @param uring - the io_uring
+ * @param time_out - how long to wait in milliseconds
+ *
+ * @return 0 on success, WSA_ERR_QUERYNORESP on time out, or another
+ *		negative number on error
+ */
+static int16_t wsa_uring_next(struct wsa_uring *uring, uint32_t time_out)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	uint32_t head;
+	uint32_t to_submit;
+	int32_t res;
+	uint32_t flags;
+	long ret;
+
+	head = *uring->cq_head;
+	while (head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+		// the receive is disarmed when the buffers run out; they are all
+		// back by now, so arm it again
+		to_submit = 0;
+		if (!uring->armed) {
+			wsa_uring_arm(uring);
+			to_submit = 1;
+		}
+
+		ts.tv_sec = time_out / 1000;
+		ts.tv_nsec = (long long) (time_out % 1000) * 1000000;
+		memset(&arg, 0, sizeof(arg));
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (uint64_t) (uintptr_t) &ts;
+
+		ret = syscall(__NR_io_uring_enter, uring->ring_fd, to_submit, 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		if (ret < 0 && errno == ETIME)
+			return WSA_ERR_QUERYNORESP;
+		if (ret < 0 && errno != EINTR) {
+			doutf(DHIGH, "io_uring_enter() failed with error %d\n", errno);
+			return WSA_ERR_SOCKETERROR;
+		}
+	}
+
+	cqe = &uring->cqes[head & *uring->cq_mask];
+	res = cqe->res;
+	flags = cqe->flags;
+	__atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	if (!(flags & IORING_CQE_F_MORE))
+		uring->armed = 0;
+
+	if (res == -ENOBUFS)
+		return 0;
+	if (res == 0) {
+		doutf(DMED, "Connection is already closed.\n");
+		return WSA_ERR_SOCKETERROR;
+	}
+	if (res < 0) {
+		doutf(DHIGH, "io_uring receive failed with error %d\n", -res);
+		return WSA_ERR_SOCKETERROR;
+	}
+
+	uring->current = (int32_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+	uring->data = uring->buffers + (size_t) uring->current * uring->buffer_size;
+	uring->left = (uint32_t) res;
+
+	return 0;
+}
+
+
+/**
+ * checks that the kernel has what the receive needs: IORING_OP_RECV, and
+ * the multishot receive and buffer rings that came with it.  A probe can't
+ * see the multishot flag itself, so IORING_OP_SEND_ZC, which arrived in
+ * the same release, stands in for it.
+ *
+ * @param ring_fd - the io_uring
+ *
+ * @return 1 if the receive is supported, or 0 if not
+ */
+static int wsa_uring_probe(int ring_fd)
+{
+	struct io_uring_probe *probe;
+	size_t size = sizeof(struct io_uring_probe) +
+		IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	int supported;
+
+	probe = (struct io_uring_probe *) calloc(1, size);
+	if (probe == NULL)
+		return 0;
+
+	if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+			probe, IORING_OP_LAST) < 0) {
+		doutf(DHIGH, "probing io_uring failed with error %d\n", errno);
+		free(probe);
+		return 0;
+	}
+
+	supported = probe->last_op >= IORING_OP_SEND_ZC &&
+		(probe->ops[IORING_OP_RECV].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+
+	return supported;
+}
+
+
+/**
+ * frees what wsa_uring_open() set up, as far as it got
+ *
+ * @param uring - the io_uring
+ */
+static void wsa_uring_free(struct wsa_uring *uring)
+{
+	struct io_uring_buf_reg reg;
+
+	// the ring is torn down after close() returns, so the kernel is made
+	// to let go of the buffers before they are freed
+	if (uring->buf_registered) {
+		memset(&reg, 0, sizeof(reg));
+		reg.bgid = WSA_URING_BUFFER_GROUP;
+		if (syscall(__NR_io_uring_register, uring->ring_fd, IORING_UNREGISTER_PBUF_RING,
+				&reg, 1) == 0)
+			uring->buf_registered = 0;
+		else
+			doutf(DHIGH, "unregistering the buffer ring failed with error %d\n", errno);
+	}
+
+	if (uring->ring_fd >= 0)
+		close(uring->ring_fd);
+	if (uring->sqes != NULL)
+		munmap(uring->sqes, uring->sqes_size);
+	if (uring->cq_ptr != NULL && uring->cq_ptr != uring->sq_ptr)
+		munmap(uring->cq_ptr, uring->cq_size);
+	if (uring->sq_ptr != NULL)
+		munmap(uring->sq_ptr, uring->sq_size);
+
+	// buffers the kernel may still receive into are left to it
+	if (!uring->buf_registered) {
+		free(uring->buf_ring);
+		free(uring->buffers);
+	}
+	free(uring);
+}
+
+
+/**
+ * starts receiving the device's data socket through io_uring
+ *
+ * @param dev - the device, which must be connected
+ * @param buffers - the number of buffers to receive into, rounded up to a
+ *		power of 2, or 0 for WSA_URING_DEFAULT_BUFFERS
+ * @param buffer_size - the size of each buffer, or 0 for
+ *		WSA_URING_DEFAULT_BUFFER_SIZE
+ *
+ * @return 0 on success, or a negative number on error, such as
+ *		WSA_ERR_IOURINGFAILED when the kernel lacks the multishot receive,
+ *		after which the device keeps reading the socket as before
+ */
+int16_t wsa_uring_open(struct wsa_device *dev, uint32_t buffers, uint32_t buffer_size)
+{
+	struct wsa_uring *uring;
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	void *mem;
+	uint32_t count = 1;
+	uint32_t i;
+	long fd;
+
+	if (dev->uring != NULL)
+		return 0;
+
+	if (buffers == 0)
+		buffers = WSA_URING_DEFAULT_BUFFERS;
+	if (buffer_size == 0)
+		buffer_size = WSA_URING_DEFAULT_BUFFER_SIZE;
+	while (count < buffers)
+		count <<= 1;
+	if (count > 32768)
+		return WSA_ERR_INVINPUT;
+
+	uring = (struct wsa_uring *) calloc(1, sizeof(struct wsa_uring));
+	if (uring == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	uring->ring_fd = -1;
+	uring->sock_fd = dev->sock.data;
+	uring->buffer_count = count;
+	uring->buffer_size = buffer_size;
+	uring->current = -1;
+
+	// a completion can wait for every buffer, and then one more to end
+	// the receive
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = 2 * count;
+	fd = syscall(__NR_io_uring_setup, 4, &params);
+	if (fd < 0) {
+		doutf(DHIGH, "io_uring_setup() failed with error %d\n", errno);
+		wsa_uring_free(uring);
+		return WSA_ERR_IOURINGFAILED;
+	}
+	uring->ring_fd = (int) fd;
+
+	// the reads wait with a time out, and the receive needs the kernel to
+	// pick its buffers
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !wsa_uring_probe(uring->ring_fd)) {
+		doutf(DHIGH, "io_uring lacks the multishot receive\n");
+		wsa_uring_free(uring);
+		return WSA_ERR_IOURINGFAILED;
+	}
+
+	uring->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	uring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (uring->cq_size > uring->sq_size)
+			uring->sq_size = uring->cq_size;
+		uring->cq_size = uring->sq_size;
+	}
+
+	mem = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		uring->ring_fd, IORING_OFF_SQ_RING);
+	if (mem == MAP_FAILED) {
+		wsa_uring_free(uring);
+		return WSA_ERR_IOURINGFAILED;
+	}
+	uring->sq_ptr = mem;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		uring->cq_ptr = uring->sq_ptr;
+	} else {
+		mem = mmap(NULL, uring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			uring->ring_fd, IORING_OFF_CQ_RING);
+		if (mem == MAP_FAILED) {
+			wsa_uring_free(uring);
+			return WSA_ERR_IOURINGFAILED;
+		}
+		uring->cq_ptr = mem;
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	mem = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		uring->ring_fd, IORING_OFF_SQES);
+	if (mem == MAP_FAILED) {
+		uring->sqes = NULL;
+		wsa_uring_free(uring);
+		return WSA_ERR_IOURINGFAILED;
+	}
+	uring->sqes = (struct io_uring_sqe *) mem;
+
+	uring->sq_tail = (uint32_t *) ((uint8_t *) uring->sq_ptr + params.sq_off.tail);
+	uring->sq_mask = (uint32_t *) ((uint8_t *) uring->sq_ptr + params.sq_off.ring_mask);
+	uring->sq_array = (uint32_t *) ((uint8_t *) uring->sq_ptr + params.sq_off.array);
+	uring->cq_head = (uint32_t *) ((uint8_t *) uring->cq_ptr + params.cq_off.head);
+	uring->cq_tail = (uint32_t *) ((uint8_t *) uring->cq_ptr + params.cq_off.tail);
+	uring->cq_mask = (uint32_t *) ((uint8_t *) uring->cq_ptr + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *) ((uint8_t *) uring->cq_ptr + params.cq_off.cqes);
+
+	// the buffer ring must be page aligned
+	if (posix_memalign(&mem, (size_t) sysconf(_SC_PAGESIZE),
+			count * sizeof(struct io_uring_buf)) != 0) {
+		wsa_uring_free(uring);
+		return WSA_ERR_MALLOCFAILED;
+	}
+	uring->buf_ring = (struct io_uring_buf *) mem;
+	memset(uring->buf_ring, 0, count * sizeof(struct io_uring_buf));
+
+	uring->buffers = (uint8_t *) malloc((size_t) count * buffer_size);
+	if (uring->buffers == NULL) {
+		wsa_uring_free(uring);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t) (uintptr_t) uring->buf_ring;
+	reg.ring_entries = count;
+	reg.bgid = WSA_URING_BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, uring->ring_fd, IORING_REGISTER_PBUF_RING,
+			&reg, 1) < 0) {
+		doutf(DHIGH, "registering the buffer ring failed with error %d\n", errno);
+		wsa_uring_free(uring);
+		return WSA_ERR_IOURINGFAILED;
+	}
+	uring->buf_registered = 1;
+
+	for (i = 0; i < count; i++)
+		wsa_uring_give_buffer(uring, (uint16_t) i);
+
+	dev->uring = uring;
+	return 0;
+}
+
+
+/**
+ * stops receiving the device's data socket through io_uring.  Data the
+ * kernel already received and nothing read is dropped.
+ *
+ * @param dev - the device
+ */
+void wsa_uring_close(struct wsa_device *dev)
+{
+	if (dev->uring == NULL)
+		return;
+
+	// closing the ring cancels the receive
+	wsa_uring_free(dev->uring);
+	dev->uring = NULL;
+}
+
+
+/**
+ * reads \b buf_size bytes of the data socket, as wsa_sock_recv_data() does
+ *
+ * @param uring - the io_uring of the device
+ * @param rx_buf_ptr - a buffer to store the bytes in
+ * @param buf_size - the number of bytes to read
+ * @param time_out - time out in milliseconds
+ * @param total_bytes - a pointer to store the number of bytes read in
+ * @param stats - the device counters to update with time outs, or NULL
+ *
+ * @return 0 on success or a negative value on error
+ */
+int16_t wsa_uring_recv_data(struct wsa_uring *uring, uint8_t *rx_buf_ptr,
+		int32_t buf_size, uint32_t time_out, int32_t *total_bytes,
+		struct wsa_stats *stats)
+{
+	uint32_t n;
+	int16_t result;
+
+	*total_bytes = 0;
+
+	while (*total_bytes < buf_size) {
+		if (uring->left == 0) {
+			result = wsa_uring_next(uring, time_out);
+			if (result < 0) {
+				if (stats != NULL && result == WSA_ERR_QUERYNORESP)
+					wsa_atomic_add64(&stats->socket_timeouts, 1);
+				return result;
+			}
+			continue;
+		}
+
+		n = (uint32_t) (buf_size - *total_bytes);
+		if (n > uring->left)
+			n = uring->left;
+		memcpy(rx_buf_ptr + *total_bytes, uring->data, n);
+		uring->data += n;
+		uring->left -= n;
+		*total_bytes += (int32_t) n;
+
+		// a used up buffer goes straight back to the kernel
+		if (uring->left == 0) {
+			wsa_uring_give_buffer(uring, (uint16_t) uring->current);
+			uring->current = -1;
+		}
+	}
+
+	return 0;
+}
+
+#else
+
+/**
+ * starts receiving the device's data socket through io_uring, which this
+ * build doesn't have
+ *
+ * @param dev - the device
+ * @param buffers - unused
+ * @param buffer_size - unused
+ *
+ * @return WSA_ERR_IOURINGFAILED
+ */
+int16_t wsa_uring_open(struct wsa_device *dev, uint32_t buffers, uint32_t buffer_size)
+{
+	dev = dev;
+	buffers = buffers;
+	buffer_size = buffer_size;
+
+	return WSA_ERR_IOURINGFAILED;
+}
+
+
+/**
+ * stops receiving the device's data socket through io_uring
+ *
+ * @param dev - the device
+ */
+void wsa_uring_close(struct wsa_device *dev)
+{
+	dev->uring = NULL;
+}
+
+
+/**
+ * reads the data socket through io_uring, which this build doesn't have
+ *
+ * @return WSA_ERR_IOURINGFAILED
+ */
+int16_t wsa_uring_recv_data(struct wsa_uring *uring, uint8_t *rx_buf_ptr,
+		int32_t buf_size, uint32_t time_out, int32_t *total_bytes,
+		struct wsa_stats *stats)
+{
+	uring = uring;
+	rx_buf_ptr = rx_buf_ptr;
+	buf_size = buf_size;
+	time_out = time_out;
+	stats = stats;
+	*total_bytes = 0;
+
+	return WSA_ERR_IOURINGFAILED;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include "wsa_shm.h"
+#include "wsa_error.h"
+
+// maps a large page section with large pages, from Windows 10 1703 on
+#ifndef FILE_MAP_LARGE_PAGES
+#define FILE_MAP_LARGE_PAGES 0x20000000
+#endif
+
+
+/**
+ * makes the local object name for a segment name
+ *
+ * @param shm - the segment to store the name in
+ * @param name - the segment name
+ *
+ * @return 0 on success, or a negative number if the name won't do
+ */
+static int16_t wsa_shm_name(struct wsa_shm *shm, char const *name)
+{
+	if (name == NULL || name[0] == '\0' || strlen(name) > WSA_SHM_NAME_LEN ||
+			strchr(name, '\\') != NULL)
+		return WSA_ERR_INVINPUT;
+
+	sprintf(shm->name, "Local\\%s", name);
+
+	return 0;
+}
+
+
+/**
+ * creates a file mapping and maps all of it
+ *
+ * @param shm - the segment
+ * @param size - the size in bytes
+ * @param protect - the section's protection and attributes
+ * @param access - the view's access
+ *
+ * @return 0 on success, WSA_ERR_SHMINUSE if a segment of the name is
+ *		still mapped by some process, or another negative number on error
+ */
+static int16_t wsa_shm_map(struct wsa_shm *shm, size_t size, DWORD protect, DWORD access)
+{
+	unsigned long long size64 = (unsigned long long) size;
+	HANDLE handle;
+
+	handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, protect,
+		(DWORD) (size64 >> 32), (DWORD) size64, shm->name);
+	if (handle == NULL)
+		return WSA_ERR_SHMFAILED;
+	// an older segment of the name, which some process still maps and
+	// which can't be replaced under it
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(handle);
+		return WSA_ERR_SHMINUSE;
+	}
+
+	shm->addr = MapViewOfFile(handle, access, 0, 0, size);
+	if (shm->addr == NULL) {
+		CloseHandle(handle);
+		return WSA_ERR_SHMFAILED;
+	}
+
+	shm->size = size;
+	shm->handle = handle;
+
+	return 0;
+}
+
+
+/**
+ * creates a shared memory segment and maps it.  Windows removes a
+ * segment when the last process using it closes it, so none is left over
+ * by a process that exited; but one a process still maps can't be
+ * replaced, as it can on Unix.
+ *
+ * @param shm - the segment
+ * @param name - the segment name
+ * @param size - the size in bytes
+ * @param flags - WSA_SHM_HUGEPAGES to back it with large pages if possible
+ *
+ * @return 0 on success, WSA_ERR_SHMINUSE if a segment of the name is
+ *		still mapped by some process, or another negative number on error
+ */
+int16_t wsa_shm_create(struct wsa_shm *shm, char const *name, size_t size, uint32_t flags)
+{
+	SIZE_T page;
+	int16_t result;
+
+	result = wsa_shm_name(shm, name);
+	if (result < 0)
+		return result;
+
+	shm->owner = 1;
+	shm->huge = 0;
+
+	// a large page section is committed whole, in whole large pages, and
+	// only by a process holding the lock pages in memory privilege
+	page = GetLargePageMinimum();
+	if ((flags & WSA_SHM_HUGEPAGES) && page > 0) {
+		result = wsa_shm_map(shm, (size + page - 1) / page * page,
+			PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES,
+			FILE_MAP_ALL_ACCESS | FILE_MAP_LARGE_PAGES);
+		if (result == 0) {
+			shm->huge = 1;
+			return 0;
+		}
+		if (result == WSA_ERR_SHMINUSE)
+			return result;
+	}
+
+	return wsa_shm_map(shm, size, PAGE_READWRITE, FILE_MAP_ALL_ACCESS);
+}
+
+
+/**
+ * opens a shared memory segment another process created, and maps all
+ * of it
+ *
+ * @param shm - the segment
+ * @param name - the segment name
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_shm_open(struct wsa_shm *shm, char const *name)
+{
+	MEMORY_BASIC_INFORMATION info;
+	HANDLE handle;
+	int16_t result;
+
+	result = wsa_shm_name(shm, name);
+	if (result < 0)
+		return result;
+
+	handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, shm->name);
+	if (handle == NULL)
+		return WSA_ERR_SHMFAILED;
+
+	shm->addr = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (shm->addr == NULL || VirtualQuery(shm->addr, &info, sizeof(info)) == 0) {
+		if (shm->addr != NULL)
+			UnmapViewOfFile(shm->addr);
+		CloseHandle(handle);
+		return WSA_ERR_SHMFAILED;
+	}
+
+	// the view is rounded up to whole pages
+	shm->size = info.RegionSize;
+	shm->owner = 0;
+	shm->huge = 0;
+	shm->handle = handle;
+
+	return 0;
+}
+
+
+/**
+ * unmaps a shared memory segment
+ *
+ * @param shm - the segment
+ */
+void wsa_shm_close(struct wsa_shm *shm)
+{
+	UnmapViewOfFile(shm->addr);
+	CloseHandle((HANDLE) shm->handle);
+}
+
+
+/**
+ * gets the ID of the calling process
+ *
+ * @return the process ID
+ */
+uint32_t wsa_shm_process_id(void)
+{
+	return (uint32_t) GetCurrentProcessId();
+}
+
+
+/**
+ * checks whether a process is still running.  Windows doesn't reuse the
+ * ID of a process while a handle to it is open, so the handle opened here
+ * is the process asked about or none at all.
+ *
+ * @param pid - the process ID
+ *
+ * @return 1 if it is, 0 if it has exited
+ */
+uint8_t wsa_shm_process_alive(uint32_t pid)
+{
+	HANDLE process;
+	DWORD wait;
+
+	// a process that can't be opened for want of access is still running
+	process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD) pid);
+	if (process == NULL)
+		return GetLastError() != ERROR_INVALID_PARAMETER;
+
+	wait = WaitForSingleObject(process, 0);
+	CloseHandle(process);
+
+	return wait != WAIT_OBJECT_0;
+}
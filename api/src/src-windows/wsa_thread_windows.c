@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <windows.h>
+
+#include "wsa_thread.h"
+#include "wsa_error.h"
+
+/// what a new thread needs to call its entry point
+struct wsa_thread_start {
+	wsa_thread_func func;
+	void *arg;
+};
+
+/**
+ * adapts a wsa_thread_func to the Win32 thread entry point signature
+ *
+ * @param start - the malloc'ed wsa_thread_start, freed here
+ */
+static DWORD WINAPI wsa_thread_trampoline(LPVOID start)
+{
+	struct wsa_thread_start info = *((struct wsa_thread_start *) start);
+
+	free(start);
+	info.func(info.arg);
+
+	return 0;
+}
+
+/**
+ * starts a new thread
+ *
+ * @param thread - a pointer to store the thread handle
+ * @param func - the function the thread runs
+ * @param arg - the argument passed to \b func
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_thread_create(wsa_thread_t *thread, wsa_thread_func func, void *arg)
+{
+	struct wsa_thread_start *start;
+	HANDLE handle;
+
+	start = (struct wsa_thread_start *) malloc(sizeof(struct wsa_thread_start));
+	if (start == NULL)
+		return WSA_ERR_MALLOCFAILED;
+
+	start->func = func;
+	start->arg = arg;
+
+	handle = CreateThread(NULL, 0, wsa_thread_trampoline, start, 0, NULL);
+	if (handle == NULL) {
+		free(start);
+		return WSA_ERR_THREADCREATEFAILED;
+	}
+
+	*thread = (wsa_thread_t) handle;
+
+	return 0;
+}
+
+/**
+ * waits for a thread to return, and releases it
+ *
+ * @param thread - the thread handle
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_thread_join(wsa_thread_t thread)
+{
+	if (WaitForSingleObject((HANDLE) thread, INFINITE) != WAIT_OBJECT_0)
+		return WSA_ERR_UNKNOWN_ERROR;
+
+	CloseHandle((HANDLE) thread);
+
+	return 0;
+}
+
+/**
+ * identifies the calling thread, e.g. for trace events
+ *
+ * @return the thread's id
+ */
+uint32_t wsa_thread_id(void)
+{
+	return (uint32_t) GetCurrentThreadId();
+}
+
+/**
+ * suspends the calling thread
+ *
+ * @param milliseconds - how long to sleep
+ */
+void wsa_sleep_ms(uint32_t milliseconds)
+{
+	Sleep(milliseconds);
+}
+
+/**
+ * initializes a mutex
+ *
+ * @param mutex - the mutex
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_mutex_init(wsa_mutex_t *mutex)
+{
+	InitializeSRWLock((PSRWLOCK) mutex);
+
+	return 0;
+}
+
+/**
+ * releases a mutex, which must not be locked
+ *
+ * @param mutex - the mutex
+ */
+void wsa_mutex_destroy(wsa_mutex_t *mutex)
+{
+	// an SRWLOCK holds nothing to release
+	(void) mutex;
+}
+
+/**
+ * locks a mutex, waiting for any other thread holding it
+ *
+ * @param mutex - the mutex
+ */
+void wsa_mutex_lock(wsa_mutex_t *mutex)
+{
+	AcquireSRWLockExclusive((PSRWLOCK) mutex);
+}
+
+/**
+ * unlocks a mutex the calling thread holds
+ *
+ * @param mutex - the mutex
+ */
+void wsa_mutex_unlock(wsa_mutex_t *mutex)
+{
+	ReleaseSRWLockExclusive((PSRWLOCK) mutex);
+}
+
+/**
+ * initializes a condition variable
+ *
+ * @param cond - the condition variable
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_cond_init(wsa_cond_t *cond)
+{
+	InitializeConditionVariable((PCONDITION_VARIABLE) cond);
+
+	return 0;
+}
+
+/**
+ * releases a condition variable no thread is waiting on
+ *
+ * @param cond - the condition variable
+ */
+void wsa_cond_destroy(wsa_cond_t *cond)
+{
+	// a CONDITION_VARIABLE holds nothing to release
+	(void) cond;
+}
+
+/**
+ * unlocks a mutex and waits for a condition variable to be signalled,
+ * then locks the mutex again.  The wait may also end spuriously, so the
+ * condition must be checked again.
+ *
+ * @param cond - the condition variable
+ * @param mutex - the mutex the calling thread holds
+ */
+void wsa_cond_wait(wsa_cond_t *cond, wsa_mutex_t *mutex)
+{
+	SleepConditionVariableSRW((PCONDITION_VARIABLE) cond, (PSRWLOCK) mutex, INFINITE, 0);
+}
+
+/**
+ * wakes every thread waiting on a condition variable
+ *
+ * @param cond - the condition variable
+ */
+void wsa_cond_broadcast(wsa_cond_t *cond)
+{
+	WakeAllConditionVariable((PCONDITION_VARIABLE) cond);
+}
@@ -0,0 +1,58 @@
+#include <stdlib.h>
+
+#include "wsa_uring.h"
+#include "wsa_error.h"
+
+// io_uring is Linux only, so the data socket is always read with select()
+// and recv() here
+
+
+/**
+ * starts receiving the device's data socket through io_uring, which
+ * Windows doesn't have
+ *
+ * @param dev - the device
+ * @param buffers - unused
+ * @param buffer_size - unused
+ *
+ * @return WSA_ERR_IOURINGFAILED
+ */
+int16_t wsa_uring_open(struct wsa_device *dev, uint32_t buffers, uint32_t buffer_size)
+{
+	dev = dev;
+	buffers = buffers;
+	buffer_size = buffer_size;
+
+	return WSA_ERR_IOURINGFAILED;
+}
+
+
+/**
+ * stops receiving the device's data socket through io_uring
+ *
+ * @param dev - the device
+ */
+void wsa_uring_close(struct wsa_device *dev)
+{
+	dev->uring = NULL;
+}
+
+
+/**
+ * reads the data socket through io_uring, which Windows doesn't have
+ *
+ * @return WSA_ERR_IOURINGFAILED
+ */
+int16_t wsa_uring_recv_data(struct wsa_uring *uring, uint8_t *rx_buf_ptr,
+		int32_t buf_size, uint32_t time_out, int32_t *total_bytes,
+		struct wsa_stats *stats)
+{
+	uring = uring;
+	rx_buf_ptr = rx_buf_ptr;
+	buf_size = buf_size;
+	time_out = time_out;
+	stats = stats;
+	*total_bytes = 0;
+
+	return WSA_ERR_IOURINGFAILED;
+}
@@ -47,6 +47,8 @@
 #include "wsa_client.h"
 #include "wsa_dsp.h"
 #include "wsa_sweep_device.h"
+#include "wsa_perf.h"
+#include "wsa_trace.h"
 
 #ifdef _WIN32
 # define strtok_r strtok_s
@@ -60,6 +62,17 @@
 // ////////////////////////////////////////////////////////////////////////////
 int16_t wsa_verify_freq(struct wsa_device *dev, int64_t freq);
 
+// from wsa_lib.c
+int16_t _wsa_recv_data(struct wsa_device *dev, uint8_t *rx_buf_ptr, int32_t buf_size,
+		uint32_t time_out, int32_t *total_bytes);
+
+// Forget the context of earlier captures, so a capture about to start
+// reads its IF packets with only the context sent for it
+static void wsa_reset_context(struct wsa_device *dev)
+{
+	memset(&dev->context, 0, sizeof(struct wsa_packet_context));
+}
+
 // Verify if the frequency is valid (within allowed range)
 int16_t wsa_verify_freq(struct wsa_device *dev, int64_t freq)
 {
@@ -290,6 +303,44 @@ int16_t wsa_send_scpi(struct wsa_device *dev, char const *command)
     return WSA_ERR_MALLOCFAILED;
 }
 
+/**
+ * Take a snapshot of the device's throughput and health counters.  The 
+ * counters only ever increase from the time the device is connected, so 
+ * rates are obtained by comparing two snapshots.  It is safe to call this 
+ * from a different thread than the one receiving data.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param stats - A pointer to a \b wsa_stats structure to store the counters
+ *
+ * @return 0 on success, or a negative number on error.
+ */
+int16_t wsa_get_stats(struct wsa_device *dev, struct wsa_stats *stats)
+{
+	int i;
+
+	if (dev == NULL || stats == NULL)
+		return WSA_ERR_INVINPUT;
+
+	for (i = 0; i < WSA_STATS_NUM_STREAMS; i++) {
+		// the last slot collects every unexpected stream identifier
+		stats->streams[i].stream_id = (i == WSA_STATS_OTHER_STREAM) ? 0 : RECEIVER_STREAM_ID + i;
+		stats->streams[i].packets = wsa_atomic_load64(&dev->stats.streams[i].packets);
+		stats->streams[i].bytes = wsa_atomic_load64(&dev->stats.streams[i].bytes);
+	}
+
+	stats->context_packets = wsa_atomic_load64(&dev->stats.context_packets);
+	stats->if_packets = wsa_atomic_load64(&dev->stats.if_packets);
+	stats->over_range_packets = wsa_atomic_load64(&dev->stats.over_range_packets);
+	stats->sample_loss_packets = wsa_atomic_load64(&dev->stats.sample_loss_packets);
+	stats->socket_timeouts = wsa_atomic_load64(&dev->stats.socket_timeouts);
+	stats->socket_retries = wsa_atomic_load64(&dev->stats.socket_retries);
+	stats->scpi_commands = wsa_atomic_load64(&dev->stats.scpi_commands);
+	stats->scpi_queries = wsa_atomic_load64(&dev->stats.scpi_queries);
+	stats->error_queries = wsa_atomic_load64(&dev->stats.error_queries);
+
+	return 0;
+}
+
 
 // ////////////////////////////////////////////////////////////////////////////
 // LAN CONFIGURATION SECTION                                                 //
@@ -751,11 +802,7 @@ int16_t wsa_clean_data_socket(struct wsa_device *dev)
 	}
 	// read the left over packets from the socket
 	while(clock() <= end_time) {
-		wsa_sock_recv_data(dev->sock.data, 
-									packet, 
-									packet_size, 
-									timeout,	
-									&bytes_received);
+		_wsa_recv_data(dev, packet, packet_size, timeout, &bytes_received);
 	}
 
 	free(packet);
@@ -796,7 +843,13 @@ int16_t wsa_system_abort_capture(struct wsa_device *dev)
 int16_t wsa_get_capture_mode(struct wsa_device * const dev, char *mode)
 {
 	struct wsa_resp query;
+
 	wsa_send_query(dev, "SYST:CAPT:MODE?\n", &query);
+	if (query.status <= 0)
+		return (int16_t) query.status;
+
+	strcpy(mode, query.output);
+
 	return 0;
 }
 
@@ -842,6 +895,7 @@ int16_t wsa_capture_block(struct wsa_device * const dev)
 {
 	int16_t result = 0;
 
+	wsa_reset_context(dev);
 	result = wsa_send_command(dev, "TRACE:BLOCK:DATA?\n");
 	if (result < 0) {
         doutf(DHIGH, "Error in wsa_capture_block: %d - %s\n", result, wsa_get_error_msg(result));
@@ -901,13 +955,18 @@ int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 	int16_t result = 0;
 	int16_t result2 = 0;
 	int i = 0;
+	uint64_t trace_ts;
+	struct wsa_arena_mark arena_mark;
+
 	// allocate the data buffer
-	data_buffer = (uint8_t *) malloc(samples_per_packet * BYTES_PER_VRT_WORD * sizeof(uint8_t));
+	arena_mark = wsa_arena_mark(&dev->arena);
+	data_buffer = (uint8_t *) wsa_arena_alloc(&dev->arena, samples_per_packet * BYTES_PER_VRT_WORD * sizeof(uint8_t));
 	if (data_buffer == NULL) {
 		doutf(DHIGH, "In wsa_read_vrt_packet: failed to allocate memory\n");
 		return WSA_ERR_MALLOCFAILED;
 	}
-			
+
+	WSA_TRACE_BEGIN(trace_ts);
 	result = wsa_read_vrt_packet_raw(dev, header, trailer, receiver, digitizer, sweep_info, data_buffer, timeout);
 	doutf(DLOW, "wsa_read_vrt_packet_raw returned %hd\n", result);
 	if (result < 0)	{
@@ -917,7 +976,8 @@ int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 			result2 = wsa_flush_data(dev); 
         }
 
-		free(data_buffer);
+		wsa_arena_release(&dev->arena, arena_mark);
+		WSA_TRACE_END(trace_ts, "read_vrt_packet", "io", NULL);
 		return result;
 	} 
 
@@ -929,17 +989,209 @@ int16_t wsa_read_vrt_packet (struct wsa_device * const dev,
 	else if (header->stream_id == I32_DATA_STREAM_ID || header->stream_id == I16_DATA_STREAM_ID)
 		result = (int16_t) wsa_decode_i_only_frame(header->stream_id, data_buffer, i16_buffer, i32_buffer,  header->samples_per_packet);
 
-	// apply reflevel offset to R5500 if needed
-	if (header->packet_type == IF_PACKET_TYPE){
+	// apply reflevel offset to R5500 if needed, once, as the level arrives
+	if (header->stream_id == DIGITIZER_STREAM_ID &&
+			(digitizer->indicator_field & REF_LEVEL_INDICATOR_MASK) == REF_LEVEL_INDICATOR_MASK) {
 		if ((strstr(dev->descr.prod_model, R5500) != NULL)){
 			digitizer->reference_level = digitizer->reference_level - REFLEVEL_OFFSET;
 		}
 	}
-	free(data_buffer);
+	wsa_arena_release(&dev->arena, arena_mark);
+	WSA_TRACE_END(trace_ts, "read_vrt_packet", "io", NULL);
 
 	return 0;
 }
 
+/**
+ * Reads the next IF packet, with the context it was sent in.  Context
+ * packets met on the way are not returned; the device keeps the latest
+ * value of each of their fields, and \b context receives a copy of them
+ * with the IF packet.
+ *
+ * @remarks As with \b wsa_read_vrt_packet, the capture must have been
+ * started, and the packet must hold at most \b samples_per_packet samples.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param header - A pointer to \b wsa_vrt_packet_header structure to store 
+ *		the VRT header information
+ * @param trailer - A pointer to \b wsa_vrt_packet_trailer structure to store 
+ *		the VRT trailer information
+ * @param context - A pointer to \b wsa_packet_context structure to store the
+ *		center frequency, bandwidth, reference level and sweep and stream
+ *		start IDs in effect for the packet.  Its valid field tells which
+ *		were received.
+ * @param i16_buffer - A 16-bit signed integer pointer for the unscaled, 
+ *		I data buffer with size specified by samples_per_packet.
+ * @param q16_buffer - A 16-bit signed integer pointer for the unscaled 
+ *		Q data buffer with size specified by samples_per_packet.
+ * @param i32_buffer - A 32-bit signed integer pointer for the unscaled 
+ *		I data buffer with size specified by samples_per_packet.
+ * @param samples_per_packet - the largest number of samples the buffers
+ *		hold
+ * @param timeout - An unsigned 32-bit value containing the timeout (in 
+ *		miliseconds) for each packet
+ *
+ * @return 0 on success or a negative value on error
+ */
+int16_t wsa_read_if_packet(struct wsa_device * const dev,
+		struct wsa_vrt_packet_header * const header,
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_packet_context * const context,
+		int16_t * const i16_buffer,
+		int16_t * const q16_buffer,
+		int32_t * const i32_buffer,
+		int32_t samples_per_packet,
+		uint32_t timeout)
+{
+	struct wsa_receiver_packet receiver;
+	struct wsa_digitizer_packet digitizer;
+	struct wsa_extension_packet extension;
+	uint8_t *data_buffer;
+	struct wsa_arena_mark arena_mark;
+	int16_t result = 0;
+	uint64_t trace_ts;
+
+	if (samples_per_packet <= 0)
+		return WSA_ERR_INVSAMPLESIZE;
+
+	// a payload buffer big enough for any packet
+	arena_mark = wsa_arena_mark(&dev->arena);
+	data_buffer = (uint8_t *) wsa_arena_alloc(&dev->arena, VRT_MAX_PACKET_WORDS * BYTES_PER_VRT_WORD);
+	if (data_buffer == NULL) {
+		doutf(DHIGH, "In wsa_read_if_packet: failed to allocate memory\n");
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	WSA_TRACE_BEGIN(trace_ts);
+	for (;;) {
+		// the trailer is only decoded when the packet has one
+		memset(trailer, 0, sizeof(struct wsa_vrt_packet_trailer));
+		result = wsa_read_vrt_packet_raw(dev, header, trailer, &receiver,
+			&digitizer, &extension, data_buffer, timeout);
+		if (result < 0) {
+			doutf(DHIGH, "Error in wsa_read_if_packet: %s\n", wsa_get_error_msg(result));
+			if (result == WSA_ERR_NOTIQFRAME || result == WSA_ERR_QUERYNORESP) {
+				wsa_system_abort_capture(dev);
+				wsa_flush_data(dev);
+			}
+			break;
+		}
+
+		// the device tracks the context packets as they are read
+		if (header->stream_id == RECEIVER_STREAM_ID ||
+				header->stream_id == DIGITIZER_STREAM_ID ||
+				header->stream_id == EXTENSION_STREAM_ID)
+			continue;
+
+		if (header->samples_per_packet > samples_per_packet) {
+			result = WSA_ERR_INVSAMPLESIZE;
+			break;
+		}
+
+		if (header->stream_id == I16Q16_DATA_STREAM_ID)
+			wsa_decode_zif_frame(data_buffer, i16_buffer, q16_buffer,
+				header->samples_per_packet);
+		else
+			wsa_decode_i_only_frame(header->stream_id, data_buffer,
+				i16_buffer, i32_buffer, header->samples_per_packet);
+
+		*context = dev->context;
+		break;
+	}
+	WSA_TRACE_END(trace_ts, "read_if_packet", "io", NULL);
+
+	wsa_arena_release(&dev->arena, arena_mark);
+
+	return result;
+}
+
+/**
+ * Reads a block of IF packets into contiguous sample buffers, logging the
+ * metadata of each packet in \b log.  Context packets met on the way are
+ * not returned; they update the center frequency and reference level
+ * logged for the IF packets that follow them.
+ *
+ * The samples of the n-th packet read are stored at offset
+ * n * \b samples_per_packet of the buffers, and its metadata at entry
+ * log->count of \b log when the packet was read.
+ *
+ * @remarks As with \b wsa_read_vrt_packet, the capture must have been
+ * started, for example by \b wsa_capture_block, and every packet must
+ * hold at most \b samples_per_packet samples.
+ *
+ * @param dev - A pointer to the WSA device structure.
+ * @param log - A pointer to a packet log with room for \b packets more
+ *		entries
+ * @param i16_buffer - A 16-bit signed integer pointer for the unscaled
+ *		I data, with room for \b packets * \b samples_per_packet samples
+ * @param q16_buffer - A 16-bit signed integer pointer for the unscaled
+ *		Q data, the same size as \b i16_buffer
+ * @param i32_buffer - A 32-bit signed integer pointer for the unscaled
+ *		I data of I32 packets, the same size as \b i16_buffer
+ * @param samples_per_packet - the number of samples in each packet
+ * @param packets - the number of IF packets to read
+ * @param timeout - An unsigned 32-bit value containing the timeout (in 
+ *		miliseconds) for each packet
+ *
+ * @return 0 on success or a negative value on error
+ */
+int16_t wsa_read_block(struct wsa_device * const dev,
+		struct wsa_packet_log * const log,
+		int16_t * const i16_buffer,
+		int16_t * const q16_buffer,
+		int32_t * const i32_buffer,
+		int32_t samples_per_packet,
+		uint32_t packets,
+		uint32_t timeout)
+{
+	struct wsa_vrt_packet_header header;
+	struct wsa_vrt_packet_trailer trailer;
+	struct wsa_packet_context context;
+	size_t offset;
+	uint32_t n;
+	uint8_t flags;
+	int16_t result = 0;
+	uint64_t trace_ts;
+
+	if (samples_per_packet <= 0)
+		return WSA_ERR_INVSAMPLESIZE;
+	if (log->capacity - log->count < packets)
+		return WSA_ERR_INVCAPTURESIZE;
+
+	WSA_TRACE_BEGIN(trace_ts);
+	for (n = 0; n < packets; n++) {
+		// the buffers a stream doesn't use may be NULL
+		offset = (size_t) n * samples_per_packet;
+		result = wsa_read_if_packet(dev, &header, &trailer, &context,
+			i16_buffer ? i16_buffer + offset : NULL,
+			q16_buffer ? q16_buffer + offset : NULL,
+			i32_buffer ? i32_buffer + offset : NULL,
+			samples_per_packet, timeout);
+		if (result < 0) {
+			doutf(DHIGH, "Error in wsa_read_block: %s\n", wsa_get_error_msg(result));
+			break;
+		}
+
+		flags = 0;
+		if (trailer.valid_data_indicator)
+			flags |= WSA_PACKET_LOG_VALID_DATA;
+		if (trailer.ref_lock_indicator)
+			flags |= WSA_PACKET_LOG_REF_LOCK;
+		if (trailer.spectral_inversion_indicator)
+			flags |= WSA_PACKET_LOG_SPECTRAL_INVERSION;
+		if (trailer.over_range_indicator)
+			flags |= WSA_PACKET_LOG_OVER_RANGE;
+		if (trailer.sample_loss_indicator)
+			flags |= WSA_PACKET_LOG_SAMPLE_LOSS;
+
+		wsa_packet_log_append(log, header.time_stamp.sec, header.time_stamp.psec,
+			context.freq, context.reference_level, header.pkt_count, flags);
+	}
+	WSA_TRACE_END(trace_ts, "read_block", "io", NULL);
+
+	return result;
+}
+
 /**
  * Retrieve the the size of the buffer required to store the spectral data
  *
@@ -965,6 +1217,8 @@ int16_t wsa_get_fft_size(int32_t const samples_per_packet,
  * Retrieve the the size of the buffer required to store the spectral data
  *
  * @param samples_per_packet - The number of time domain samples
+ * @param fft_size - The number of FFT bins to store, as given by
+ *		wsa_get_fft_size(), which is at most \b samples_per_packet
  * @param stream_id - The ID indentifying the type of data
  * @param reference_level - dBm value used to calibrate the signal
  * @param spectral_inversion - byte containing whether spectral inversion is active
@@ -993,10 +1247,23 @@ int16_t wsa_compute_fft(int32_t const samples_per_packet,
 	kiss_fft_scalar tmpscalar;
 	int16_t result = 0;
 	int32_t i = 0;
+	uint64_t perf_ts;
+	struct wsa_arena workspace;
+
+	// the FFT output has no more bins than samples
+	if (fft_size < 0 || fft_size > samples_per_packet)
+		return WSA_ERR_INVSAMPLESIZE;
 
-	idata = (float *) malloc(sizeof(float) *MAX_BLOCK_SIZE);
-	qdata = (float *) malloc(sizeof(float) * MAX_BLOCK_SIZE);
-	fftout = (kiss_fft_cpx *) malloc(sizeof(kiss_fft_cpx) * MAX_BLOCK_SIZE);
+	// one block holds all the buffers
+	wsa_arena_init(&workspace, (sizeof(kiss_fft_scalar) * 2 + sizeof(kiss_fft_cpx)) *
+		samples_per_packet + 3 * WSA_ARENA_ALIGNMENT);
+	idata = (kiss_fft_scalar *) wsa_arena_alloc(&workspace, sizeof(kiss_fft_scalar) * samples_per_packet);
+	qdata = (kiss_fft_scalar *) wsa_arena_alloc(&workspace, sizeof(kiss_fft_scalar) * samples_per_packet);
+	fftout = (kiss_fft_cpx *) wsa_arena_alloc(&workspace, sizeof(kiss_fft_cpx) * samples_per_packet);
+	if (idata == NULL || qdata == NULL || fftout == NULL) {
+		wsa_arena_free(&workspace);
+		return WSA_ERR_MALLOCFAILED;
+	}
 
 	// window and normalize the data
 	normalize_iq_data(samples_per_packet,
@@ -1031,17 +1298,17 @@ int16_t wsa_compute_fft(int32_t const samples_per_packet,
 
 	doutf(DHIGH, "In wsa_compute_fft: finished compensating for spectral inversion\n");
 	// for the usable section, convert to power, apply reflevel and copy into buffer
+	WSA_PERF_START(perf_ts);
 	for (i = 0; i < fft_size; i++) {
 		tmpscalar = cpx_to_power(fftout[i]) / samples_per_packet;
 		tmpscalar = 2 * power_to_logpower(tmpscalar);
 		fft_buffer[i] = tmpscalar + ((float) reference_level) - KISS_FFT_OFFSET;
 		}
+	WSA_PERF_STOP(WSA_PERF_LOG_POWER, perf_ts);
 
 	doutf(DHIGH, "In wsa_compute_fft: finished moving buffer\n");
 
-	free(qdata);
-	free(fftout);
-	free(idata);
+	wsa_arena_free(&workspace);
 	
 	return result;
 }
@@ -1090,7 +1357,7 @@ int16_t peak_find(struct wsa_device *dev,
 	result = wsa_power_spectrum_alloc(wsa_sweep_dev, fstart, fstop, rbw, mode, &pscfg);
 	if (result < 0)
 	{
-		wsa_power_spectrum_free(pscfg);
+		// a failed alloc leaves nothing to free
 		wsa_sweep_device_free(wsa_sweep_dev);
 		return (int16_t) result;
 	}
@@ -1152,7 +1419,7 @@ int16_t calculate_channel_power(struct wsa_device *dev,
 	result = wsa_power_spectrum_alloc(wsa_sweep_dev, fstart, fstop, rbw, mode, &pscfg);
 	if (result < 0)
 	{
-		wsa_power_spectrum_free(pscfg);
+		// a failed alloc leaves nothing to free
 		wsa_sweep_device_free(wsa_sweep_dev);
 		return (int16_t) result; 
 	}
@@ -1217,7 +1484,7 @@ int16_t calculate_occupied_bandwidth(struct wsa_device *dev,
 	result = wsa_power_spectrum_alloc(wsa_sweep_dev, fstart, fstop, rbw, mode, &pscfg);
 	if (result < 0)
 	{
-		wsa_power_spectrum_free(pscfg);
+		// a failed alloc leaves nothing to free
 		wsa_sweep_device_free(wsa_sweep_dev);
 		return (int16_t) result; 
 	}
@@ -2345,6 +2612,7 @@ int16_t wsa_stream_start(struct wsa_device * const dev)
 {
 	int16_t result = 0;
 	
+	wsa_reset_context(dev);
 	result = wsa_send_command(dev, "TRACE:STREAM:START\n");
 	if (result < 0) {
         doutf(DHIGH, "Error in wsa_stream_start: %d - %s\n", result, wsa_get_error_msg(result));
@@ -2381,6 +2649,7 @@ int16_t wsa_stream_start_id(struct wsa_device * const dev, int64_t stream_start_
 	if (stream_start_id < 0 || stream_start_id > UINT_MAX)
 		return WSA_ERR_INVSTREAMSTARTID;
 
+	wsa_reset_context(dev);
 	sprintf(temp_str, "TRACE:STREAM:START %lld \n", stream_start_id);
 	result = wsa_send_command(dev, temp_str);
 	if (result < 0) {
@@ -3442,6 +3711,7 @@ int16_t wsa_sweep_start(struct wsa_device *dev)
 	int16_t result = 0;
 	int32_t size = 0;
 
+	wsa_reset_context(dev);
 	result = wsa_send_command(dev, "SWEEP:LIST:START\n");
     if (result < 0) {
     	doutf(DHIGH, "In wsa_sweep_start: %d - %s.\n", result, wsa_get_error_msg(result));
@@ -3490,6 +3760,7 @@ int16_t wsa_sweep_start_id(struct wsa_device *dev, int64_t sweep_start_id)
 	if (sweep_start_id < 0 || sweep_start_id > UINT_MAX)
 		return WSA_ERR_INVSWEEPSTARTID;
 
+	wsa_reset_context(dev);
 	sprintf(temp_str, "SWEEP:LIST:START %lld \n", sweep_start_id);
 
     result = wsa_send_command(dev, temp_str);
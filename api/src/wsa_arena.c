@@ -0,0 +1,223 @@
+#include <stdlib.h>
+
+#include "wsa_arena.h"
+#include "wsa_error.h"
+
+
+struct wsa_arena_block {
+	/// next block of the chain
+	struct wsa_arena_block *next;
+
+	/// usable bytes from data
+	size_t size;
+
+	/// the aligned start of the usable bytes
+	uint8_t *data;
+};
+
+
+// round up to a multiple of WSA_ARENA_ALIGNMENT
+#define WSA_ARENA_ALIGN(size) \
+	(((size) + WSA_ARENA_ALIGNMENT - 1) & ~((size_t) WSA_ARENA_ALIGNMENT - 1))
+
+
+/**
+ * initializes an empty arena.  Nothing is allocated until the first
+ * wsa_arena_alloc() or wsa_arena_reserve().
+ *
+ * @param arena - the arena
+ * @param block_size - the minimum size of the blocks, or 0 for
+ *		WSA_ARENA_DEFAULT_BLOCK_SIZE
+ */
+void wsa_arena_init(struct wsa_arena *arena, size_t block_size)
+{
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->offset = 0;
+	arena->block_size = block_size ? block_size : WSA_ARENA_DEFAULT_BLOCK_SIZE;
+	arena->reserved = 0;
+}
+
+
+/**
+ * moves the cursor to a block with at least \b size free bytes, adding a
+ * block to the chain after the current one if none of the blocks past it
+ * is big enough
+ *
+ * @param arena - the arena
+ * @param size - the aligned size needed
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_arena_grow(struct wsa_arena *arena, size_t size)
+{
+	struct wsa_arena_block *block;
+	size_t block_size;
+
+	// a block left over from earlier use of the arena
+	if (arena->current && arena->current->next && arena->current->next->size >= size) {
+		arena->current = arena->current->next;
+		arena->offset = 0;
+		return 0;
+	}
+	if (arena->current == NULL && arena->first && arena->first->size >= size) {
+		arena->current = arena->first;
+		arena->offset = 0;
+		return 0;
+	}
+
+	block_size = arena->block_size;
+	if (block_size < size)
+		block_size = size;
+
+	block = (struct wsa_arena_block *) malloc(
+		sizeof(struct wsa_arena_block) + block_size + WSA_ARENA_ALIGNMENT);
+	if (block == NULL)
+		return WSA_ERR_MALLOCFAILED;
+
+	block->size = block_size;
+	block->data = (uint8_t *) WSA_ARENA_ALIGN((size_t) (block + 1));
+
+	// keep the chain in cursor order, so marks stay valid
+	if (arena->current) {
+		block->next = arena->current->next;
+		arena->current->next = block;
+	} else {
+		block->next = arena->first;
+		arena->first = block;
+	}
+
+	arena->current = block;
+	arena->offset = 0;
+	arena->reserved += block_size;
+
+	return 0;
+}
+
+
+/**
+ * allocates memory from an arena.  The memory is aligned to
+ * WSA_ARENA_ALIGNMENT and stays valid until the cursor is moved back past
+ * it, or the arena is freed.
+ *
+ * @param arena - the arena
+ * @param size - the number of bytes
+ *
+ * @return a pointer to the memory, or NULL if a block couldn't be allocated
+ */
+void *wsa_arena_alloc(struct wsa_arena *arena, size_t size)
+{
+	void *ptr;
+
+	size = WSA_ARENA_ALIGN(size);
+
+	if (arena->current == NULL || arena->offset + size > arena->current->size) {
+		if (wsa_arena_grow(arena, size) < 0)
+			return NULL;
+	}
+
+	ptr = arena->current->data + arena->offset;
+	arena->offset += size;
+
+	return ptr;
+}
+
+
+/**
+ * makes sure the next \b size bytes allocated from an arena come from one
+ * contiguous block
+ *
+ * @param arena - the arena
+ * @param size - the number of bytes
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_arena_reserve(struct wsa_arena *arena, size_t size)
+{
+	if (arena->current && arena->offset + size <= arena->current->size)
+		return 0;
+
+	return wsa_arena_grow(arena, WSA_ARENA_ALIGN(size));
+}
+
+
+/**
+ * gets the cursor position, to give back everything allocated after it
+ * with wsa_arena_release()
+ *
+ * @param arena - the arena
+ *
+ * @return the mark
+ */
+struct wsa_arena_mark wsa_arena_mark(struct wsa_arena *arena)
+{
+	struct wsa_arena_mark mark;
+
+	mark.block = arena->current;
+	mark.offset = arena->offset;
+
+	return mark;
+}
+
+
+/**
+ * gives back everything allocated since a mark was taken.  The blocks are
+ * kept for later allocations.
+ *
+ * @param arena - the arena
+ * @param mark - a mark from wsa_arena_mark()
+ */
+void wsa_arena_release(struct wsa_arena *arena, struct wsa_arena_mark mark)
+{
+	arena->current = mark.block;
+	arena->offset = mark.offset;
+}
+
+
+/**
+ * gives back everything allocated from an arena, keeping its blocks
+ *
+ * @param arena - the arena
+ */
+void wsa_arena_reset(struct wsa_arena *arena)
+{
+	arena->current = NULL;
+	arena->offset = 0;
+}
+
+
+/**
+ * frees all the blocks of an arena.  The arena is left empty and can be
+ * used again.
+ *
+ * @param arena - the arena
+ */
+void wsa_arena_free(struct wsa_arena *arena)
+{
+	struct wsa_arena_block *block;
+	struct wsa_arena_block *next;
+
+	for (block = arena->first; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->offset = 0;
+	arena->reserved = 0;
+}
+
+
+/**
+ * frees an arena held in memory of its own, such as an object allocated
+ * from the arena it keeps.  The arena is copied out before its blocks go.
+ *
+ * @param arena - the arena
+ */
+void wsa_arena_free_self(struct wsa_arena *arena)
+{
+	struct wsa_arena copy = *arena;
+
+	wsa_arena_free(&copy);
+}
@@ -0,0 +1,941 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsa_capture.h"
+#include "wsa_commons.h"
+#include "wsa_error.h"
+#include "wsa_iq_codec.h"
+
+// file offsets go past 2 GB
+#ifdef _WIN32
+#define wsa_capture_fseek _fseeki64
+#define wsa_capture_ftell _ftelli64
+#else
+#define wsa_capture_fseek fseeko
+#define wsa_capture_ftell ftello
+#endif
+
+#define WSA_CAPTURE_VERSION 1
+
+// how a record stores its packet
+#define WSA_CAPTURE_RAW 0
+#define WSA_CAPTURE_CODEC 1
+
+#define WSA_CAPTURE_PACKET_HEADER_BYTES (VRT_HEADER_SIZE * BYTES_PER_VRT_WORD)
+
+// the largest compressed record: two channels of a full I16Q16 packet, or
+// one of a full I16 or I32 packet, after the header words and trailer
+#define WSA_CAPTURE_SCRATCH_SIZE (WSA_CAPTURE_RECORD_HEADER_SIZE + \
+	WSA_CAPTURE_PACKET_HEADER_BYTES + 2 * BYTES_PER_VRT_WORD + \
+	2 * WSA_IQ_CODEC_BOUND(VRT_MAX_PACKET_WORDS, 2))
+
+static char const wsa_capture_magic[] = "WSACAP01";
+static char const wsa_capture_index_magic[] = "WSAIDX01";
+
+
+static void wsa_capture_put32(uint8_t *p, uint32_t value)
+{
+	p[0] = (uint8_t) value;
+	p[1] = (uint8_t) (value >> 8);
+	p[2] = (uint8_t) (value >> 16);
+	p[3] = (uint8_t) (value >> 24);
+}
+
+
+static void wsa_capture_put64(uint8_t *p, uint64_t value)
+{
+	wsa_capture_put32(p, (uint32_t) value);
+	wsa_capture_put32(p + 4, (uint32_t) (value >> 32));
+}
+
+
+static uint32_t wsa_capture_get32(uint8_t const *p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+		((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static uint64_t wsa_capture_get64(uint8_t const *p)
+{
+	return (uint64_t) wsa_capture_get32(p) |
+		((uint64_t) wsa_capture_get32(p + 4) << 32);
+}
+
+
+// packet words are in network byte order
+static uint32_t wsa_capture_get_be32(uint8_t const *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+		((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+/**
+ * reads the time stamp of a packet, the same way wsa_decode_vrt_packet()
+ * does
+ *
+ * @param packet - the packet, at least its header words
+ * @param time - a pointer to store the time stamp in
+ */
+static void wsa_capture_packet_time(uint8_t const *packet, struct wsa_time *time)
+{
+	time->sec = wsa_capture_get_be32(packet + 8);
+	if (packet[1] & 0x20)
+		time->psec = ((uint64_t) wsa_capture_get_be32(packet + 12) << 32) |
+			wsa_capture_get_be32(packet + 16);
+	else
+		time->psec = 0;
+}
+
+
+static int wsa_capture_time_before(struct wsa_time const *a, struct wsa_time const *b)
+{
+	return a->sec < b->sec || (a->sec == b->sec && a->psec < b->psec);
+}
+
+
+/**
+ * checks whether a packet is an extension context packet starting a sweep
+ *
+ * @param packet - the packet
+ * @param packet_bytes - its size
+ * @param sweep_id - a pointer to store the sweep start ID in, if it is
+ *
+ * @return 1 if the packet starts a sweep, 0 if not, or a negative number
+ *		on error
+ */
+static int16_t wsa_capture_sweep_start(uint8_t *packet, uint32_t packet_bytes,
+		uint32_t *sweep_id)
+{
+	struct wsa_vrt_packet_header header;
+	struct wsa_vrt_packet_trailer trailer;
+	struct wsa_receiver_packet receiver;
+	struct wsa_digitizer_packet digitizer;
+	struct wsa_extension_packet extension;
+	int16_t result;
+
+	// the indicator field and sweep start ID follow the header words
+	if (packet_bytes < WSA_CAPTURE_PACKET_HEADER_BYTES + 2 * BYTES_PER_VRT_WORD ||
+			wsa_capture_get_be32(packet + 4) != EXTENSION_STREAM_ID)
+		return 0;
+
+	memset(&extension, 0, sizeof(extension));
+	result = wsa_decode_vrt_packet(packet, &header, &trailer, &receiver,
+		&digitizer, &extension, NULL);
+	if (result < 0)
+		return result;
+
+	if (!(extension.indicator_field & SWEEP_START_ID_INDICATOR_MASK))
+		return 0;
+
+	*sweep_id = extension.sweep_start_id;
+	return 1;
+}
+
+
+/**
+ * creates a capture file to record packets into.  See wsa_capture_record()
+ * to record every packet read from a device.
+ *
+ * @param file_name - the name of the file to create
+ * @param chunk_size - the size of a chunk in bytes, a multiple of 4 of at
+ *		least WSA_CAPTURE_MIN_CHUNK_SIZE, or 0 for
+ *		WSA_CAPTURE_DEFAULT_CHUNK_SIZE
+ * @param flags - WSA_CAPTURE_* flags
+ * @param writer - a pointer to store the new writer in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_capture_create(char const *file_name, uint32_t chunk_size,
+		uint32_t flags, struct wsa_capture_writer **writer)
+{
+	struct wsa_capture_writer *w;
+	struct wsa_arena arena;
+	uint8_t header[WSA_CAPTURE_HEADER_SIZE];
+
+	if (chunk_size == 0)
+		chunk_size = WSA_CAPTURE_DEFAULT_CHUNK_SIZE;
+	if (file_name == NULL || chunk_size < WSA_CAPTURE_MIN_CHUNK_SIZE ||
+			chunk_size % BYTES_PER_VRT_WORD != 0)
+		return WSA_ERR_INVINPUT;
+
+	wsa_arena_init(&arena, sizeof(struct wsa_capture_writer) + chunk_size +
+		WSA_CAPTURE_SCRATCH_SIZE +
+		3 * VRT_MAX_PACKET_WORDS * sizeof(int16_t) +
+		VRT_MAX_PACKET_WORDS * sizeof(int32_t) + 6 * WSA_ARENA_ALIGNMENT);
+	w = (struct wsa_capture_writer *) wsa_arena_alloc(&arena, sizeof(struct wsa_capture_writer));
+	if (w == NULL)
+		return WSA_ERR_MALLOCFAILED;
+
+	// an I16 packet has two samples per word
+	w->chunk = (uint8_t *) wsa_arena_alloc(&arena, chunk_size);
+	w->record = (uint8_t *) wsa_arena_alloc(&arena, WSA_CAPTURE_SCRATCH_SIZE);
+	w->i16 = (int16_t *) wsa_arena_alloc(&arena, 2 * VRT_MAX_PACKET_WORDS * sizeof(int16_t));
+	w->q16 = (int16_t *) wsa_arena_alloc(&arena, VRT_MAX_PACKET_WORDS * sizeof(int16_t));
+	w->i32 = (int32_t *) wsa_arena_alloc(&arena, VRT_MAX_PACKET_WORDS * sizeof(int32_t));
+	w->arena = arena;
+	if (w->chunk == NULL || w->record == NULL || w->i16 == NULL ||
+			w->q16 == NULL || w->i32 == NULL) {
+		wsa_arena_free(&arena);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	w->fp = fopen(file_name, "wb");
+	if (w->fp == NULL) {
+		wsa_arena_free(&arena);
+		return WSA_ERR_FILECREATEFAILED;
+	}
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, wsa_capture_magic, 8);
+	wsa_capture_put32(header + 8, WSA_CAPTURE_VERSION);
+	wsa_capture_put32(header + 12, chunk_size);
+	wsa_capture_put32(header + 16, flags);
+	if (fwrite(header, 1, sizeof(header), w->fp) != sizeof(header)) {
+		fclose(w->fp);
+		wsa_arena_free(&arena);
+		return WSA_ERR_FILEWRITEFAILED;
+	}
+
+	w->chunk_size = chunk_size;
+	w->flags = flags;
+	memset(&w->current, 0, sizeof(w->current));
+	w->current.offset = WSA_CAPTURE_HEADER_SIZE;
+	w->index = NULL;
+	w->chunks = 0;
+	w->index_capacity = 0;
+	w->sweep_id = 0;
+
+	*writer = w;
+	return 0;
+}
+
+
+/**
+ * writes the chunk being filled and adds it to the index
+ *
+ * @param writer - the writer
+ * @param last - 1 if no chunk follows, so it isn't padded
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_capture_flush(struct wsa_capture_writer *writer, uint8_t last)
+{
+	struct wsa_capture_index_entry *index;
+	uint32_t write_bytes = writer->current.bytes;
+
+	if (writer->current.packets == 0)
+		return 0;
+
+	if (!last) {
+		memset(writer->chunk + writer->current.bytes, 0,
+			writer->chunk_size - writer->current.bytes);
+		write_bytes = writer->chunk_size;
+	}
+	if (fwrite(writer->chunk, 1, write_bytes, writer->fp) != write_bytes)
+		return WSA_ERR_FILEWRITEFAILED;
+
+	if (writer->chunks == writer->index_capacity) {
+		index = (struct wsa_capture_index_entry *) realloc(writer->index,
+			sizeof(struct wsa_capture_index_entry) *
+			(writer->index_capacity ? 2 * writer->index_capacity : 64));
+		if (index == NULL)
+			return WSA_ERR_MALLOCFAILED;
+		writer->index = index;
+		writer->index_capacity = writer->index_capacity ? 2 * writer->index_capacity : 64;
+	}
+	writer->index[writer->chunks++] = writer->current;
+
+	writer->current.offset += writer->chunk_size;
+	writer->current.bytes = 0;
+	writer->current.packets = 0;
+	writer->current.streams = 0;
+	writer->current.sweep_id = writer->sweep_id;
+
+	return 0;
+}
+
+
+/**
+ * stores an IF packet with its samples compressed, one channel at a time:
+ * the header words, the trailer, the size of the first channel, then the
+ * channels
+ *
+ * @param writer - the writer, whose record scratch space is written
+ * @param packet - the packet
+ * @param packet_bytes - its size
+ * @param stream_id - its stream
+ *
+ * @return the size of the record, or 0 if the packet can't be compressed
+ */
+static uint32_t wsa_capture_compress(struct wsa_capture_writer *writer,
+		uint8_t *packet, uint32_t packet_bytes, uint32_t stream_id)
+{
+	uint8_t *record = writer->record;
+	uint8_t *payload = packet + WSA_CAPTURE_PACKET_HEADER_BYTES;
+	uint8_t *pos;
+	uint32_t tail_bytes = (packet[0] & 0x04) ? BYTES_PER_VRT_WORD : 0;
+	uint32_t payload_bytes;
+	uint32_t record_bytes;
+	int32_t samples;
+	int32_t first;
+	int32_t second = 0;
+
+	if (packet_bytes < WSA_CAPTURE_PACKET_HEADER_BYTES + tail_bytes)
+		return 0;
+	payload_bytes = packet_bytes - WSA_CAPTURE_PACKET_HEADER_BYTES - tail_bytes;
+
+	pos = record + WSA_CAPTURE_RECORD_HEADER_SIZE;
+	memcpy(pos, packet, WSA_CAPTURE_PACKET_HEADER_BYTES);
+	pos += WSA_CAPTURE_PACKET_HEADER_BYTES;
+	memcpy(pos, payload + payload_bytes, tail_bytes);
+	pos += tail_bytes + 4;
+
+	if (stream_id == I16Q16_DATA_STREAM_ID) {
+		samples = payload_bytes / 4;
+		wsa_decode_zif_frame(payload, writer->i16, writer->q16, samples);
+		first = wsa_iq_encode_i16(writer->i16, samples, pos,
+			WSA_CAPTURE_SCRATCH_SIZE - (int32_t) (pos - record));
+		if (first < 0)
+			return 0;
+		second = wsa_iq_encode_i16(writer->q16, samples, pos + first,
+			WSA_CAPTURE_SCRATCH_SIZE - (int32_t) (pos + first - record));
+		if (second < 0)
+			return 0;
+	} else if (stream_id == I16_DATA_STREAM_ID) {
+		samples = payload_bytes / 2;
+		wsa_decode_i_only_frame(stream_id, payload, writer->i16, NULL, samples);
+		first = wsa_iq_encode_i16(writer->i16, samples, pos,
+			WSA_CAPTURE_SCRATCH_SIZE - (int32_t) (pos - record));
+	} else if (stream_id == I32_DATA_STREAM_ID) {
+		samples = payload_bytes / 4;
+		wsa_decode_i_only_frame(stream_id, payload, NULL, writer->i32, samples);
+		first = wsa_iq_encode_i32(writer->i32, samples, pos,
+			WSA_CAPTURE_SCRATCH_SIZE - (int32_t) (pos - record));
+	} else {
+		return 0;
+	}
+	if (first < 0)
+		return 0;
+	wsa_capture_put32(pos - 4, (uint32_t) first);
+
+	// records stay word aligned
+	pos += first + second;
+	record_bytes = (uint32_t) (pos - record);
+	while (record_bytes % BYTES_PER_VRT_WORD) {
+		*pos++ = 0;
+		record_bytes++;
+	}
+
+	wsa_capture_put32(record, record_bytes);
+	wsa_capture_put32(record + 4, packet_bytes);
+	wsa_capture_put32(record + 8, 0);
+	record[8] = WSA_CAPTURE_CODEC;
+	record[9] = (uint8_t) tail_bytes;
+
+	return record_bytes;
+}
+
+
+/**
+ * writes a packet to a capture file
+ *
+ * @param writer - the writer
+ * @param packet - the whole VRT packet, as received
+ * @param packet_bytes - its size, which must match its packet size field
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_capture_write_packet(struct wsa_capture_writer *writer,
+		uint8_t *packet, uint32_t packet_bytes)
+{
+	struct wsa_vrt_packet_header header;
+	uint16_t packet_size;
+	uint32_t record_bytes = 0;
+	uint32_t raw_bytes;
+	uint8_t *dest;
+	int16_t result;
+
+	if (packet_bytes < WSA_CAPTURE_PACKET_HEADER_BYTES)
+		return WSA_ERR_INVINPUT;
+	result = wsa_decode_vrt_prologue(packet, &header, &packet_size);
+	if (result < 0)
+		return result;
+	if ((uint32_t) packet_size * BYTES_PER_VRT_WORD != packet_bytes)
+		return WSA_ERR_VRTPACKETSIZE;
+
+	result = wsa_capture_sweep_start(packet, packet_bytes, &writer->sweep_id);
+	if (result < 0)
+		return result;
+
+	// keep the packet as is unless compressing it saves space
+	raw_bytes = WSA_CAPTURE_RECORD_HEADER_SIZE + packet_bytes;
+	if (writer->flags & WSA_CAPTURE_COMPRESS)
+		record_bytes = wsa_capture_compress(writer, packet, packet_bytes, header.stream_id);
+	if (record_bytes == 0 || record_bytes >= raw_bytes)
+		record_bytes = 0;
+
+	if (writer->current.bytes + (record_bytes ? record_bytes : raw_bytes) > writer->chunk_size) {
+		result = wsa_capture_flush(writer, 0);
+		if (result < 0)
+			return result;
+	}
+
+	dest = writer->chunk + writer->current.bytes;
+	if (record_bytes) {
+		memcpy(dest, writer->record, record_bytes);
+	} else {
+		record_bytes = raw_bytes;
+		wsa_capture_put32(dest, record_bytes);
+		wsa_capture_put32(dest + 4, packet_bytes);
+		wsa_capture_put32(dest + 8, WSA_CAPTURE_RAW);
+		memcpy(dest + WSA_CAPTURE_RECORD_HEADER_SIZE, packet, packet_bytes);
+	}
+
+	if (writer->current.packets == 0)
+		wsa_capture_packet_time(packet, &writer->current.first_time);
+	writer->current.bytes += record_bytes;
+	writer->current.packets++;
+	writer->current.sweep_id = writer->sweep_id;
+	writer->current.streams |= WSA_CAPTURE_STREAM_BIT(header.stream_id);
+
+	return 0;
+}
+
+
+/**
+ * writes the last chunk and the index, closes a capture file and frees its
+ * writer.  A file that isn't closed has no index and can't be read.
+ *
+ * @param writer - the writer
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_capture_close(struct wsa_capture_writer *writer)
+{
+	struct wsa_capture_index_entry *entry;
+	uint8_t bytes[WSA_CAPTURE_INDEX_ENTRY_SIZE];
+	uint64_t index_offset = WSA_CAPTURE_HEADER_SIZE;
+	uint32_t i;
+	int16_t result;
+
+	result = wsa_capture_flush(writer, 1);
+
+	if (writer->chunks > 0) {
+		entry = &writer->index[writer->chunks - 1];
+		index_offset = entry->offset + entry->bytes;
+	}
+
+	for (i = 0; i < writer->chunks && result == 0; i++) {
+		entry = &writer->index[i];
+		memset(bytes, 0, sizeof(bytes));
+		wsa_capture_put64(bytes, entry->offset);
+		wsa_capture_put32(bytes + 8, entry->bytes);
+		wsa_capture_put32(bytes + 12, entry->packets);
+		wsa_capture_put32(bytes + 16, entry->first_time.sec);
+		wsa_capture_put32(bytes + 20, entry->sweep_id);
+		wsa_capture_put64(bytes + 24, entry->first_time.psec);
+		wsa_capture_put32(bytes + 32, entry->streams);
+		if (fwrite(bytes, 1, WSA_CAPTURE_INDEX_ENTRY_SIZE, writer->fp) != WSA_CAPTURE_INDEX_ENTRY_SIZE)
+			result = WSA_ERR_FILEWRITEFAILED;
+	}
+
+	if (result == 0) {
+		memset(bytes, 0, sizeof(bytes));
+		wsa_capture_put64(bytes, index_offset);
+		wsa_capture_put32(bytes + 8, writer->chunks);
+		memcpy(bytes + 16, wsa_capture_index_magic, 8);
+		if (fwrite(bytes, 1, WSA_CAPTURE_FOOTER_SIZE, writer->fp) != WSA_CAPTURE_FOOTER_SIZE)
+			result = WSA_ERR_FILEWRITEFAILED;
+	}
+
+	if (fclose(writer->fp) != 0 && result == 0)
+		result = WSA_ERR_FILEWRITEFAILED;
+
+	free(writer->index);
+
+	wsa_arena_free_self(&writer->arena);
+
+	return result;
+}
+
+
+/**
+ * records every packet read from a device into a capture file, until
+ * called again with NULL.  A packet that can't be recorded makes its read
+ * fail with the writer's error.
+ *
+ * @param dev - the device
+ * @param writer - the writer to record into, or NULL to stop recording
+ */
+void wsa_capture_record(struct wsa_device *dev, struct wsa_capture_writer *writer)
+{
+	dev->capture = writer;
+}
+
+
+/**
+ * opens a capture file and reads its index
+ *
+ * @param file_name - the name of the file
+ * @param reader - a pointer to store the new reader in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_capture_open(char const *file_name, struct wsa_capture_reader **reader)
+{
+	struct wsa_capture_reader *r;
+	struct wsa_capture_index_entry *entry;
+	struct wsa_arena arena;
+	struct wsa_arena_mark mark;
+	uint8_t header[WSA_CAPTURE_HEADER_SIZE];
+	uint8_t footer[WSA_CAPTURE_FOOTER_SIZE];
+	uint8_t *bytes;
+	uint64_t file_size;
+	uint64_t index_offset;
+	uint32_t chunk_size;
+	uint32_t chunks;
+	uint32_t i;
+	FILE *fp;
+
+	if (file_name == NULL)
+		return WSA_ERR_INVINPUT;
+
+	fp = fopen(file_name, "rb");
+	if (fp == NULL)
+		return WSA_ERR_FILEOPENFAILED;
+
+	// the header, then the footer giving where the index is
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+			memcmp(header, wsa_capture_magic, 8) != 0 ||
+			wsa_capture_get32(header + 8) != WSA_CAPTURE_VERSION ||
+			wsa_capture_fseek(fp, 0, SEEK_END) != 0) {
+		fclose(fp);
+		return WSA_ERR_FILECORRUPT;
+	}
+	chunk_size = wsa_capture_get32(header + 12);
+	file_size = (uint64_t) wsa_capture_ftell(fp);
+
+	if (chunk_size < WSA_CAPTURE_MIN_CHUNK_SIZE ||
+			file_size < WSA_CAPTURE_HEADER_SIZE + WSA_CAPTURE_FOOTER_SIZE ||
+			wsa_capture_fseek(fp, (int64_t) (file_size - WSA_CAPTURE_FOOTER_SIZE), SEEK_SET) != 0 ||
+			fread(footer, 1, sizeof(footer), fp) != sizeof(footer) ||
+			memcmp(footer + 16, wsa_capture_index_magic, 8) != 0) {
+		fclose(fp);
+		return WSA_ERR_FILECORRUPT;
+	}
+	index_offset = wsa_capture_get64(footer);
+	chunks = wsa_capture_get32(footer + 8);
+	if (index_offset < WSA_CAPTURE_HEADER_SIZE || index_offset > file_size ||
+			file_size - index_offset != (uint64_t) chunks * WSA_CAPTURE_INDEX_ENTRY_SIZE + WSA_CAPTURE_FOOTER_SIZE) {
+		fclose(fp);
+		return WSA_ERR_FILECORRUPT;
+	}
+
+	wsa_arena_init(&arena, sizeof(struct wsa_capture_reader) +
+		chunks * (sizeof(struct wsa_capture_index_entry) + WSA_CAPTURE_INDEX_ENTRY_SIZE) +
+		chunk_size + 3 * VRT_MAX_PACKET_WORDS * sizeof(int16_t) +
+		VRT_MAX_PACKET_WORDS * sizeof(int32_t) + 7 * WSA_ARENA_ALIGNMENT);
+	r = (struct wsa_capture_reader *) wsa_arena_alloc(&arena, sizeof(struct wsa_capture_reader));
+	if (r == NULL) {
+		fclose(fp);
+		return WSA_ERR_MALLOCFAILED;
+	}
+	r->index = (struct wsa_capture_index_entry *) wsa_arena_alloc(&arena,
+		chunks * sizeof(struct wsa_capture_index_entry) + 1);
+	r->chunk = (uint8_t *) wsa_arena_alloc(&arena, chunk_size);
+	r->i16 = (int16_t *) wsa_arena_alloc(&arena, 2 * VRT_MAX_PACKET_WORDS * sizeof(int16_t));
+	r->q16 = (int16_t *) wsa_arena_alloc(&arena, VRT_MAX_PACKET_WORDS * sizeof(int16_t));
+	r->i32 = (int32_t *) wsa_arena_alloc(&arena, VRT_MAX_PACKET_WORDS * sizeof(int32_t));
+
+	// the index as stored is only needed until it is decoded
+	mark = wsa_arena_mark(&arena);
+	bytes = (uint8_t *) wsa_arena_alloc(&arena, chunks * WSA_CAPTURE_INDEX_ENTRY_SIZE + 1);
+	r->arena = arena;
+	if (r->index == NULL || r->chunk == NULL || r->i16 == NULL ||
+			r->q16 == NULL || r->i32 == NULL || bytes == NULL) {
+		fclose(fp);
+		wsa_arena_free(&arena);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	if (wsa_capture_fseek(fp, (int64_t) index_offset, SEEK_SET) != 0 ||
+			fread(bytes, WSA_CAPTURE_INDEX_ENTRY_SIZE, chunks, fp) != chunks) {
+		fclose(fp);
+		wsa_arena_free(&arena);
+		return WSA_ERR_FILEREADFAILED;
+	}
+
+	for (i = 0; i < chunks; i++) {
+		entry = &r->index[i];
+		entry->offset = wsa_capture_get64(bytes + i * WSA_CAPTURE_INDEX_ENTRY_SIZE);
+		entry->bytes = wsa_capture_get32(bytes + i * WSA_CAPTURE_INDEX_ENTRY_SIZE + 8);
+		entry->packets = wsa_capture_get32(bytes + i * WSA_CAPTURE_INDEX_ENTRY_SIZE + 12);
+		entry->first_time.sec = wsa_capture_get32(bytes + i * WSA_CAPTURE_INDEX_ENTRY_SIZE + 16);
+		entry->sweep_id = wsa_capture_get32(bytes + i * WSA_CAPTURE_INDEX_ENTRY_SIZE + 20);
+		entry->first_time.psec = wsa_capture_get64(bytes + i * WSA_CAPTURE_INDEX_ENTRY_SIZE + 24);
+		entry->streams = wsa_capture_get32(bytes + i * WSA_CAPTURE_INDEX_ENTRY_SIZE + 32);
+
+		// every chunk is where its number puts it, and inside the file
+		if (entry->offset != WSA_CAPTURE_HEADER_SIZE + (uint64_t) i * chunk_size ||
+				entry->bytes > chunk_size || entry->offset + entry->bytes > index_offset) {
+			fclose(fp);
+			wsa_arena_free(&arena);
+			return WSA_ERR_FILECORRUPT;
+		}
+	}
+	wsa_arena_release(&r->arena, mark);
+
+	r->fp = fp;
+	r->chunk_size = chunk_size;
+	r->flags = wsa_capture_get32(header + 16);
+	r->chunks = chunks;
+	r->loaded = chunks;
+	r->next_chunk = 0;
+	r->next_offset = 0;
+
+	*reader = r;
+	return 0;
+}
+
+
+/**
+ * closes a capture file and frees its reader
+ *
+ * @param reader - the reader
+ */
+void wsa_capture_reader_close(struct wsa_capture_reader *reader)
+{
+	fclose(reader->fp);
+
+	wsa_arena_free_self(&reader->arena);
+}
+
+
+/**
+ * reads a chunk into memory, unless it already is
+ *
+ * @param reader - the reader
+ * @param n - the chunk
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_capture_load(struct wsa_capture_reader *reader, uint32_t n)
+{
+	struct wsa_capture_index_entry *entry = &reader->index[n];
+
+	if (reader->loaded == n)
+		return 0;
+
+	if (wsa_capture_fseek(reader->fp, (int64_t) entry->offset, SEEK_SET) != 0 ||
+			fread(reader->chunk, 1, entry->bytes, reader->fp) != entry->bytes) {
+		reader->loaded = reader->chunks;
+		return WSA_ERR_FILEREADFAILED;
+	}
+
+	reader->loaded = n;
+	return 0;
+}
+
+
+/**
+ * finds the next record, skipping chunks without the stream wanted, and
+ * moves past it
+ *
+ * @param reader - the reader
+ * @param stream_id - the stream wanted, or 0 for any
+ * @param record - a pointer to store the record in, in the chunk loaded
+ *
+ * @return 0 on success, WSA_ERR_FILEEND at the end of the file, or another
+ *		negative number on error
+ */
+static int16_t wsa_capture_next(struct wsa_capture_reader *reader,
+		uint32_t stream_id, uint8_t **record)
+{
+	struct wsa_capture_index_entry *entry;
+	uint8_t *rec;
+	uint32_t record_bytes;
+	uint32_t packet_bytes;
+	int16_t result;
+
+	while (reader->next_chunk < reader->chunks) {
+		entry = &reader->index[reader->next_chunk];
+		if (reader->next_offset >= entry->bytes ||
+				(stream_id != 0 && !(entry->streams & WSA_CAPTURE_STREAM_BIT(stream_id)))) {
+			reader->next_chunk++;
+			reader->next_offset = 0;
+			continue;
+		}
+
+		result = wsa_capture_load(reader, reader->next_chunk);
+		if (result < 0)
+			return result;
+
+		// a record holds at least the header words of its packet
+		rec = reader->chunk + reader->next_offset;
+		if (entry->bytes - reader->next_offset < WSA_CAPTURE_RECORD_HEADER_SIZE + WSA_CAPTURE_PACKET_HEADER_BYTES)
+			return WSA_ERR_FILECORRUPT;
+		record_bytes = wsa_capture_get32(rec);
+		packet_bytes = wsa_capture_get32(rec + 4);
+		if (record_bytes < WSA_CAPTURE_RECORD_HEADER_SIZE + WSA_CAPTURE_PACKET_HEADER_BYTES ||
+				record_bytes % BYTES_PER_VRT_WORD != 0 ||
+				record_bytes > entry->bytes - reader->next_offset ||
+				packet_bytes < WSA_CAPTURE_PACKET_HEADER_BYTES ||
+				packet_bytes != BYTES_PER_VRT_WORD * (uint32_t) ((rec[WSA_CAPTURE_RECORD_HEADER_SIZE + 2] << 8) |
+					rec[WSA_CAPTURE_RECORD_HEADER_SIZE + 3]))
+			return WSA_ERR_FILECORRUPT;
+
+		reader->next_offset += record_bytes;
+		if (stream_id != 0 && wsa_capture_get_be32(rec + WSA_CAPTURE_RECORD_HEADER_SIZE + 4) != stream_id)
+			continue;
+
+		*record = rec;
+		return 0;
+	}
+
+	return WSA_ERR_FILEEND;
+}
+
+
+/**
+ * moves a reader back to a record wsa_capture_next() found, so it is read
+ * next
+ *
+ * @param reader - the reader
+ * @param record - the record, in the chunk loaded
+ */
+static void wsa_capture_back(struct wsa_capture_reader *reader, uint8_t *record)
+{
+	reader->next_chunk = reader->loaded;
+	reader->next_offset = (uint32_t) (record - reader->chunk);
+}
+
+
+/**
+ * rebuilds an IF packet stored by wsa_capture_compress()
+ *
+ * @param reader - the reader, whose scratch space is used
+ * @param record - the record
+ * @param packet - a buffer for the packet
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_capture_decompress(struct wsa_capture_reader *reader,
+		uint8_t const *record, uint8_t *packet)
+{
+	uint8_t const *pos = record + WSA_CAPTURE_RECORD_HEADER_SIZE;
+	uint8_t const *end = record + wsa_capture_get32(record);
+	uint8_t *payload = packet + WSA_CAPTURE_PACKET_HEADER_BYTES;
+	uint32_t packet_bytes = wsa_capture_get32(record + 4);
+	uint32_t tail_bytes = record[9];
+	uint32_t stream_id;
+	uint32_t payload_bytes;
+	uint32_t first;
+	int32_t samples;
+	int32_t i;
+
+	if (tail_bytes > BYTES_PER_VRT_WORD ||
+			packet_bytes < WSA_CAPTURE_PACKET_HEADER_BYTES + tail_bytes ||
+			(uint32_t) (end - pos) < WSA_CAPTURE_PACKET_HEADER_BYTES + tail_bytes + 4)
+		return WSA_ERR_FILECORRUPT;
+	payload_bytes = packet_bytes - WSA_CAPTURE_PACKET_HEADER_BYTES - tail_bytes;
+	stream_id = wsa_capture_get_be32(pos + 4);
+
+	memcpy(packet, pos, WSA_CAPTURE_PACKET_HEADER_BYTES);
+	pos += WSA_CAPTURE_PACKET_HEADER_BYTES;
+	memcpy(payload + payload_bytes, pos, tail_bytes);
+	pos += tail_bytes;
+	first = wsa_capture_get32(pos);
+	pos += 4;
+	if (first > (uint32_t) (end - pos))
+		return WSA_ERR_FILECORRUPT;
+
+	// put the samples back in network byte order
+	if (stream_id == I16Q16_DATA_STREAM_ID) {
+		samples = payload_bytes / 4;
+		if (wsa_iq_decode_i16(pos, first, reader->i16, samples) < 0 ||
+				wsa_iq_decode_i16(pos + first, (int32_t) (end - pos) - first, reader->q16, samples) < 0)
+			return WSA_ERR_FILECORRUPT;
+		for (i = 0; i < samples; i++) {
+			payload[4 * i] = (uint8_t) (reader->i16[i] >> 8);
+			payload[4 * i + 1] = (uint8_t) reader->i16[i];
+			payload[4 * i + 2] = (uint8_t) (reader->q16[i] >> 8);
+			payload[4 * i + 3] = (uint8_t) reader->q16[i];
+		}
+	} else if (stream_id == I16_DATA_STREAM_ID) {
+		samples = payload_bytes / 2;
+		if (wsa_iq_decode_i16(pos, first, reader->i16, samples) < 0)
+			return WSA_ERR_FILECORRUPT;
+		for (i = 0; i < samples; i++) {
+			payload[2 * i] = (uint8_t) (reader->i16[i] >> 8);
+			payload[2 * i + 1] = (uint8_t) reader->i16[i];
+		}
+	} else if (stream_id == I32_DATA_STREAM_ID) {
+		samples = payload_bytes / 4;
+		if (wsa_iq_decode_i32(pos, first, reader->i32, samples) < 0)
+			return WSA_ERR_FILECORRUPT;
+		for (i = 0; i < samples; i++) {
+			payload[4 * i] = (uint8_t) ((uint32_t) reader->i32[i] >> 24);
+			payload[4 * i + 1] = (uint8_t) ((uint32_t) reader->i32[i] >> 16);
+			payload[4 * i + 2] = (uint8_t) ((uint32_t) reader->i32[i] >> 8);
+			payload[4 * i + 3] = (uint8_t) reader->i32[i];
+		}
+	} else {
+		return WSA_ERR_FILECORRUPT;
+	}
+
+	return 0;
+}
+
+
+/**
+ * moves a reader to the first packet stamped at or after a time.  Only
+ * the last chunk the index shows starting before the time, and the ones
+ * after it up to that packet, are read.
+ *
+ * @param reader - the reader
+ * @param time - the time; past the last packet, the next read returns
+ *		WSA_ERR_FILEEND
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_capture_seek_time(struct wsa_capture_reader *reader,
+		struct wsa_time const *time)
+{
+	struct wsa_time packet_time;
+	uint8_t *record;
+	uint32_t lo = 0;
+	uint32_t hi = reader->chunks;
+	uint32_t mid;
+	int16_t result;
+
+	// the last chunk starting before the time.  One starting at it could
+	// follow packets stamped with it at the end of the chunk before.
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (wsa_capture_time_before(&reader->index[mid].first_time, time))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	reader->next_chunk = lo ? lo - 1 : 0;
+	reader->next_offset = 0;
+
+	for (;;) {
+		result = wsa_capture_next(reader, 0, &record);
+		if (result == WSA_ERR_FILEEND)
+			return 0;
+		if (result < 0)
+			return result;
+
+		wsa_capture_packet_time(record + WSA_CAPTURE_RECORD_HEADER_SIZE, &packet_time);
+		if (!wsa_capture_time_before(&packet_time, time)) {
+			wsa_capture_back(reader, record);
+			return 0;
+		}
+	}
+}
+
+
+/**
+ * moves a reader to the extension context packet that starts a sweep.
+ * Sweep start IDs must increase through the recording, as they do in a
+ * single sweep session.
+ *
+ * @param reader - the reader
+ * @param sweep_id - the sweep start ID
+ *
+ * @return 0 on success, WSA_ERR_FILEEND if the sweep wasn't recorded, or
+ *		another negative number on error
+ */
+int16_t wsa_capture_seek_sweep(struct wsa_capture_reader *reader, uint32_t sweep_id)
+{
+	uint8_t *record;
+	uint32_t lo = 0;
+	uint32_t hi = reader->chunks;
+	uint32_t mid;
+	uint32_t found;
+	int16_t result;
+
+	// the first chunk that got to the sweep holds its start
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (reader->index[mid].sweep_id < sweep_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	reader->next_chunk = lo;
+	reader->next_offset = 0;
+
+	for (;;) {
+		result = wsa_capture_next(reader, EXTENSION_STREAM_ID, &record);
+		if (result < 0)
+			return result;
+		if (record[8] != WSA_CAPTURE_RAW)
+			continue;
+
+		result = wsa_capture_sweep_start(record + WSA_CAPTURE_RECORD_HEADER_SIZE,
+			wsa_capture_get32(record + 4), &found);
+		if (result < 0)
+			return result;
+		if (result == 0 || found < sweep_id)
+			continue;
+		if (found > sweep_id)
+			return WSA_ERR_FILEEND;
+
+		wsa_capture_back(reader, record);
+		return 0;
+	}
+}
+
+
+/**
+ * reads the next packet of a capture file, as it was received
+ *
+ * @param reader - the reader
+ * @param stream_id - the stream to read, or 0 for any; chunks the index
+ *		shows without the stream aren't read
+ * @param packet - a buffer for the packet; VRT_MAX_PACKET_WORDS words
+ *		always hold it
+ * @param size - the size of \b packet in bytes
+ * @param packet_bytes - a pointer to store the size of the packet in
+ *
+ * @return 0 on success, WSA_ERR_FILEEND after the last packet, or another
+ *		negative number on error
+ */
+int16_t wsa_capture_read_packet(struct wsa_capture_reader *reader,
+		uint32_t stream_id, uint8_t *packet, uint32_t size,
+		uint32_t *packet_bytes)
+{
+	uint8_t *record;
+	uint32_t bytes;
+	int16_t result;
+
+	result = wsa_capture_next(reader, stream_id, &record);
+	if (result < 0)
+		return result;
+
+	// leave the packet to be read again into a bigger buffer
+	bytes = wsa_capture_get32(record + 4);
+	if (bytes > size) {
+		wsa_capture_back(reader, record);
+		return WSA_ERR_INVINPUT;
+	}
+
+	if (record[8] == WSA_CAPTURE_RAW) {
+		if (wsa_capture_get32(record) < WSA_CAPTURE_RECORD_HEADER_SIZE + bytes)
+			return WSA_ERR_FILECORRUPT;
+		memcpy(packet, record + WSA_CAPTURE_RECORD_HEADER_SIZE, bytes);
+	} else if (record[8] == WSA_CAPTURE_CODEC) {
+		result = wsa_capture_decompress(reader, record, packet);
+		if (result < 0)
+			return result;
+	} else {
+		return WSA_ERR_FILECORRUPT;
+	}
+
+	*packet_bytes = bytes;
+	return 0;
+}
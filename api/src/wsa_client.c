@@ -154,6 +154,7 @@ int16_t wsa_setup_sock(char *sock_name, const char *sock_addr,
 	int32_t temp_fd = 0;
 	char str[INET6_ADDRSTRLEN];
 	int32_t result;
+	int nodelay = 1;
 	// Construct local address structure
 	memset(&hint_ai, 0, sizeof(hint_ai)); //Zero out structure
 	hint_ai.ai_family = AF_UNSPEC;		// Address family unspec in order to
@@ -196,6 +197,10 @@ int16_t wsa_setup_sock(char *sock_name, const char *sock_addr,
             continue;
         }
 
+        // commands are short writes, each waiting on its reply, which Nagle's
+        // algorithm would otherwise hold for the peer's delayed ACK
+        /* Ignore result */ setsockopt(temp_fd, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay));
+
         break; // successfully connected if got to here
     }
 
@@ -354,11 +359,14 @@ int16_t wsa_sock_recv(int32_t sock_fd, uint8_t *rx_buf_ptr, int32_t buf_size,
  * @param buf_size - The size of the buffer in bytes.
  * @param time_out - Time out in milliseconds.
  * @param total_bytes - Pointer to int32_t storing number of bytes read (on success)
+ * @param stats - Pointer to the device counters to update with time outs and 
+ *		retries, or NULL
  * 
  * @return 0 on success or a negative value on error
  */
 int16_t wsa_sock_recv_data(int32_t sock_fd, uint8_t *rx_buf_ptr, 
-						   int32_t buf_size, uint32_t time_out, int32_t *total_bytes)
+						   int32_t buf_size, uint32_t time_out, int32_t *total_bytes,
+						   struct wsa_stats *stats)
 {
 	int16_t recv_result = 0;
 	int32_t bytes_received = 0;
@@ -387,10 +395,16 @@ int16_t wsa_sock_recv_data(int32_t sock_fd, uint8_t *rx_buf_ptr,
 			doutf(DLOW, "bytes received: %d - ", bytes_received);
 		}
 		else {
+			if (stats != NULL && recv_result == WSA_ERR_QUERYNORESP)
+				wsa_atomic_add64(&stats->socket_timeouts, 1);
+
 			// if got error, try again to make sure?
 			if (retry == (try_limit - 1))
 				return recv_result;
 			retry++;
+
+			if (stats != NULL)
+				wsa_atomic_add64(&stats->socket_retries, 1);
 		}
 	} while (1);
 
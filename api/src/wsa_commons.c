@@ -73,6 +73,7 @@ const char *_wsa_get_err_msg(int16_t err_id)
 			"check the Ethernet connection (repower WSA if necessary)"},
 		{WSA_ERR_INVLANCONFIG,
 			"Invalid LAN configuration option"},
+		{WSA_ERR_IOURINGFAILED, "The io_uring receive path is not available"},
 
 						
 		//*****
@@ -93,6 +94,13 @@ const char *_wsa_get_err_msg(int16_t err_id)
 		{WSA_ERR_INVCAPTURESIZE, "Capture size exceeds amount of memory space available"},
 		{WSA_ERR_PACKETOUTOFORDER, "A VRT packet was received out of order"},
 		{WSA_ERR_CAPTUREACCESSDENIED, "Capture access denied, only 1 user can capture data at a time"},
+		{WSA_ERR_BUFFERSHELD, "Every packet buffer is still held by a consumer"},
+		{WSA_ERR_SHMFAILED, "Can't create or map the shared memory segment"},
+		{WSA_ERR_SHMINVALID, "The shared memory segment doesn't hold what was expected"},
+		{WSA_ERR_NOSPECTRUM, "No newer spectrum has been published"},
+		{WSA_ERR_NOPACKET, "No newer packet has been published"},
+		{WSA_ERR_SHMINUSE, "The shared memory segment is still mapped by another process"},
+		{WSA_ERR_NOCONSUMERSLOT, "The ring has no room for another consumer"},
 		
 		//*****
 		// Frequency related
@@ -159,6 +167,8 @@ const char *_wsa_get_err_msg(int16_t err_id)
 		{WSA_ERR_FILEOPENFAILED, "Unable to open the file"},
 		{WSA_ERR_FILEREADFAILED, "Unable to read the file"},
 		{WSA_ERR_FILEWRITEFAILED, "Unable to write to the file"},
+		{WSA_ERR_FILECORRUPT, "The recorded data is corrupt"},
+		{WSA_ERR_FILEEND, "The end of the recorded data was reached"},
 
 		//*****
 		// Others
@@ -169,6 +179,7 @@ const char *_wsa_get_err_msg(int16_t err_id)
 		{WSA_ERR_MALLOCFAILED, "Memory allocation failed"},
 		{WSA_ERR_UNKNOWN_ERROR, "Unknown error"},
 		{WSA_ERR_INVINPUT, "Invalid input"},
+		{WSA_ERR_THREADCREATEFAILED, "Unable to start a background thread"},
 		
 		//*****
 		// Sweep Errors   
@@ -203,8 +214,10 @@ const char *_wsa_get_err_msg(int16_t err_id)
 		//*****
 		// DSP ERRORS      
 		//*****
-		{WSA_ERR_INVCHPOWERRANGE, "Invalid start/stop ranges for channel power"}
+		{WSA_ERR_INVCHPOWERRANGE, "Invalid start/stop ranges for channel power"},
 
+		// end of list marker
+		{0, NULL}
 
 	};
 
@@ -3,15 +3,82 @@
 //*****************************************************************************
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "thinkrf_stdint.h"
+#include "wsa_atomic.h"
+#include "wsa_thread.h"
 #include "wsa_debug.h"
 
+#if defined(_MSC_VER) && _MSC_VER < 1900
+# define snprintf _snprintf
+#endif
+
+// how long the logging thread sleeps when the queue is empty
+#define WSA_LOG_IDLE_MS 1
+
+// logger states
+#define WSA_LOG_STOPPED		0	// no message logged yet
+#define WSA_LOG_STARTING	1	// a caller is starting the logging thread
+#define WSA_LOG_RUNNING		2	// messages are queued for the logging thread
+#define WSA_LOG_SYNC		3	// messages are written by the caller (no thread, or exiting)
+
+// how a format conversion reads its argument
+#define WSA_LOG_ARG_NONE	0	// "%%", no argument
+#define WSA_LOG_ARG_INT		1
+#define WSA_LOG_ARG_LONG	2
+#define WSA_LOG_ARG_LLONG	3
+#define WSA_LOG_ARG_SIZE	4
+#define WSA_LOG_ARG_DOUBLE	5
+#define WSA_LOG_ARG_LDOUBLE	6
+#define WSA_LOG_ARG_PTR		7
+#define WSA_LOG_ARG_STR		8
+#define WSA_LOG_ARG_WRITE	9	// "%n", the argument is skipped
+#define WSA_LOG_ARG_INVALID	10
+
+// %s argument placeholders, instead of an offset into the entry's strings
+#define WSA_LOG_STR_NULL	-1
+#define WSA_LOG_STR_NOROOM	-2
+
+/// one raw argument of a queued message
+union wsa_log_arg {
+	long long ll;
+	size_t z;
+	double d;
+	const void *p;
+};
+
+/// a queued message, formatted later by the logging thread
+struct wsa_log_entry {
+	// the queue position this slot is ready for (see wsa_log_reserve)
+	volatile uint32_t sequence;
+
+	int level;
+	time_t stamp;
+	const char *fmt;
+	int nargs;
+	union wsa_log_arg args[WSA_LOG_MAX_ARGS];
+
+	// copies of the %s arguments, which may not outlive the call
+	char strings[WSA_LOG_STRING_BYTES];
+};
 
 static int    debuglevel = DEBUGLEVEL;
 static void * debugcallbackpvoid = 0;
-static void (*debugcallbackfunc)(void * pvoid, char const * pstring) = 0; 
+static void (*debugcallbackfunc)(void * pvoid, char const * pstring) = 0;
+
+static struct wsa_log_entry wsa_log_queue[WSA_LOG_QUEUE_SIZE];
+static volatile uint32_t wsa_log_enqueue_pos = 0;
+static volatile uint32_t wsa_log_dequeue_pos = 0;
+static volatile uint32_t wsa_log_state = WSA_LOG_STOPPED;
+static volatile uint32_t wsa_log_stopping = 0;
+static volatile uint32_t wsa_log_dropped = 0;
+static uint32_t wsa_log_reported = 0;
+static wsa_thread_t wsa_log_thread;
+static FILE *wsa_log_file = NULL;
 
 void wsa_debuglevel(int level)
 {
@@ -24,55 +91,615 @@ void wsa_debugcallback(void(*callback)(void * pvoid, char const * pstring), void
   debugcallbackpvoid = pvoid;
 }
 
+
+/**
+ * parses one printf conversion specification
+ *
+ * @param spec - the character following the '%'
+ * @param stars - a pointer to store the number of '*' int arguments
+ *		read before the conversion's own argument
+ * @param arg_class - a pointer to store the WSA_LOG_ARG_* argument type
+ *
+ * @return a pointer past the conversion specification
+ */
+static const char *wsa_log_parse_spec(const char *spec, int *stars, int *arg_class)
+{
+	int longs = 0;
+	int sized = 0;
+	int long_double = 0;
+
+	*stars = 0;
+
+	// flags
+	while (*spec == '-' || *spec == '+' || *spec == ' ' || *spec == '#' || *spec == '0')
+		spec++;
+
+	// width and precision
+	if (*spec == '*') {
+		(*stars)++;
+		spec++;
+	} else {
+		while (*spec >= '0' && *spec <= '9')
+			spec++;
+	}
+	if (*spec == '.') {
+		spec++;
+		if (*spec == '*') {
+			(*stars)++;
+			spec++;
+		} else {
+			while (*spec >= '0' && *spec <= '9')
+				spec++;
+		}
+	}
+
+	// length modifiers
+	for (;;) {
+		if (*spec == 'h') {
+			spec++;
+		} else if (*spec == 'l') {
+			longs++;
+			spec++;
+		} else if (*spec == 'L') {
+			long_double = 1;
+			spec++;
+		} else if (*spec == 'j' || *spec == 'q') {
+			longs = 2;
+			spec++;
+		} else if (*spec == 'z' || *spec == 't') {
+			sized = 1;
+			spec++;
+		} else if (spec[0] == 'I' && spec[1] == '6' && spec[2] == '4') {
+			longs = 2;
+			spec += 3;
+		} else {
+			break;
+		}
+	}
+
+	switch (*spec) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		if (sized)
+			*arg_class = WSA_LOG_ARG_SIZE;
+		else if (longs >= 2)
+			*arg_class = WSA_LOG_ARG_LLONG;
+		else if (longs == 1)
+			*arg_class = WSA_LOG_ARG_LONG;
+		else
+			*arg_class = WSA_LOG_ARG_INT;
+		break;
+
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		*arg_class = long_double ? WSA_LOG_ARG_LDOUBLE : WSA_LOG_ARG_DOUBLE;
+		break;
+
+	case 's':
+		*arg_class = WSA_LOG_ARG_STR;
+		break;
+
+	case 'p':
+		*arg_class = WSA_LOG_ARG_PTR;
+		break;
+
+	case 'n':
+		*arg_class = WSA_LOG_ARG_WRITE;
+		break;
+
+	case '%':
+		*arg_class = WSA_LOG_ARG_NONE;
+		break;
+
+	default:
+		*arg_class = WSA_LOG_ARG_INVALID;
+		return spec;
+	}
+
+	return spec + 1;
+}
+
+
+/**
+ * copies a message's arguments into its queue entry, without formatting them
+ *
+ * @param entry - the queue entry, whose fmt is set
+ * @param ap - the message arguments
+ */
+static void wsa_log_capture(struct wsa_log_entry *entry, va_list ap)
+{
+	const char *fmt = entry->fmt;
+	const char *str;
+	int nargs = 0;
+	int used = 0;
+	int start;
+	int stars;
+	int arg_class;
+	int i;
+
+	while (*fmt) {
+		if (*fmt++ != '%')
+			continue;
+
+		fmt = wsa_log_parse_spec(fmt, &stars, &arg_class);
+		if (arg_class == WSA_LOG_ARG_INVALID)
+			break;
+
+		// the rest of the message is cut off when formatted
+		if (nargs + stars + 1 > WSA_LOG_MAX_ARGS)
+			break;
+
+		for (i = 0; i < stars; i++)
+			entry->args[nargs++].ll = va_arg(ap, int);
+
+		switch (arg_class) {
+		case WSA_LOG_ARG_INT:
+			entry->args[nargs++].ll = va_arg(ap, int);
+			break;
+
+		case WSA_LOG_ARG_LONG:
+			entry->args[nargs++].ll = va_arg(ap, long);
+			break;
+
+		case WSA_LOG_ARG_LLONG:
+			entry->args[nargs++].ll = va_arg(ap, long long);
+			break;
+
+		case WSA_LOG_ARG_SIZE:
+			entry->args[nargs++].z = va_arg(ap, size_t);
+			break;
+
+		case WSA_LOG_ARG_DOUBLE:
+			entry->args[nargs++].d = va_arg(ap, double);
+			break;
+
+		case WSA_LOG_ARG_LDOUBLE:
+			entry->args[nargs++].d = (double) va_arg(ap, long double);
+			break;
+
+		case WSA_LOG_ARG_PTR:
+			entry->args[nargs++].p = va_arg(ap, void *);
+			break;
+
+		case WSA_LOG_ARG_STR:
+			str = va_arg(ap, const char *);
+			if (str == NULL) {
+				entry->args[nargs++].ll = WSA_LOG_STR_NULL;
+			} else if (used >= WSA_LOG_STRING_BYTES) {
+				entry->args[nargs++].ll = WSA_LOG_STR_NOROOM;
+			} else {
+				entry->args[nargs++].ll = used;
+				start = used;
+				while (*str && used < WSA_LOG_STRING_BYTES - 1)
+					entry->strings[used++] = *str++;
+
+				// show where a string that didn't fit was cut
+				if (*str)
+					for (i = used - 3 < start ? start : used - 3; i < used; i++)
+						entry->strings[i] = '.';
+				entry->strings[used++] = '\0';
+			}
+			break;
+
+		case WSA_LOG_ARG_WRITE:
+			(void) va_arg(ap, int *);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	entry->nargs = nargs;
+}
+
+
+/**
+ * formats a queued message
+ *
+ * @param entry - the queue entry
+ * @param line - a buffer to store the message
+ * @param size - the size of \b line
+ *
+ * @return the length of the message
+ */
+static int wsa_log_format(struct wsa_log_entry *entry, char *line, int size)
+{
+	const char *fmt = entry->fmt;
+	const char *start;
+	const char *c;
+	const char *str;
+	union wsa_log_arg *value;
+	char spec[64];
+	int len = 0;
+	int arg = 0;
+	int stars;
+	int arg_class;
+	int s;
+	int n;
+
+	while (*fmt && len < size - 1) {
+		if (*fmt != '%') {
+			line[len++] = *fmt++;
+			continue;
+		}
+
+		start = fmt;
+		fmt = wsa_log_parse_spec(fmt + 1, &stars, &arg_class);
+
+		if (arg_class == WSA_LOG_ARG_NONE) {
+			line[len++] = '%';
+			continue;
+		}
+		if (arg_class == WSA_LOG_ARG_WRITE)
+			continue;
+
+		// print what can't be parsed as is
+		if (arg_class == WSA_LOG_ARG_INVALID || (fmt - start) > (int) sizeof(spec) - 24) {
+			while (*start && len < size - 1)
+				line[len++] = *start++;
+			break;
+		}
+
+		// the arguments that did not fit in the entry
+		if (arg + stars + 1 > entry->nargs) {
+			n = snprintf(line + len, size - len, "[...]\n");
+			len += (n < 0) ? 0 : n;
+			break;
+		}
+
+		// rebuild the conversion with any '*' resolved, and long doubles
+		// narrowed to the double they were stored as
+		s = 0;
+		for (c = start; c < fmt; c++) {
+			if (*c == '*')
+				s += sprintf(spec + s, "%d", (int) entry->args[arg++].ll);
+			else if (*c != 'L')
+				spec[s++] = *c;
+		}
+		spec[s] = '\0';
+
+		value = &entry->args[arg++];
+		switch (arg_class) {
+		case WSA_LOG_ARG_INT:
+			n = snprintf(line + len, size - len, spec, (int) value->ll);
+			break;
+
+		case WSA_LOG_ARG_LONG:
+			n = snprintf(line + len, size - len, spec, (long) value->ll);
+			break;
+
+		case WSA_LOG_ARG_LLONG:
+			n = snprintf(line + len, size - len, spec, value->ll);
+			break;
+
+		case WSA_LOG_ARG_SIZE:
+			n = snprintf(line + len, size - len, spec, value->z);
+			break;
+
+		case WSA_LOG_ARG_DOUBLE:
+		case WSA_LOG_ARG_LDOUBLE:
+			n = snprintf(line + len, size - len, spec, value->d);
+			break;
+
+		case WSA_LOG_ARG_PTR:
+			n = snprintf(line + len, size - len, spec, value->p);
+			break;
+
+		case WSA_LOG_ARG_STR:
+			if (value->ll == WSA_LOG_STR_NULL)
+				str = "(null)";
+			else if (value->ll == WSA_LOG_STR_NOROOM)
+				str = "...";
+			else
+				str = entry->strings + value->ll;
+			n = snprintf(line + len, size - len, spec, str);
+			break;
+
+		default:
+			n = 0;
+			break;
+		}
+
+		// snprintf reports the untruncated length
+		if (n > 0)
+			len += n;
+		if (len > size - 1)
+			len = size - 1;
+	}
+
+	line[len] = '\0';
+
+	return len;
+}
+
+
+/**
+ * writes a formatted message to the callback or stdout, and to the log file
+ *
+ * @param level - the message's debug level
+ * @param stamp - when the message was logged
+ * @param line - the message
+ */
+static void wsa_log_emit(int level, time_t stamp, const char *line)
+{
+	struct tm *timeinfo;
+
+	if (debugcallbackfunc)
+		debugcallbackfunc(debugcallbackpvoid, line);
+	else
+		fputs(line, stdout);
+
+	if (ENABLE_LOG_FILE) {
+		// kept open, rather than opened for every message
+		if (wsa_log_file == NULL)
+			wsa_log_file = fopen(WSA_API_LOG_FILE, "a");
+
+		if (wsa_log_file) {
+			timeinfo = localtime(&stamp);
+			fprintf(wsa_log_file, "[%d-%02d-%02d %02d:%02d:%02d] [Level %d] ",
+				timeinfo->tm_year + 1900,
+				timeinfo->tm_mon + 1,
+				timeinfo->tm_mday,
+				timeinfo->tm_hour,
+				timeinfo->tm_min,
+				timeinfo->tm_sec,
+				level);
+			fputs(line, wsa_log_file);
+		}
+	}
+}
+
+
+/**
+ * flushes stdout and the log file
+ */
+static void wsa_log_flush_output(void)
+{
+	fflush(stdout);
+	if (wsa_log_file)
+		fflush(wsa_log_file);
+}
+
+
+/**
+ * formats and writes out every message published in the queue.  Only the
+ * logging thread, or the exit handler once it has stopped, calls this.
+ *
+ * @return the number of messages written
+ */
+static int wsa_log_drain(void)
+{
+	struct wsa_log_entry *entry;
+	char line[WSA_LOG_LINE_LEN];
+	uint32_t pos = wsa_log_dequeue_pos;
+	uint32_t dropped;
+	int count = 0;
+
+	for (;;) {
+		entry = &wsa_log_queue[pos & (WSA_LOG_QUEUE_SIZE - 1)];
+		if (wsa_atomic_load32(&entry->sequence) != pos + 1)
+			break;
+
+		wsa_log_format(entry, line, sizeof(line));
+		wsa_log_emit(entry->level, entry->stamp, line);
+
+		// hand the slot back to the producers, one lap ahead
+		wsa_atomic_store32(&entry->sequence, pos + WSA_LOG_QUEUE_SIZE);
+		pos++;
+		count++;
+	}
+
+	dropped = wsa_atomic_load32(&wsa_log_dropped);
+	if (dropped != wsa_log_reported) {
+		sprintf(line, "wsa_doutf: %u debug messages dropped, the log queue was full\n",
+			dropped - wsa_log_reported);
+		wsa_log_emit(DHIGH, time(NULL), line);
+		wsa_log_reported = dropped;
+		count++;
+	}
+
+	if (count) {
+		wsa_log_flush_output();
+		wsa_atomic_store32(&wsa_log_dequeue_pos, pos);
+	}
+
+	return count;
+}
+
+
+/**
+ * the logging thread: writes out queued messages until the process exits
+ *
+ * @param arg - unused
+ */
+static void wsa_log_worker(void *arg)
+{
+	(void) arg;
+
+	while (!wsa_atomic_load32(&wsa_log_stopping)) {
+		if (wsa_log_drain() == 0)
+			wsa_sleep_ms(WSA_LOG_IDLE_MS);
+	}
+
+	wsa_log_drain();
+}
+
+
+/**
+ * exit handler: stops the logging thread once it has written out the queue
+ */
+static void wsa_log_shutdown(void)
+{
+	wsa_atomic_store32(&wsa_log_stopping, 1);
+	wsa_thread_join(wsa_log_thread);
+
+	// anything logged from now on (i.e. by other exit handlers) is written
+	// directly, and anything queued since the thread's last pass is drained here
+	wsa_atomic_store32(&wsa_log_state, WSA_LOG_SYNC);
+	wsa_log_drain();
+
+	if (wsa_log_file) {
+		fclose(wsa_log_file);
+		wsa_log_file = NULL;
+	}
+}
+
+
+/**
+ * starts the logging thread on first use
+ *
+ * @return 1 if messages can be queued, 0 if they must be written directly
+ */
+static int wsa_log_start(void)
+{
+	uint32_t state = wsa_atomic_load32(&wsa_log_state);
+	uint32_t i;
+
+	if (state == WSA_LOG_RUNNING)
+		return 1;
+	if (state == WSA_LOG_SYNC)
+		return 0;
+
+	if (wsa_atomic_cas32(&wsa_log_state, WSA_LOG_STOPPED, WSA_LOG_STARTING)) {
+		for (i = 0; i < WSA_LOG_QUEUE_SIZE; i++)
+			wsa_log_queue[i].sequence = i;
+
+		if (wsa_thread_create(&wsa_log_thread, wsa_log_worker, NULL) < 0) {
+			wsa_atomic_store32(&wsa_log_state, WSA_LOG_SYNC);
+			return 0;
+		}
+
+		atexit(wsa_log_shutdown);
+		wsa_atomic_store32(&wsa_log_state, WSA_LOG_RUNNING);
+		return 1;
+	}
+
+	// another thread is starting the logger
+	while ((state = wsa_atomic_load32(&wsa_log_state)) == WSA_LOG_STARTING)
+		wsa_sleep_ms(0);
+
+	return state == WSA_LOG_RUNNING;
+}
+
+
+/**
+ * claims the next free queue slot.  Any number of threads may call this:
+ * each slot's sequence tells whether it is free for the current lap of the
+ * queue, and the position is claimed with a compare and swap.
+ *
+ * @param pos - a pointer to store the claimed position
+ *
+ * @return the slot, or NULL if the queue is full
+ */
+static struct wsa_log_entry *wsa_log_reserve(uint32_t *pos)
+{
+	struct wsa_log_entry *entry;
+	uint32_t current;
+	int32_t lag;
+
+	for (;;) {
+		current = wsa_atomic_load32(&wsa_log_enqueue_pos);
+		entry = &wsa_log_queue[current & (WSA_LOG_QUEUE_SIZE - 1)];
+		lag = (int32_t) (wsa_atomic_load32(&entry->sequence) - current);
+
+		if (lag == 0) {
+			if (wsa_atomic_cas32(&wsa_log_enqueue_pos, current, current + 1)) {
+				*pos = current;
+				return entry;
+			}
+		} else if (lag < 0) {
+			// the logging thread has not written this slot out yet
+			return NULL;
+		}
+
+		// otherwise another caller claimed the position first, so retry
+	}
+}
+
+
+/**
+ * writes a message directly, when there is no logging thread
+ *
+ * @param level - the message's debug level
+ * @param fmt - the printf format
+ * @param ap - the format arguments
+ */
+static void wsa_log_write_now(int level, const char *fmt, va_list ap)
+{
+	char line[WSA_LOG_LINE_LEN];
+
+	vsnprintf(line, sizeof(line), fmt, ap);
+	line[sizeof(line) - 1] = '\0';
+
+	wsa_log_emit(level, time(NULL), line);
+	wsa_log_flush_output();
+}
+
+
+/**
+ * logs a debug message.  The message is queued and formatted by a
+ * background thread, so the format must be a string constant; %s
+ * arguments are copied and may be temporary, but only the first
+ * WSA_LOG_STRING_BYTES of them in all are kept, and a string cut short
+ * ends in "...".  The debug callback, if any, is called from that thread.
+ *
+ * Unlike before the queue, the message is not formatted here, so its
+ * length isn't known: the return value only says whether it was logged.
+ *
+ * @param level - the message's debug level (DHIGH, DMED or DLOW)
+ * @param fmt - the printf format
+ *
+ * @return 1 if the message was logged, 0 if it was filtered out or dropped
+ */
 int wsa_doutf(int level, const char *fmt, ...)
 {
+	struct wsa_log_entry *entry;
+	uint32_t pos;
 	va_list ap;
-	FILE* debugFile;
-	time_t rawtime;
-	struct tm * timeinfo;
-    char buffer[256];
-	int n;
 
 	// don't print if debug level is too low
 	if (level > debuglevel) {
 		return 0;
-    }
-	
-    if(debugcallbackfunc) {
-	  va_start(ap, fmt);
-	  n = vsnprintf(buffer, sizeof(buffer), fmt, ap);
-	  va_end(ap);
-      buffer[sizeof(buffer)-1] = 0;
-      debugcallbackfunc(debugcallbackpvoid, buffer); 
-    } else {
-	  va_start(ap, fmt);
-	  n = vprintf(fmt, ap);
-	  va_end(ap);
-  	  fflush(stdout);
-    }
-
-	if (ENABLE_LOG_FILE)
-	{
-		debugFile = fopen(WSA_API_LOG_FILE, "a");
-	
-		if (debugFile) {
-			time(&rawtime);
-			timeinfo = localtime(&rawtime);
-
-			va_start(ap, fmt);
-			fprintf(debugFile, "[%d-%02d-%02d %02d:%02d:%02d] [Level %d] ", 
-				timeinfo->tm_year + 1900, 
-				timeinfo->tm_mon + 1, 
-				timeinfo->tm_mday, 
-				timeinfo->tm_hour, 
-				timeinfo->tm_min, 
-				timeinfo->tm_sec,
-				level);
-			vfprintf(debugFile, fmt, ap);
-			fclose(debugFile);
-			va_end(ap);
-		}
 	}
 
-	return n;
+	if (!wsa_log_start()) {
+		va_start(ap, fmt);
+		wsa_log_write_now(level, fmt, ap);
+		va_end(ap);
+		return 1;
+	}
+
+	entry = wsa_log_reserve(&pos);
+	if (entry == NULL) {
+		wsa_atomic_add32(&wsa_log_dropped, 1);
+		return 0;
+	}
+
+	entry->level = level;
+	entry->stamp = ENABLE_LOG_FILE ? time(NULL) : 0;
+	entry->fmt = fmt;
+
+	va_start(ap, fmt);
+	wsa_log_capture(entry, ap);
+	va_end(ap);
+
+	// publish the message to the logging thread
+	wsa_atomic_store32(&entry->sequence, pos + 1);
+
+	return 1;
+}
+
+
+/**
+ * waits until every message logged so far has been written out
+ */
+void wsa_debugflush(void)
+{
+	uint32_t target;
+
+	if (wsa_atomic_load32(&wsa_log_state) != WSA_LOG_RUNNING)
+		return;
+
+	target = wsa_atomic_load32(&wsa_log_enqueue_pos);
+	while ((int32_t) (wsa_atomic_load32(&wsa_log_dequeue_pos) - target) < 0)
+		wsa_sleep_ms(WSA_LOG_IDLE_MS);
 }
@@ -3,6 +3,7 @@
 #include "wsa_lib.h"
 #include "wsa_dsp.h"
 #include "wsa_error.h"
+#include "wsa_perf.h"
 #define _USE_MATH_DEFINES
 #include "math.h"
 #define ENOMEM 4
@@ -53,6 +54,7 @@ void get_normalization_factor(uint32_t const stream_id, kiss_fft_scalar  * norma
  * @idata - buffer containing normalized i data
  * @qdata - buffer containing normalized q data
  */
+WSA_TARGET_CLONES
 void normalize_iq_data(int32_t samples_per_packet,
 					uint32_t stream_id,
 					int16_t * i16_buffer,
@@ -97,6 +99,7 @@ void normalize_iq_data(int32_t samples_per_packet,
  * @idata - buffer containing normalized i data
  * @qdata - buffer containing normalized q data
  */
+WSA_TARGET_CLONES
 void correct_dc_offset(int32_t samples_per_packet,
 					kiss_fft_scalar * idata,
 					kiss_fft_scalar * qdata)
@@ -138,13 +141,19 @@ kiss_fft_scalar window_hanning_scalar(kiss_fft_scalar value, int len, int index)
  * @param values - a pointer to the array of scalar values
  * @param len - the length of the array
  */
+WSA_TARGET_CLONES
 void window_hanning_scalar_array(kiss_fft_scalar *values, int len)
 {
 	int i;
+	uint64_t perf_ts;
+
+	WSA_PERF_START(perf_ts);
 
 	for(i=0; i<len; i++) {
 		values[i] = window_hanning_scalar(values[i], len, i);
 	}
+
+	WSA_PERF_STOP(WSA_PERF_WINDOW, perf_ts);
 }
 
 
@@ -170,6 +179,7 @@ void window_hanning_cpx(kiss_fft_cpx *value, int len, int index)
  * @value - a pointer to the array of complex values
  * @len - the length of the array
  */
+WSA_TARGET_CLONES
 void reverse_cpx(kiss_fft_cpx *value, int len)
 {
 	int i;
@@ -204,6 +214,9 @@ int rfft(kiss_fft_scalar *idata, kiss_fft_cpx *fftdata, int len)
 	kiss_fft_cfg fftcfg;
 	kiss_fft_cpx *iq;
 	kiss_fft_cpx tmpval;
+	uint64_t perf_ts;
+
+	WSA_PERF_START(perf_ts);
 
 	iq = malloc(sizeof(kiss_fft_cpx) * len);
 	if (iq == NULL) {
@@ -239,6 +252,8 @@ int rfft(kiss_fft_scalar *idata, kiss_fft_cpx *fftdata, int len)
 		fftdata[i].i = fftdata[i+n].i;
 	}
 
+	WSA_PERF_STOP(WSA_PERF_FFT, perf_ts);
+
 	return 0;
 }
 
@@ -258,6 +273,152 @@ kiss_fft_scalar power_to_logpower(kiss_fft_scalar value) {
 	return  (float) (10 * log10(value));
 }
 
+// ////////////////////////////////////////////////////////////////////////////
+// Stitching Section                                                         //
+// ////////////////////////////////////////////////////////////////////////////
+/**
+ * finds the weight of a grid bin, by how far it is from the nearer edge
+ * of a block's usable band.  The comparisons are quiet ones, so a loop
+ * calling this still vectorizes.
+ *
+ * @param i - the grid bin
+ * @param left - the first grid bin position the block is usable from
+ * @param right - the last grid bin position the block is usable to
+ * @param inv_ramp - one over the overlap in grid bins the edges fade over
+ *
+ * @return the weight, up to 1
+ */
+static float stitch_weight(int i, double left, double right, float inv_ramp)
+{
+	float edge = (float) (i - left);
+	float w;
+
+	edge = isless((float) (right - i), edge) ? (float) (right - i) : edge;
+	w = (edge + 0.5f) * inv_ramp;
+
+	return isgreater(w, 1) ? 1 : w;
+}
+
+/**
+ * adds the power of one block to a spectrum being stitched on a global
+ * frequency grid.  The block's bins are resampled onto the grid by linear
+ * interpolation, so a bin that falls between two of the block's lands
+ * where it belongs, and each bin is weighted by how far it is from the
+ * nearer edge of the block's usable band: the weight ramps up to 1 over
+ * \b ramp bins, so the blocks on either side of an overlap crossfade
+ * into each other rather than one cutting the other off.
+ *
+ * Both the interpolation and the crossfade are done in linear power: in
+ * dB a tone between two bins would read low, and a bin with no power at
+ * all (-inf dB) would turn its neighbours into NaN.  The block comes in
+ * linear power already, so each grid bin is a multiply-add.  A bin that
+ * is NaN or +inf can't be interpolated, so the grid bin takes the nearer
+ * of the two block bins as it is, and keeps it through stitch_finish();
+ * a block with any such bin is stitched by a loop of its own.
+ *
+ * @param sum - the weighted linear power of each grid bin so far
+ * @param weight - the weight of each grid bin so far
+ * @param len - the number of grid bins
+ * @param block - the linear power of the block's bins, which overlaps
+ *		neither \b sum nor \b weight
+ * @param block_len - the number of block bins
+ * @param offset - where grid bin 0 falls among the block's bins
+ * @param step - the width of a grid bin in block bins
+ * @param left - the first grid bin position the block is usable from
+ * @param right - the last grid bin position the block is usable to
+ * @param ramp - the overlap in grid bins that the edges fade over
+ */
+WSA_TARGET_CLONES
+void stitch_block(float * WSA_RESTRICT sum, float * WSA_RESTRICT weight, int len,
+				float const * WSA_RESTRICT block, int block_len,
+				double offset, double step,
+				double left, double right, double ramp)
+{
+	int i, first, last;
+	int index;
+	int finite = 1;
+	double pos;
+	float frac;
+	float lo;
+	float hi;
+	float power;
+	float w;
+	float inv_ramp;
+
+	if (ramp < 1)
+		ramp = 1;
+	inv_ramp = (float) (1 / ramp);
+
+	// the grid bins in the usable band, whose block bins and the ones
+	// after them are in the block
+	first = (int) ceil(left);
+	if (first < 0)
+		first = 0;
+	if (offset + first * step < 0)
+		first = (int) ceil(-offset / step);
+	last = (int) floor(right);
+	if (last > len - 1)
+		last = len - 1;
+	if (offset + last * step >= block_len - 1)
+		last = (int) ceil((block_len - 1 - offset) / step) - 1;
+
+	for (i = 0; i < block_len; i++)
+		finite &= block[i] - block[i] == 0;
+
+	if (finite) {
+		for (i = first; i <= last; i++) {
+			pos = offset + i * step;
+			index = (int) pos;
+			frac = (float) (pos - index);
+			w = stitch_weight(i, left, right, inv_ramp);
+
+			lo = block[index];
+			hi = block[index + 1];
+			sum[i] += w * (lo + frac * (hi - lo));
+			weight[i] += w;
+		}
+		return;
+	}
+
+	for (i = first; i <= last; i++) {
+		pos = offset + i * step;
+		index = (int) pos;
+		frac = (float) (pos - index);
+		w = stitch_weight(i, left, right, inv_ramp);
+
+		lo = block[index];
+		hi = block[index + 1];
+		if (lo - lo == 0 && hi - hi == 0)
+			power = lo + frac * (hi - lo);
+		else
+			power = frac < 0.5f ? lo : hi;
+
+		sum[i] += w * power;
+		weight[i] += w;
+	}
+}
+
+/**
+ * turns the sums of a stitched spectrum into its power in dB.  A bin no
+ * block covered keeps the value it had; one with no power at all gets
+ * -inf, and a NaN or +inf a block carried stays one.
+ *
+ * @param spectrum - the spectrum to store the power in
+ * @param sum - the weighted linear power of each bin
+ * @param weight - the weight of each bin
+ * @param len - the number of bins
+ */
+WSA_TARGET_CLONES
+void stitch_finish(float *spectrum, float const *sum, float const *weight, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (weight[i] > 0)
+			spectrum[i] = (float) (10 * log10(sum[i] / weight[i]));
+	}
+}
+
 // ////////////////////////////////////////////////////////////////////////////
 // Utility Functions                                                         //
 // ////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,198 @@
+#include <float.h>
+#include <string.h>
+
+#include "wsa_emission_mask.h"
+#include "wsa_commons.h"
+#include "wsa_error.h"
+
+// lanes of the partial minimums, enough for an AVX2 register of floats
+#define WSA_EMISSION_MASK_LANES 8
+
+
+/**
+ * allocates an emission mask, resampling its limit line onto a bin grid.
+ * For a sweep, pass the cfg->fstart, cfg->fstop and cfg->buflen of its
+ * wsa_power_spectrum_config.
+ *
+ * @param points - the corners of the limit line, in increasing frequency.
+ *		The level is interpolated linearly between them.
+ * @param num_points - the number of corners, at least 1
+ * @param fstart - the frequency of the first bin, in Hz
+ * @param fstop - the end of the bin grid, in Hz
+ * @param bins - the number of bins
+ * @param mask - a pointer to store the new mask in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_emission_mask_alloc(struct wsa_emission_mask_point const *points,
+		uint32_t num_points, uint64_t fstart, uint64_t fstop, uint32_t bins,
+		struct wsa_emission_mask **mask)
+{
+	struct wsa_emission_mask *m;
+	struct wsa_arena arena;
+	uint64_t freq;
+	uint32_t p = 0;
+	uint32_t i;
+
+	if (num_points == 0 || bins == 0 || fstop <= fstart)
+		return WSA_ERR_INVINPUT;
+	for (i = 1; i < num_points; i++) {
+		if (points[i].freq < points[i - 1].freq)
+			return WSA_ERR_INVINPUT;
+	}
+
+	wsa_arena_init(&arena, sizeof(struct wsa_emission_mask) +
+		sizeof(float) * bins + 2 * WSA_ARENA_ALIGNMENT);
+	m = (struct wsa_emission_mask *) wsa_arena_alloc(&arena, sizeof(struct wsa_emission_mask));
+	if (m == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	m->limits = (float *) wsa_arena_alloc(&arena, sizeof(float) * bins);
+	m->arena = arena;
+	if (m->limits == NULL) {
+		wsa_emission_mask_free(m);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	m->fstart = fstart;
+	m->fstop = fstop;
+	m->bins = bins;
+
+	// the bins go up in frequency, so walk the segments along with them
+	for (i = 0; i < bins; i++) {
+		freq = fstart + ((fstop - fstart) * (uint64_t) i) / bins;
+
+		while (p < num_points && points[p].freq < freq)
+			p++;
+
+		if (p == num_points || (p == 0 && points[0].freq > freq))
+			m->limits[i] = WSA_EMISSION_MASK_NO_LIMIT;
+		else if (points[p].freq == freq || p == 0)
+			m->limits[i] = points[p].level;
+		else
+			m->limits[i] = (float) (points[p - 1].level +
+				(points[p].level - points[p - 1].level) *
+				((double) (freq - points[p - 1].freq) /
+				(double) (points[p].freq - points[p - 1].freq)));
+	}
+
+	*mask = m;
+	return 0;
+}
+
+
+/**
+ * frees an emission mask
+ *
+ * @param mask - the mask to free
+ */
+void wsa_emission_mask_free(struct wsa_emission_mask *mask)
+{
+	wsa_arena_free_self(&mask->arena);
+}
+
+
+/**
+ * finds the margin of a bin.  A NaN level, which compares false with
+ * everything, or a +inf one fails the bin rather than slipping past the
+ * minimum; a -inf level is a silent bin and passes with a +inf margin.  A
+ * bin without a limit is never checked.
+ *
+ * @param limit - the bin's limit
+ * @param level - the bin's level
+ *
+ * @return the limit minus the level
+ */
+static float wsa_emission_mask_margin(float limit, float level)
+{
+	if (limit == WSA_EMISSION_MASK_NO_LIMIT)
+		return WSA_EMISSION_MASK_NO_LIMIT;
+
+	if (level != level || level > FLT_MAX)
+		return WSA_EMISSION_MASK_NOT_FINITE;
+
+	return limit - level;
+}
+
+
+/**
+ * finds the smallest margin between the limits and a spectrum.  Each lane
+ * keeps its own minimum, so the loop vectorizes without reordering any
+ * floating point operation.
+ *
+ * @param limits - the limits
+ * @param spectrum - the spectrum
+ * @param len - the number of bins
+ *
+ * @return the smallest limit minus level
+ */
+WSA_TARGET_CLONES
+static float wsa_emission_mask_min_margin(float const *limits,
+		float const *spectrum, uint32_t len)
+{
+	float lanes[WSA_EMISSION_MASK_LANES];
+	float margin;
+	float worst;
+	uint32_t blocks = len - (len % WSA_EMISSION_MASK_LANES);
+	uint32_t i;
+	uint32_t j;
+
+	for (j = 0; j < WSA_EMISSION_MASK_LANES; j++)
+		lanes[j] = WSA_EMISSION_MASK_NO_LIMIT;
+
+	for (i = 0; i < blocks; i += WSA_EMISSION_MASK_LANES) {
+		for (j = 0; j < WSA_EMISSION_MASK_LANES; j++) {
+			margin = wsa_emission_mask_margin(limits[i + j], spectrum[i + j]);
+			lanes[j] = margin < lanes[j] ? margin : lanes[j];
+		}
+	}
+
+	worst = lanes[0];
+	for (j = 1; j < WSA_EMISSION_MASK_LANES; j++)
+		worst = lanes[j] < worst ? lanes[j] : worst;
+
+	for (i = blocks; i < len; i++) {
+		margin = wsa_emission_mask_margin(limits[i], spectrum[i]);
+		worst = margin < worst ? margin : worst;
+	}
+
+	return worst;
+}
+
+
+/**
+ * checks a spectrum, such as the buffer of a sweep, against an emission
+ * mask
+ *
+ * @param mask - the mask
+ * @param spectrum - the spectrum, in dBm
+ * @param len - the number of bins in the spectrum, which must be the
+ *		mask's number of bins
+ * @param result - a pointer to store the result in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_emission_mask_check(struct wsa_emission_mask const *mask,
+		float const *spectrum, uint32_t len,
+		struct wsa_emission_mask_result *result)
+{
+	float worst;
+	uint32_t i;
+
+	if (len != mask->bins)
+		return WSA_ERR_INVINPUT;
+
+	worst = wsa_emission_mask_min_margin(mask->limits, spectrum, len);
+
+	// only the position of the worst bin is left to find
+	for (i = 0; i < len - 1; i++) {
+		if (wsa_emission_mask_margin(mask->limits[i], spectrum[i]) == worst)
+			break;
+	}
+
+	result->pass = worst >= 0;
+	result->worst_margin = worst;
+	result->worst_bin = i;
+	result->worst_freq = mask->fstart + ((mask->fstop - mask->fstart) * (uint64_t) i) / mask->bins;
+
+	return 0;
+}
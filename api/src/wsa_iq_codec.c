@@ -0,0 +1,304 @@
+#include "wsa_iq_codec.h"
+#include "wsa_commons.h"
+#include "wsa_error.h"
+
+
+/**
+ * finds the number of bits needed to hold every value of a block
+ *
+ * @param values - the zigzag coded differences
+ * @param n - the number of values
+ *
+ * @return the width in bits, 0 to 32
+ */
+static uint32_t wsa_iq_codec_width(uint32_t const *values, uint32_t n)
+{
+	uint32_t all = 0;
+	uint32_t width = 0;
+	uint32_t i;
+
+	// the width of the largest value is the width of all of them or'ed
+	for (i = 0; i < n; i++)
+		all |= values[i];
+
+	while (all) {
+		width++;
+		all >>= 1;
+	}
+
+	return width;
+}
+
+
+/**
+ * writes a block: its width, then its values bit packed
+ *
+ * @param values - the zigzag coded differences
+ * @param n - the number of values
+ * @param out - where to write the block
+ *
+ * @return the end of the block
+ */
+static uint8_t *wsa_iq_codec_pack(uint32_t const *values, uint32_t n, uint8_t *out)
+{
+	uint32_t width = wsa_iq_codec_width(values, n);
+	uint64_t acc = 0;
+	uint32_t bits = 0;
+	uint32_t i;
+
+	*out++ = (uint8_t) width;
+	if (width == 0)
+		return out;
+
+	for (i = 0; i < n; i++) {
+		acc |= (uint64_t) values[i] << bits;
+		bits += width;
+		if (bits >= 32) {
+			out[0] = (uint8_t) acc;
+			out[1] = (uint8_t) (acc >> 8);
+			out[2] = (uint8_t) (acc >> 16);
+			out[3] = (uint8_t) (acc >> 24);
+			out += 4;
+			acc >>= 32;
+			bits -= 32;
+		}
+	}
+
+	while (bits > 0) {
+		*out++ = (uint8_t) acc;
+		acc >>= 8;
+		bits = bits > 8 ? bits - 8 : 0;
+	}
+
+	return out;
+}
+
+
+/**
+ * reads a block written by wsa_iq_codec_pack()
+ *
+ * @param in - the start of the block
+ * @param end - the end of the encoded data
+ * @param values - an array for the zigzag coded differences
+ * @param n - the number of values in the block
+ * @param max_width - the widest a valid block of this sample size can be
+ *
+ * @return the end of the block, or NULL if the data is corrupt
+ */
+static uint8_t const *wsa_iq_codec_unpack(uint8_t const *in, uint8_t const *end,
+		uint32_t *values, uint32_t n, uint32_t max_width)
+{
+	uint8_t const *block_end;
+	uint32_t width;
+	uint32_t mask;
+	uint64_t acc = 0;
+	uint32_t bits = 0;
+	uint32_t i;
+
+	if (in >= end)
+		return NULL;
+	width = *in++;
+	if (width > max_width || (size_t) (end - in) < (width * n + 7) / 8)
+		return NULL;
+	block_end = in + (width * n + 7) / 8;
+
+	mask = (uint32_t) ((1ULL << width) - 1);
+	for (i = 0; i < n; i++) {
+		// refill 32 bits at a time, except at the end of the block
+		while (bits < width) {
+			if (block_end - in >= 4) {
+				acc |= ((uint64_t) in[0] | ((uint64_t) in[1] << 8) |
+					((uint64_t) in[2] << 16) | ((uint64_t) in[3] << 24)) << bits;
+				in += 4;
+				bits += 32;
+			} else {
+				acc |= (uint64_t) *in++ << bits;
+				bits += 8;
+			}
+		}
+		values[i] = (uint32_t) acc & mask;
+		acc >>= width;
+		bits -= width;
+	}
+
+	return block_end;
+}
+
+
+/**
+ * compresses one channel of 16-bit samples
+ *
+ * @param samples - the samples
+ * @param count - the number of samples
+ * @param out - a buffer for the encoded samples
+ * @param out_size - the size of \b out, WSA_IQ_CODEC_BOUND(count, 2) is
+ *		always enough
+ *
+ * @return the number of bytes written, or a negative number on error
+ */
+WSA_TARGET_CLONES
+int32_t wsa_iq_encode_i16(int16_t const *samples, int32_t count,
+		uint8_t *out, int32_t out_size)
+{
+	uint32_t values[WSA_IQ_CODEC_BLOCK];
+	uint8_t *pos = out;
+	uint16_t prev = 0;
+	uint16_t delta;
+	int32_t done;
+	uint32_t n;
+	uint32_t i;
+
+	if (count < 0 || out_size < WSA_IQ_CODEC_BOUND(count, 2))
+		return WSA_ERR_INVINPUT;
+
+	for (done = 0; done < count; done += n) {
+		n = (uint32_t) (count - done);
+		if (n > WSA_IQ_CODEC_BLOCK)
+			n = WSA_IQ_CODEC_BLOCK;
+
+		// differences wrap around at 16 bits, so they always fit in 16
+		for (i = 0; i < n; i++) {
+			delta = (uint16_t) ((uint16_t) samples[done + i] - prev);
+			prev = (uint16_t) samples[done + i];
+			values[i] = (uint16_t) ((delta << 1) ^ (uint16_t) ((int16_t) delta >> 15));
+		}
+
+		pos = wsa_iq_codec_pack(values, n, pos);
+	}
+
+	return (int32_t) (pos - out);
+}
+
+
+/**
+ * decompresses one channel of 16-bit samples
+ *
+ * @param in - the encoded samples
+ * @param in_size - the number of encoded bytes
+ * @param samples - a buffer for \b count samples
+ * @param count - the number of samples encoded
+ *
+ * @return the number of bytes read, or a negative number on error
+ */
+WSA_TARGET_CLONES
+int32_t wsa_iq_decode_i16(uint8_t const *in, int32_t in_size,
+		int16_t *samples, int32_t count)
+{
+	uint32_t values[WSA_IQ_CODEC_BLOCK];
+	uint8_t const *pos = in;
+	uint8_t const *end = in + in_size;
+	uint16_t prev = 0;
+	uint16_t delta;
+	int32_t done;
+	uint32_t n;
+	uint32_t i;
+
+	if (count < 0 || in_size < 0)
+		return WSA_ERR_INVINPUT;
+
+	for (done = 0; done < count; done += n) {
+		n = (uint32_t) (count - done);
+		if (n > WSA_IQ_CODEC_BLOCK)
+			n = WSA_IQ_CODEC_BLOCK;
+
+		pos = wsa_iq_codec_unpack(pos, end, values, n, 16);
+		if (pos == NULL)
+			return WSA_ERR_FILECORRUPT;
+
+		for (i = 0; i < n; i++) {
+			delta = (uint16_t) ((values[i] >> 1) ^ (0U - (values[i] & 1)));
+			prev = (uint16_t) (prev + delta);
+			samples[done + i] = (int16_t) prev;
+		}
+	}
+
+	return (int32_t) (pos - in);
+}
+
+
+/**
+ * compresses one channel of 32-bit samples
+ *
+ * @param samples - the samples
+ * @param count - the number of samples
+ * @param out - a buffer for the encoded samples
+ * @param out_size - the size of \b out, WSA_IQ_CODEC_BOUND(count, 4) is
+ *		always enough
+ *
+ * @return the number of bytes written, or a negative number on error
+ */
+WSA_TARGET_CLONES
+int32_t wsa_iq_encode_i32(int32_t const *samples, int32_t count,
+		uint8_t *out, int32_t out_size)
+{
+	uint32_t values[WSA_IQ_CODEC_BLOCK];
+	uint8_t *pos = out;
+	uint32_t prev = 0;
+	uint32_t delta;
+	int32_t done;
+	uint32_t n;
+	uint32_t i;
+
+	if (count < 0 || out_size < WSA_IQ_CODEC_BOUND(count, 4))
+		return WSA_ERR_INVINPUT;
+
+	for (done = 0; done < count; done += n) {
+		n = (uint32_t) (count - done);
+		if (n > WSA_IQ_CODEC_BLOCK)
+			n = WSA_IQ_CODEC_BLOCK;
+
+		for (i = 0; i < n; i++) {
+			delta = (uint32_t) samples[done + i] - prev;
+			prev = (uint32_t) samples[done + i];
+			values[i] = (delta << 1) ^ (0U - (delta >> 31));
+		}
+
+		pos = wsa_iq_codec_pack(values, n, pos);
+	}
+
+	return (int32_t) (pos - out);
+}
+
+
+/**
+ * decompresses one channel of 32-bit samples
+ *
+ * @param in - the encoded samples
+ * @param in_size - the number of encoded bytes
+ * @param samples - a buffer for \b count samples
+ * @param count - the number of samples encoded
+ *
+ * @return the number of bytes read, or a negative number on error
+ */
+WSA_TARGET_CLONES
+int32_t wsa_iq_decode_i32(uint8_t const *in, int32_t in_size,
+		int32_t *samples, int32_t count)
+{
+	uint32_t values[WSA_IQ_CODEC_BLOCK];
+	uint8_t const *pos = in;
+	uint8_t const *end = in + in_size;
+	uint32_t prev = 0;
+	int32_t done;
+	uint32_t n;
+	uint32_t i;
+
+	if (count < 0 || in_size < 0)
+		return WSA_ERR_INVINPUT;
+
+	for (done = 0; done < count; done += n) {
+		n = (uint32_t) (count - done);
+		if (n > WSA_IQ_CODEC_BLOCK)
+			n = WSA_IQ_CODEC_BLOCK;
+
+		pos = wsa_iq_codec_unpack(pos, end, values, n, 32);
+		if (pos == NULL)
+			return WSA_ERR_FILECORRUPT;
+
+		for (i = 0; i < n; i++) {
+			prev += (values[i] >> 1) ^ (0U - (values[i] & 1));
+			samples[done + i] = (int32_t) prev;
+		}
+	}
+
+	return (int32_t) (pos - in);
+}
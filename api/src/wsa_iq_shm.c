@@ -0,0 +1,488 @@
+#include <string.h>
+
+#include "wsa_iq_shm.h"
+#include "wsa_atomic.h"
+#include "wsa_error.h"
+#include "wsa_perf.h"
+
+// where a slot's packet starts, from the start of the slot
+#define WSA_IQ_SHM_DATA ((sizeof(struct wsa_iq_shm_slot) + 63) & ~((size_t) 63))
+
+
+/**
+ * finds a slot of a ring
+ *
+ * @param slot_base - the first slot
+ * @param slot_size - the bytes from one slot to the next
+ * @param index - the slot's index
+ *
+ * @return the slot
+ */
+static struct wsa_iq_shm_slot *wsa_iq_slot(uint8_t *slot_base, uint32_t slot_size, uint32_t index)
+{
+	return (struct wsa_iq_shm_slot *) (slot_base + (size_t) slot_size * index);
+}
+
+
+/**
+ * creates an IQ ring in a new shared memory segment, replacing any of the
+ * same name, for a receiver to publish packets into
+ *
+ * @param name - the segment name, which consumers attach to it by
+ * @param slots - the number of slots, at least 2; consumers can fall up
+ *		to slots - 1 packets behind before they drop any
+ * @param max_packet - the largest packet to read in bytes, or 0 for the
+ *		largest a VRT packet can be
+ * @param consumers - the most consumers that can be attached at once, or
+ *		0 for WSA_IQ_SHM_DEFAULT_CONSUMERS
+ * @param flags - WSA_SHM_HUGEPAGES to put the ring on huge pages if the
+ *		system has some to spare
+ * @param ring - a pointer to store the new ring in
+ *
+ * @return 0 on success, WSA_ERR_SHMINUSE on Windows if a reader of an
+ *		older segment of the name still has it open, or another negative
+ *		number on error
+ */
+int16_t wsa_iq_ring_new(char const *name, uint32_t slots, uint32_t max_packet,
+		uint32_t consumers, uint32_t flags, struct wsa_iq_ring **ring)
+{
+	struct wsa_iq_ring *r;
+	struct wsa_iq_shm_header *header;
+	struct wsa_arena arena;
+	uint64_t slot_size;
+	uint64_t size;
+	uint32_t i;
+	int16_t result;
+
+	if (max_packet == 0)
+		max_packet = VRT_MAX_PACKET_WORDS * BYTES_PER_VRT_WORD;
+	if (consumers == 0)
+		consumers = WSA_IQ_SHM_DEFAULT_CONSUMERS;
+	if (slots < 2 || max_packet < VRT_HEADER_SIZE * BYTES_PER_VRT_WORD ||
+			max_packet > VRT_MAX_PACKET_WORDS * BYTES_PER_VRT_WORD)
+		return WSA_ERR_INVINPUT;
+
+	// keep every packet on cache lines of its own
+	slot_size = (WSA_IQ_SHM_DATA + (uint64_t) max_packet + 63) & ~((uint64_t) 63);
+	size = sizeof(struct wsa_iq_shm_header) +
+		sizeof(struct wsa_iq_shm_consumer) * (uint64_t) consumers + slot_size * slots;
+	if (size != (size_t) size)
+		return WSA_ERR_INVINPUT;
+
+	wsa_arena_init(&arena, sizeof(struct wsa_iq_ring) + WSA_ARENA_ALIGNMENT);
+	r = (struct wsa_iq_ring *) wsa_arena_alloc(&arena, sizeof(struct wsa_iq_ring));
+	if (r == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	r->arena = arena;
+
+	result = wsa_shm_create(&r->shm, name, (size_t) size, flags);
+	if (result < 0) {
+		wsa_arena_free_self(&r->arena);
+		return result;
+	}
+
+	// consumers go by the magic number, so that is set once the rest is
+	header = (struct wsa_iq_shm_header *) r->shm.addr;
+	header->version = WSA_IQ_SHM_VERSION;
+	header->slots = slots;
+	header->slot_size = (uint32_t) slot_size;
+	header->max_packet = max_packet;
+	header->slot_header = sizeof(struct wsa_iq_shm_slot);
+	header->consumers = consumers;
+	header->huge = r->shm.huge;
+	header->head = 0;
+	r->header = header;
+	r->consumers = (struct wsa_iq_shm_consumer *) (header + 1);
+	r->slot_base = (uint8_t *) (r->consumers + consumers);
+	r->head = 0;
+	for (i = 0; i < slots; i++)
+		wsa_iq_slot(r->slot_base, header->slot_size, i)->packet.number = WSA_IQ_SHM_EMPTY;
+	wsa_atomic_store32(&header->magic, WSA_IQ_SHM_MAGIC);
+
+	*ring = r;
+	return 0;
+}
+
+
+/**
+ * frees a ring and removes its segment's name.  Consumers still attached
+ * can read what was published until they close it.
+ *
+ * @param ring - the ring to free
+ */
+void wsa_iq_ring_free(struct wsa_iq_ring *ring)
+{
+	wsa_shm_close(&ring->shm);
+
+	wsa_arena_free_self(&ring->arena);
+}
+
+
+/**
+ * marks the slot the next packet goes in as being written.  It holds the
+ * oldest packet, which consumers stopped seeing when the newest was
+ * published, but one that hasn't noticed yet may still be copying it.
+ *
+ * @param ring - the ring
+ * @param seq - where to store the slot's sequence count
+ *
+ * @return the slot
+ */
+static struct wsa_iq_shm_slot *wsa_iq_slot_begin(struct wsa_iq_ring *ring, uint32_t *seq)
+{
+	struct wsa_iq_shm_slot *slot;
+
+	slot = wsa_iq_slot(ring->slot_base, ring->header->slot_size,
+		(uint32_t) (ring->head % ring->header->slots));
+
+	*seq = slot->seq;
+	wsa_atomic_store32(&slot->seq, *seq + 1);
+	wsa_atomic_fence();
+
+	return slot;
+}
+
+
+/**
+ * finishes writing a slot, and publishes its packet
+ *
+ * @param ring - the ring
+ * @param slot - the slot
+ * @param seq - the slot's sequence count from wsa_iq_slot_begin()
+ * @param valid - whether the slot holds a packet now
+ */
+static void wsa_iq_slot_end(struct wsa_iq_ring *ring, struct wsa_iq_shm_slot *slot,
+		uint32_t seq, uint8_t valid)
+{
+	struct wsa_iq_packet *packet = &slot->packet;
+	uint32_t words;
+
+	if (!valid) {
+		packet->number = WSA_IQ_SHM_EMPTY;
+		wsa_atomic_store32(&slot->seq, seq + 2);
+		return;
+	}
+
+	if (packet->header.stream_id == I16Q16_DATA_STREAM_ID ||
+		packet->header.stream_id == I16_DATA_STREAM_ID ||
+		packet->header.stream_id == I32_DATA_STREAM_ID) {
+		// the same payload wsa_decode_vrt_packet() copies out
+		words = packet->bytes / BYTES_PER_VRT_WORD;
+		packet->payload_offset = VRT_HEADER_SIZE * BYTES_PER_VRT_WORD;
+		packet->payload_bytes = words > VRT_HEADER_SIZE + VRT_TRAILER_SIZE ?
+			(words - VRT_HEADER_SIZE - VRT_TRAILER_SIZE) * BYTES_PER_VRT_WORD : 0;
+	} else {
+		packet->payload_offset = 0;
+		packet->payload_bytes = 0;
+	}
+
+	packet->number = ring->head;
+	packet->received_ns = wsa_perf_now();
+	wsa_atomic_store32(&slot->seq, seq + 2);
+
+	ring->head++;
+	wsa_atomic_add64(&ring->header->head, 1);
+}
+
+
+/**
+ * reads the next VRT packet from a device straight into the ring, and
+ * publishes it.  The packet is decoded as by wsa_read_vrt_packet_raw(),
+ * and written over the oldest one, whether or not every consumer has
+ * read that.
+ *
+ * @param dev - the device to read from
+ * @param ring - the ring to read into
+ * @param timeout - the timeout in milliseconds
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_iq_ring_read(struct wsa_device *dev, struct wsa_iq_ring *ring, uint32_t timeout)
+{
+	struct wsa_receiver_packet receiver;
+	struct wsa_digitizer_packet digitizer;
+	struct wsa_extension_packet extension;
+	struct wsa_iq_shm_slot *slot;
+	uint32_t seq;
+	int16_t result;
+
+	slot = wsa_iq_slot_begin(ring, &seq);
+
+	result = wsa_read_vrt_packet_into(dev, &slot->packet.header, &slot->packet.trailer,
+		&receiver, &digitizer, &extension, (uint8_t *) slot + WSA_IQ_SHM_DATA,
+		ring->header->max_packet, &slot->packet.bytes, timeout);
+	if (result < 0) {
+		wsa_iq_slot_end(ring, slot, seq, 0);
+		return result;
+	}
+
+	slot->packet.context = dev->context;
+	wsa_iq_slot_end(ring, slot, seq, 1);
+
+	return 0;
+}
+
+
+/**
+ * publishes a packet already read into a packet ring, for a receiver that
+ * also hands its packets to consumers in its own process
+ *
+ * @param ring - the ring to publish into
+ * @param slice - the packet, which the caller keeps its reference to
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_iq_ring_publish(struct wsa_iq_ring *ring, struct wsa_packet_slice const *slice)
+{
+	struct wsa_iq_shm_slot *slot;
+	uint32_t seq;
+
+	if (slice->bytes > ring->header->max_packet)
+		return WSA_ERR_INVINPUT;
+
+	slot = wsa_iq_slot_begin(ring, &seq);
+
+	slot->packet.bytes = slice->bytes;
+	slot->packet.header = slice->header;
+	slot->packet.trailer = slice->trailer;
+	slot->packet.context = slice->context;
+	memcpy((uint8_t *) slot + WSA_IQ_SHM_DATA, slice->packet, slice->bytes);
+
+	wsa_iq_slot_end(ring, slot, seq, 1);
+
+	return 0;
+}
+
+
+/**
+ * gets the counters of a consumer attached to a ring
+ *
+ * @param ring - the ring
+ * @param index - the consumer's entry in the ring's consumer table
+ * @param stats - where to store its counters
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_iq_ring_consumer_stats(struct wsa_iq_ring *ring, uint32_t index,
+		struct wsa_iq_consumer_stats *stats)
+{
+	struct wsa_iq_shm_consumer *entry;
+	uint32_t visible = ring->header->slots - 1;
+	uint64_t cursor;
+
+	if (index >= ring->header->consumers)
+		return WSA_ERR_INVINPUT;
+	entry = &ring->consumers[index];
+
+	stats->attached = (uint8_t) wsa_atomic_load32(&entry->attached);
+	memcpy(stats->name, entry->name, WSA_IQ_SHM_CONSUMER_NAME_LEN);
+	stats->name[WSA_IQ_SHM_CONSUMER_NAME_LEN - 1] = '\0';
+	cursor = entry->cursor;
+	stats->packets = entry->packets;
+	stats->drops = entry->drops;
+	stats->behind = cursor < ring->head ? ring->head - cursor : 0;
+
+	// a consumer only counts its drops when it reads, so count for it
+	// those already written over
+	if (stats->behind > visible) {
+		stats->drops += stats->behind - visible;
+		stats->behind = visible;
+	}
+
+	return 0;
+}
+
+
+/**
+ * attaches a consumer to an IQ ring a receiver in another process
+ * publishes into.  It reads the packets published from then on.  If the
+ * ring has no room for another consumer, it takes over the entry of one
+ * whose process exited without closing it.
+ *
+ * @param name - the segment name the ring was created with
+ * @param consumer_name - a name for the consumer, which the receiver can
+ *		tell it by in its counters
+ * @param consumer - a pointer to store the new consumer in
+ *
+ * @return 0 on success, WSA_ERR_NOCONSUMERSLOT if the ring has as many
+ *		consumers as it has room for, or another negative number on error
+ */
+int16_t wsa_iq_consumer_open(char const *name, char const *consumer_name,
+		struct wsa_iq_consumer **consumer)
+{
+	struct wsa_iq_consumer *c;
+	struct wsa_iq_shm_header *header;
+	struct wsa_iq_shm_consumer *table;
+	struct wsa_arena arena;
+	uint32_t consumers;
+	uint32_t pid;
+	uint32_t i;
+	int16_t result;
+
+	if (consumer_name == NULL || strlen(consumer_name) >= WSA_IQ_SHM_CONSUMER_NAME_LEN)
+		return WSA_ERR_INVINPUT;
+
+	wsa_arena_init(&arena, sizeof(struct wsa_iq_consumer) + WSA_ARENA_ALIGNMENT);
+	c = (struct wsa_iq_consumer *) wsa_arena_alloc(&arena, sizeof(struct wsa_iq_consumer));
+	if (c == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	c->arena = arena;
+	c->entry = NULL;
+
+	result = wsa_shm_open(&c->shm, name);
+	if (result < 0) {
+		wsa_arena_free_self(&c->arena);
+		return result;
+	}
+
+	// check the layout once, and keep it, so that nothing written into
+	// the segment later can make the consumer stray outside it
+	header = (struct wsa_iq_shm_header *) c->shm.addr;
+	if (c->shm.size < sizeof(struct wsa_iq_shm_header) ||
+			wsa_atomic_load32(&header->magic) != WSA_IQ_SHM_MAGIC ||
+			header->version != WSA_IQ_SHM_VERSION ||
+			header->slot_header != sizeof(struct wsa_iq_shm_slot)) {
+		wsa_iq_consumer_close(c);
+		return WSA_ERR_SHMINVALID;
+	}
+
+	c->slots = header->slots;
+	c->slot_size = header->slot_size;
+	c->max_packet = header->max_packet;
+	consumers = header->consumers;
+	if (c->slots < 2 || c->max_packet > VRT_MAX_PACKET_WORDS * BYTES_PER_VRT_WORD ||
+			c->slot_size < WSA_IQ_SHM_DATA + c->max_packet ||
+			sizeof(struct wsa_iq_shm_header) +
+				sizeof(struct wsa_iq_shm_consumer) * (uint64_t) consumers +
+				(uint64_t) c->slot_size * c->slots > c->shm.size) {
+		wsa_iq_consumer_close(c);
+		return WSA_ERR_SHMINVALID;
+	}
+	table = (struct wsa_iq_shm_consumer *) (header + 1);
+	c->header = header;
+	c->slot_base = (uint8_t *) (table + consumers);
+
+	for (i = 0; i < consumers; i++) {
+		if (wsa_atomic_cas32(&table[i].attached, 0, 1)) {
+			c->entry = &table[i];
+			wsa_atomic_store32(&c->entry->pid, wsa_shm_process_id());
+			break;
+		}
+	}
+
+	// an entry is only taken over by whoever swaps its pid for their own,
+	// and one with no pid is still being attached to
+	for (i = 0; i < consumers && c->entry == NULL; i++) {
+		pid = wsa_atomic_load32(&table[i].pid);
+		if (pid != 0 && wsa_atomic_load32(&table[i].attached) &&
+				!wsa_shm_process_alive(pid) &&
+				wsa_atomic_cas32(&table[i].pid, pid, wsa_shm_process_id()))
+			c->entry = &table[i];
+	}
+	if (c->entry == NULL) {
+		wsa_iq_consumer_close(c);
+		return WSA_ERR_NOCONSUMERSLOT;
+	}
+
+	c->cursor = wsa_atomic_load64(&header->head);
+	c->packets = 0;
+	c->drops = 0;
+	strcpy(c->entry->name, consumer_name);
+	c->entry->cursor = c->cursor;
+	c->entry->packets = 0;
+	c->entry->drops = 0;
+
+	*consumer = c;
+	return 0;
+}
+
+
+/**
+ * detaches a consumer from its ring and frees it
+ *
+ * @param consumer - the consumer to close
+ */
+void wsa_iq_consumer_close(struct wsa_iq_consumer *consumer)
+{
+	if (consumer->entry != NULL) {
+		wsa_atomic_store32(&consumer->entry->pid, 0);
+		wsa_atomic_store32(&consumer->entry->attached, 0);
+	}
+	wsa_shm_close(&consumer->shm);
+
+	wsa_arena_free_self(&consumer->arena);
+}
+
+
+/**
+ * reads the next packet of a ring, without waiting for one.  A consumer
+ * that fell so far behind that the packets it had to read next were
+ * written over skips to the oldest packet still in the ring, and counts
+ * those it skipped as dropped.
+ *
+ * @param consumer - the consumer
+ * @param packet - where to store the packet's number, size, decoded
+ *		header, trailer and context
+ * @param buf - where to store the packet as received
+ * @param buflen - the room in buf, at least the ring's max_packet
+ *
+ * @return 0 on success, WSA_ERR_NOPACKET if no newer packet is published
+ *		or none could be read whole, or another negative number on error
+ */
+int16_t wsa_iq_consumer_read(struct wsa_iq_consumer *consumer,
+		struct wsa_iq_packet *packet, uint8_t *buf, uint32_t buflen)
+{
+	struct wsa_iq_shm_slot *slot;
+	uint32_t visible = consumer->slots - 1;
+	uint64_t head;
+	uint32_t seq;
+	int16_t result = WSA_ERR_NOPACKET;
+	int tries;
+
+	if (packet == NULL || buf == NULL || buflen < consumer->max_packet)
+		return WSA_ERR_INVINPUT;
+
+	for (tries = 0; tries < WSA_IQ_SHM_RETRIES; tries++) {
+		head = wsa_atomic_load64(&consumer->header->head);
+		if (consumer->cursor >= head)
+			break;
+
+		if (head - consumer->cursor > visible) {
+			consumer->drops += head - visible - consumer->cursor;
+			consumer->cursor = head - visible;
+		}
+
+		slot = wsa_iq_slot(consumer->slot_base, consumer->slot_size,
+			(uint32_t) (consumer->cursor % consumer->slots));
+		seq = wsa_atomic_load32(&slot->seq);
+		if (seq & 1)
+			continue;
+
+		*packet = slot->packet;
+		if (packet->bytes > consumer->max_packet)
+			continue;
+		memcpy(buf, (uint8_t *) slot + WSA_IQ_SHM_DATA, packet->bytes);
+
+		// keep the copy only if the receiver didn't touch the slot
+		// meanwhile, and it still held the packet wanted
+		wsa_atomic_fence();
+		if (slot->seq != seq || packet->number != consumer->cursor)
+			continue;
+
+		if (packet->payload_offset + (uint64_t) packet->payload_bytes > packet->bytes) {
+			packet->payload_offset = 0;
+			packet->payload_bytes = 0;
+		}
+
+		consumer->cursor++;
+		consumer->packets++;
+		result = 0;
+		break;
+	}
+
+	consumer->entry->cursor = consumer->cursor;
+	consumer->entry->packets = consumer->packets;
+	consumer->entry->drops = consumer->drops;
+
+	return result;
+}
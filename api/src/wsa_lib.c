@@ -2,9 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "wsa_capture.h"
 #include "wsa_client.h"
 #include "wsa_error.h"
 #include "wsa_lib.h"
+#include "wsa_perf.h"
+#include "wsa_trace.h"
+#include "wsa_uring.h"
 
 
 #ifdef _WIN32
@@ -29,6 +33,30 @@ int16_t _wsa_query_esr(struct wsa_device *dev, char *output);
 void extract_receiver_packet_data(uint8_t *temp_buffer, struct wsa_receiver_packet * const receiver);
 void extract_digitizer_packet_data(uint8_t *temp_buffer, struct wsa_digitizer_packet * const digitizer);
 void extract_extension_packet_data(uint8_t *temp_buffer, struct wsa_extension_packet * const extension);
+void _wsa_count_vrt_packet(struct wsa_stats *stats, struct wsa_vrt_packet_header const *header,
+		struct wsa_vrt_packet_trailer const *trailer, uint16_t packet_size, uint8_t has_trailer);
+void _wsa_track_context(struct wsa_device *dev, struct wsa_vrt_packet_header const *header,
+		struct wsa_receiver_packet const *receiver, struct wsa_digitizer_packet const *digitizer,
+		struct wsa_extension_packet const *extension);
+int16_t _wsa_recv_vrt_packet(struct wsa_device * const device,
+		struct wsa_vrt_packet_header * const header,
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t *packet, uint32_t packet_size, uint8_t * const data_buffer,
+		uint32_t *packet_bytes, uint32_t timeout);
+static int16_t wsa_decode_vrt_rest(uint8_t *packet,
+		struct wsa_vrt_packet_header * const header,
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t * const data_buffer);
+int16_t _wsa_recv_data(struct wsa_device *dev, uint8_t *rx_buf_ptr, int32_t buf_size,
+		uint32_t time_out, int32_t *total_bytes);
+int16_t _wsa_send_command(struct wsa_device *dev, char const *command);
+int16_t _wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_resp * resp);
 
 // Initialized the \b wsa_device descriptor structure
 // Return 0 on success or a 16-bit negative number on error.
@@ -151,6 +179,74 @@ int16_t _wsa_dev_init(struct wsa_device *dev)
 	return 0;
 }
 
+
+/**
+ * Gets the center frequency of a receiver context packet
+ *
+ * @param receiver - A pointer to the receiver packet structure
+ *
+ * @return The frequency in Hz, with the fraction added as it has always
+ * been reported, as millionths of a Hz
+ */
+double wsa_receiver_freq(struct wsa_receiver_packet const *receiver)
+{
+	return (double) receiver->freq + ((double) receiver->freq_frac / MHZ);
+}
+
+
+/**
+ * Gets the IF gain of a receiver context packet
+ *
+ * @param receiver - A pointer to the receiver packet structure
+ *
+ * @return The gain in dB
+ */
+double wsa_receiver_gain_if(struct wsa_receiver_packet const *receiver)
+{
+	return receiver->gain_if / VRT_GAIN_SCALE;
+}
+
+
+/**
+ * Gets the RF gain of a receiver context packet
+ *
+ * @param receiver - A pointer to the receiver packet structure
+ *
+ * @return The gain in dB
+ */
+double wsa_receiver_gain_rf(struct wsa_receiver_packet const *receiver)
+{
+	return receiver->gain_rf / VRT_GAIN_SCALE;
+}
+
+
+/**
+ * Gets the bandwidth of a digitizer context packet
+ *
+ * @param digitizer - A pointer to the digitizer packet structure
+ *
+ * @return The bandwidth in Hz, with the fraction added as millionths of a
+ * Hz like wsa_receiver_freq()
+ */
+double wsa_digitizer_bandwidth(struct wsa_digitizer_packet const *digitizer)
+{
+	return (double) digitizer->bandwidth + ((double) digitizer->bandwidth_frac / MHZ);
+}
+
+
+/**
+ * Gets the RF frequency offset of a digitizer context packet
+ *
+ * @param digitizer - A pointer to the digitizer packet structure
+ *
+ * @return The offset in Hz, with the fraction added as millionths of a Hz
+ * like wsa_receiver_freq()
+ */
+double wsa_digitizer_rf_freq_offset(struct wsa_digitizer_packet const *digitizer)
+{
+	return (double) digitizer->rf_freq_offset + ((double) digitizer->rf_freq_offset_frac / MHZ);
+}
+
 // Open the WSA after socket connection is established
 int16_t _wsa_open(struct wsa_device *dev) 
 {
@@ -291,6 +387,7 @@ int16_t wsa_query_error(struct wsa_device *dev, char *output)
 {
 	struct wsa_resp resp;
 
+	wsa_atomic_add64(&dev->stats.error_queries, 1);
 	wsa_send_query(dev, "SYST:ERR?\n", &resp);
 	if (resp.status < 0)
 	{
@@ -310,6 +407,76 @@ int16_t wsa_query_error(struct wsa_device *dev, char *output)
 
 	return 0;
 }
+
+
+// Update the device counters with a packet that was just received.
+void _wsa_count_vrt_packet(struct wsa_stats *stats, struct wsa_vrt_packet_header const *header,
+		struct wsa_vrt_packet_trailer const *trailer, uint16_t packet_size, uint8_t has_trailer)
+{
+	uint32_t slot = header->stream_id - RECEIVER_STREAM_ID;
+
+	if (header->stream_id < RECEIVER_STREAM_ID || slot >= WSA_STATS_OTHER_STREAM)
+		slot = WSA_STATS_OTHER_STREAM;
+
+	wsa_atomic_add64(&stats->streams[slot].packets, 1);
+	wsa_atomic_add64(&stats->streams[slot].bytes, (uint64_t) packet_size * BYTES_PER_VRT_WORD);
+
+	if (header->packet_type != IF_PACKET_TYPE) {
+		wsa_atomic_add64(&stats->context_packets, 1);
+		return;
+	}
+
+	wsa_atomic_add64(&stats->if_packets, 1);
+	if (has_trailer) {
+		if (trailer->over_range_indicator)
+			wsa_atomic_add64(&stats->over_range_packets, 1);
+		if (trailer->sample_loss_indicator)
+			wsa_atomic_add64(&stats->sample_loss_packets, 1);
+	}
+}
+
+// Update the device's context with a packet that was just received.  Only
+// the fields the packet's indicator says it holds are taken from it.
+void _wsa_track_context(struct wsa_device *dev, struct wsa_vrt_packet_header const *header,
+		struct wsa_receiver_packet const *receiver, struct wsa_digitizer_packet const *digitizer,
+		struct wsa_extension_packet const *extension)
+{
+	struct wsa_packet_context *context = &dev->context;
+
+	if (header->stream_id == RECEIVER_STREAM_ID) {
+		if ((receiver->indicator_field & FREQ_INDICATOR_MASK) == FREQ_INDICATOR_MASK) {
+			context->freq = receiver->freq;
+			context->freq_frac = receiver->freq_frac;
+			context->valid |= WSA_CONTEXT_FREQ;
+		}
+	} else if (header->stream_id == DIGITIZER_STREAM_ID) {
+		if ((digitizer->indicator_field & BW_INDICATOR_MASK) == BW_INDICATOR_MASK) {
+			context->bandwidth = digitizer->bandwidth;
+			context->bandwidth_frac = digitizer->bandwidth_frac;
+			context->valid |= WSA_CONTEXT_BANDWIDTH;
+		}
+		if ((digitizer->indicator_field & RF_FREQ_OFFSET_INDICATOR_MASK) == RF_FREQ_OFFSET_INDICATOR_MASK) {
+			context->rf_freq_offset = digitizer->rf_freq_offset;
+			context->rf_freq_offset_frac = digitizer->rf_freq_offset_frac;
+			context->valid |= WSA_CONTEXT_RF_FREQ_OFFSET;
+		}
+		if ((digitizer->indicator_field & REF_LEVEL_INDICATOR_MASK) == REF_LEVEL_INDICATOR_MASK) {
+			context->reference_level = digitizer->reference_level;
+			if (strstr(dev->descr.prod_model, R5500) != NULL)
+				context->reference_level -= REFLEVEL_OFFSET;
+			context->valid |= WSA_CONTEXT_REFERENCE_LEVEL;
+		}
+	} else if (header->stream_id == EXTENSION_STREAM_ID) {
+		if ((extension->indicator_field & SWEEP_START_ID_INDICATOR_MASK) == SWEEP_START_ID_INDICATOR_MASK) {
+			context->sweep_start_id = extension->sweep_start_id;
+			context->valid |= WSA_CONTEXT_SWEEP_START_ID;
+		}
+		if ((extension->indicator_field & STREAM_START_ID_INDICATOR_MASK) == STREAM_START_ID_INDICATOR_MASK) {
+			context->stream_start_id = extension->stream_start_id;
+			context->valid |= WSA_CONTEXT_STREAM_START_ID;
+		}
+	}
+}
 	
 
 // *****
@@ -360,6 +527,13 @@ int16_t wsa_connect(struct wsa_device *dev, char const *cmd_syntax, char *intf_m
 	uint8_t is_tcpip = FALSE;	// flag to indicate a TCPIP connection method
 	int32_t colons = 0;
 
+	// start the device counters from zero
+	memset(&dev->stats, 0, sizeof(struct wsa_stats));
+	wsa_arena_init(&dev->arena, WSA_DEVICE_ARENA_SIZE);
+	dev->capture = NULL;
+	dev->uring = NULL;
+	memset(&dev->context, 0, sizeof(struct wsa_packet_context));
+
 	// initialed the strings
 	strcpy(intf_type, "");
 	strcpy(wsa_addr, "");
@@ -477,12 +651,15 @@ int16_t wsa_disconnect(struct wsa_device *dev)
 	//TODO close based on connection type
 	// right now do only TCPIP client
 	if (strcmp(dev->descr.intf_type, "TCPIP") == 0) {
+		wsa_uring_close(dev);
 		result = wsa_close_sock(dev->sock.cmd);
 		result = wsa_close_sock(dev->sock.data);
 
 		wsa_destroy_client();
 	}
 
+	wsa_arena_free(&dev->arena);
+
 	return result;
 }
 
@@ -522,6 +699,21 @@ int16_t wsa_verify_addr(const char *sock_addr, const char *sock_port)
  * @return Number of bytes sent on success, or a negative number on error.
  */
 int16_t wsa_send_command(struct wsa_device *dev, char const *command)
+{
+	int16_t result;
+	uint64_t trace_ts;
+
+	WSA_TRACE_BEGIN(trace_ts);
+	result = _wsa_send_command(dev, command);
+	WSA_TRACE_END(trace_ts, "scpi_command", "scpi", command);
+
+	return result;
+}
+
+
+// Sends a command and, unless it requests data, verifies it with SYST:ERR?
+// (see wsa_send_command())
+int16_t _wsa_send_command(struct wsa_device *dev, char const *command)
 {
 	int16_t bytes_txed = 0;
 	uint8_t resend_cnt = 0;
@@ -547,6 +739,7 @@ int16_t wsa_send_command(struct wsa_device *dev, char const *command)
 			// than can fit into int16_t
 			// TODO: revisit this and move bytes_txed into the parameter list
 			bytes_txed = (int16_t) wsa_sock_send(dev->sock.cmd, command, len);
+			wsa_atomic_add64(&dev->stats.scpi_commands, 1);
 			if (bytes_txed < 0)
 			{
 				return bytes_txed;
@@ -705,6 +898,20 @@ int16_t wsa_send_command_file(struct wsa_device *dev, char const *file_name)
 * @return 0 upon successful or a negative value
 */
 int16_t wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_resp * resp)
+{
+	int16_t result;
+	uint64_t trace_ts;
+
+	WSA_TRACE_BEGIN(trace_ts);
+	result = _wsa_send_query(dev, command, resp);
+	WSA_TRACE_END(trace_ts, "scpi_query", "scpi", command);
+
+	return result;
+}
+
+
+// Sends a query and reads back its response (see wsa_send_query())
+int16_t _wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_resp * resp)
 {
 	int16_t bytes_got = 0;
 	int16_t recv_result = 0;
@@ -727,6 +934,7 @@ int16_t wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_r
 			// than can fit into int16_t
 			// TODO: revisit this and move bytes_txed into the parameter list
 			bytes_got = (int16_t) wsa_sock_send(dev->sock.cmd, command, len);
+			wsa_atomic_add64(&dev->stats.scpi_queries, 1);
 			if (bytes_got < 0) {
 				resp->status = bytes_got;
 				strcpy(resp->output, _wsa_get_err_msg(bytes_got));
@@ -760,7 +968,7 @@ int16_t wsa_send_query(struct wsa_device *dev, char const *command, struct wsa_r
 				break;
 			}
 		}
-		if (resp->output[bytes_received - 1] == '\n'){
+		if (bytes_received > 0 && resp->output[bytes_received - 1] == '\n'){
 			resp->output[bytes_received - 1] = '\0';
 		}
 		// TODO define what result should be
@@ -882,23 +1090,125 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 		struct wsa_extension_packet * const extension,
 		uint8_t * const data_buffer,
 		uint32_t timeout)
+{
+	uint32_t packet_bytes;
+
+	return _wsa_recv_vrt_packet(device, header, trailer, receiver, digitizer,
+		extension, NULL, 0, data_buffer, &packet_bytes, timeout);
+}
+
+
+/**
+ * Reads one VRT packet into a buffer of the caller's, leaving it there
+ * as received: context packets are decoded as by wsa_read_vrt_packet_raw(),
+ * but the payload of an IF packet isn't copied anywhere.
+ *
+ * @param device - A pointer to the WSA device structure.
+ * @param header - A pointer to \b wsa_vrt_packet_header structure to store 
+ *		the VRT header information
+ * @param trailer - A pointer to \b wsa_vrt_packet_trailer structure to store 
+ *		the VRT trailer information
+ * @param receiver - a pointer to \b wsa_receiver_packet strucuture to store
+ *		the receiver Context data
+ * @param digitizer - a pointer to \b wsa_digitizer_packet strucuture to store
+ *		the digitizer Context data
+ * @param extension - a pointer to \b wsa_extension_packet strucuture to store
+ *		the custom Context data
+ * @param packet - a buffer to store the whole packet in
+ * @param packet_size - the size of \b packet in bytes.  A larger packet is
+ *		read and dropped, and WSA_ERR_VRTPACKETSIZE returned.
+ * @param packet_bytes - a pointer to store the size of the packet in bytes
+ * @param timeout - An unsigned 32-bit integer containing the timeout (in miliseconds).
+ *
+ * @return  0 on success or a negative value on error
+ */
+int16_t wsa_read_vrt_packet_into(struct wsa_device * const device, 
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t * const packet,
+		uint32_t packet_size,
+		uint32_t *packet_bytes,
+		uint32_t timeout)
+{
+	return _wsa_recv_vrt_packet(device, header, trailer, receiver, digitizer,
+		extension, packet, packet_size, NULL, packet_bytes, timeout);
+}
+
+
+/**
+ * Reads \b buf_size bytes of the data socket, through the device's
+ * io_uring if it has one
+ *
+ * @param dev - the device to read from
+ * @param rx_buf_ptr - a buffer to store the bytes in
+ * @param buf_size - the number of bytes to read
+ * @param time_out - time out in milliseconds
+ * @param total_bytes - a pointer to store the number of bytes read in
+ *
+ * @return 0 on success or a negative value on error
+ */
+int16_t _wsa_recv_data(struct wsa_device *dev, uint8_t *rx_buf_ptr, int32_t buf_size,
+		uint32_t time_out, int32_t *total_bytes)
+{
+	if (dev->uring != NULL)
+		return wsa_uring_recv_data(dev->uring, rx_buf_ptr, buf_size, time_out,
+			total_bytes, &dev->stats);
+
+	return wsa_sock_recv_data(dev->sock.data, rx_buf_ptr, buf_size, time_out,
+		total_bytes, &dev->stats);
+}
+
+
+/**
+ * Reads one VRT packet off the data socket, into a buffer of the caller's
+ * or of the device's arena, and decodes it.  The packet is counted in the
+ * device's statistics and context, and recorded if the device is being
+ * captured.
+ *
+ * @param device - the device to read from
+ * @param header - a pointer to store the VRT header in
+ * @param trailer - a pointer to store the VRT trailer in
+ * @param receiver - a pointer to store receiver context data in
+ * @param digitizer - a pointer to store digitizer context data in
+ * @param extension - a pointer to store extension context data in
+ * @param packet - a buffer of \b packet_size bytes for the packet, or NULL
+ *		to use the device's arena
+ * @param packet_size - the size of \b packet
+ * @param data_buffer - a buffer to copy the payload of an IF packet to, or
+ *		NULL to leave it in the packet
+ * @param packet_bytes - a pointer to store the size of the packet in bytes
+ * @param timeout - the timeout in milliseconds
+ *
+ * @return  0 on success or a negative value on error
+ */
+int16_t _wsa_recv_vrt_packet(struct wsa_device * const device, 
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t *packet,
+		uint32_t packet_size,
+		uint8_t * const data_buffer,
+		uint32_t *packet_bytes,
+		uint32_t timeout)
 {	
-	uint8_t *vrt_header_buffer;
-	int32_t vrt_header_bytes;
+	uint8_t vrt_prologue[VRT_PROLOGUE_SIZE * BYTES_PER_VRT_WORD];
 
-	uint8_t *vrt_packet_buffer;
+	uint8_t *vrt_packet_buffer = packet;
 	int32_t vrt_packet_bytes;
-	
-	uint32_t stream_identifier_word = 0;
+	struct wsa_arena_mark arena_mark;
 	
 	int32_t bytes_received = 0;
 	int16_t socket_receive_result = 0;
+	int16_t result = 0;
 	
-	uint16_t packet_size = 0;
-	uint16_t iq_packet_size;
-	
-	uint8_t has_trailer = 0;
-	uint32_t trailer_word = 0;
+	uint16_t vrt_packet_size = 0;
+
+	uint64_t perf_ts;
 
 	// reset header
 	header->pkt_count = 0;
@@ -907,64 +1217,124 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 	header->time_stamp.psec = 0;
 
 	// *****
-	// Setup, allocate buffer memory and fetch the first 2 header words
+	// Fetch the first 2 header words, to determine the packet size and type
 	// *****
-	
-	// Set to get the first 2 words of the header to extract 
-	// packet size and packet type
-	vrt_header_bytes = 2 * BYTES_PER_VRT_WORD;
-	
-	// allocate space for the header buffer
-	vrt_header_buffer = (uint8_t *) malloc(vrt_header_bytes * sizeof(uint8_t));
-	if (vrt_header_buffer == NULL)
-		return WSA_ERR_MALLOCFAILED;
-
-	// retrieve the first two words of the packet to determine if the packet contains IQ data or context data
-	socket_receive_result = wsa_sock_recv_data(device->sock.data, 
-												vrt_header_buffer, 
-												vrt_header_bytes, 
-												timeout, 
-												&bytes_received);	
+	WSA_PERF_START(perf_ts);
+	socket_receive_result = _wsa_recv_data(device, vrt_prologue, sizeof(vrt_prologue),
+		timeout, &bytes_received);
+	WSA_PERF_STOP(WSA_PERF_SOCKET_WAIT, perf_ts);
 	doutf(DLOW, "In wsa_read_vrt_packet_raw: wsa_sock_recv_data returned %hd\n", socket_receive_result);
 	if (socket_receive_result < 0) {
 		doutf(DHIGH, "Error in wsa_read_vrt_packet_raw:  %s\n", wsa_get_error_msg(socket_receive_result));
-		free(vrt_header_buffer);
-
 		return socket_receive_result;
 	}
+
+	// don't read the rest of a packet that can't be decoded
+	result = wsa_decode_vrt_prologue(vrt_prologue, header, &vrt_packet_size);
+	if (result < 0)
+		return result;
 	
 	// *****
-	// Decode the first 2 words from the header
+	// Fetch the rest of the packet, after the first two words, into the
+	// device's arena unless the caller's buffer holds it
 	// *****
+	vrt_packet_bytes = BYTES_PER_VRT_WORD * vrt_packet_size;
+	*packet_bytes = (uint32_t) vrt_packet_bytes;
+	arena_mark = wsa_arena_mark(&device->arena);
+	if (vrt_packet_buffer == NULL || (uint32_t) vrt_packet_bytes > packet_size) {
+		vrt_packet_buffer = (uint8_t *) wsa_arena_alloc(&device->arena, vrt_packet_bytes * sizeof(uint8_t));
+		if (vrt_packet_buffer == NULL)
+			return WSA_ERR_MALLOCFAILED;
+	}
+
+	memcpy(vrt_packet_buffer, vrt_prologue, sizeof(vrt_prologue));
+
+	WSA_PERF_START(perf_ts);
+	socket_receive_result = _wsa_recv_data(device, 
+		vrt_packet_buffer + sizeof(vrt_prologue), vrt_packet_bytes - sizeof(vrt_prologue),
+		timeout, &bytes_received);
+	WSA_PERF_STOP(WSA_PERF_SOCKET_WAIT, perf_ts);
+	doutf(DLOW, "In wsa_read_vrt_packet_raw: wsa_sock_recv_data returned %hd\n", socket_receive_result);
+	if (socket_receive_result < 0)
+	{
+		doutf(DHIGH, "Error in wsa_read_vrt_packet_raw:  %s\n", 
+			wsa_get_error_msg(socket_receive_result));
+		wsa_arena_release(&device->arena, arena_mark);
+
+		return socket_receive_result;
+	}
+
+	// a packet too large for the caller's buffer was only read to drop it
+	if (packet != NULL && vrt_packet_buffer != packet) {
+		wsa_arena_release(&device->arena, arena_mark);
+		return WSA_ERR_VRTPACKETSIZE;
+	}
+
+	WSA_PERF_START(perf_ts);
+	// the prologue was decoded as it came in
+	result = wsa_decode_vrt_rest(vrt_packet_buffer, header, trailer,
+		receiver, digitizer, extension, data_buffer);
+	WSA_PERF_STOP(WSA_PERF_VRT_PARSE, perf_ts);
+
+	if (result == 0) {
+		_wsa_count_vrt_packet(&device->stats, header, trailer, vrt_packet_size,
+			(vrt_packet_buffer[0] & 0x04) >> 2);
+		_wsa_track_context(device, header, receiver, digitizer, extension);
+	}
+
+	if (result == 0 && device->capture != NULL)
+		result = wsa_capture_write_packet(device->capture, vrt_packet_buffer, vrt_packet_bytes);
+
+	wsa_arena_release(&device->arena, arena_mark);
+
+	return result;
+}
+
+
+/**
+ * Decodes the first two words of a VRT packet: its type, count, size and
+ * stream identifier.  Used to find how much of the packet is left to read.
+ *
+ * @param prologue - the first 2 words (8 bytes) of the packet
+ * @param header - A pointer to \b wsa_vrt_packet_header structure to store 
+ *		the packet type, count and stream identifier
+ * @param packet_size - a pointer to store the packet size, in 32-bit words
+ *
+ * @return 0 on success or a negative value on error
+ */
+int16_t wsa_decode_vrt_prologue(uint8_t const *prologue,
+		struct wsa_vrt_packet_header * const header,
+		uint16_t *packet_size)
+{
+	uint32_t stream_identifier_word;
 
-	has_trailer = (vrt_header_buffer[0] & 0x04) >> 2;
-	
 	// Get the packet type
-	header->packet_type = vrt_header_buffer[0] >> 4;
+	header->packet_type = prologue[0] >> 4;
 	
 	// Get the 4-bit VRT "Pkt Count"
 	// This counter increments from 0 to 15 and repeats again from 0 in a never-ending loop.
 	// It provides a simple verification that packets are arriving in the right order
-	header->pkt_count = (uint8_t) vrt_header_buffer[1] & 0x0f;	
+	header->pkt_count = (uint8_t) prologue[1] & 0x0f;	
 	doutf(DLOW, "Packet order indicator: 0x%02X\n", header->pkt_count);
 	
 	// Check TSI field for 0x01 & get sec time stamp at the 3rd word
-	if (!((vrt_header_buffer[1] & 0xC0) >> 6)) 
+	if (!((prologue[1] & 0xC0) >> 6)) 
 	{
 		doutf(DHIGH, "ERROR: Second timestamp is not of UTC type.\n");
-		free(vrt_header_buffer);
 		return WSA_ERR_INVTIMESTAMP;
 	}
 		
-	// retrieve the VRT packet size
-	packet_size = (((uint16_t) vrt_header_buffer[2]) << 8) + (uint16_t) vrt_header_buffer[3];
-	header->samples_per_packet = packet_size - VRT_HEADER_SIZE - VRT_TRAILER_SIZE;
+	// retrieve the VRT packet size, which must at least hold a full header
+	*packet_size = (((uint16_t) prologue[2]) << 8) + (uint16_t) prologue[3];
+	if (*packet_size < VRT_HEADER_SIZE)
+		return WSA_ERR_VRTPACKETSIZE;
+	header->samples_per_packet = *packet_size - VRT_HEADER_SIZE - VRT_TRAILER_SIZE;
 	
 	// Store the Stream Identifier to determine if the packet is an IQ packet or a context packet
-	stream_identifier_word = (((uint32_t) vrt_header_buffer[4]) << 24) 
-			+ (((uint32_t) vrt_header_buffer[5]) << 16) 
-			+ (((uint32_t) vrt_header_buffer[6]) << 8) 
-			+ (uint32_t) vrt_header_buffer[7];
+	stream_identifier_word = (((uint32_t) prologue[4]) << 24) 
+			+ (((uint32_t) prologue[5]) << 16) 
+			+ (((uint32_t) prologue[6]) << 8) 
+			+ (uint32_t) prologue[7];
 	if ((stream_identifier_word != RECEIVER_STREAM_ID) && 
 		(stream_identifier_word != DIGITIZER_STREAM_ID) && 
 		(stream_identifier_word != EXTENSION_STREAM_ID) &&
@@ -972,36 +1342,51 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 		(stream_identifier_word != I16_DATA_STREAM_ID) &&
 		(stream_identifier_word != I32_DATA_STREAM_ID))
 	{
-		free(vrt_header_buffer);
 		return WSA_ERR_NOTIQFRAME;
 	}
 	header->stream_id = stream_identifier_word;
 
-	// *****
-	// set up and get the remaining words of each different type of packet accordingly
-	// *****
-	
-	// allocate memory for the vrt packet without the first two words
-	vrt_packet_bytes = BYTES_PER_VRT_WORD * (packet_size - 2);
-	vrt_packet_buffer = (uint8_t *) malloc(vrt_packet_bytes * sizeof(uint8_t));
-	if (vrt_packet_buffer == NULL)
-	{
-		free(vrt_header_buffer);
-		return WSA_ERR_MALLOCFAILED;
-	}
+	return 0;
+}
 
-	socket_receive_result = wsa_sock_recv_data(device->sock.data, 
-		vrt_packet_buffer, vrt_packet_bytes, timeout, &bytes_received);
-	doutf(DLOW, "In wsa_read_vrt_packet_raw: wsa_sock_recv_data returned %hd\n", socket_receive_result);
-	if (socket_receive_result < 0)
-	{
-		doutf(DHIGH, "Error in wsa_read_vrt_packet_raw:  %s\n", 
-			wsa_get_error_msg(socket_receive_result));
-		free(vrt_packet_buffer);
-		free(vrt_header_buffer);
 
-		return socket_receive_result;
-	}
+/**
+ * Decodes the rest of a VRT packet held in memory, once its first two
+ * words are decoded into \b header by wsa_decode_vrt_prologue().
+ *
+ * @param packet - the packet, starting at its first word, whose size is
+ *		the packet size field of its header
+ * @param header - the header, with the fields of the prologue set, to
+ *		store the rest of the VRT header information in
+ * @param trailer - A pointer to \b wsa_vrt_packet_trailer structure to store 
+ *		the VRT trailer information
+ * @param receiver - a pointer to \b wsa_receiver_packet strucuture to store
+ *		the receiver Context data
+ * @param digitizer - a pointer to \b wsa_digitizer_packet strucuture to store
+ *		the digitizer Context data
+ * @param extension - a pointer to \b wsa_extension_packet strucuture to store
+ *		the custom Context data
+ * @param data_buffer - A uint8_t pointer buffer to store the raw I and Q data,
+ *		of at least the packet's payload size, or NULL to leave it in
+ *		the packet
+ *
+ * @return  0 on success or a negative value on error
+ */
+static int16_t wsa_decode_vrt_rest(uint8_t *packet,
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t * const data_buffer)
+{
+	// the packet after its first two words
+	uint8_t *vrt_packet_buffer = packet + VRT_PROLOGUE_SIZE * BYTES_PER_VRT_WORD;
+	uint16_t iq_packet_size;
+	uint8_t has_trailer;
+	uint32_t trailer_word = 0;
+
+	has_trailer = (packet[0] & 0x04) >> 2;
 
 	// Get the second timestamp
 	header->time_stamp.sec = (((uint32_t) vrt_packet_buffer[0]) << 24) +
@@ -1015,7 +1400,7 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 
 	// Check the TSF field, if present (= 0x10), 
 	// then get the picoseconds time stamp at the 4th & 5th words
-	if ((vrt_header_buffer[1] & 0x30) >> 5)
+	if ((packet[1] & 0x30) >> 5)
 	{
 		header->time_stamp.psec = (((uint64_t) vrt_packet_buffer[4]) << 56) +
 				(((uint64_t) vrt_packet_buffer[5]) << 48) +
@@ -1034,21 +1419,21 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 		header->time_stamp.psec, 
 		header->time_stamp.psec);
 	
-	if (stream_identifier_word == EXTENSION_STREAM_ID)
+	if (header->stream_id == EXTENSION_STREAM_ID)
 	{
 		// extract and store the extension context data
 		extract_extension_packet_data(vrt_packet_buffer, extension);
 		
 		extension->pkt_count = header->pkt_count;
 	}
-	else if (stream_identifier_word == RECEIVER_STREAM_ID) 
+	else if (header->stream_id == RECEIVER_STREAM_ID) 
 	{
 		// extract and store the receiver context data
 		extract_receiver_packet_data(vrt_packet_buffer, receiver);
 		
 		receiver->pkt_count = header->pkt_count;
 	} 
-	else if (stream_identifier_word == DIGITIZER_STREAM_ID) 
+	else if (header->stream_id == DIGITIZER_STREAM_ID) 
 	{
 		// extract and store the digitizer context data
 		extract_digitizer_packet_data(vrt_packet_buffer, digitizer);
@@ -1056,16 +1441,17 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 		digitizer->pkt_count = header->pkt_count;
 	}
 	// if the packet is an IQ packet proceed with the method from previous release
-	else if (stream_identifier_word == I16Q16_DATA_STREAM_ID || 
-			 stream_identifier_word == I16_DATA_STREAM_ID || 
-			 stream_identifier_word == I32_DATA_STREAM_ID)
+	else if (header->stream_id == I16Q16_DATA_STREAM_ID || 
+			 header->stream_id == I16_DATA_STREAM_ID || 
+			 header->stream_id == I32_DATA_STREAM_ID)
 	{
 		iq_packet_size = header->samples_per_packet;
 		
 		// Copy only the IQ data payload to the provided buffer
-		memcpy(data_buffer, 
-			vrt_packet_buffer + ((VRT_HEADER_SIZE - 2) * BYTES_PER_VRT_WORD),
-			iq_packet_size * BYTES_PER_VRT_WORD);
+		if (data_buffer != NULL)
+			memcpy(data_buffer, 
+				vrt_packet_buffer + ((VRT_HEADER_SIZE - 2) * BYTES_PER_VRT_WORD),
+				iq_packet_size * BYTES_PER_VRT_WORD);
 
 		// Handle the trailer word
 		if (has_trailer)
@@ -1097,12 +1483,54 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
 			doutf(DLOW, "Sample loss: %d\n", trailer->sample_loss_indicator);
 		}
 	}
-	if (stream_identifier_word == I16_DATA_STREAM_ID)
+	if (header->stream_id == I16_DATA_STREAM_ID)
 		header->samples_per_packet = header->samples_per_packet * 2;
-	free(vrt_packet_buffer);
-	free(vrt_header_buffer);
 
-	return 0;	
+	return 0;
+}
+
+
+/**
+ * Decodes a complete VRT packet held in memory, as read by
+ * wsa_read_vrt_packet_raw().  Context packets fill in the matching context
+ * structure; IF data packets have their payload copied into \b data_buffer,
+ * and their trailer decoded.
+ *
+ * @param packet - the packet, starting at its first word, whose size is
+ *		the packet size field of its header
+ * @param header - A pointer to \b wsa_vrt_packet_header structure to store 
+ *		the VRT header information
+ * @param trailer - A pointer to \b wsa_vrt_packet_trailer structure to store 
+ *		the VRT trailer information
+ * @param receiver - a pointer to \b wsa_receiver_packet strucuture to store
+ *		the receiver Context data
+ * @param digitizer - a pointer to \b wsa_digitizer_packet strucuture to store
+ *		the digitizer Context data
+ * @param extension - a pointer to \b wsa_extension_packet strucuture to store
+ *		the custom Context data
+ * @param data_buffer - A uint8_t pointer buffer to store the raw I and Q data,
+ *		of at least the packet's payload size, or NULL to leave it in
+ *		the packet
+ *
+ * @return  0 on success or a negative value on error
+ */
+int16_t wsa_decode_vrt_packet(uint8_t *packet,
+		struct wsa_vrt_packet_header * const header, 
+		struct wsa_vrt_packet_trailer * const trailer,
+		struct wsa_receiver_packet * const receiver,
+		struct wsa_digitizer_packet * const digitizer,
+		struct wsa_extension_packet * const extension,
+		uint8_t * const data_buffer)
+{
+	uint16_t packet_size = 0;
+	int16_t result;
+
+	result = wsa_decode_vrt_prologue(packet, header, &packet_size);
+	if (result < 0)
+		return result;
+
+	return wsa_decode_vrt_rest(packet, header, trailer, receiver, digitizer,
+		extension, data_buffer);
 }
 
 
@@ -1129,11 +1557,15 @@ int16_t wsa_read_vrt_packet_raw(struct wsa_device * const device,
  * @return The number of samples decoded, or a 16-bit negative 
  * number on error.
  */
+WSA_TARGET_CLONES
 int32_t wsa_decode_zif_frame(uint8_t *data_buf, int16_t *i_buf, int16_t *q_buf, 
 						 int32_t sample_size)
 {
 	int32_t i;
 	int32_t j = 0;
+	uint64_t perf_ts;
+
+	WSA_PERF_START(perf_ts);
 
     if(q_buf) {
 	  // Split up the IQ data bytes
@@ -1153,6 +1585,8 @@ int32_t wsa_decode_zif_frame(uint8_t *data_buf, int16_t *i_buf, int16_t *q_buf,
 	  }
     }
 
+	WSA_PERF_STOP(WSA_PERF_DECODE, perf_ts);
+
 	return (i / 4);
 }
 
@@ -1181,10 +1615,14 @@ int32_t wsa_decode_zif_frame(uint8_t *data_buf, int16_t *i_buf, int16_t *q_buf,
  * @return The number of samples decoded, or a 16-bit negative 
  * number on error.
  */
+WSA_TARGET_CLONES
 int32_t wsa_decode_i_only_frame(uint32_t stream_id, uint8_t *data_buf, int16_t *i16_buf,int32_t *i32_buf,  int32_t sample_size)
 {
 	int32_t i = 0;
 	int32_t j = 0;
+	uint64_t perf_ts;
+
+	WSA_PERF_START(perf_ts);
 
 	//  store HDR data in 32 bit buffer
 	if (stream_id == I32_DATA_STREAM_ID )
@@ -1202,9 +1640,42 @@ int32_t wsa_decode_i_only_frame(uint32_t stream_id, uint8_t *data_buf, int16_t *
 			j++;
 		}
 
+	WSA_PERF_STOP(WSA_PERF_DECODE, perf_ts);
+
 	return i/4;
 }
 
+/**
+ * Decodes a 64-bit VRT fixed point field into its whole Hz and fractional
+ * parts
+ *
+ * @param field - A pointer to the first byte of the field
+ * @param hz - A pointer to store the whole Hz, rounded down
+ * @param frac - A pointer to store the fraction, the VRT_FIXED_FRAC_BITS low
+ *				bits of the field
+ *
+ * @return None
+ */
+static void wsa_decode_vrt_fixed(uint8_t const *field, int64_t *hz, uint32_t *frac)
+{
+	int64_t word1;
+	int64_t word2;
+
+	word1 = ((((int32_t) field[0]) << 24) +
+			(((int32_t) field[1]) << 16) +
+			(((int32_t) field[2]) << 8) + 
+			(int32_t) field[3]);
+
+	word2 = ((((int64_t) field[4]) << 24) +
+			(((int64_t) field[5]) << 16) +
+			(((int64_t) field[6]) << 8) + 
+			(int64_t) field[7]);
+
+	*hz = (word1 << (32 - VRT_FIXED_FRAC_BITS)) + (word2 >> VRT_FIXED_FRAC_BITS);
+	*frac = (uint32_t) (word2 & VRT_FIXED_FRAC_MASK);
+}
+
+
 /**
  * Decodes the raw receiver context packet and store it in the receiver 
  * structure
@@ -1221,10 +1692,6 @@ int32_t wsa_decode_i_only_frame(uint32_t stream_id, uint8_t *data_buf, int16_t *
 void extract_receiver_packet_data(uint8_t *temp_buffer, struct wsa_receiver_packet * const receiver)
 {	
 	int32_t reference_point = 0;
-	int64_t freq_word1 = 0; 
-	int64_t freq_word2 = 0;
-	long double freq_int_part = 0;
-	long double freq_dec_part = 0;
 	
 	int8_t data_pos = 16; // to increment data index
 	
@@ -1248,38 +1715,27 @@ void extract_receiver_packet_data(uint8_t *temp_buffer, struct wsa_receiver_pack
 	// determine if frequency data is present
 	if ((receiver->indicator_field  & FREQ_INDICATOR_MASK) == FREQ_INDICATOR_MASK)
 	{
-		freq_word1 = ((((int32_t) temp_buffer[data_pos]) << 24) +
-					(((int32_t) temp_buffer[data_pos + 1]) << 16) +
-					(((int32_t) temp_buffer[data_pos + 2]) << 8) + 
-					(int32_t) temp_buffer[data_pos + 3]);
-
-		freq_word2 = ((((int64_t) temp_buffer[data_pos + 4]) << 24) +
-					(((int64_t) temp_buffer[data_pos + 5]) << 16) +
-					(((int64_t) temp_buffer[data_pos + 6]) << 8) + 
-					(int64_t) temp_buffer[data_pos + 7]);
-
-		freq_int_part = (long double) ((freq_word1 << 12) + (freq_word2 >> 20));
-		freq_dec_part = (long double) (freq_word2 & 0x000fffff);
-		receiver->freq = freq_int_part + (freq_dec_part / MHZ);
+		wsa_decode_vrt_fixed(&temp_buffer[data_pos], &receiver->freq,
+			&receiver->freq_frac);
 		data_pos = data_pos + 8;
 	}
 	
 	// determine if gain data is present
 	if ((receiver->indicator_field & GAIN_INDICATOR_MASK) == GAIN_INDICATOR_MASK) 
 	{
-		receiver->gain_if = ((int16_t) (temp_buffer[data_pos] << 8) + 
-							temp_buffer[data_pos + 1]) / 128.0;
+		receiver->gain_if = (int16_t) ((temp_buffer[data_pos] << 8) + 
+							temp_buffer[data_pos + 1]);
 
-		receiver->gain_rf = ((int16_t) (temp_buffer[data_pos + 2] << 8) + 
-							temp_buffer[data_pos + 3]) / 128.0;
+		receiver->gain_rf = (int16_t) ((temp_buffer[data_pos + 2] << 8) + 
+							temp_buffer[data_pos + 3]);
 		
 		data_pos = data_pos + 4;		
 	}
 
 	// TODO: handle temperature
 	/*if ((receiver->indicator_field & 0x0f) == 0x04) {
-		receiver->temperature = ((int16_t) (temp_buffer[data_pos + 2] << 8) + 
-					temp_buffer[data_pos + 3]) / 64.0;
+		receiver->temperature = (int16_t) ((temp_buffer[data_pos + 2] << 8) + 
+					temp_buffer[data_pos + 3]);
 	}*/
 }
 		
@@ -1300,16 +1756,6 @@ void extract_receiver_packet_data(uint8_t *temp_buffer, struct wsa_receiver_pack
 void extract_digitizer_packet_data(uint8_t *temp_buffer, struct wsa_digitizer_packet * const digitizer) 
 {
 
-	int64_t bw_word1 = 0;
-	int64_t bw_word2 = 0;
-	long double bw_int_part = 0;
-	long double bw_dec_part = 0;
-
-	int64_t rf_freq_word1 = 0;
-	int64_t rf_freq_word2 = 0;
-	long double rf_freq_int_part = 0;
-	long double rf_freq_dec_part = 0;
-
 	int16_t ref_level_word = 0;
 
 	int32_t data_pos = 16;
@@ -1324,19 +1770,8 @@ void extract_digitizer_packet_data(uint8_t *temp_buffer, struct wsa_digitizer_pa
 	if ((digitizer->indicator_field & BW_INDICATOR_MASK) ==  
 		BW_INDICATOR_MASK) 
 	{		
-		bw_word1 = ((((int32_t) temp_buffer[data_pos]) << 24) +
-						(((int32_t) temp_buffer[data_pos + 1]) << 16) +
-						(((int32_t) temp_buffer[data_pos + 2]) << 8) + 
-						(int32_t) temp_buffer[data_pos + 3]);
-
-		bw_word2 =  ((((int64_t) temp_buffer[data_pos + 4]) << 24) +
-						(((int64_t) temp_buffer[data_pos + 5]) << 16) +
-						(((int64_t) temp_buffer[data_pos + 6]) << 8) + 
-						(int64_t) temp_buffer[data_pos + 7]);
-		
-		bw_int_part = (long double) ((bw_word1 << 12) + (bw_word2 >> 20));
-		bw_dec_part = (long double) (bw_word2 & 0x000fffff);
-		digitizer->bandwidth = bw_int_part + (bw_dec_part / MHZ);
+		wsa_decode_vrt_fixed(&temp_buffer[data_pos], &digitizer->bandwidth,
+			&digitizer->bandwidth_frac);
 		data_pos = data_pos + 8;
 	}
 
@@ -1344,19 +1779,8 @@ void extract_digitizer_packet_data(uint8_t *temp_buffer, struct wsa_digitizer_pa
 	if ((digitizer->indicator_field & RF_FREQ_OFFSET_INDICATOR_MASK) == 
 		RF_FREQ_OFFSET_INDICATOR_MASK) 
 	{
-		rf_freq_word1 = ((((int32_t) temp_buffer[data_pos]) << 24) +
-						(((int32_t) temp_buffer[data_pos + 1]) << 16) +
-						(((int32_t) temp_buffer[data_pos + 2]) << 8) + 
-						(int32_t) temp_buffer[data_pos + 3]);
-
-		rf_freq_word2 =  ((((int64_t) temp_buffer[data_pos + 4]) << 24) +
-						(((int64_t) temp_buffer[data_pos + 5]) << 16) +
-						(((int64_t) temp_buffer[data_pos + 6]) << 8) + 
-						(int64_t) temp_buffer[data_pos + 7]);
-
-		rf_freq_int_part = (long double) ((rf_freq_word1 << 12) + (rf_freq_word2 >> 20));
-		rf_freq_dec_part = (long double) (rf_freq_word2 & 0x000fffff);
-		digitizer->rf_freq_offset = rf_freq_int_part + (rf_freq_dec_part / MHZ);
+		wsa_decode_vrt_fixed(&temp_buffer[data_pos], &digitizer->rf_freq_offset,
+			&digitizer->rf_freq_offset_frac);
 		
 		data_pos = data_pos + 8;
 	}
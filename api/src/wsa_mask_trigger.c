@@ -0,0 +1,484 @@
+#include <string.h>
+
+#include "wsa_mask_trigger.h"
+#include "wsa_commons.h"
+#include "wsa_dsp.h"
+#include "wsa_error.h"
+
+
+/**
+ * allocates a frequency mask trigger, with its spectrogram, mask table,
+ * event ring and sample history
+ *
+ * @param fft_size - the samples in each STFT frame, a multiple of 2
+ * @param hop - the samples between the starts of consecutive frames
+ * @param complex_input - 1 if the samples will be IQ (ZIF), 0 if I-only
+ * @param sample_rate - the sample rate in Hz, to time stamp the events
+ * @param max_masks - the most masks that will be added
+ * @param history_len - the number of recent samples to keep, at least
+ *		fft_size
+ * @param max_events - the most events held before they are read; more
+ *		are dropped and counted
+ * @param trigger - a pointer to store the new trigger in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_mask_trigger_alloc(uint32_t fft_size, uint32_t hop,
+		uint8_t complex_input, uint64_t sample_rate, uint32_t max_masks,
+		uint32_t history_len, uint32_t max_events,
+		struct wsa_mask_trigger **trigger)
+{
+	struct wsa_mask_trigger *trig;
+	struct wsa_spectrogram *sg;
+	struct wsa_arena arena;
+	size_t bytes;
+	int16_t result;
+
+	if (sample_rate == 0 || max_masks == 0 || max_events == 0 || history_len < fft_size)
+		return WSA_ERR_INVINPUT;
+
+	// a frame's row is checked as soon as it is computed, so one row is enough
+	result = wsa_spectrogram_alloc(fft_size, hop, 1, complex_input, &sg);
+	if (result < 0)
+		return result;
+
+	bytes = sizeof(struct wsa_mask_trigger) +
+		sizeof(float) * (size_t) max_masks * sg->bins +
+		sizeof(uint8_t) * max_masks +
+		sizeof(struct wsa_mask_trigger_event) * max_events +
+		2 * sizeof(kiss_fft_scalar) * history_len +
+		6 * WSA_ARENA_ALIGNMENT;
+
+	wsa_arena_init(&arena, bytes);
+	trig = (struct wsa_mask_trigger *) wsa_arena_alloc(&arena, sizeof(struct wsa_mask_trigger));
+	if (trig == NULL) {
+		wsa_spectrogram_free(sg);
+		return WSA_ERR_MALLOCFAILED;
+	}
+	memset(trig, 0, sizeof(struct wsa_mask_trigger));
+
+	trig->thresholds = (float *) wsa_arena_alloc(&arena, sizeof(float) * (size_t) max_masks * sg->bins);
+	trig->armed = (uint8_t *) wsa_arena_alloc(&arena, sizeof(uint8_t) * max_masks);
+	trig->events = (struct wsa_mask_trigger_event *) wsa_arena_alloc(&arena,
+		sizeof(struct wsa_mask_trigger_event) * max_events);
+	trig->history_i = (kiss_fft_scalar *) wsa_arena_alloc(&arena, sizeof(kiss_fft_scalar) * history_len);
+	trig->history_q = (kiss_fft_scalar *) wsa_arena_alloc(&arena, sizeof(kiss_fft_scalar) * history_len);
+	trig->arena = arena;
+	trig->spectrogram = sg;
+	if (trig->thresholds == NULL || trig->armed == NULL || trig->events == NULL ||
+		trig->history_i == NULL || trig->history_q == NULL) {
+		wsa_mask_trigger_free(trig);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	// I-only history has no Q, keep it silent
+	memset(trig->history_q, 0, sizeof(kiss_fft_scalar) * history_len);
+
+	trig->max_masks = max_masks;
+	trig->max_events = max_events;
+	trig->history_len = history_len;
+	trig->sample_rate = sample_rate;
+
+	*trigger = trig;
+	return 0;
+}
+
+
+/**
+ * frees a frequency mask trigger and its spectrogram
+ *
+ * @param trigger - the trigger to free
+ */
+void wsa_mask_trigger_free(struct wsa_mask_trigger *trigger)
+{
+	wsa_spectrogram_free(trigger->spectrogram);
+
+	wsa_arena_free_self(&trigger->arena);
+}
+
+
+/**
+ * starts a trigger over, as if no samples had been pushed: the sample
+ * count, history, events and spectrogram are cleared and every mask is
+ * armed.  The masks themselves are kept.
+ *
+ * @param trigger - the trigger
+ */
+void wsa_mask_trigger_reset(struct wsa_mask_trigger *trigger)
+{
+	wsa_spectrogram_reset(trigger->spectrogram);
+	memset(trigger->history_i, 0, sizeof(kiss_fft_scalar) * trigger->history_len);
+	memset(trigger->history_q, 0, sizeof(kiss_fft_scalar) * trigger->history_len);
+	memset(trigger->armed, 1, trigger->masks);
+	trigger->event_head = 0;
+	trigger->event_count = 0;
+	trigger->events_dropped = 0;
+	trigger->samples = 0;
+	trigger->anchor_sample = 0;
+	trigger->anchor_time.sec = 0;
+	trigger->anchor_time.psec = 0;
+}
+
+
+/**
+ * adds a mask to a trigger
+ *
+ * @param trigger - the trigger
+ * @param thresholds - the level in dB of each of the spectrogram's bins
+ *		(trigger->spectrogram->bins of them) a frame must rise above to fire
+ *		the mask.  Bins set to WSA_MASK_TRIGGER_IGNORE never fire it.
+ *
+ * @return the index of the mask, or a negative number on error
+ */
+int32_t wsa_mask_trigger_add_mask(struct wsa_mask_trigger *trigger,
+		float const *thresholds)
+{
+	uint32_t bins = trigger->spectrogram->bins;
+
+	if (trigger->masks >= trigger->max_masks)
+		return WSA_ERR_INVINPUT;
+
+	memcpy(trigger->thresholds + (size_t) trigger->masks * bins, thresholds,
+		sizeof(float) * bins);
+	trigger->armed[trigger->masks] = 1;
+
+	return (int32_t) trigger->masks++;
+}
+
+
+/**
+ * adds a mask that fires when any bin of a range rises above a level
+ *
+ * @param trigger - the trigger
+ * @param start_bin - the first bin of the range
+ * @param stop_bin - the last bin of the range
+ * @param level - the level in dB
+ *
+ * @return the index of the mask, or a negative number on error
+ */
+int32_t wsa_mask_trigger_add_range(struct wsa_mask_trigger *trigger,
+		uint32_t start_bin, uint32_t stop_bin, float level)
+{
+	uint32_t bins = trigger->spectrogram->bins;
+	float *thresholds;
+	uint32_t i;
+
+	if (start_bin > stop_bin || stop_bin >= bins)
+		return WSA_ERR_INVINPUT;
+	if (trigger->masks >= trigger->max_masks)
+		return WSA_ERR_INVINPUT;
+
+	thresholds = trigger->thresholds + (size_t) trigger->masks * bins;
+	for (i = 0; i < bins; i++)
+		thresholds[i] = (i >= start_bin && i <= stop_bin) ? level : WSA_MASK_TRIGGER_IGNORE;
+	trigger->armed[trigger->masks] = 1;
+
+	return (int32_t) trigger->masks++;
+}
+
+
+/**
+ * counts the bins of a row above a mask.  There's no early exit, so the
+ * loop vectorizes.
+ *
+ * @param row - the row
+ * @param thresholds - the mask
+ * @param bins - the number of bins
+ *
+ * @return the number of bins above the mask
+ */
+WSA_TARGET_CLONES
+static uint32_t wsa_mask_trigger_count_over(float const *row,
+		float const *thresholds, uint32_t bins)
+{
+	uint32_t over = 0;
+	uint32_t i;
+
+	for (i = 0; i < bins; i++)
+		over += row[i] > thresholds[i];
+
+	return over;
+}
+
+
+/**
+ * gets the time of a sample, from the last time stamp given
+ *
+ * @param trigger - the trigger
+ * @param sample - the sample number
+ * @param time_stamp - a pointer to store the time in
+ */
+static void wsa_mask_trigger_sample_time(struct wsa_mask_trigger const *trigger,
+		uint64_t sample, struct wsa_time *time_stamp)
+{
+	uint64_t rate = trigger->sample_rate;
+	uint64_t delta;
+	uint64_t psec;
+	uint32_t sec;
+
+	if (sample >= trigger->anchor_sample) {
+		delta = sample - trigger->anchor_sample;
+		sec = trigger->anchor_time.sec + (uint32_t) (delta / rate);
+		psec = trigger->anchor_time.psec +
+			(uint64_t) ((double) (delta % rate) * 1e12 / rate);
+		if (psec >= 1000000000000ULL) {
+			psec -= 1000000000000ULL;
+			sec++;
+		}
+	} else {
+		delta = trigger->anchor_sample - sample;
+		sec = trigger->anchor_time.sec - (uint32_t) (delta / rate);
+		psec = (uint64_t) ((double) (delta % rate) * 1e12 / rate);
+		if (psec > trigger->anchor_time.psec) {
+			psec = trigger->anchor_time.psec + 1000000000000ULL - psec;
+			sec--;
+		} else {
+			psec = trigger->anchor_time.psec - psec;
+		}
+	}
+
+	time_stamp->sec = sec;
+	time_stamp->psec = psec;
+}
+
+
+/**
+ * checks the newest spectrogram row against every mask, queueing an event
+ * for each armed mask it fires
+ *
+ * @param trigger - the trigger
+ */
+static void wsa_mask_trigger_check_frame(struct wsa_mask_trigger *trigger)
+{
+	struct wsa_spectrogram *sg = trigger->spectrogram;
+	struct wsa_mask_trigger_event *event;
+	float const *row;
+	float const *thresholds;
+	uint64_t frame = sg->frames - 1;
+	uint32_t m;
+	uint32_t i;
+
+	row = wsa_spectrogram_row(sg, frame);
+
+	for (m = 0; m < trigger->masks; m++) {
+		thresholds = trigger->thresholds + (size_t) m * sg->bins;
+
+		if (wsa_mask_trigger_count_over(row, thresholds, sg->bins) == 0) {
+			trigger->armed[m] = 1;
+			continue;
+		}
+		if (!trigger->armed[m])
+			continue;
+		trigger->armed[m] = 0;
+
+		if (trigger->event_count == trigger->max_events) {
+			trigger->events_dropped++;
+			continue;
+		}
+
+		event = &trigger->events[(trigger->event_head + trigger->event_count) % trigger->max_events];
+		trigger->event_count++;
+
+		for (i = 0; row[i] <= thresholds[i]; i++)
+			;
+		event->mask = m;
+		event->bin = i;
+		event->level = row[i];
+		event->frame = frame;
+		event->sample = frame * sg->hop;
+		wsa_mask_trigger_sample_time(trigger, event->sample, &event->time_stamp);
+	}
+}
+
+
+/**
+ * copies normalized samples into the history ring
+ *
+ * @param trigger - the trigger
+ * @param stream_id - the stream the samples came from
+ * @param i16_buffer - the 16-bit I data, for IQ and I16 streams
+ * @param q16_buffer - the 16-bit Q data, for IQ streams
+ * @param i32_buffer - the 32-bit I data, for I32 streams
+ * @param samples - the number of samples, at most history_len
+ */
+static void wsa_mask_trigger_keep_history(struct wsa_mask_trigger *trigger,
+		uint32_t stream_id,
+		int16_t *i16_buffer,
+		int16_t *q16_buffer,
+		int32_t *i32_buffer,
+		uint32_t samples)
+{
+	uint32_t start = (uint32_t) (trigger->samples % trigger->history_len);
+	uint32_t done = 0;
+	uint32_t n;
+
+	// at most two pieces, around the end of the ring
+	while (done < samples) {
+		n = trigger->history_len - start;
+		if (n > samples - done)
+			n = samples - done;
+
+		if (stream_id == I16Q16_DATA_STREAM_ID)
+			normalize_iq_data((int32_t) n, stream_id, i16_buffer + done,
+				q16_buffer + done, NULL, trigger->history_i + start,
+				trigger->history_q + start);
+		else if (stream_id == I16_DATA_STREAM_ID)
+			normalize_iq_data((int32_t) n, stream_id, i16_buffer + done,
+				NULL, NULL, trigger->history_i + start, NULL);
+		else
+			normalize_iq_data((int32_t) n, stream_id, NULL, NULL,
+				i32_buffer + done, trigger->history_i + start, NULL);
+
+		done += n;
+		start = 0;
+	}
+}
+
+
+/**
+ * adds streamed samples to a trigger, checking every frame they complete
+ * against the masks
+ *
+ * @param trigger - the trigger
+ * @param stream_id - the stream the samples came from, see
+ *		wsa_spectrogram_push_iq()
+ * @param i16_buffer - the 16-bit I data, for IQ and I16 streams
+ * @param q16_buffer - the 16-bit Q data, for IQ streams
+ * @param i32_buffer - the 32-bit I data, for I32 streams
+ * @param samples - the number of samples in the buffers
+ * @param time_stamp - the time of the first sample, such as the time stamp
+ *		of the VRT packet they came in, or NULL to count on from the last
+ *		time stamp given
+ *
+ * @return the number of times a mask fired, including events dropped
+ * because the queue was full, or a negative number on error
+ */
+int32_t wsa_mask_trigger_push_iq(struct wsa_mask_trigger *trigger,
+		uint32_t stream_id,
+		int16_t *i16_buffer,
+		int16_t *q16_buffer,
+		int32_t *i32_buffer,
+		int32_t samples,
+		struct wsa_time const *time_stamp)
+{
+	struct wsa_spectrogram *sg = trigger->spectrogram;
+	uint32_t events_before = trigger->event_count;
+	uint64_t dropped_before = trigger->events_dropped;
+	int32_t pos = 0;
+	int32_t n;
+	int32_t result;
+
+	if (sg->complex_input != (stream_id == I16Q16_DATA_STREAM_ID))
+		return WSA_ERR_INVINPUT;
+
+	if (time_stamp) {
+		trigger->anchor_sample = trigger->samples;
+		trigger->anchor_time = *time_stamp;
+	}
+
+	// hop samples at a time complete at most one frame, so each frame is
+	// checked before the next one replaces it
+	while (pos < samples) {
+		n = samples - pos;
+		if (n > (int32_t) sg->hop)
+			n = (int32_t) sg->hop;
+		if (n > (int32_t) trigger->history_len)
+			n = (int32_t) trigger->history_len;
+
+		if (stream_id == I16Q16_DATA_STREAM_ID) {
+			wsa_mask_trigger_keep_history(trigger, stream_id, i16_buffer + pos,
+				q16_buffer + pos, NULL, (uint32_t) n);
+			result = wsa_spectrogram_push_iq(sg, stream_id, i16_buffer + pos,
+				q16_buffer + pos, NULL, n);
+		} else if (stream_id == I16_DATA_STREAM_ID) {
+			wsa_mask_trigger_keep_history(trigger, stream_id, i16_buffer + pos,
+				NULL, NULL, (uint32_t) n);
+			result = wsa_spectrogram_push_iq(sg, stream_id, i16_buffer + pos,
+				NULL, NULL, n);
+		} else {
+			wsa_mask_trigger_keep_history(trigger, stream_id, NULL, NULL,
+				i32_buffer + pos, (uint32_t) n);
+			result = wsa_spectrogram_push_iq(sg, stream_id, NULL, NULL,
+				i32_buffer + pos, n);
+		}
+		if (result < 0)
+			return result;
+
+		trigger->samples += n;
+		pos += n;
+
+		if (result > 0)
+			wsa_mask_trigger_check_frame(trigger);
+	}
+
+	return (int32_t) ((trigger->event_count - events_before) +
+		(trigger->events_dropped - dropped_before));
+}
+
+
+/**
+ * takes the oldest event off a trigger's queue
+ *
+ * @param trigger - the trigger
+ * @param event - a pointer to store the event in
+ *
+ * @return 1 if an event was taken, 0 if there was none
+ */
+int16_t wsa_mask_trigger_next_event(struct wsa_mask_trigger *trigger,
+		struct wsa_mask_trigger_event *event)
+{
+	if (trigger->event_count == 0)
+		return 0;
+
+	*event = trigger->events[trigger->event_head];
+	trigger->event_head = (trigger->event_head + 1) % trigger->max_events;
+	trigger->event_count--;
+
+	return 1;
+}
+
+
+/**
+ * copies samples out of a trigger's history, such as the samples leading
+ * up to an event's frame
+ *
+ * @param trigger - the trigger
+ * @param first_sample - the number of the first sample to copy
+ * @param len - the number of samples to copy
+ * @param idata - a buffer for \b len normalized I samples
+ * @param qdata - a buffer for \b len normalized Q samples, or NULL.  They
+ *		are 0 for I-only streams.
+ *
+ * @return 0 on success, or WSA_ERR_INVCAPTURESIZE if some of the samples
+ * are no longer, or not yet, in the history
+ */
+int16_t wsa_mask_trigger_copy_history(struct wsa_mask_trigger const *trigger,
+		uint64_t first_sample, uint32_t len,
+		kiss_fft_scalar *idata, kiss_fft_scalar *qdata)
+{
+	uint64_t oldest = 0;
+	uint32_t start;
+	uint32_t done = 0;
+	uint32_t n;
+
+	if (trigger->samples > trigger->history_len)
+		oldest = trigger->samples - trigger->history_len;
+	if (first_sample < oldest || first_sample + len > trigger->samples)
+		return WSA_ERR_INVCAPTURESIZE;
+
+	start = (uint32_t) (first_sample % trigger->history_len);
+	while (done < len) {
+		n = trigger->history_len - start;
+		if (n > len - done)
+			n = len - done;
+
+		memcpy(idata + done, trigger->history_i + start, sizeof(kiss_fft_scalar) * n);
+		if (qdata)
+			memcpy(qdata + done, trigger->history_q + start, sizeof(kiss_fft_scalar) * n);
+
+		done += n;
+		start = 0;
+	}
+
+	return 0;
+}
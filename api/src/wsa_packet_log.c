@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "wsa_packet_log.h"
+#include "wsa_error.h"
+
+
+/**
+ * allocates the columns of a packet log.  All the columns come from one
+ * block of the log's arena.
+ *
+ * @param log - the packet log
+ * @param capacity - the number of packets the log holds
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_packet_log_init(struct wsa_packet_log *log, uint32_t capacity)
+{
+	size_t size;
+
+	memset(log, 0, sizeof(struct wsa_packet_log));
+	if (capacity == 0)
+		return WSA_ERR_INVCAPTURESIZE;
+
+	// every column starts aligned, so round each one up
+	size = (sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t) +
+		sizeof(int16_t) + 2 * sizeof(uint8_t)) * (size_t) capacity +
+		6 * WSA_ARENA_ALIGNMENT;
+
+	wsa_arena_init(&log->arena, size);
+	log->sec = (uint32_t *) wsa_arena_alloc(&log->arena, capacity * sizeof(uint32_t));
+	log->psec = (uint64_t *) wsa_arena_alloc(&log->arena, capacity * sizeof(uint64_t));
+	log->freq = (int64_t *) wsa_arena_alloc(&log->arena, capacity * sizeof(int64_t));
+	log->reference_level = (int16_t *) wsa_arena_alloc(&log->arena, capacity * sizeof(int16_t));
+	log->pkt_count = (uint8_t *) wsa_arena_alloc(&log->arena, capacity * sizeof(uint8_t));
+	log->flags = (uint8_t *) wsa_arena_alloc(&log->arena, capacity * sizeof(uint8_t));
+	if (log->sec == NULL || log->psec == NULL || log->freq == NULL ||
+		log->reference_level == NULL || log->pkt_count == NULL ||
+		log->flags == NULL) {
+		wsa_packet_log_free(log);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	log->capacity = capacity;
+
+	return 0;
+}
+
+
+/**
+ * empties a packet log, keeping its columns for the next capture
+ *
+ * @param log - the packet log
+ */
+void wsa_packet_log_reset(struct wsa_packet_log *log)
+{
+	log->count = 0;
+}
+
+
+/**
+ * frees the columns of a packet log
+ *
+ * @param log - the packet log
+ */
+void wsa_packet_log_free(struct wsa_packet_log *log)
+{
+	wsa_arena_free(&log->arena);
+	memset(log, 0, sizeof(struct wsa_packet_log));
+}
+
+
+/**
+ * adds a packet to the end of a packet log
+ *
+ * @param log - the packet log
+ * @param sec - integer seconds of the packet's time stamp
+ * @param psec - picoseconds of the packet's time stamp
+ * @param freq - the center frequency in Hz
+ * @param reference_level - the reference level in dBm
+ * @param pkt_count - the packet's VRT packet count
+ * @param flags - WSA_PACKET_LOG_* trailer flags
+ *
+ * @return 0 on success, or WSA_ERR_INVCAPTURESIZE if the log is full
+ */
+int16_t wsa_packet_log_append(struct wsa_packet_log *log,
+		uint32_t sec, uint64_t psec, int64_t freq, int16_t reference_level,
+		uint8_t pkt_count, uint8_t flags)
+{
+	uint32_t n = log->count;
+
+	if (n >= log->capacity)
+		return WSA_ERR_INVCAPTURESIZE;
+
+	log->sec[n] = sec;
+	log->psec[n] = psec;
+	log->freq[n] = freq;
+	log->reference_level[n] = reference_level;
+	log->pkt_count[n] = pkt_count;
+	log->flags[n] = flags;
+	log->count = n + 1;
+
+	return 0;
+}
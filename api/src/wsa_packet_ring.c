@@ -0,0 +1,163 @@
+#include "wsa_packet_ring.h"
+#include "wsa_atomic.h"
+#include "wsa_error.h"
+
+
+/**
+ * allocates a packet ring
+ *
+ * @param slots - the number of packets the ring holds, at least 1
+ * @param slice_size - the largest packet to read in bytes, or 0 for the
+ *		largest a VRT packet can be
+ * @param ring - a pointer to store the new ring in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_packet_ring_alloc(uint32_t slots, uint32_t slice_size,
+		struct wsa_packet_ring **ring)
+{
+	struct wsa_packet_ring *r;
+	struct wsa_arena arena;
+	uint8_t *buffers;
+	uint32_t i;
+
+	if (slice_size == 0)
+		slice_size = VRT_MAX_PACKET_WORDS * BYTES_PER_VRT_WORD;
+	if (slots == 0 || slice_size < VRT_HEADER_SIZE * BYTES_PER_VRT_WORD)
+		return WSA_ERR_INVINPUT;
+
+	// keep every buffer aligned, so payloads decode as fast as in the arena
+	slice_size = (slice_size + WSA_ARENA_ALIGNMENT - 1) & ~(WSA_ARENA_ALIGNMENT - 1);
+
+	wsa_arena_init(&arena, sizeof(struct wsa_packet_ring) +
+		sizeof(struct wsa_packet_slice) * slots + (size_t) slice_size * slots +
+		3 * WSA_ARENA_ALIGNMENT);
+	r = (struct wsa_packet_ring *) wsa_arena_alloc(&arena, sizeof(struct wsa_packet_ring));
+	if (r == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	r->slices = (struct wsa_packet_slice *) wsa_arena_alloc(&arena,
+		sizeof(struct wsa_packet_slice) * slots);
+	buffers = (uint8_t *) wsa_arena_alloc(&arena, (size_t) slice_size * slots);
+	r->arena = arena;
+	if (r->slices == NULL || buffers == NULL) {
+		wsa_packet_ring_free(r);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	r->slots = slots;
+	r->slice_size = slice_size;
+	r->next = 0;
+
+	for (i = 0; i < slots; i++) {
+		r->slices[i].packet = buffers + (size_t) slice_size * i;
+		r->slices[i].bytes = 0;
+		r->slices[i].payload = NULL;
+		r->slices[i].payload_bytes = 0;
+		r->slices[i].refs = 0;
+	}
+
+	*ring = r;
+	return 0;
+}
+
+
+/**
+ * frees a packet ring.  Any slice still held goes with it.
+ *
+ * @param ring - the ring to free
+ */
+void wsa_packet_ring_free(struct wsa_packet_ring *ring)
+{
+	wsa_arena_free_self(&ring->arena);
+}
+
+
+/**
+ * reads the next VRT packet from a device into a free buffer of a ring.
+ * The packet is decoded as by wsa_read_vrt_packet_raw(), but its payload is
+ * left where it was received.  The slice comes with one reference held for
+ * the caller; hand it to more consumers with wsa_packet_slice_hold().
+ *
+ * @param dev - the device to read from
+ * @param ring - the ring to read into
+ * @param timeout - the timeout in milliseconds
+ * @param slice - a pointer to store the slice holding the packet in
+ *
+ * @return 0 on success, WSA_ERR_BUFFERSHELD if every buffer is still held,
+ *		or another negative number on error
+ */
+int16_t wsa_packet_ring_read(struct wsa_device *dev, struct wsa_packet_ring *ring,
+		uint32_t timeout, struct wsa_packet_slice **slice)
+{
+	struct wsa_packet_slice *s = NULL;
+	struct wsa_receiver_packet receiver;
+	struct wsa_digitizer_packet digitizer;
+	struct wsa_extension_packet extension;
+	uint32_t slot = ring->next;
+	uint32_t words;
+	uint32_t i;
+	int16_t result;
+
+	// slices are mostly released in the order they're read, so the oldest
+	// buffer is the one most likely to be free
+	for (i = 0; i < ring->slots; i++) {
+		slot = (ring->next + i) % ring->slots;
+		if (wsa_atomic_load32(&ring->slices[slot].refs) == 0) {
+			s = &ring->slices[slot];
+			break;
+		}
+	}
+	if (s == NULL)
+		return WSA_ERR_BUFFERSHELD;
+
+	result = wsa_read_vrt_packet_into(dev, &s->header, &s->trailer, &receiver,
+		&digitizer, &extension, s->packet, ring->slice_size, &s->bytes, timeout);
+	if (result < 0)
+		return result;
+
+	s->context = dev->context;
+
+	if (s->header.stream_id == I16Q16_DATA_STREAM_ID ||
+		s->header.stream_id == I16_DATA_STREAM_ID ||
+		s->header.stream_id == I32_DATA_STREAM_ID) {
+		// the same payload wsa_decode_vrt_packet() copies out
+		words = s->bytes / BYTES_PER_VRT_WORD;
+		s->payload = s->packet + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD;
+		s->payload_bytes = words > VRT_HEADER_SIZE + VRT_TRAILER_SIZE ?
+			(words - VRT_HEADER_SIZE - VRT_TRAILER_SIZE) * BYTES_PER_VRT_WORD : 0;
+	} else {
+		s->payload = NULL;
+		s->payload_bytes = 0;
+	}
+
+	ring->next = (slot + 1) % ring->slots;
+	wsa_atomic_store32(&s->refs, 1);
+
+	*slice = s;
+	return 0;
+}
+
+
+/**
+ * adds references to a slice, one for each consumer it is handed to.
+ * Only a holder of a reference may add more.
+ *
+ * @param slice - the slice
+ * @param count - the number of references to add
+ */
+void wsa_packet_slice_hold(struct wsa_packet_slice *slice, uint32_t count)
+{
+	wsa_atomic_add32(&slice->refs, count);
+}
+
+
+/**
+ * releases a reference to a slice.  Its buffer is read into again once the
+ * last reference is released, so the slice must not be used after.
+ *
+ * @param slice - the slice
+ */
+void wsa_packet_slice_release(struct wsa_packet_slice *slice)
+{
+	wsa_atomic_add32(&slice->refs, (uint32_t) -1);
+}
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "wsa_perf.h"
+#include "wsa_trace.h"
+#include "wsa_error.h"
+
+
+/// the histogram for one pipeline stage
+struct wsa_perf_histogram {
+	uint32_t buckets[WSA_PERF_BUCKETS];
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+int wsa_perf_enabled = 0;
+
+static struct wsa_perf_histogram wsa_perf_histograms[WSA_PERF_NUM_STAGES];
+
+static const char *wsa_perf_stage_names[WSA_PERF_NUM_STAGES] = {
+	"socket_wait",
+	"vrt_parse",
+	"decode",
+	"window",
+	"fft",
+	"log_power",
+	"stitch"
+};
+
+
+/**
+ * find the position of the most significant set bit of a non-zero value
+ *
+ * @param value - the value to inspect
+ * @returns the bit position, 0 being the least significant bit
+ */
+static int wsa_perf_msb(uint64_t value)
+{
+#ifdef __GNUC__
+	return 63 - __builtin_clzll(value);
+#else
+	int msb = 0;
+
+	while (value >>= 1)
+		msb++;
+
+	return msb;
+#endif
+}
+
+
+/**
+ * maps a latency to its histogram bucket
+ *
+ * @param value - the latency in nanoseconds
+ * @returns the bucket index
+ */
+static int wsa_perf_bucket_index(uint64_t value)
+{
+	int shift;
+	int index;
+
+	// the first two magnitudes are exact
+	if (value < (2 * WSA_PERF_SUB_BUCKETS))
+		return (int) value;
+
+	shift = wsa_perf_msb(value) - WSA_PERF_SUB_BUCKET_BITS;
+	index = ((shift + 1) << WSA_PERF_SUB_BUCKET_BITS) +
+		(int) ((value >> shift) - WSA_PERF_SUB_BUCKETS);
+
+	// clamp anything beyond the range into the last bucket
+	if (index >= WSA_PERF_BUCKETS)
+		index = WSA_PERF_BUCKETS - 1;
+
+	return index;
+}
+
+
+/**
+ * maps a bucket back to the highest latency it can hold
+ *
+ * @param index - the bucket index
+ * @returns the latency in nanoseconds
+ */
+static uint64_t wsa_perf_bucket_value(int index)
+{
+	int shift;
+	uint64_t sub;
+
+	if (index < (2 * WSA_PERF_SUB_BUCKETS))
+		return (uint64_t) index;
+
+	shift = (index >> WSA_PERF_SUB_BUCKET_BITS) - 1;
+	sub = (uint64_t) (WSA_PERF_SUB_BUCKETS + (index & (WSA_PERF_SUB_BUCKETS - 1)));
+
+	return ((sub + 1) << shift) - 1;
+}
+
+
+/**
+ * enables or disables recording of the per-stage latency histograms.
+ * Recording is disabled by default.
+ *
+ * @param enable - 1 to record, 0 to stop recording
+ */
+void wsa_perf_enable(int enable)
+{
+	wsa_perf_enabled = enable;
+}
+
+
+/**
+ * clears the latencies recorded for every stage
+ */
+void wsa_perf_reset(void)
+{
+	memset(wsa_perf_histograms, 0, sizeof(wsa_perf_histograms));
+}
+
+
+/**
+ * reads the monotonic clock
+ *
+ * @returns the current time in nanoseconds from an arbitrary origin
+ */
+uint64_t wsa_perf_now(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+
+	QueryPerformanceCounter(&counter);
+
+	return (uint64_t) ((counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+		((counter.QuadPart % frequency.QuadPart) * 1000000000ULL) / frequency.QuadPart);
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t) now.tv_sec * 1000000000ULL) + (uint64_t) now.tv_nsec;
+#endif
+}
+
+
+/**
+ * records the time spent in a stage.  Use WSA_PERF_START() and WSA_PERF_STOP()
+ * rather than calling this directly, so nothing is recorded while disabled.
+ *
+ * @param stage - the WSA_PERF_* stage
+ * @param start_ns - the wsa_perf_now() time stamp taken when the stage began
+ */
+void wsa_perf_record(int stage, uint64_t start_ns)
+{
+	struct wsa_perf_histogram *hist;
+	uint64_t now;
+	uint64_t elapsed;
+
+	if (stage < 0 || stage >= WSA_PERF_NUM_STAGES)
+		return;
+
+	now = wsa_perf_now();
+	if (wsa_trace_enabled)
+		wsa_trace_record(wsa_perf_stage_names[stage], "pipeline", NULL, start_ns, now);
+
+	if (!wsa_perf_enabled)
+		return;
+
+	elapsed = now - start_ns;
+	hist = &wsa_perf_histograms[stage];
+
+	hist->buckets[wsa_perf_bucket_index(elapsed)]++;
+	hist->count++;
+	hist->total_ns += elapsed;
+	if (elapsed > hist->max_ns)
+		hist->max_ns = elapsed;
+}
+
+
+/**
+ * summarizes the latencies recorded for a stage
+ *
+ * @param stage - the WSA_PERF_* stage
+ * @param summary - a pointer to store the count, total, p50, p99 and max (in ns)
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_perf_get_summary(int stage, struct wsa_perf_summary *summary)
+{
+	struct wsa_perf_histogram *hist;
+	uint64_t p50_rank;
+	uint64_t p99_rank;
+	uint64_t seen = 0;
+	int have_p50 = 0;
+	int i;
+
+	if (stage < 0 || stage >= WSA_PERF_NUM_STAGES || summary == NULL)
+		return WSA_ERR_INVINPUT;
+
+	hist = &wsa_perf_histograms[stage];
+	memset(summary, 0, sizeof(struct wsa_perf_summary));
+
+	summary->count = hist->count;
+	summary->total_ns = hist->total_ns;
+	summary->max_ns = hist->max_ns;
+	if (hist->count == 0)
+		return 0;
+
+	// ranks of the percentiles, rounded up
+	p50_rank = (hist->count * 50 + 99) / 100;
+	p99_rank = (hist->count * 99 + 99) / 100;
+
+	for (i = 0; i < WSA_PERF_BUCKETS; i++) {
+		if (hist->buckets[i] == 0)
+			continue;
+
+		seen += hist->buckets[i];
+		if (!have_p50 && seen >= p50_rank) {
+			summary->p50_ns = wsa_perf_bucket_value(i);
+			have_p50 = 1;
+		}
+		if (seen >= p99_rank) {
+			summary->p99_ns = wsa_perf_bucket_value(i);
+			break;
+		}
+	}
+
+	// bucket bounds can overshoot the largest value seen
+	if (summary->p50_ns > summary->max_ns)
+		summary->p50_ns = summary->max_ns;
+	if (summary->p99_ns > summary->max_ns)
+		summary->p99_ns = summary->max_ns;
+
+	return 0;
+}
+
+
+/**
+ * returns a short name for a stage, suitable for reports
+ *
+ * @param stage - the WSA_PERF_* stage
+ * @returns the name, or NULL if the stage is invalid
+ */
+const char *wsa_perf_stage_name(int stage)
+{
+	if (stage < 0 || stage >= WSA_PERF_NUM_STAGES)
+		return NULL;
+
+	return wsa_perf_stage_names[stage];
+}
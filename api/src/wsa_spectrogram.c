@@ -0,0 +1,332 @@
+#include <string.h>
+
+#include "wsa_spectrogram.h"
+#include "wsa_lib.h"
+#include "wsa_dsp.h"
+#include "wsa_error.h"
+#include "wsa_perf.h"
+
+
+/**
+ * allocates a spectrogram, with its ring of rows and every buffer needed
+ * to compute them
+ *
+ * @param fft_size - the samples in each STFT frame, a multiple of 2
+ * @param hop - the samples between the starts of consecutive frames
+ * @param rows - the number of rows the ring keeps
+ * @param complex_input - 1 if the samples will be IQ (ZIF), 0 if I-only
+ * @param spectrogram - a pointer to store the new spectrogram in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_spectrogram_alloc(uint32_t fft_size, uint32_t hop, uint32_t rows,
+		uint8_t complex_input, struct wsa_spectrogram **spectrogram)
+{
+	struct wsa_spectrogram *sg;
+	struct wsa_arena arena;
+	size_t cfg_bytes = 0;
+	size_t bytes;
+	uint32_t bins;
+	uint32_t i;
+
+	if (fft_size < 2 || (fft_size & 1) || hop == 0 || rows == 0)
+		return WSA_ERR_INVINPUT;
+
+	bins = complex_input ? fft_size : fft_size / 2;
+	kiss_fft_alloc((int) fft_size, 0, NULL, &cfg_bytes);
+
+	// the struct, the ring and the workspaces all share one block
+	bytes = sizeof(struct wsa_spectrogram) +
+		sizeof(float) * (size_t) bins * rows +
+		3 * sizeof(kiss_fft_scalar) * fft_size +
+		2 * sizeof(kiss_fft_cpx) * fft_size +
+		cfg_bytes +
+		8 * WSA_ARENA_ALIGNMENT;
+
+	wsa_arena_init(&arena, bytes);
+	sg = (struct wsa_spectrogram *) wsa_arena_alloc(&arena, sizeof(struct wsa_spectrogram));
+	if (sg == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	memset(sg, 0, sizeof(struct wsa_spectrogram));
+
+	sg->ring = (float *) wsa_arena_alloc(&arena, sizeof(float) * (size_t) bins * rows);
+	sg->window = (kiss_fft_scalar *) wsa_arena_alloc(&arena, sizeof(kiss_fft_scalar) * fft_size);
+	sg->idata = (kiss_fft_scalar *) wsa_arena_alloc(&arena, sizeof(kiss_fft_scalar) * fft_size);
+	sg->qdata = (kiss_fft_scalar *) wsa_arena_alloc(&arena, sizeof(kiss_fft_scalar) * fft_size);
+	sg->fft_in = (kiss_fft_cpx *) wsa_arena_alloc(&arena, sizeof(kiss_fft_cpx) * fft_size);
+	sg->fft_out = (kiss_fft_cpx *) wsa_arena_alloc(&arena, sizeof(kiss_fft_cpx) * fft_size);
+	sg->fft_cfg = (kiss_fft_cfg) wsa_arena_alloc(&arena, cfg_bytes);
+	sg->arena = arena;
+	if (sg->ring == NULL || sg->window == NULL || sg->idata == NULL ||
+		sg->qdata == NULL || sg->fft_in == NULL || sg->fft_out == NULL ||
+		sg->fft_cfg == NULL) {
+		wsa_spectrogram_free(sg);
+		return WSA_ERR_MALLOCFAILED;
+	}
+	kiss_fft_alloc((int) fft_size, 0, sg->fft_cfg, &cfg_bytes);
+
+	sg->fft_size = fft_size;
+	sg->hop = hop;
+	sg->bins = bins;
+	sg->rows = rows;
+	sg->complex_input = complex_input ? 1 : 0;
+
+	// window a frame of ones once, instead of every frame
+	for (i = 0; i < fft_size; i++)
+		sg->window[i] = 1;
+	window_hanning_scalar_array(sg->window, (int) fft_size);
+
+	*spectrogram = sg;
+	return 0;
+}
+
+
+/**
+ * frees a spectrogram and all its buffers
+ *
+ * @param spectrogram - the spectrogram to free
+ */
+void wsa_spectrogram_free(struct wsa_spectrogram *spectrogram)
+{
+	wsa_arena_free_self(&spectrogram->arena);
+}
+
+
+/**
+ * empties a spectrogram's ring and drops any samples waiting for a frame
+ *
+ * @param spectrogram - the spectrogram
+ */
+void wsa_spectrogram_reset(struct wsa_spectrogram *spectrogram)
+{
+	spectrogram->frames = 0;
+	spectrogram->pending = 0;
+	spectrogram->skip = 0;
+}
+
+
+/**
+ * gets the next row of the ring to write, overwriting the oldest once the
+ * ring is full
+ *
+ * @param sg - the spectrogram
+ *
+ * @return the row
+ */
+static float *wsa_spectrogram_next_row(struct wsa_spectrogram *sg)
+{
+	return sg->ring + (size_t) (sg->frames % sg->rows) * sg->bins;
+}
+
+
+/**
+ * computes the STFT frame of the samples waiting in the spectrogram into
+ * its next row
+ *
+ * @param sg - the spectrogram, with fft_size samples pending
+ */
+static void wsa_spectrogram_frame(struct wsa_spectrogram *sg)
+{
+	float *row = wsa_spectrogram_next_row(sg);
+	kiss_fft_scalar tmpscalar;
+	uint32_t n = sg->fft_size;
+	uint32_t half = n >> 1;
+	uint32_t i;
+	uint64_t perf_ts;
+
+	WSA_PERF_START(perf_ts);
+	for (i = 0; i < n; i++) {
+		sg->fft_in[i].r = sg->idata[i] * sg->window[i];
+		sg->fft_in[i].i = sg->complex_input ? sg->qdata[i] * sg->window[i] : 0;
+	}
+	WSA_PERF_STOP(WSA_PERF_WINDOW, perf_ts);
+
+	WSA_PERF_START(perf_ts);
+	kiss_fft(sg->fft_cfg, sg->fft_in, sg->fft_out);
+	WSA_PERF_STOP(WSA_PERF_FFT, perf_ts);
+
+	// same scaling as the sweep spectra, without the reference level.
+	// IQ rows are shifted so DC is in the middle; I-only rows keep the
+	// positive half, like rfft()
+	WSA_PERF_START(perf_ts);
+	for (i = 0; i < sg->bins; i++) {
+		if (sg->complex_input)
+			tmpscalar = cpx_to_power(sg->fft_out[(i + half) % n]) / n;
+		else
+			tmpscalar = cpx_to_power(sg->fft_out[i]) / n;
+		row[i] = 2 * power_to_logpower(tmpscalar);
+	}
+	WSA_PERF_STOP(WSA_PERF_LOG_POWER, perf_ts);
+
+	sg->frames++;
+}
+
+
+/**
+ * adds streamed samples to a spectrogram, computing a row for every
+ * \b hop samples once a whole frame is available.  Samples left over are
+ * kept for the next call, so packets of any size can be pushed.
+ *
+ * @param spectrogram - the spectrogram
+ * @param stream_id - the stream the samples came from, which must be
+ *		I16Q16_DATA_STREAM_ID for an IQ spectrogram and I16_DATA_STREAM_ID or
+ *		I32_DATA_STREAM_ID otherwise
+ * @param i16_buffer - the 16-bit I data, for IQ and I16 streams
+ * @param q16_buffer - the 16-bit Q data, for IQ streams
+ * @param i32_buffer - the 32-bit I data, for I32 streams
+ * @param samples - the number of samples in the buffers
+ *
+ * @return the number of rows added, or a negative number on error
+ */
+int32_t wsa_spectrogram_push_iq(struct wsa_spectrogram *spectrogram,
+		uint32_t stream_id,
+		int16_t *i16_buffer,
+		int16_t *q16_buffer,
+		int32_t *i32_buffer,
+		int32_t samples)
+{
+	struct wsa_spectrogram *sg = spectrogram;
+	uint32_t keep;
+	uint32_t n;
+	int32_t pos = 0;
+	int32_t added = 0;
+
+	if (sg->complex_input != (stream_id == I16Q16_DATA_STREAM_ID))
+		return WSA_ERR_INVINPUT;
+
+	while (pos < samples) {
+		// drop the gap between frames
+		if (sg->skip) {
+			n = (uint32_t) (samples - pos);
+			if (n > sg->skip)
+				n = sg->skip;
+			sg->skip -= n;
+			pos += n;
+			continue;
+		}
+
+		n = sg->fft_size - sg->pending;
+		if (n > (uint32_t) (samples - pos))
+			n = (uint32_t) (samples - pos);
+
+		if (stream_id == I16Q16_DATA_STREAM_ID)
+			normalize_iq_data((int32_t) n, stream_id, i16_buffer + pos,
+				q16_buffer + pos, NULL, sg->idata + sg->pending,
+				sg->qdata + sg->pending);
+		else if (stream_id == I16_DATA_STREAM_ID)
+			normalize_iq_data((int32_t) n, stream_id, i16_buffer + pos,
+				NULL, NULL, sg->idata + sg->pending, NULL);
+		else
+			normalize_iq_data((int32_t) n, stream_id, NULL, NULL,
+				i32_buffer + pos, sg->idata + sg->pending, NULL);
+
+		sg->pending += n;
+		pos += n;
+
+		if (sg->pending < sg->fft_size)
+			break;
+
+		wsa_spectrogram_frame(sg);
+		added++;
+
+		// slide the overlap to the front for the next frame
+		if (sg->hop < sg->fft_size) {
+			keep = sg->fft_size - sg->hop;
+			memmove(sg->idata, sg->idata + sg->hop, sizeof(kiss_fft_scalar) * keep);
+			if (sg->complex_input)
+				memmove(sg->qdata, sg->qdata + sg->hop, sizeof(kiss_fft_scalar) * keep);
+			sg->pending = keep;
+		} else {
+			sg->pending = 0;
+			sg->skip = sg->hop - sg->fft_size;
+		}
+	}
+	return added;
+}
+
+
+/**
+ * adds a whole spectrum, such as a sweep from wsa_capture_power_spectrum(),
+ * as the next row of a spectrogram.  A spectrum of a different length than
+ * the rows is resampled, keeping the peak of the values that fall into
+ * each bin.
+ *
+ * @param spectrogram - the spectrogram
+ * @param spectrum - the spectrum, in dB
+ * @param len - the number of values in the spectrum
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_spectrogram_push_spectrum(struct wsa_spectrogram *spectrogram,
+		float const *spectrum, uint32_t len)
+{
+	struct wsa_spectrogram *sg = spectrogram;
+	float *row;
+	float peak;
+	uint32_t start;
+	uint32_t stop;
+	uint32_t i;
+	uint32_t j;
+
+	if (len == 0)
+		return WSA_ERR_INVINPUT;
+
+	row = wsa_spectrogram_next_row(sg);
+	if (len == sg->bins) {
+		memcpy(row, spectrum, sizeof(float) * len);
+	} else {
+		for (i = 0; i < sg->bins; i++) {
+			start = (uint32_t) (((uint64_t) i * len) / sg->bins);
+			stop = (uint32_t) (((uint64_t) (i + 1) * len) / sg->bins);
+			if (stop <= start)
+				stop = start + 1;
+
+			peak = spectrum[start];
+			for (j = start + 1; j < stop; j++) {
+				if (spectrum[j] > peak)
+					peak = spectrum[j];
+			}
+			row[i] = peak;
+		}
+	}
+
+	sg->frames++;
+
+	return 0;
+}
+
+
+/**
+ * gets the number of the oldest row still in a spectrogram's ring
+ *
+ * @param spectrogram - the spectrogram
+ *
+ * @return the row number, which equals spectrogram->frames if the ring is
+ * empty
+ */
+uint64_t wsa_spectrogram_oldest(struct wsa_spectrogram const *spectrogram)
+{
+	if (spectrogram->frames > spectrogram->rows)
+		return spectrogram->frames - spectrogram->rows;
+	return 0;
+}
+
+
+/**
+ * gets a row of a spectrogram, in place in the ring.  The row stays valid
+ * until \b rows more rows have been added.
+ *
+ * @param spectrogram - the spectrogram
+ * @param frame - the row number, from wsa_spectrogram_oldest() to
+ *		spectrogram->frames - 1
+ *
+ * @return the \b bins values of the row, or NULL if the row has been
+ * overwritten or not written yet
+ */
+float *wsa_spectrogram_row(struct wsa_spectrogram const *spectrogram, uint64_t frame)
+{
+	if (frame >= spectrogram->frames || frame < wsa_spectrogram_oldest(spectrogram))
+		return NULL;
+
+	return spectrogram->ring + (size_t) (frame % spectrogram->rows) * spectrogram->bins;
+}
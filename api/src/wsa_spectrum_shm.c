@@ -0,0 +1,417 @@
+#include <string.h>
+
+#include "wsa_spectrum_shm.h"
+#include "wsa_sweep_device.h"
+#include "wsa_atomic.h"
+#include "wsa_error.h"
+#include "wsa_perf.h"
+
+
+/**
+ * finds a slot of a ring
+ *
+ * @param header - the start of the segment
+ * @param slot_size - the bytes from one slot to the next
+ * @param index - the slot's index
+ *
+ * @return the slot
+ */
+static struct wsa_spectrum_shm_slot *wsa_spectrum_slot(struct wsa_spectrum_shm_header *header,
+		uint32_t slot_size, uint32_t index)
+{
+	return (struct wsa_spectrum_shm_slot *) ((uint8_t *) header +
+		sizeof(struct wsa_spectrum_shm_header) + (size_t) slot_size * index);
+}
+
+
+/**
+ * creates a spectrum ring in a new shared memory segment, replacing any
+ * of the same name, and a publisher to fill it
+ *
+ * @param name - the segment name, which readers open it by
+ * @param slots - the number of spectra the ring holds, at least 1; a
+ *		reader falls behind once that many are published before it reads
+ * @param max_bins - the most bins a spectrum published can have
+ * @param publisher - a pointer to store the new publisher in
+ *
+ * @return 0 on success, WSA_ERR_SHMINUSE on Windows if a reader of an
+ *		older segment of the name still has it open, or another negative
+ *		number on error
+ */
+int16_t wsa_spectrum_publisher_new(char const *name, uint32_t slots, uint32_t max_bins,
+		struct wsa_spectrum_publisher **publisher)
+{
+	struct wsa_spectrum_publisher *p;
+	struct wsa_spectrum_shm_header *header;
+	struct wsa_arena arena;
+	uint32_t slot_size;
+	int16_t result;
+
+	if (slots == 0 || max_bins == 0 ||
+			max_bins > (0xffffffff - WSA_SPECTRUM_SHM_DATA - 63) / sizeof(float))
+		return WSA_ERR_INVINPUT;
+
+	// keep every slot on its own cache lines
+	slot_size = (WSA_SPECTRUM_SHM_DATA + sizeof(float) * max_bins + 63) & ~63;
+
+	wsa_arena_init(&arena, sizeof(struct wsa_spectrum_publisher) + WSA_ARENA_ALIGNMENT);
+	p = (struct wsa_spectrum_publisher *) wsa_arena_alloc(&arena, sizeof(struct wsa_spectrum_publisher));
+	if (p == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	p->arena = arena;
+
+	result = wsa_shm_create(&p->shm, name, sizeof(struct wsa_spectrum_shm_header) +
+		(size_t) slot_size * slots, 0);
+	if (result < 0) {
+		wsa_arena_free_self(&p->arena);
+		return result;
+	}
+
+	// the segment starts zeroed, so every slot is empty; readers go by
+	// the magic number, so that is set once the rest is
+	header = (struct wsa_spectrum_shm_header *) p->shm.addr;
+	header->version = WSA_SPECTRUM_SHM_VERSION;
+	header->slots = slots;
+	header->max_bins = max_bins;
+	header->slot_size = slot_size;
+	header->latest = WSA_SPECTRUM_SHM_NONE;
+	wsa_atomic_store32(&header->magic, WSA_SPECTRUM_SHM_MAGIC);
+
+	p->header = header;
+	p->sweeps = 0;
+
+	*publisher = p;
+	return 0;
+}
+
+
+/**
+ * frees a publisher and removes its segment's name.  Readers that have it
+ * open keep what was published until they close it.
+ *
+ * @param publisher - the publisher to free
+ */
+void wsa_spectrum_publisher_free(struct wsa_spectrum_publisher *publisher)
+{
+	wsa_shm_close(&publisher->shm);
+
+	wsa_arena_free_self(&publisher->arena);
+}
+
+
+/**
+ * publishes a spectrum into the next slot of the ring, over the oldest
+ * spectrum in it
+ *
+ * @param publisher - the publisher
+ * @param fstart - the frequency of the first bin
+ * @param fstop - the end of the span
+ * @param rbw - the width of each bin
+ * @param data - the bins
+ * @param bins - the number of bins, up to the ring's max_bins
+ * @param oldest - the device time stamp of the first step swept, or NULL
+ * @param newest - the device time stamp of the last step swept, or NULL
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_spectrum_publish(struct wsa_spectrum_publisher *publisher,
+		uint64_t fstart, uint64_t fstop, uint64_t rbw,
+		float const *data, uint32_t bins,
+		struct wsa_time const *oldest, struct wsa_time const *newest)
+{
+	struct wsa_spectrum_shm_header *header = publisher->header;
+	struct wsa_spectrum_shm_slot *slot;
+	uint32_t index;
+	uint32_t seq;
+
+	if (data == NULL || bins > header->max_bins)
+		return WSA_ERR_INVINPUT;
+
+	publisher->sweeps++;
+	index = (uint32_t) ((publisher->sweeps - 1) % header->slots);
+	slot = wsa_spectrum_slot(header, header->slot_size, index);
+
+	// mark the slot as being written before touching any of it
+	seq = slot->seq;
+	wsa_atomic_store32(&slot->seq, seq + 1);
+	wsa_atomic_fence();
+
+	slot->bins = bins;
+	slot->sweep = publisher->sweeps;
+	slot->fstart = fstart;
+	slot->fstop = fstop;
+	slot->rbw = rbw;
+	slot->oldest_sec = oldest ? oldest->sec : 0;
+	slot->oldest_psec = oldest ? oldest->psec : 0;
+	slot->newest_sec = newest ? newest->sec : 0;
+	slot->newest_psec = newest ? newest->psec : 0;
+	slot->published_ns = wsa_perf_now();
+	memcpy((uint8_t *) slot + WSA_SPECTRUM_SHM_DATA, data, sizeof(float) * bins);
+
+	wsa_atomic_store32(&slot->seq, seq + 2);
+	wsa_atomic_store32(&header->latest, index);
+
+	return 0;
+}
+
+
+/**
+ * publishes the spectrum of a power spectrum config, as its last capture
+ * or refresh left it.  Its time stamps are those of the steps swept
+ * longest ago and most recently.
+ *
+ * @param publisher - the publisher
+ * @param cfg - the power spectrum config
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_spectrum_publish_config(struct wsa_spectrum_publisher *publisher,
+		struct wsa_power_spectrum_config const *cfg)
+{
+	struct wsa_sweep_step const *step;
+	struct wsa_time const *oldest = NULL;
+	struct wsa_time const *newest = NULL;
+	struct wsa_time const *ts;
+
+	for (step = cfg->steps; step < cfg->steps + cfg->step_count; step++) {
+		if (step->swept == 0)
+			continue;
+
+		ts = &step->time_stamp;
+		if (oldest == NULL || ts->sec < oldest->sec ||
+				(ts->sec == oldest->sec && ts->psec < oldest->psec))
+			oldest = ts;
+		if (newest == NULL || ts->sec > newest->sec ||
+				(ts->sec == newest->sec && ts->psec > newest->psec))
+			newest = ts;
+	}
+
+	return wsa_spectrum_publish(publisher, cfg->fstart, cfg->fstop, cfg->rbw,
+		cfg->buf, cfg->buflen, oldest, newest);
+}
+
+
+/**
+ * opens a spectrum ring another process publishes into
+ *
+ * @param name - the segment name the publisher was created with
+ * @param reader - a pointer to store the new reader in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_spectrum_reader_open(char const *name, struct wsa_spectrum_reader **reader)
+{
+	struct wsa_spectrum_reader *r;
+	struct wsa_spectrum_shm_header *header;
+	struct wsa_arena arena;
+	int16_t result;
+
+	wsa_arena_init(&arena, sizeof(struct wsa_spectrum_reader) + WSA_ARENA_ALIGNMENT);
+	r = (struct wsa_spectrum_reader *) wsa_arena_alloc(&arena, sizeof(struct wsa_spectrum_reader));
+	if (r == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	r->arena = arena;
+
+	result = wsa_shm_open(&r->shm, name);
+	if (result < 0) {
+		wsa_arena_free_self(&r->arena);
+		return result;
+	}
+
+	// check the layout once, and keep it, so that nothing written into
+	// the segment later can make the reader stray outside it
+	header = (struct wsa_spectrum_shm_header *) r->shm.addr;
+	if (r->shm.size < sizeof(struct wsa_spectrum_shm_header) ||
+			wsa_atomic_load32(&header->magic) != WSA_SPECTRUM_SHM_MAGIC ||
+			header->version != WSA_SPECTRUM_SHM_VERSION) {
+		wsa_spectrum_reader_close(r);
+		return WSA_ERR_SHMINVALID;
+	}
+
+	r->slots = header->slots;
+	r->max_bins = header->max_bins;
+	r->slot_size = header->slot_size;
+	if (r->slots == 0 || r->max_bins == 0 ||
+			r->max_bins > (0xffffffff - WSA_SPECTRUM_SHM_DATA) / sizeof(float) ||
+			r->slot_size < WSA_SPECTRUM_SHM_DATA + sizeof(float) * r->max_bins ||
+			sizeof(struct wsa_spectrum_shm_header) + (uint64_t) r->slot_size * r->slots > r->shm.size) {
+		wsa_spectrum_reader_close(r);
+		return WSA_ERR_SHMINVALID;
+	}
+
+	r->header = header;
+	r->last = 0;
+	r->missed = 0;
+
+	*reader = r;
+	return 0;
+}
+
+
+/**
+ * closes a spectrum ring and frees the reader
+ *
+ * @param reader - the reader to close
+ */
+void wsa_spectrum_reader_close(struct wsa_spectrum_reader *reader)
+{
+	wsa_shm_close(&reader->shm);
+
+	wsa_arena_free_self(&reader->arena);
+}
+
+
+/**
+ * copies a slot of the ring whole, retrying while the publisher writes it
+ *
+ * @param reader - the reader
+ * @param index - the slot's index
+ * @param info - where to store what was published with the spectrum
+ * @param buf - where to store the bins, or NULL for just the info
+ *
+ * @return 0 on success, WSA_ERR_NOSPECTRUM if the slot is empty or kept
+ *		changing, or a negative number on error
+ */
+static int16_t wsa_spectrum_slot_read(struct wsa_spectrum_reader *reader, uint32_t index,
+		struct wsa_spectrum_info *info, float *buf)
+{
+	struct wsa_spectrum_shm_slot *slot;
+	uint32_t seq;
+	uint32_t bins;
+	int tries;
+
+	if (index >= reader->slots)
+		return WSA_ERR_SHMINVALID;
+	slot = wsa_spectrum_slot(reader->header, reader->slot_size, index);
+
+	for (tries = 0; tries < WSA_SPECTRUM_SHM_RETRIES; tries++) {
+		seq = wsa_atomic_load32(&slot->seq);
+		if (seq == 0)
+			return WSA_ERR_NOSPECTRUM;
+		if (seq & 1)
+			continue;
+
+		// a torn count must not overrun the buffer
+		bins = slot->bins;
+		if (bins > reader->max_bins)
+			bins = reader->max_bins;
+
+		info->sweep = slot->sweep;
+		info->fstart = slot->fstart;
+		info->fstop = slot->fstop;
+		info->rbw = slot->rbw;
+		info->bins = bins;
+		info->oldest.sec = slot->oldest_sec;
+		info->oldest.psec = slot->oldest_psec;
+		info->newest.sec = slot->newest_sec;
+		info->newest.psec = slot->newest_psec;
+		info->published_ns = slot->published_ns;
+		if (buf != NULL)
+			memcpy(buf, (uint8_t *) slot + WSA_SPECTRUM_SHM_DATA, sizeof(float) * bins);
+
+		// keep the copy only if the publisher didn't touch the slot meanwhile
+		wsa_atomic_fence();
+		if (slot->seq == seq)
+			return 0;
+	}
+
+	return WSA_ERR_NOSPECTRUM;
+}
+
+
+/**
+ * reads the newest spectrum published, whether or not it was read before
+ *
+ * @param reader - the reader
+ * @param info - where to store what was published with the spectrum;
+ *		missed counts those published since the last one read that it skips
+ * @param buf - where to store the bins
+ * @param buflen - the room in buf, at least the ring's max_bins
+ *
+ * @return 0 on success, WSA_ERR_NOSPECTRUM if none is published or none
+ *		could be read whole, or a negative number on error
+ */
+int16_t wsa_spectrum_reader_latest(struct wsa_spectrum_reader *reader,
+		struct wsa_spectrum_info *info, float *buf, uint32_t buflen)
+{
+	uint32_t latest;
+	int16_t result;
+
+	if (buf == NULL || buflen < reader->max_bins)
+		return WSA_ERR_INVINPUT;
+
+	latest = wsa_atomic_load32(&reader->header->latest);
+	if (latest == WSA_SPECTRUM_SHM_NONE)
+		return WSA_ERR_NOSPECTRUM;
+
+	result = wsa_spectrum_slot_read(reader, latest, info, buf);
+	if (result < 0)
+		return result;
+
+	info->missed = 0;
+	if (info->sweep > reader->last) {
+		info->missed = info->sweep - reader->last - 1;
+		reader->missed += info->missed;
+		reader->last = info->sweep;
+	}
+
+	return 0;
+}
+
+
+/**
+ * reads the spectrum published after the last one read.  A reader that
+ * fell more than the ring behind skips to the oldest spectrum still in
+ * it, and counts those it skipped as missed.
+ *
+ * @param reader - the reader
+ * @param info - where to store what was published with the spectrum
+ * @param buf - where to store the bins
+ * @param buflen - the room in buf, at least the ring's max_bins
+ *
+ * @return 0 on success, WSA_ERR_NOSPECTRUM if none newer is published or
+ *		none could be read whole, or a negative number on error
+ */
+int16_t wsa_spectrum_reader_next(struct wsa_spectrum_reader *reader,
+		struct wsa_spectrum_info *info, float *buf, uint32_t buflen)
+{
+	struct wsa_spectrum_info newest;
+	uint64_t wanted;
+	uint32_t latest;
+	int16_t result;
+	int tries;
+
+	if (buf == NULL || buflen < reader->max_bins)
+		return WSA_ERR_INVINPUT;
+
+	for (tries = 0; tries < WSA_SPECTRUM_SHM_RETRIES; tries++) {
+		latest = wsa_atomic_load32(&reader->header->latest);
+		if (latest == WSA_SPECTRUM_SHM_NONE)
+			return WSA_ERR_NOSPECTRUM;
+
+		result = wsa_spectrum_slot_read(reader, latest, &newest, NULL);
+		if (result < 0)
+			return result;
+		if (newest.sweep <= reader->last)
+			return WSA_ERR_NOSPECTRUM;
+
+		wanted = reader->last + 1;
+		if (newest.sweep - wanted >= reader->slots)
+			wanted = newest.sweep - reader->slots + 1;
+
+		// the spectrum wanted may be written over before it's read, and
+		// then the reader looks again from the newest
+		result = wsa_spectrum_slot_read(reader,
+			(uint32_t) ((wanted - 1) % reader->slots), info, buf);
+		if (result < 0 && result != WSA_ERR_NOSPECTRUM)
+			return result;
+		if (result == 0 && info->sweep == wanted) {
+			info->missed = wanted - reader->last - 1;
+			reader->missed += info->missed;
+			reader->last = wanted;
+			return 0;
+		}
+	}
+
+	return WSA_ERR_NOSPECTRUM;
+}
@@ -18,6 +18,10 @@
 #include "kiss_fft.h"
 #include "wsa_dsp.h"
 #include "wsa_debug.h"
+#include "wsa_perf.h"
+#include "wsa_trace.h"
+#include "wsa_error.h"
+#include "wsa_spectrum_shm.h"
 #ifndef _TIMES_H
 #define _TIMES_H
 
@@ -89,13 +93,46 @@ typedef long long suseconds_t ;
 #define EINVCAPTSIZE 3
 #define ENOMEM 4
 
+/// the cost model the planner tunes blocks with, in nanoseconds: an FFT
+/// stage per point per unit of radix weight, the overhead of a packet
+/// between the device and the host, moving an I16 sample over gigabit
+/// ethernet, and the device retuning and settling at each step
+#define WSA_TUNE_FFT_NS 2.0
+#define WSA_TUNE_PACKET_NS 20000.0
+#define WSA_TUNE_SAMPLE_NS 16.0
+#define WSA_TUNE_RETUNE_NS 500000.0
+
+/// the most packets the planner splits a block into
+#define WSA_TUNE_MAX_PPB 16
+
+/// by default a refresh sweeps a quiet step once every 8 refreshes, and
+/// every time one whose power changes by 1 dB on average
+#define WSA_REFRESH_PERIOD 8
+#define WSA_REFRESH_THRESHOLD 1.0f
+
+/// how many sweeps a step's activity is averaged over, about
+#define WSA_REFRESH_SMOOTHING 4
+
+/// how long a capture waits for the first packet of a sweep, which comes
+/// once the device has tuned, and for each packet after it, in ms
+#define WSA_SWEEP_FIRST_PACKET_TIMEOUT 5000
+#define WSA_SWEEP_PACKET_TIMEOUT 500
+
 /*
  * define internal functions
  */
-static int wsa_plan_sweep(struct wsa_power_spectrum_config *);
+static int wsa_plan_sweep(struct wsa_sweep_device *, struct wsa_power_spectrum_config *);
 static int wsa_sweep_plan_load(struct wsa_sweep_device *, struct wsa_power_spectrum_config *);
+static int16_t wsa_sweep_plans_load(struct wsa_sweep_device *, struct wsa_power_spectrum_config **, uint32_t);
+static int wsa_sweep_steps_load(struct wsa_sweep_device *, struct wsa_power_spectrum_config *);
+static uint32_t wsa_sweep_steps_entries(struct wsa_power_spectrum_config *);
+static uint32_t wsa_sweep_plan_entries(struct wsa_power_spectrum_config *);
+static uint32_t wsa_sweep_plan_entry_steps(struct wsa_sweep_plan *);
 static struct wsa_sweep_device_properties *wsa_get_sweep_device_properties(uint32_t);
 
+// from wsa_lib.c
+int16_t _wsa_dev_init(struct wsa_device *dev);
+
 
 /// a list of properties that are attributed to each mode
 static struct wsa_sweep_device_properties wsa_sweep_device_properties[] = {
@@ -204,15 +241,15 @@ static const char *mode_const_to_string(uint32_t modeint)
 /**
  * creates a new sweep plan entry and initializes it with values given
  *
- * @param device - a pointer to the wsa we've connected to
+ * @param arena - the arena of the config the plan belongs to
  * @return - a pointer to the allocated sweep plan struct, or NULL on failure
  */
-struct wsa_sweep_plan *wsa_sweep_plan_entry_new(uint64_t fcstart, uint64_t fcstop, uint32_t fstep, uint32_t spp, uint32_t ppb, uint8_t dd_mode)
+struct wsa_sweep_plan *wsa_sweep_plan_entry_new(struct wsa_arena *arena, uint64_t fcstart, uint64_t fcstop, uint32_t fstep, uint32_t spp, uint32_t ppb, uint8_t dd_mode)
 {
 	struct wsa_sweep_plan *plan;
 
 	// alloc memory for object
-	plan = malloc(sizeof(struct wsa_sweep_plan));
+	plan = wsa_arena_alloc(arena, sizeof(struct wsa_sweep_plan));
 	if (plan == NULL)
 		return NULL;
 
@@ -246,6 +283,12 @@ struct wsa_sweep_device *wsa_sweep_device_new(struct wsa_device *device)
 
 	// initialize everything in the struct
 	sweepdev->real_device = device;
+	sweepdev->sweep_start_id = 0;
+	sweepdev->plan_settings.tune_blocks = 0;
+	sweepdev->plan_settings.stitch_overlap = 0;
+	sweepdev->refresh_settings.period = WSA_REFRESH_PERIOD;
+	sweepdev->refresh_settings.threshold = WSA_REFRESH_THRESHOLD;
+	sweepdev->publisher = NULL;
 
 	return sweepdev;
 }
@@ -263,6 +306,104 @@ void wsa_sweep_device_free(struct wsa_sweep_device *sweepdev)
 }
 
 
+/**
+ * counts the steps a sweep plan entry sweeps.  An entry that spans no
+ * more than one step is swept at its start only.
+ *
+ * @param plan - the sweep plan entry
+ * @return - the number of steps
+ */
+static uint32_t wsa_sweep_plan_entry_steps(struct wsa_sweep_plan *plan)
+{
+	if ((plan->fcstop - plan->fcstart) <= plan->fstep)
+		return 1;
+
+	return (uint32_t) ((plan->fcstop - plan->fcstart) / plan->fstep) + 1;
+}
+
+
+/**
+ * allocates the steps of a planned config, with room for the power of
+ * each, and works out how they are stitched
+ *
+ * @param pscfg - the config, once planned
+ * @return - 0 on success, negative on error
+ */
+static int wsa_sweep_steps_alloc(struct wsa_power_spectrum_config *pscfg)
+{
+	struct wsa_sweep_device_properties *prop;
+	struct wsa_sweep_device_properties *dd_prop;
+	struct wsa_sweep_plan *plan;
+	struct wsa_sweep_step *step;
+	uint32_t count = 0;
+	uint32_t i;
+
+	prop = wsa_get_sweep_device_properties(pscfg->mode);
+	dd_prop = wsa_get_sweep_device_properties(MODE_DD);
+	if (prop == NULL || dd_prop == NULL)
+		return -EUNSUPPORTED;
+
+	pscfg->bin_width = (double) prop->full_bw /
+		(pscfg->samples_per_packet * pscfg->packets_per_block / 2);
+
+	// neighbouring steps overlap by what the step falls short of the
+	// usable band, and their edges are faded over that many bins
+	pscfg->stitch_ramp = (double) (prop->usable_bw - pscfg->sweep_plan->fstep) / pscfg->rbw;
+
+	if (pscfg->sweep_plan->dd_mode == 1)
+		count++;
+	if (pscfg->only_dd != 1) {
+		for (plan = pscfg->sweep_plan; plan; plan = plan->next_entry)
+			count += wsa_sweep_plan_entry_steps(plan);
+	}
+
+	pscfg->steps = wsa_arena_alloc(&pscfg->arena, sizeof(struct wsa_sweep_step) * count);
+	if (pscfg->steps == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	pscfg->step_count = count;
+
+	step = pscfg->steps;
+	if (pscfg->sweep_plan->dd_mode == 1) {
+		step->plan = NULL;
+		step->freq = 0;
+		step->left = (double) dd_prop->usable_left;
+		step->right = (double) dd_prop->usable_right;
+		step++;
+	}
+	if (pscfg->only_dd != 1) {
+		for (plan = pscfg->sweep_plan; plan; plan = plan->next_entry) {
+			for (i = 0; i < wsa_sweep_plan_entry_steps(plan); i++) {
+				step->plan = plan;
+				step->freq = plan->fcstart + (uint64_t) i * plan->fstep;
+				step->left = (double) step->freq - (prop->usable_bw >> 1);
+				step->right = (double) step->freq + (prop->usable_bw >> 1);
+				step++;
+			}
+		}
+	}
+
+	for (step = pscfg->steps; step < pscfg->steps + count; step++) {
+		// the usable band, and a bin more each side to interpolate with
+		step->power_len = (uint32_t) ((step->right - step->left) / pscfg->bin_width) + 4;
+		step->power = wsa_arena_alloc(&pscfg->arena, sizeof(float) * step->power_len);
+		step->linear = wsa_arena_alloc(&pscfg->arena, sizeof(float) * step->power_len);
+		if (step->power == NULL || step->linear == NULL)
+			return WSA_ERR_MALLOCFAILED;
+		step->bins = 0;
+		step->origin = 0;
+		step->swept = 0;
+		step->time_stamp.sec = 0;
+		step->time_stamp.psec = 0;
+		step->change = 0;
+		step->activity = 0;
+		step->due = 0;
+		step->loaded = 0;
+	}
+
+	return 0;
+}
+
+
 /**
  * allocates memory to do power spectrum domain captures on the bandwidths indicated
  *
@@ -284,21 +425,32 @@ int wsa_power_spectrum_alloc(
 )
 {
 	struct wsa_power_spectrum_config *pscfg;
+	struct wsa_arena arena;
+	uint32_t total_samples;
+	size_t bytes;
 	int result;
 
-	// right now, we don't need sweep_device or mode, so just pretend to use it to get rid of compile warnings
-	sweep_device = sweep_device;
-	// alloc some memory for it
-	pscfg = malloc(sizeof(struct wsa_power_spectrum_config));
+	// alloc some memory for it, from the arena that will hold everything else
+	wsa_arena_init(&arena, WSA_SWEEP_ARENA_BLOCK_SIZE);
+	pscfg = wsa_arena_alloc(&arena, sizeof(struct wsa_power_spectrum_config));
 	if (pscfg == NULL){
 		doutf(DHIGH, "wsa_power_spectrum_alloc: Failed to initialize struct wsa_power_spectrum_config\n");
 		return -15;
 	}
+	pscfg->arena = arena;
 
 
 	// init things in it that must be initted
 	pscfg->sweep_plan = NULL;
 	pscfg->buf = NULL;
+	pscfg->fftout = NULL;
+	pscfg->stitch_weight = NULL;
+	pscfg->steps = NULL;
+	pscfg->step_count = 0;
+	pscfg->captures = 0;
+	pscfg->partial_load = 0;
+	pscfg->entry_load_ns = 0;
+	pscfg->packet_ns = 0;
 
 	// copy the sweep settings into the cfg object
 	pscfg->mode = mode_string_to_const(mode);
@@ -308,128 +460,202 @@ int wsa_power_spectrum_alloc(
 
 	// figure out a way to get that spectrum
 
-	result = wsa_plan_sweep(pscfg);
+	result = wsa_plan_sweep(sweep_device, pscfg);
 	if (result < 0){
+		wsa_power_spectrum_free(pscfg);
 		return result;
 	}
 
 	// now allocate enough buffer for the spectrum
 	pscfg->buflen = (uint32_t) ((pscfg->fstop - pscfg->fstart) / pscfg->rbw);
 
-	pscfg->buf = malloc(sizeof(float) * pscfg->buflen);
-	if (pscfg->buf == NULL) {
-		free(pscfg);
+	// and for capturing it, so a capture doesn't allocate anything.  The
+	// spectrum and the capture buffers share one block
+	total_samples = pscfg->samples_per_packet * pscfg->packets_per_block;
+	bytes = sizeof(float) * pscfg->buflen +
+		sizeof(int16_t) * pscfg->samples_per_packet +
+		sizeof(kiss_fft_scalar) * total_samples +
+		sizeof(kiss_fft_cpx) * total_samples +
+		2 * sizeof(float) * pscfg->buflen +
+		6 * WSA_ARENA_ALIGNMENT;
+
+	if (wsa_arena_reserve(&pscfg->arena, bytes) == 0) {
+		pscfg->buf = wsa_arena_alloc(&pscfg->arena, sizeof(float) * pscfg->buflen);
+		pscfg->tmp_buffer = wsa_arena_alloc(&pscfg->arena, sizeof(int16_t) * pscfg->samples_per_packet);
+		pscfg->idata = wsa_arena_alloc(&pscfg->arena, sizeof(kiss_fft_scalar) * total_samples);
+		pscfg->fftout = wsa_arena_alloc(&pscfg->arena, sizeof(kiss_fft_cpx) * total_samples);
+		pscfg->stitch_sum = wsa_arena_alloc(&pscfg->arena, sizeof(float) * pscfg->buflen);
+		pscfg->stitch_weight = wsa_arena_alloc(&pscfg->arena, sizeof(float) * pscfg->buflen);
+	}
+	if (pscfg->buf == NULL || pscfg->fftout == NULL || pscfg->stitch_weight == NULL) {
+		wsa_power_spectrum_free(pscfg);
 		return -1;
 	}
+
+	// and the steps the spectrum is stitched from
+	result = wsa_sweep_steps_alloc(pscfg);
+	if (result < 0) {
+		wsa_power_spectrum_free(pscfg);
+		return result;
+	}
 	*pscfgptr = pscfg;
 	return 0;
 }
 
 
 /**
- * destroys a power spectrum config object
+ * destroys a power spectrum config object, with its sweep plan and buffers
  *
  * @param cfg - the config oject to destroy
  */
 void wsa_power_spectrum_free(struct wsa_power_spectrum_config *cfg)
 {
-	struct wsa_sweep_plan *plan, *next;
+	wsa_arena_free_self(&cfg->arena);
+}
 
-	// free the plan, if there is one
-	plan = cfg->sweep_plan;
-	for (;;) {
-		// list is null terminated
-		if (plan == NULL)
-			break;
+/**
+ * Configure the WSA to the configuration in the power spectrum config structure
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the power spectrum config to use
+ */
+void wsa_configure_sweep(struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg)
+{
+	uint64_t trace_ts;
 
-		// store next pointer before freeing
-		next = plan->next_entry;
+	// load the sweep plan
+	WSA_TRACE_BEGIN(trace_ts);
+	wsa_sweep_plan_load(sweep_device, pscfg);
+	WSA_TRACE_END(trace_ts, "wsa_sweep_plan_load", "sweep", NULL);
+}
 
-		// free the memory
-		free(plan);
 
-		// go to next item
-		plan = next;
-	}
+/**
+ * loads the sweep plans of several configs onto the WSA as one sweep
+ * list, for wsa_capture_power_spectra() to capture them all in one sweep
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfgs - the power spectrum configs, in the order they're swept
+ * @param count - the number of configs
+ * @return - 0 on success, negative on error, when none of the configs
+ *		is loaded
+ */
+int wsa_configure_sweeps(struct wsa_sweep_device *sweep_device,
+		struct wsa_power_spectrum_config **cfgs, uint32_t count)
+{
+	uint64_t trace_ts;
+	int result;
 
-	// free the buffer
-	if (cfg->buf)
-		free(cfg->buf);
+	WSA_TRACE_BEGIN(trace_ts);
+	result = wsa_sweep_plans_load(sweep_device, cfgs, count);
+	WSA_TRACE_END(trace_ts, "wsa_sweep_plans_load", "sweep", NULL);
 
-	// free the struct
-	free(cfg);
+	return result;
 }
 
 /**
- * Configure the WSA to the configuration in the power spectrum config structure
+ * finds the step of a config that a block captured at a frequency belongs
+ * to.  Blocks mostly come in the order of the steps, so the search starts
+ * at the step after the last one found.
+ *
+ * @param cfg - the power spectrum config
+ * @param freq - the center frequency the block was captured at
+ * @param hint - the index to start at, updated to follow the step found
+ * @return - the step, or NULL if none is at that frequency
+ */
+static struct wsa_sweep_step *wsa_sweep_step_find(struct wsa_power_spectrum_config *cfg,
+		int64_t freq, uint32_t *hint)
+{
+	uint32_t first = cfg->sweep_plan->dd_mode ? 1 : 0;
+	uint32_t count;
+	uint32_t i;
+
+	if (cfg->step_count <= first)
+		return NULL;
+	count = cfg->step_count - first;
+
+	for (i = 0; i < count; i++) {
+		if (*hint < first || *hint >= cfg->step_count)
+			*hint = first;
+		if (cfg->steps[*hint].freq == (uint64_t) freq)
+			return &cfg->steps[(*hint)++];
+		(*hint)++;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * starts the sweep list loaded on the device, with an ID of its own so
+ * packets left over from an older sweep can be told apart
  *
  * @param sweep_device - the sweep device to use
- * @param cfg - the power spectrum config to use
+ * @return - 0 on success, negative on error
  */
-void wsa_configure_sweep(struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg)
+static int16_t wsa_sweep_list_start(struct wsa_sweep_device *sweep_device)
 {
-	// load the sweep plan
-	wsa_sweep_plan_load(sweep_device, pscfg);
+	sweep_device->sweep_start_id++;
+	return wsa_sweep_start_id(sweep_device->real_device, sweep_device->sweep_start_id);
 }
 
+
 /**
- * captures some power spectrum using the configuration supplied
+ * reads the packets of a config's part of the sweep list running on the
+ * device, and stores the power of each block in the config's step for
+ * it, along with how much that changed since the step was last swept
  *
  * @param sweep_device - the sweep device to use
  * @param cfg - the power spectrum config to use
- * @param buf - if buf is not NULL, a pointer to the allocated memory is stored there for convience
+ * @param packet_total - the number of packets its part of the list captures
+ * @param dd_blocks - 1 if its part starts with the DD block
+ * @param started - 1 if the parts before it already read packets, so the
+ *		first packet is waited for no longer than any other
  * @return - 0 on success, negative on error
  */
-int wsa_capture_power_spectrum(
+static int wsa_sweep_capture_steps(
 	struct wsa_sweep_device *sweep_device,
 	struct wsa_power_spectrum_config *cfg,
-	float **buf
+	uint32_t packet_total,
+	uint8_t dd_blocks,
+	uint8_t started
 )
 {
 	uint32_t i;
 	int16_t result;
-	const uint32_t total_samples = cfg->samples_per_packet * cfg->packets_per_block;
 	struct wsa_device *dev = sweep_device->real_device;
 	struct wsa_vrt_packet_header header;
 	struct wsa_vrt_packet_trailer trailer;
-	struct wsa_receiver_packet receiver;
-	struct wsa_digitizer_packet digitizer;
-	struct wsa_extension_packet sweep;
-	int16_t *i16_buffer;
+	struct wsa_packet_context context;
+	struct wsa_sweep_step *step;
 	int16_t *tmp_buffer;
-	int16_t *q16_buffer;
-	int32_t *i32_buffer;
 	kiss_fft_scalar *idata;
 	kiss_fft_cpx *fftout;
 	float pkt_reflevel = 0;
-	uint64_t pkt_fcenter = 0;
-	uint32_t buf_offset = 0;
+	float level;
+	float scale;
+	int64_t block_freq = 0;
+	double bin, origin;
+	double first, last;
 	kiss_fft_scalar tmpscalar;
+	float change;
+	double diff;
+	uint8_t compare;
 	uint32_t packet_count;
+	uint32_t hint = 0;
 	struct wsa_sweep_device_properties *prop;
-	struct wsa_sweep_device_properties *dd_prop;
-	uint32_t istart, istop, ilen;
+	uint32_t istart, istop;
 	uint32_t spp, fftlen;
 	int16_t dd_packet = 0;
 	int32_t ppb_count = 0;
 	int32_t offset = 0;
 	int x;
-	
-	// do a malloc to allocate data for each buffer
-	i16_buffer = (int16_t *) malloc(sizeof(int16_t) * total_samples);
-	tmp_buffer = (int16_t *) malloc(sizeof(int16_t) * cfg->samples_per_packet);
-	doutf(DHIGH, "wsa_capture_power_spectrum: Created I Data buffer sized: %d\n", (int) total_samples);
-	idata = (kiss_fft_scalar *) malloc(sizeof(kiss_fft_scalar) * total_samples);
-	fftout = (kiss_fft_cpx *) malloc(sizeof(kiss_fft_cpx) * total_samples);
+	uint64_t perf_ts;
 
-
-	// assign their convienence pointer
-	if (*buf)
-		*buf = cfg->buf;
-
-	// poison our buffer
-	for (i=0; i<cfg->buflen; i++)
-		cfg->buf[i] = 77;
+	// the buffers were allocated with the config
+	tmp_buffer = cfg->tmp_buffer;
+	idata = cfg->idata;
+	fftout = cfg->fftout;
 
 	// try to get device properties for this mode
 	prop = wsa_get_sweep_device_properties(cfg->mode);
@@ -438,150 +664,525 @@ int wsa_capture_power_spectrum(
 		fprintf(stderr, "error: unsupported rfe mode: %d - %s\n", cfg->mode, mode_const_to_string(cfg->mode));
 		return -EUNSUPPORTED;
 	}
-	// get the properties for DD mode
-	dd_prop = wsa_get_sweep_device_properties(8);
-	
-	// start the sweep
-	wsa_sweep_start(sweep_device->real_device);
-	
+
 	// read out all the data
 	packet_count = 0;
 	
-	while(1) {
-		if (packet_count < cfg->packets_per_block && cfg->sweep_plan->dd_mode == 1)
+	while(packet_count < packet_total) {
+		if (packet_count < cfg->packets_per_block && dd_blocks == 1)
 			dd_packet = 1;
 		else
 			dd_packet = 0;
-		// poison the buffers if last packet was a data packet
-		if (header.packet_type == IF_PACKET_TYPE) {
-			for(i=0; i<total_samples; i++)
-				i16_buffer[i] = 9999;
-		}
-
-		// read a packet
-		result = wsa_read_vrt_packet(
+		// read a data packet, with the frequency and reference level it was captured at
+		result = wsa_read_if_packet(
 			dev,
-			&header, &trailer, &receiver, &digitizer, &sweep,
-			tmp_buffer, q16_buffer, i32_buffer,
+			&header, &trailer, &context,
+			tmp_buffer, NULL, NULL,
 			cfg->samples_per_packet,
-			5000);
+			packet_count || started ? WSA_SWEEP_PACKET_TIMEOUT : WSA_SWEEP_FIRST_PACKET_TIMEOUT);
 
-		
+		// a packet lost once the sweep is under way leaves it short, and
+		// the steps it didn't get to as they were
+		if (result == WSA_ERR_QUERYNORESP && (packet_count > 0 || started)) {
+			doutf(DHIGH, "wsa_capture_power_spectrum: sweep ended after %u of %u packets\n",
+				packet_count, packet_total);
+			break;
+		}
 		if (result < 0) {
-			fprintf(stderr, "error: wsa_read_vrt_packet(): %d\n", result);
+			fprintf(stderr, "error: wsa_read_if_packet(): %d\n", result);
 			return result;
 		}
 
-		//  capture receiver context packets we need
-		if (header.stream_id == RECEIVER_STREAM_ID) {
-			// grab the center frequency for each capture
-			if ((receiver.indicator_field & FREQ_INDICATOR_MASK) == FREQ_INDICATOR_MASK) {
-				pkt_fcenter = (uint64_t) receiver.freq;
-				
-			}
-		}
+		// drop the packets of an older sweep, including those read before
+		// this sweep's ID, as the context was cleared when it started
+		if (!(context.valid & WSA_CONTEXT_SWEEP_START_ID) ||
+				context.sweep_start_id != sweep_device->sweep_start_id)
+			continue;
+
+		// a block is the packets captured at one frequency, so one cut
+		// short by a lost packet is dropped rather than mixed with the next
+		if (ppb_count > 0 && context.freq != block_freq)
+			ppb_count = 0;
+		block_freq = context.freq;
 
 		// data packets need to be parsed
-		if (header.packet_type == IF_PACKET_TYPE) {
-			doutf(DHIGH, "wsa_capture_power_spectrum: Recieved data packet %0.2f \n", (float) pkt_fcenter);
-			pkt_reflevel = (float) digitizer.reference_level;
-
-			// increase packet count
-			ppb_count++;
-			packet_count++;
-
-			// calculate buffer offset
-			offset = cfg->samples_per_packet * ppb_count;
-			for (x = 0; x < (int) cfg->samples_per_packet; x++)
-				idata[x] = ((float) tmp_buffer[x]) / 8192;
-
-			// move temporary buffer into the i16 buffer
-			if (ppb_count == cfg->packets_per_block){
-				ppb_count = 0;
-				
-				spp = header.samples_per_packet * cfg->packets_per_block;
-
-				/*
-				 * for now, we assume it's an I16 packet
-				 */
-
-				// window and normalize the data
-				window_hanning_scalar_array(idata, spp);
-
-				// fft this data
-				rfft(idata, fftout, spp);
-
-				fftlen = spp >> 1;
-
-				/*
-				 * we used to be in superhet mode, but after a complex FFT, we have twice 
-				 * the spectrum at twice the RBW.
-				 * our fcenter is now moved from center to $passband_center so our start and stop 
-				 * indexes are calculated given that fact
-				 */
-
-				// check for inversion and calculate indexes of our good data
-				if (trailer.spectral_inversion_indicator && dd_packet == 0) {
-					reverse_cpx(fftout, fftlen);
-
-					istart =  (prop->full_bw - prop->usable_right) / ((uint32_t) cfg->rbw);
-					istop = (prop->full_bw - prop->usable_left) / ( (uint32_t) cfg->rbw);
-
-				} else {
-
-					istart = prop->usable_left / ((uint32_t) cfg->rbw);
-					istop = prop->usable_right / ((uint32_t) cfg->rbw);
-				}
-
-				ilen = istop - istart;
-				// make sure we don't copy beyond end of buffer
-				if ((buf_offset + ilen) >= cfg->buflen) {
-					// reduce istop by how much it's past
-					istop = istop - ((buf_offset + ilen) - cfg->buflen);
-					ilen = istop - istart;
-				}
-				
-				// if we are in DD mode, the start and stop will be different
-				if (dd_packet == 1){
-					istart = (uint32_t) (((float)cfg->fstart /  (float) prop->full_bw) * (spp / 2));
-
-					doutf(DHIGH, "wsa_capture_power_spectrum: calculated istart %0.2f \n", (float) istart);
-					if (cfg->fstop >  (float) prop->min_tunable)
-						istop = (uint32_t) (0.8 * spp / 2);
-					else
-						istop = (uint32_t) (((float)cfg->fstop /  (float) prop->full_bw) * (spp / 2)) - 1;
-
-					buf_offset = 0;
-					ilen = istop - istart;
-
-				}
-				
-				// for the usable section, convert to power, apply reflevel and copy into buffer
-				for (i=0; i<ilen; i++) {
-					if (i + istart > (spp / 2))
-						break;
-					tmpscalar = cpx_to_power(fftout[i + istart]) / spp;
-
-					tmpscalar = 2 * power_to_logpower(tmpscalar);
-					if (buf_offset + i > cfg->buflen)
-						break;
-					cfg->buf[buf_offset + i] = tmpscalar + pkt_reflevel - (float) KISS_FFT_OFFSET;
-
-				}
-
-				buf_offset = buf_offset + ilen;
+		doutf(DHIGH, "wsa_capture_power_spectrum: Recieved data packet %0.2f \n", (float) context.freq);
+		pkt_reflevel = (float) context.reference_level;
+
+		// increase packet count
+		ppb_count++;
+		packet_count++;
+
+		// the packet's samples follow those of the block's earlier packets
+		offset = cfg->samples_per_packet * (ppb_count - 1);
+		for (x = 0; x < (int) cfg->samples_per_packet; x++)
+			idata[offset + x] = ((float) tmp_buffer[x]) / 8192;
+
+		if (ppb_count < (int32_t) cfg->packets_per_block)
+			continue;
+		ppb_count = 0;
 
+		// the step the block refreshes
+		if (dd_packet == 1)
+			step = &cfg->steps[0];
+		else
+			step = wsa_sweep_step_find(cfg, block_freq, &hint);
+		if (step == NULL) {
+			doutf(DHIGH, "wsa_capture_power_spectrum: no step at %0.2f \n", (float) block_freq);
+			continue;
+		}
+			
+		spp = header.samples_per_packet * cfg->packets_per_block;
+
+		/*
+		 * for now, we assume it's an I16 packet
+		 */
+
+		// window and normalize the data
+		window_hanning_scalar_array(idata, spp);
+
+		// fft this data
+		rfft(idata, fftout, spp);
+
+		fftlen = spp >> 1;
+
+		WSA_PERF_START(perf_ts);
+
+		/*
+		 * we used to be in superhet mode, but after a complex FFT, we have twice 
+		 * the spectrum at twice the RBW.
+		 * our fcenter is now moved from center to $passband_center so our start and stop 
+		 * indexes are calculated given that fact
+		 */
+
+		// the block's bins are a full band wide, with its center
+		// frequency $passband_center into it, or as far from its end
+		// when the spectrum is inverted; a DD block starts at 0 Hz
+		bin = (double) prop->full_bw / fftlen;
+		if (dd_packet == 1) {
+			origin = 0;
+		} else if (trailer.spectral_inversion_indicator) {
+			reverse_cpx(fftout, fftlen);
+			origin = (double) block_freq - (prop->full_bw - prop->passband_center) + bin;
+		} else {
+			origin = (double) block_freq - prop->passband_center;
+		}
+
+		// the bins of the usable band, and one more each side to
+		// interpolate with
+		first = (step->left - origin) / bin - 1;
+		last = (step->right - origin) / bin + 2;
+		istart = first < 0 ? 0 : (uint32_t) first;
+		istop = last > fftlen ? fftlen : (uint32_t) last;
+		if (istop - istart > step->power_len)
+			istop = istart + step->power_len;
+		origin += istart * bin;
+
+		// the change is only measured against the same bins
+		compare = step->swept && step->bins == istop - istart &&
+			fabs(step->origin - origin) < bin / 2;
+		WSA_PERF_STOP(WSA_PERF_STITCH, perf_ts);
+
+		// convert them to power and apply the reflevel, in dB and, for
+		// stitching, in linear power, which is the magnitude squared and
+		// scaled rather than the dB raised back up
+		WSA_PERF_START(perf_ts);
+		level = pkt_reflevel - (float) KISS_FFT_OFFSET;
+		scale = (float) pow(10, level / 10);
+		change = 0;
+		for (i = istart; i < istop; i++) {
+			tmpscalar = cpx_to_power(fftout[i]) / spp;
+			step->linear[i - istart] = tmpscalar * tmpscalar * scale;
+			tmpscalar = 2 * power_to_logpower(tmpscalar) + level;
+			// a bin with no power at all is -inf dB, which no change is
+			// measured against
+			if (compare) {
+				diff = fabs(tmpscalar - step->power[i - istart]);
+				if (diff < HUGE_VAL)
+					change += (float) diff;
 			}
+			step->power[i - istart] = tmpscalar;
+		}
+		WSA_PERF_STOP(WSA_PERF_LOG_POWER, perf_ts);
 
-			if (packet_count >= cfg->packet_total)
-				break;
+		if (compare && istop > istart) {
+			step->change = change / (istop - istart);
+			step->activity += (step->change - step->activity) / WSA_REFRESH_SMOOTHING;
+		} else {
+			step->change = 0;
 		}
+		step->origin = origin;
+		step->bins = istop - istart;
+		step->swept = cfg->captures;
+		step->time_stamp = header.time_stamp;
 	}
 
-	free(fftout);
-	free(idata);
-	free(tmp_buffer);
-	free(i16_buffer);
+	return 0;
+}
+
+
+/**
+ * stitches the steps of a config into part of its spectrum
+ *
+ * @param cfg - the power spectrum config
+ * @param first - the first bin of the spectrum to stitch
+ * @param len - the number of bins to stitch
+ * @param since - the earliest capture a step must have been swept in to
+ *		be stitched
+ */
+static void wsa_sweep_restitch(struct wsa_power_spectrum_config *cfg,
+		uint32_t first, uint32_t len, uint32_t since)
+{
+	struct wsa_sweep_step *step;
+	double step_ratio = (double) cfg->rbw / cfg->bin_width;
+	double left, right;
+	uint32_t i;
+	uint64_t perf_ts;
+
+	WSA_PERF_START(perf_ts);
+
+	for (i = first; i < first + len; i++) {
+		cfg->stitch_sum[i] = 0;
+		cfg->stitch_weight[i] = 0;
+	}
+
+	// lay each step's bins onto the spectrum's grid of one bin per rbw
+	// from fstart, blending them into the steps they overlap
+	for (step = cfg->steps; step < cfg->steps + cfg->step_count; step++) {
+		if (step->swept == 0 || step->swept < since)
+			continue;
+
+		left = (step->left - cfg->fstart) / cfg->rbw;
+		right = (step->right - cfg->fstart) / cfg->rbw;
+		if (right < first || left >= first + len)
+			continue;
+
+		stitch_block(cfg->stitch_sum + first, cfg->stitch_weight + first, len,
+			step->linear, step->bins,
+			((double) cfg->fstart - step->origin) / cfg->bin_width + first * step_ratio,
+			step_ratio, left - first, right - first, cfg->stitch_ramp);
+	}
+
+	stitch_finish(cfg->buf + first, cfg->stitch_sum + first,
+		cfg->stitch_weight + first, len);
+
+	WSA_PERF_STOP(WSA_PERF_STITCH, perf_ts);
+}
+
+
+/**
+ * publishes a config's spectrum, if the sweep device has a publisher.  A
+ * spectrum that can't be published is only logged, since the caller has
+ * it anyway.
+ *
+ * @param sweep_device - the sweep device
+ * @param cfg - the power spectrum config just captured or refreshed
+ */
+static void wsa_sweep_publish(struct wsa_sweep_device *sweep_device,
+		struct wsa_power_spectrum_config *cfg)
+{
+	int16_t result;
+
+	if (sweep_device->publisher == NULL)
+		return;
+
+	result = wsa_spectrum_publish_config(sweep_device->publisher, cfg);
+	if (result < 0)
+		doutf(DHIGH, "wsa_sweep_publish: failed to publish the spectrum: %s\n", wsa_get_error_msg(result));
+}
+
+
+/**
+ * runs the sweep list loaded on the device, which holds the sweep plans,
+ * or for a refresh the due steps, of some configs one after the other,
+ * and reads each config's packets in turn.  What a packet took is kept
+ * with each config, for wsa_sweep_steps_prepare() to weigh up.
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfgs - the configs, in the order the list has them
+ * @param count - the number of configs
+ * @return - 0 on success, negative on error
+ */
+static int wsa_sweep_list_capture(struct wsa_sweep_device *sweep_device,
+		struct wsa_power_spectrum_config **cfgs, uint32_t count)
+{
+	struct wsa_power_spectrum_config *cfg;
+	uint32_t packet_total;
+	uint8_t dd_blocks;
+	uint64_t start;
+	uint64_t now;
+	uint32_t i, j;
+	int result;
+
+	result = wsa_sweep_list_start(sweep_device);
+	if (result < 0) {
+		fprintf(stderr, "error: wsa_sweep_start_id(): %d\n", result);
+		return result;
+	}
+
+	start = wsa_perf_now();
+	for (i = 0; i < count; i++) {
+		cfg = cfgs[i];
+
+		// the packets of the config's steps on the list
+		packet_total = cfg->packet_total;
+		dd_blocks = cfg->sweep_plan->dd_mode;
+		if (cfg->partial_load) {
+			packet_total = 0;
+			for (j = 0; j < cfg->step_count; j++)
+				packet_total += cfg->steps[j].loaded * cfg->packets_per_block;
+			dd_blocks = dd_blocks && cfg->steps[0].loaded;
+		}
+
+		cfg->captures++;
+		result = wsa_sweep_capture_steps(sweep_device, cfg, packet_total,
+			dd_blocks, i > 0);
+		if (result < 0)
+			return result;
+
+		now = wsa_perf_now();
+		if (packet_total > 0)
+			cfg->packet_ns = (now - start) / packet_total;
+		start = now;
+	}
+
+	return 0;
+}
+
+
+/**
+ * captures some power spectrum using the configuration supplied
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the power spectrum config to use
+ * @param buf - if buf is not NULL, a pointer to the allocated memory is stored there for convience
+ * @return - 0 on success, negative on error
+ */
+int wsa_capture_power_spectrum(
+	struct wsa_sweep_device *sweep_device,
+	struct wsa_power_spectrum_config *cfg,
+	float **buf
+)
+{
+	// assign their convienence pointer
+	if (buf)
+		*buf = cfg->buf;
+
+	return wsa_capture_power_spectra(sweep_device, &cfg, 1);
+}
+
+
+/**
+ * captures the power spectra of several configs in one sweep, of the list
+ * wsa_configure_sweeps() loaded them in together.  If a refresh left only
+ * some steps of one of them on the device, the list is loaded again.
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfgs - the power spectrum configs, in the order they were loaded
+ * @param count - the number of configs
+ * @return - 0 on success, negative on error
+ */
+int wsa_capture_power_spectra(
+	struct wsa_sweep_device *sweep_device,
+	struct wsa_power_spectrum_config **cfgs,
+	uint32_t count
+)
+{
+	struct wsa_power_spectrum_config *cfg;
+	uint32_t i, j;
+	int result = 0;
+	uint64_t trace_ts;
+
+	WSA_TRACE_BEGIN(trace_ts);
+
+	// a refresh may leave only the steps it swept on the device
+	for (i = 0; i < count; i++) {
+		if (cfgs[i]->partial_load) {
+			result = wsa_sweep_plans_load(sweep_device, cfgs, count);
+			break;
+		}
+	}
+
+	if (result >= 0)
+		result = wsa_sweep_list_capture(sweep_device, cfgs, count);
+	if (result < 0) {
+		WSA_TRACE_END(trace_ts, "sweep", "sweep", NULL);
+		return result;
+	}
+
+	for (i = 0; i < count; i++) {
+		cfg = cfgs[i];
+
+		// poison our buffer, where this sweep missed a step
+		for (j = 0; j < cfg->buflen; j++)
+			cfg->buf[j] = WSA_SPECTRUM_POISON;
+		wsa_sweep_restitch(cfg, 0, cfg->buflen, cfg->captures);
+		wsa_sweep_publish(sweep_device, cfg);
+	}
+
+	WSA_TRACE_END(trace_ts, "sweep", "sweep", NULL);
+
+	return 0;
+}
+
+
+/**
+ * marks the steps of a config the next refresh sweeps: any never swept,
+ * every active one, whose power changed by the refresh threshold or more
+ * on average, and the quiet ones in turn, oldest first, so that each is
+ * swept about once per refresh period
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the power spectrum config to refresh
+ * @return - the number of steps marked
+ */
+static uint32_t wsa_sweep_steps_schedule(struct wsa_sweep_device *sweep_device,
+		struct wsa_power_spectrum_config *cfg)
+{
+	struct wsa_sweep_step *step;
+	struct wsa_sweep_step *oldest;
+	uint32_t period = sweep_device->refresh_settings.period;
+	uint32_t due = 0;
+	uint32_t quiet = 0;
+	uint32_t turns;
+
+	if (period == 0)
+		period = 1;
+
+	for (step = cfg->steps; step < cfg->steps + cfg->step_count; step++) {
+		step->due = step->swept == 0 ||
+			step->activity >= sweep_device->refresh_settings.threshold ||
+			cfg->captures - step->swept >= period;
+		if (step->due)
+			due++;
+		else
+			quiet++;
+	}
+
+	// share the quiet steps out over the period
+	for (turns = (quiet + period - 1) / period; turns > 0; turns--) {
+		oldest = NULL;
+		for (step = cfg->steps; step < cfg->steps + cfg->step_count; step++) {
+			if (!step->due && (oldest == NULL || step->swept < oldest->swept))
+				oldest = step;
+		}
+		oldest->due = 1;
+		due++;
+	}
+
+	return due;
+}
+
+
+/**
+ * makes sure the sweep list on the device sweeps the steps of a config
+ * that are due.  A list of only those steps is loaded unless the device
+ * already has it, which it does when a refresh sweeps the same steps as
+ * the one before; but each of its entries costs a few commands, and when
+ * loading them would take longer than sweeping the steps that aren't due
+ * as well, the whole plan is swept instead, and every step marked due.
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the power spectrum config, with the steps due marked
+ * @param due - the number of steps due
+ * @return - 0 on success, negative on error
+ */
+static int wsa_sweep_steps_prepare(struct wsa_sweep_device *sweep_device,
+		struct wsa_power_spectrum_config *cfg, uint32_t due)
+{
+	struct wsa_sweep_step *step;
+	uint8_t same = cfg->partial_load;
+	uint64_t partial, whole;
+
+	for (step = cfg->steps; step < cfg->steps + cfg->step_count && same; step++) {
+		if (step->due != step->loaded)
+			same = 0;
+	}
+	if (same)
+		return 0;
+
+	// the time to load the due steps and sweep them, against that of
+	// sweeping everything, loading the plan again if need be
+	partial = (wsa_sweep_steps_entries(cfg) + 1) * cfg->entry_load_ns +
+		(uint64_t) due * cfg->packets_per_block * cfg->packet_ns;
+	whole = (uint64_t) cfg->packet_total * cfg->packet_ns;
+	if (cfg->partial_load)
+		whole += (wsa_sweep_plan_entries(cfg) + 1) * cfg->entry_load_ns;
+
+	if (partial < whole)
+		return wsa_sweep_steps_load(sweep_device, cfg);
+
+	for (step = cfg->steps; step < cfg->steps + cfg->step_count; step++)
+		step->due = 1;
+	if (cfg->partial_load)
+		return wsa_sweep_plan_load(sweep_device, cfg);
+
+	return 0;
+}
+
+
+/**
+ * re-sweeps the steps of a power spectrum that are due, and stitches them
+ * into the spectrum the captures before left, so that it stays complete
+ * while active parts of it are revisited more often than quiet ones.
+ * Which steps are due is set with wsa_sweep_device_set_refresh().  A
+ * config not yet captured is captured whole.  The time stamp of each
+ * step is kept with the step, in the config's steps.
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the power spectrum config to use
+ * @param buf - if buf is not NULL, a pointer to the allocated memory is stored there for convience
+ * @return - 0 on success, negative on error
+ */
+int wsa_refresh_power_spectrum(
+	struct wsa_sweep_device *sweep_device,
+	struct wsa_power_spectrum_config *cfg,
+	float **buf
+)
+{
+	struct wsa_sweep_step *step;
+	uint32_t due;
+	double left, right;
+	uint32_t first, last;
+	int result;
+	uint64_t trace_ts;
+
+	if (cfg->captures == 0)
+		return wsa_capture_power_spectrum(sweep_device, cfg, buf);
+
+	WSA_TRACE_BEGIN(trace_ts);
+
+	// assign their convienence pointer
+	if (buf)
+		*buf = cfg->buf;
+
+	due = wsa_sweep_steps_schedule(sweep_device, cfg);
+	result = wsa_sweep_steps_prepare(sweep_device, cfg, due);
+	if (result >= 0)
+		result = wsa_sweep_list_capture(sweep_device, &cfg, 1);
+	if (result < 0) {
+		WSA_TRACE_END(trace_ts, "refresh", "sweep", NULL);
+		return result;
+	}
+
+	// stitch the bins the swept steps cover again, with the steps they
+	// overlap as they were
+	for (step = cfg->steps; step < cfg->steps + cfg->step_count; step++) {
+		if (step->swept != cfg->captures)
+			continue;
+
+		left = ceil((step->left - cfg->fstart) / cfg->rbw);
+		right = floor((step->right - cfg->fstart) / cfg->rbw);
+		if (right < 0 || left >= cfg->buflen)
+			continue;
+		first = left < 0 ? 0 : (uint32_t) left;
+		last = right >= cfg->buflen ? cfg->buflen - 1 : (uint32_t) right;
+		if (first <= last)
+			wsa_sweep_restitch(cfg, first, last - first + 1, 1);
+	}
+	wsa_sweep_publish(sweep_device, cfg);
+
+	WSA_TRACE_END(trace_ts, "refresh", "sweep", NULL);
 
 	return 0;
 }
@@ -610,6 +1211,105 @@ static struct wsa_sweep_device_properties *wsa_get_sweep_device_properties(uint3
 }
 
 
+/**
+ * estimates how long kiss_fft() takes for a size, from the radixes it
+ * splits the size into the way kf_factor() does.  Radix 2, 3, 4 and 5
+ * stages have butterflies of their own, costing about half their radix
+ * per point; any other prime goes through the generic butterfly, which
+ * costs its whole radix per point.
+ *
+ * @param n - the FFT size
+ * @return - the estimated time in nanoseconds
+ */
+static double wsa_tune_fft_cost(uint32_t n)
+{
+	double weight = 0;
+	uint32_t left = n;
+	uint32_t p = 4;
+
+	while (left > 1) {
+		while (left % p) {
+			if (p == 4)
+				p = 2;
+			else if (p == 2)
+				p = 3;
+			else
+				p += 2;
+
+			// only a prime is left
+			if ((uint64_t) p * p > left)
+				p = left;
+		}
+		left /= p;
+		weight += (p <= 5) ? p / 2.0 : (double) p;
+	}
+
+	return WSA_TUNE_FFT_NS * weight * n;
+}
+
+
+/**
+ * searches the samples per packet and packets per block for the fastest
+ * sweep that meets or beats an RBW.  A step costs the device's retune and
+ * dwell, the overhead of each packet, moving the samples and their FFT,
+ * and a finer RBW than asked for makes the step a little smaller, so the
+ * sweep a little longer.
+ *
+ * @param prop - the properties of the mode to sweep in
+ * @param pscfg - the config to sweep, holding the RBW asked for
+ * @param overlap - the overlap between steps beyond an RBW, in Hz
+ * @param spp - the samples per packet found are stored here
+ * @param ppb - the packets per block found are stored here
+ * @return - 1 if a plan meets the RBW, otherwise 0 and \b spp and
+ *		\b ppb are left as they were
+ */
+static int wsa_tune_block(struct wsa_sweep_device_properties *prop,
+		struct wsa_power_spectrum_config *pscfg, uint32_t overlap,
+		uint32_t *spp, uint32_t *ppb)
+{
+	uint64_t span = pscfg->fstop - pscfg->fstart;
+	double min_steps = (double) span / prop->usable_bw + 1;
+	double best = -1;
+	double bound;
+	double rbw;
+	double cost;
+	uint32_t try_spp;
+	uint32_t try_ppb;
+	uint32_t n;
+
+	for (try_ppb = 1; try_ppb <= WSA_TUNE_MAX_PPB; try_ppb++) {
+		for (try_spp = WSA_MIN_SPP; try_spp <= WSA_MAX_SPP; try_spp += WSA_SPP_MULTIPLE) {
+			n = try_spp * try_ppb;
+
+			// a superhet block of n samples has n / 2 bins over the full band
+			if ((uint64_t) n * pscfg->rbw < 2ULL * prop->full_bw)
+				continue;
+			rbw = (double) prop->full_bw / (n / 2);
+
+			// everything but the FFT and the step only grows with the
+			// packet size, so once that alone costs more, no larger packet
+			// can win
+			bound = WSA_TUNE_RETUNE_NS + n * (1e9 / (2.0 * prop->full_bw)) +
+				try_ppb * WSA_TUNE_PACKET_NS + n * WSA_TUNE_SAMPLE_NS;
+			if (best >= 0 && bound * min_steps >= best)
+				break;
+
+			cost = (bound + wsa_tune_fft_cost(n)) *
+				((double) span / (prop->usable_bw - overlap - rbw) + 1);
+			if (best < 0 || cost < best) {
+				best = cost;
+				*spp = try_spp;
+				*ppb = try_ppb;
+			}
+		}
+	}
+
+	doutf(DHIGH, "wsa_tune_block: best estimate %0.0f ns\n", best);
+
+	return best >= 0;
+}
+
+
 /**
  * given a desired sweep configuration, this functions figures out how to achieve it
  *
@@ -617,7 +1317,7 @@ static struct wsa_sweep_device_properties *wsa_get_sweep_device_properties(uint3
  * @param pscfg - the config object which describes what we're trying to sweep
  * @return - negative on error, zero on success
  */
-static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
+static int wsa_plan_sweep(struct wsa_sweep_device *sweep_device, struct wsa_power_spectrum_config *pscfg)
 {
 	struct wsa_sweep_device_properties *prop;
 	struct wsa_sweep_plan *plan;
@@ -630,6 +1330,7 @@ static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
 	uint32_t points;
 	uint32_t ppb = 1;
 	uint32_t divided_points;
+	uint32_t overlap;
 	// try to get device properties for this mode
 	
 	prop = wsa_get_sweep_device_properties(pscfg->mode);
@@ -645,6 +1346,11 @@ static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
 	// how wide is halfband for this mode?
 	half_usable_bw = prop->usable_bw >> 1;
 
+	// how far steps overlap beyond an rbw, leaving each at least half new
+	overlap = sweep_device->plan_settings.stitch_overlap;
+	if (overlap > half_usable_bw)
+		overlap = half_usable_bw;
+
 	// how many points (fft bins) are in a full band
 	points = prop->full_bw / ((uint32_t) pscfg->rbw);
 
@@ -665,11 +1371,15 @@ static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
 		ppb = 1;
 		points = WSA_MAX_SPP;
 	}
+
+	// or search for the fastest packets that get the rbw
+	if (sweep_device->plan_settings.tune_blocks)
+		wsa_tune_block(prop, pscfg, overlap, &points, &ppb);
  
 	doutf(DHIGH, "wsa_plan_sweep: calculated spp/ppb: %d, %d\n", (int32_t) points,  (int32_t) ppb);
 
 	// recalc what that actually results in for the rbw
-	pscfg->rbw = (uint64_t) ((double) prop->full_bw) / (points / 2);
+	pscfg->rbw = (uint64_t) ((double) prop->full_bw) / (points * ppb / 2);
 	
 	
 	// assign the samples per packet and packets per block
@@ -687,8 +1397,8 @@ static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
 	}
 	fcstop = pscfg->fstop;
 
-	// figure out our sweep step size (a bit less than usable bw.  one rbw less, yet still a multiple of tuning res)
-	fstep = prop->usable_bw - (uint32_t) pscfg->rbw;
+	// figure out our sweep step size (a bit less than usable bw.  one rbw less, and any overlap asked for, yet still a multiple of tuning res)
+	fstep = prop->usable_bw - (uint32_t) pscfg->rbw - overlap;
 	fstep = (fstep / prop->tuning_resolution) * prop->tuning_resolution;
 	
 	// force fcstart to a multiple of tuning resolution
@@ -721,7 +1431,9 @@ static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
 		pscfg->only_dd = 0;
 
 	// create sweep plan objects for each entry
-	pscfg->sweep_plan = wsa_sweep_plan_entry_new(fcstart, fcstop, fstep, points, ppb, dd_mode);
+	pscfg->sweep_plan = wsa_sweep_plan_entry_new(&pscfg->arena, fcstart, fcstop, fstep, points, ppb, dd_mode);
+	if (pscfg->sweep_plan == NULL)
+		return WSA_ERR_MALLOCFAILED;
 	doutf(DHIGH, "wsa_plan_sweep: calculated fstart/fstop: %u, %u\n",  fcstart,  fcstop);
 	// do we need a cleanup entry?
 	if ((fcstop + half_usable_bw) < pscfg->fstop) {
@@ -738,7 +1450,9 @@ static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
 		if (dd_mode == 1)
 			tmpfreq = pscfg->fstop + (half_usable_bw / 2);
 		// now create the entry
-		pscfg->sweep_plan->next_entry = wsa_sweep_plan_entry_new(tmpfreq, tmpfreq, fstep, points, 1, dd_mode);
+		pscfg->sweep_plan->next_entry = wsa_sweep_plan_entry_new(&pscfg->arena, tmpfreq, tmpfreq, fstep, points, ppb, dd_mode);
+		if (pscfg->sweep_plan->next_entry == NULL)
+			return WSA_ERR_MALLOCFAILED;
 	}
 
 	
@@ -750,14 +1464,7 @@ static int wsa_plan_sweep(struct wsa_power_spectrum_config *pscfg)
 		pscfg->packet_total = pscfg->packet_total + ppb;
 	for (plan=pscfg->sweep_plan; plan; plan=plan->next_entry) {
 
-		// if it is frequency step
-		if ((plan->fcstop - plan->fcstart) <= plan->fstep){
-			pscfg->packet_total += plan->ppb;
-		}
-		else {
-			pscfg->packet_total += ( (((plan->fcstop - plan->fcstart) /  plan->fstep) + 1) * plan->ppb);
-
-		}
+		pscfg->packet_total += wsa_sweep_plan_entry_steps(plan) * plan->ppb;
 	}
 
 	// if there is only a dd entry
@@ -797,85 +1504,438 @@ unsigned int wsa_sweep_device_get_attenuator(struct wsa_sweep_device *sweep_devi
 
 
 /**
- * converts a sweep plan into a list of sweep entries and loads them onto the device
+ * sets how far the steps of the sweeps planned with the sweep device
+ * overlap beyond the one RBW they always do.  The spectrum is blended
+ * across the overlap, so a wider one flattens the seams between steps,
+ * at the cost of more steps.
  *
  * @param sweep_device - the sweep device to use
- * @param cfg - the sweep configuration which holds all sweep info, including the sweep plan
- * @return - negative on error, 0 on success
+ * @param overlap - the overlap in Hz, up to half the usable bandwidth
  */
-static int wsa_sweep_plan_load(struct wsa_sweep_device *wsasweepdev, struct wsa_power_spectrum_config *cfg)
+void wsa_sweep_device_set_stitch_overlap(struct wsa_sweep_device *sweep_device, uint32_t overlap)
+{
+	sweep_device->plan_settings.stitch_overlap = overlap;
+}
+
+
+/**
+ * sets how wsa_refresh_power_spectrum() picks the steps to sweep.  Each
+ * refresh sweeps every step whose power changed by \b threshold dB or
+ * more on average, as averaged over its last few sweeps, and enough of
+ * the rest, oldest first, that each is swept once every \b period
+ * refreshes.
+ *
+ * @param sweep_device - the sweep device to use
+ * @param period - the refreshes a quiet step may go without a sweep, 1 to
+ *		sweep every step every time
+ * @param threshold - the change in dB that makes a step active
+ */
+void wsa_sweep_device_set_refresh(struct wsa_sweep_device *sweep_device, uint32_t period, float threshold)
+{
+	sweep_device->refresh_settings.period = period;
+	sweep_device->refresh_settings.threshold = threshold;
+}
+
+
+/**
+ * sets where the sweep device publishes each spectrum it captures or
+ * refreshes, for other local processes to read.  The publisher must be
+ * made with room for the largest spectrum captured, and outlive its use.
+ *
+ * @param sweep_device - the sweep device to use
+ * @param publisher - the publisher, or NULL to stop publishing
+ */
+void wsa_sweep_device_set_publisher(struct wsa_sweep_device *sweep_device, struct wsa_spectrum_publisher *publisher)
+{
+	sweep_device->publisher = publisher;
+}
+
+
+/**
+ * sets whether the sweeps planned with the sweep device search for the
+ * fastest samples per packet and packets per block that meet their RBW,
+ * rather than taking one packet of the size the RBW rounds to
+ *
+ * @param sweep_device - the sweep device to use
+ * @param value - 1 to tune the blocks, 0 not to
+ */
+void wsa_sweep_device_set_plan_tuning(struct wsa_sweep_device *sweep_device, unsigned int val)
+{
+	sweep_device->plan_settings.tune_blocks = (uint8_t) val;
+}
+
+
+/**
+ * clears the sweep list on the device, and sets up what every entry of a
+ * new one shares
+ *
+ * @param wsasweepdev - the sweep device to use
+ * @param init - 1 to query the device's id and limits first, which only
+ *		need to be once per config
+ */
+static int16_t wsa_sweep_list_begin(struct wsa_sweep_device *wsasweepdev, uint8_t init)
 {
-	int result;
-	struct wsa_resp query;
 	struct wsa_device *wsadev = wsasweepdev->real_device;
-	struct wsa_sweep_plan *plan_entry;
-	char dd[255] = "DD";
 	char atten_cmd[255];
-	char * strtok_result;
-    char * strtok_context = NULL;
-	plan_entry=cfg->sweep_plan;
+	int16_t result;
 
 	// grab the device id, and initialize the object
-	result = _wsa_dev_init(wsadev);
+	if (init) {
+		result = _wsa_dev_init(wsadev);
+		if (result < 0)
+			return result;
+	}
 
 	// clear any existing sweep entries
-	wsa_sweep_entry_delete_all(wsadev);
+	result = wsa_sweep_entry_delete_all(wsadev);
+	if (result < 0)
+		return result;
 
 	// create new entry with all the sweep entry devices
-	wsa_sweep_entry_new(wsadev);
+	result = wsa_sweep_entry_new(wsadev);
+	if (result < 0)
+		return result;
 
 	// setup the sweep list to only run once
-	wsa_set_sweep_iteration(wsadev, 1);
+	result = wsa_set_sweep_iteration(wsadev, 1);
+	if (result < 0)
+		return result;
 
 	// set attenuation, if the device is a 408 model use sweep entry
 	if (strstr(wsadev->descr.dev_model, WSA5000408) != NULL || 
 		strstr(wsadev->descr.dev_model, R5500408) != NULL)
-		result = wsa_set_sweep_attenuation(wsadev, wsasweepdev->device_settings.attenuator);
+		return wsa_set_sweep_attenuation(wsadev, wsasweepdev->device_settings.attenuator);
 
 	// send the command for 418/427 models
-	else{
-		sprintf(atten_cmd, "SWEEP:ENTRY:ATTEN:VAR %u\n", wsasweepdev->device_settings.attenuator);
-		result = wsa_send_scpi(wsadev, atten_cmd);
+	sprintf(atten_cmd, "SWEEP:ENTRY:ATTEN:VAR %u\n", wsasweepdev->device_settings.attenuator);
+	return wsa_send_scpi(wsadev, atten_cmd);
+}
+
+
+/**
+ * adds the DD mode entry of a sweep plan to the sweep list on the device
+ *
+ * @param wsadev - the device to use
+ * @param plan_entry - the first entry of the plan
+ * @return - negative on error, 0 on success
+ */
+static int16_t wsa_sweep_list_add_dd(struct wsa_device *wsadev, struct wsa_sweep_plan *plan_entry)
+{
+	char dd[255] = "DD";
+	int16_t result;
+
+	// set ppb/spp settings
+	result = wsa_set_sweep_rfe_input_mode(wsadev, dd);
+	if (result < 0)
+		return result;
+
+	result = wsa_set_sweep_samples_per_packet(wsadev, (int32_t) (plan_entry->spp));
+	if (result < 0)
+		return result;
+
+	result = wsa_set_sweep_packets_per_block(wsadev, (int32_t) (plan_entry->ppb));
+	if (result < 0)
+		return result;
+
+	return wsa_sweep_entry_save(wsadev, 0);
+}
+
+
+/**
+ * sets up a sweep entry on the device for part of a sweep plan entry
+ *
+ * @param wsadev - the device to use
+ * @param plan_entry - the plan entry
+ * @param fcstart - the first center frequency to sweep
+ * @param fcstop - the last center frequency to sweep
+ * @return - negative on error, 0 on success
+ */
+static int16_t wsa_sweep_list_set(struct wsa_device *wsadev, struct wsa_sweep_plan *plan_entry,
+		uint64_t fcstart, uint64_t fcstop)
+{
+	int16_t result;
+
+	// set settings
+	result = wsa_set_sweep_freq(wsadev, (int64_t) fcstart, (int64_t) fcstop);
+	if (result < 0) {
+		fprintf(stderr, "ERROR %d fstart fstop\n", result);
+		return result;
 	}
 
-	// if DD mode is required, create one sweep entry with DD mode
-	if (cfg->sweep_plan->dd_mode == 1){
-		
-		// set ppb/spp settings
-		result = wsa_set_sweep_rfe_input_mode(wsadev, dd);
+	result = wsa_set_sweep_freq_step(wsadev, (int64_t)  plan_entry->fstep);
+	if (result < 0) {
+		fprintf(stderr, "ERROR fstep\n");
+		return result;
+	}
+	
+	result = wsa_set_sweep_samples_per_packet(wsadev, plan_entry->spp);
+	if (result < 0) {
+		fprintf(stderr, "ERROR spp\n");
+		return result;
+	}
+	
+	result = wsa_set_sweep_packets_per_block(wsadev, plan_entry->ppb);
+	if (result < 0)
+		fprintf(stderr, "ERROR ppb\n");
 
-		result = wsa_set_sweep_samples_per_packet(wsadev, (int32_t) (plan_entry->spp));
+	return result;
+}
+
+
+/**
+ * marks a config's steps as not on the device, after its sweep list
+ * failed to load, so the next capture or refresh loads it again
+ *
+ * @param cfg - the sweep configuration
+ */
+static void wsa_sweep_list_lost(struct wsa_power_spectrum_config *cfg)
+{
+	uint32_t i;
 
-		result = wsa_set_sweep_packets_per_block(wsadev, (int32_t) (plan_entry->ppb));
+	for (i = 0; i < cfg->step_count; i++)
+		cfg->steps[i].loaded = 0;
+	cfg->partial_load = 1;
+}
+
+
+/**
+ * adds the entries of a config's sweep plan to the end of the sweep list
+ * on the device, and marks all its steps loaded
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the sweep configuration which holds all sweep info, including the sweep plan
+ * @return - negative on error, 0 on success
+ */
+static int16_t wsa_sweep_plan_add(struct wsa_sweep_device *wsasweepdev, struct wsa_power_spectrum_config *cfg)
+{
+	struct wsa_device *wsadev = wsasweepdev->real_device;
+	struct wsa_sweep_plan *plan_entry;
+	struct wsa_sweep_step *step;
+	int16_t result;
 
-		result = wsa_sweep_entry_save(wsadev, 0);
+	// if DD mode is required, create one sweep entry with DD mode
+	if (cfg->sweep_plan->dd_mode == 1) {
+		result = wsa_sweep_list_add_dd(wsadev, cfg->sweep_plan);
+		if (result < 0)
+			return result;
 	}
 
 	// set sweep wide settings
 	result = wsa_set_sweep_rfe_input_mode(wsadev, mode_const_to_string(cfg->mode));
+	if (result < 0)
+		return result;
 
 
 	// loop over sweep plan, convert to entries and save
 	for (plan_entry=cfg->sweep_plan; plan_entry; plan_entry = plan_entry->next_entry) {
 		
-		// set settings
-		result = wsa_set_sweep_freq(wsadev, (int64_t) plan_entry->fcstart, (int64_t) plan_entry->fcstop);
-		if (result < 0) fprintf(stderr, "ERROR %d fstart fstop\n", result);
-
-		result = wsa_set_sweep_freq_step(wsadev, (int64_t)  plan_entry->fstep);
-		if (result < 0) fprintf(stderr, "ERROR fstep\n");
-		
-		wsa_set_sweep_samples_per_packet(wsadev, plan_entry->spp);
-		if (result < 0) fprintf(stderr, "ERROR spp\n");
-		
-		wsa_set_sweep_packets_per_block(wsadev, plan_entry->ppb);
-		if (result < 0) fprintf(stderr, "ERROR ppb\n");
+		result = wsa_sweep_list_set(wsadev, plan_entry, plan_entry->fcstart, plan_entry->fcstop);
+		if (result < 0)
+			return result;
 
 		// save to end of list
-		if (cfg->only_dd != 1) 
-			wsa_sweep_entry_save(wsadev, 0);
+		if (cfg->only_dd != 1) {
+			result = wsa_sweep_entry_save(wsadev, 0);
+			if (result < 0)
+				return result;
+		}
 	}
 
+	for (step = cfg->steps; step < cfg->steps + cfg->step_count; step++)
+		step->loaded = 1;
+	cfg->partial_load = 0;
+
+	return 0;
+}
+
+
+/**
+ * converts a sweep plan into a list of sweep entries and loads them onto the device
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the sweep configuration which holds all sweep info, including the sweep plan
+ * @return - negative on error, 0 on success
+ */
+static int wsa_sweep_plan_load(struct wsa_sweep_device *wsasweepdev, struct wsa_power_spectrum_config *cfg)
+{
+	return wsa_sweep_plans_load(wsasweepdev, &cfg, 1);
+}
+
+
+/**
+ * loads the sweep plans of several configs onto the device as one sweep
+ * list, in the order given, for wsa_sweep_list_capture() to sweep
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfgs - the configs
+ * @param count - the number of configs
+ * @return - negative on error, 0 on success
+ */
+static int16_t wsa_sweep_plans_load(struct wsa_sweep_device *wsasweepdev,
+		struct wsa_power_spectrum_config **cfgs, uint32_t count)
+{
+	uint64_t start = wsa_perf_now();
+	uint32_t entries = 0;
+	uint32_t i;
+	int16_t result;
+
+	result = wsa_sweep_list_begin(wsasweepdev, 1);
+
+	for (i = 0; i < count && result >= 0; i++) {
+		result = wsa_sweep_plan_add(wsasweepdev, cfgs[i]);
+		if (result < 0)
+			break;
+		entries += wsa_sweep_plan_entries(cfgs[i]);
+	}
+
+	// the list on the device is only partly loaded
+	if (result < 0) {
+		doutf(DHIGH, "wsa_sweep_plans_load: can't load the sweep list: %d\n", result);
+		for (i = 0; i < count; i++)
+			wsa_sweep_list_lost(cfgs[i]);
+		return result;
+	}
+
+	for (i = 0; i < count; i++)
+		cfgs[i]->entry_load_ns = (wsa_perf_now() - start) / (entries + 1);
+
+	return 0;
+}
+
+
+/**
+ * counts the sweep entries wsa_sweep_plan_load() loads for a config
+ *
+ * @param cfg - the sweep configuration
+ * @return - the number of entries
+ */
+static uint32_t wsa_sweep_plan_entries(struct wsa_power_spectrum_config *cfg)
+{
+	struct wsa_sweep_plan *plan_entry;
+	uint32_t entries = cfg->sweep_plan->dd_mode == 1;
+
+	if (cfg->only_dd != 1) {
+		for (plan_entry = cfg->sweep_plan; plan_entry; plan_entry = plan_entry->next_entry)
+			entries++;
+	}
+
+	return entries;
+}
+
+
+/**
+ * finds the run of due steps of one plan entry that a sweep entry starting
+ * at a due step covers.  A run of two steps is split, since an entry would
+ * count it as one.
+ *
+ * @param cfg - the sweep configuration, with the steps due marked
+ * @param i - the index of the due step the run starts at
+ * @return - the number of steps in the run
+ */
+static uint32_t wsa_sweep_steps_run(struct wsa_power_spectrum_config *cfg, uint32_t i)
+{
+	struct wsa_sweep_step *steps = cfg->steps;
+	uint32_t run;
+
+	for (run = 1; i + run < cfg->step_count; run++) {
+		if (!steps[i + run].due || steps[i + run].plan != steps[i].plan)
+			break;
+	}
+	if (run == 2)
+		run = 1;
+
+	return run;
+}
+
+
+/**
+ * counts the sweep entries wsa_sweep_steps_load() loads for a config
+ *
+ * @param cfg - the sweep configuration, with the steps to load marked due
+ * @return - the number of entries
+ */
+static uint32_t wsa_sweep_steps_entries(struct wsa_power_spectrum_config *cfg)
+{
+	uint32_t entries = 0;
+	uint32_t i = 0;
+
+	if (cfg->sweep_plan->dd_mode == 1) {
+		entries += cfg->steps[0].due;
+		i = 1;
+	}
+
+	while (i < cfg->step_count) {
+		if (cfg->steps[i].due) {
+			i += wsa_sweep_steps_run(cfg, i);
+			entries++;
+		} else {
+			i++;
+		}
+	}
+
+	return entries;
+}
+
+
+/**
+ * loads a sweep list of only the steps of a config that are due onto the
+ * device.  A run of due steps of one plan entry goes in one sweep entry,
+ * as wsa_sweep_steps_run() finds them.
+ *
+ * @param sweep_device - the sweep device to use
+ * @param cfg - the sweep configuration, with the steps to load marked due
+ * @return - negative on error, 0 on success
+ */
+static int wsa_sweep_steps_load(struct wsa_sweep_device *wsasweepdev, struct wsa_power_spectrum_config *cfg)
+{
+	struct wsa_device *wsadev = wsasweepdev->real_device;
+	struct wsa_sweep_step *steps = cfg->steps;
+	uint64_t start = wsa_perf_now();
+	uint32_t entries = 0;
+	uint32_t i = 0;
+	uint32_t run;
+	int16_t result;
+
+	// the device was initialized when the config was first loaded
+	result = wsa_sweep_list_begin(wsasweepdev, 0);
+
+	// the DD block is always the first step
+	if (cfg->sweep_plan->dd_mode == 1) {
+		if (steps[0].due && result >= 0) {
+			result = wsa_sweep_list_add_dd(wsadev, cfg->sweep_plan);
+			entries++;
+		}
+		i = 1;
+	}
+
+	// set sweep wide settings
+	if (result >= 0)
+		result = wsa_set_sweep_rfe_input_mode(wsadev, mode_const_to_string(cfg->mode));
+
+	while (i < cfg->step_count && result >= 0) {
+		if (!steps[i].due) {
+			i++;
+			continue;
+		}
+
+		run = wsa_sweep_steps_run(cfg, i);
+		result = wsa_sweep_list_set(wsadev, steps[i].plan, steps[i].freq, steps[i + run - 1].freq);
+		if (result >= 0)
+			result = wsa_sweep_entry_save(wsadev, 0);
+		entries++;
+		i += run;
+	}
+
+	if (result < 0) {
+		wsa_sweep_list_lost(cfg);
+		return result;
+	}
+
+	for (i = 0; i < cfg->step_count; i++)
+		steps[i].loaded = steps[i].due;
+	cfg->partial_load = 1;
+	cfg->entry_load_ns = (wsa_perf_now() - start) / (entries + 1);
+
 	return 0;
 }
 
@@ -0,0 +1,549 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wsa_sweep_scheduler.h"
+#include "wsa_debug.h"
+#include "wsa_error.h"
+#include "wsa_trace.h"
+
+
+/**
+ * allocates a request for a spectrum, and the spectrum it's answered in
+ *
+ * @param fstart - the start of the span
+ * @param fstop - the end of the span
+ * @param rbw - the RBW, which is also the width of each bin of the spectrum
+ * @param mode - the mode to sweep in, such as "SH"
+ * @param rebin - WSA_REBIN_PEAK or WSA_REBIN_POWER
+ * @param request - a pointer to store the new request in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_sweep_request_alloc(uint64_t fstart, uint64_t fstop, uint32_t rbw,
+		char const *mode, uint8_t rebin, struct wsa_sweep_request **request)
+{
+	struct wsa_sweep_request *r;
+	struct wsa_arena arena;
+	uint32_t buflen;
+	char *mode_copy;
+
+	if (rbw == 0 || fstop <= fstart || mode == NULL ||
+			strlen(mode) >= WSA_SWEEP_MODE_LEN ||
+			(rebin != WSA_REBIN_PEAK && rebin != WSA_REBIN_POWER))
+		return WSA_ERR_INVINPUT;
+
+	buflen = (uint32_t) ((fstop - fstart) / rbw);
+	if (buflen == 0)
+		return WSA_ERR_INVINPUT;
+
+	wsa_arena_init(&arena, sizeof(struct wsa_sweep_request) +
+		sizeof(float) * buflen + WSA_SWEEP_MODE_LEN + 3 * WSA_ARENA_ALIGNMENT);
+	r = (struct wsa_sweep_request *) wsa_arena_alloc(&arena, sizeof(struct wsa_sweep_request));
+	if (r == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	r->buf = (float *) wsa_arena_alloc(&arena, sizeof(float) * buflen);
+	mode_copy = (char *) wsa_arena_alloc(&arena, WSA_SWEEP_MODE_LEN);
+	r->arena = arena;
+	if (r->buf == NULL || mode_copy == NULL) {
+		wsa_sweep_request_free(r);
+		return WSA_ERR_MALLOCFAILED;
+	}
+
+	strcpy(mode_copy, mode);
+	r->fstart = fstart;
+	r->fstop = fstop;
+	r->rbw = rbw;
+	r->mode = mode_copy;
+	r->rebin = rebin;
+	r->buflen = buflen;
+	r->swept_rbw = 0;
+	r->result = 0;
+	r->next = NULL;
+	r->done = 0;
+
+	*request = r;
+	return 0;
+}
+
+
+/**
+ * frees a request, which must not be pending
+ *
+ * @param request - the request to free
+ */
+void wsa_sweep_request_free(struct wsa_sweep_request *request)
+{
+	wsa_arena_free_self(&request->arena);
+}
+
+
+/**
+ * creates a scheduler for a sweep device.  While it's in use, the device
+ * should only be swept through it, since it keeps track of the sweep list
+ * loaded on the device.
+ *
+ * @param sweep_device - the sweep device to share
+ * @param scheduler - a pointer to store the new scheduler in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_sweep_scheduler_new(struct wsa_sweep_device *sweep_device,
+		struct wsa_sweep_scheduler **scheduler)
+{
+	struct wsa_sweep_scheduler *s;
+	int16_t result;
+
+	s = (struct wsa_sweep_scheduler *) malloc(sizeof(struct wsa_sweep_scheduler));
+	if (s == NULL)
+		return WSA_ERR_MALLOCFAILED;
+
+	result = wsa_mutex_init(&s->lock);
+	if (result < 0) {
+		free(s);
+		return result;
+	}
+	result = wsa_cond_init(&s->batch_done);
+	if (result < 0) {
+		wsa_mutex_destroy(&s->lock);
+		free(s);
+		return result;
+	}
+
+	s->sweep_device = sweep_device;
+	s->pending = NULL;
+	s->pending_tail = NULL;
+	s->running = 0;
+	s->regions = NULL;
+	s->region_count = 0;
+	s->loaded = NULL;
+	s->loaded_count = 0;
+	s->batches = 0;
+	s->requests = 0;
+	s->sweeps = 0;
+
+	*scheduler = s;
+	return 0;
+}
+
+
+/**
+ * frees a scheduler and the configs it kept.  No client may be waiting on
+ * it.
+ *
+ * @param scheduler - the scheduler to free
+ */
+void wsa_sweep_scheduler_free(struct wsa_sweep_scheduler *scheduler)
+{
+	uint32_t i;
+
+	for (i = 0; i < scheduler->region_count; i++) {
+		if (scheduler->regions[i].cfg != NULL)
+			wsa_power_spectrum_free(scheduler->regions[i].cfg);
+	}
+	free(scheduler->regions);
+	free(scheduler->loaded);
+
+	wsa_cond_destroy(&scheduler->batch_done);
+	wsa_mutex_destroy(&scheduler->lock);
+	free(scheduler);
+}
+
+
+/**
+ * orders requests by mode, then by where their spans start
+ */
+static int wsa_sweep_request_compare(void const *a, void const *b)
+{
+	struct wsa_sweep_request const *ra = *((struct wsa_sweep_request * const *) a);
+	struct wsa_sweep_request const *rb = *((struct wsa_sweep_request * const *) b);
+	int order;
+
+	order = strcmp(ra->mode, rb->mode);
+	if (order != 0)
+		return order;
+	if (ra->fstart != rb->fstart)
+		return ra->fstart < rb->fstart ? -1 : 1;
+
+	return 0;
+}
+
+
+/**
+ * rebins a request's spectrum from a finer one that covers its span.  Each
+ * of its bins takes the peak or the sum of the power of the finer bins it
+ * overlaps, counting those only partly in it by how much of them is.  A
+ * bin any missed finer bin falls in is missed too.
+ *
+ * @param request - the request
+ * @param spectrum - the finer spectrum
+ * @param len - the number of bins in it
+ * @param fstart - the frequency its first bin starts at
+ * @param rbw - the width of its bins
+ */
+static void wsa_sweep_rebin(struct wsa_sweep_request *request,
+		float const *spectrum, uint32_t len, uint64_t fstart, uint64_t rbw)
+{
+	double first, last;
+	double overlap;
+	double power;
+	float peak;
+	int64_t i, lo, hi;
+	uint32_t k;
+	uint8_t missed;
+
+	for (k = 0; k < request->buflen; k++) {
+		// where the bin starts and ends among the finer bins
+		first = ((double) request->fstart + (double) k * request->rbw - (double) fstart) / rbw;
+		last = first + (double) request->rbw / rbw;
+
+		lo = (int64_t) floor(first);
+		hi = (int64_t) ceil(last);
+		if (lo < 0)
+			lo = 0;
+		if (hi > (int64_t) len)
+			hi = len;
+
+		missed = lo >= hi;
+		peak = -HUGE_VAL;
+		power = 0;
+		for (i = lo; i < hi && !missed; i++) {
+			if (spectrum[i] == WSA_SPECTRUM_POISON) {
+				missed = 1;
+				break;
+			}
+
+			overlap = (i + 1 < last ? i + 1 : last) - (i > first ? i : first);
+			if (request->rebin == WSA_REBIN_PEAK) {
+				if (spectrum[i] > peak)
+					peak = spectrum[i];
+			} else {
+				power += overlap * pow(10, spectrum[i] / 10.0);
+			}
+		}
+
+		if (missed)
+			request->buf[k] = WSA_SPECTRUM_POISON;
+		else if (request->rebin == WSA_REBIN_PEAK)
+			request->buf[k] = peak;
+		else
+			request->buf[k] = (float) (10 * log10(power));
+	}
+}
+
+
+/**
+ * finds a config kept from the batches before that can sweep a region: one
+ * of its mode that covers it at its RBW or a finer one, without sweeping
+ * much more than it needs.  Of those, the one with the narrowest span is
+ * taken.
+ *
+ * @param scheduler - the scheduler
+ * @param region - the region
+ * @param batch - the number of the batch, whose regions can't share a config
+ *
+ * @return the kept region whose config will do, or NULL if none will
+ */
+static struct wsa_sweep_region *wsa_sweep_scheduler_find(
+		struct wsa_sweep_scheduler *scheduler,
+		struct wsa_sweep_region const *region, uint32_t batch)
+{
+	struct wsa_sweep_region *old;
+	struct wsa_sweep_region *best = NULL;
+	uint32_t i;
+
+	for (i = 0; i < scheduler->region_count; i++) {
+		old = &scheduler->regions[i];
+		if (old->used == batch || strcmp(old->mode, region->mode) != 0 ||
+				old->fstart > region->fstart || old->fstop < region->fstop ||
+				old->rbw > region->rbw || 2 * (uint64_t) old->rbw <= region->rbw ||
+				(old->fstop - old->fstart) - (region->fstop - region->fstart) >
+					WSA_SWEEP_SCHEDULER_MERGE_GAP)
+			continue;
+
+		if (best == NULL || old->fstop - old->fstart < best->fstop - best->fstart)
+			best = old;
+	}
+
+	return best;
+}
+
+
+/**
+ * frees the configs kept that no batch has swept for a while.  If one is
+ * in the sweep list loaded on the device, the list is forgotten.
+ *
+ * @param scheduler - the scheduler
+ * @param batch - the number of the batch just swept
+ */
+static void wsa_sweep_scheduler_expire(struct wsa_sweep_scheduler *scheduler, uint32_t batch)
+{
+	struct wsa_sweep_region *old;
+	uint32_t kept = 0;
+	uint32_t i, j;
+
+	for (i = 0; i < scheduler->region_count; i++) {
+		old = &scheduler->regions[i];
+		if (batch - old->used < WSA_SWEEP_SCHEDULER_KEEP) {
+			scheduler->regions[kept++] = *old;
+			continue;
+		}
+
+		for (j = 0; j < scheduler->loaded_count; j++) {
+			if (scheduler->loaded[j] == old->cfg)
+				scheduler->loaded_count = 0;
+		}
+		wsa_power_spectrum_free(old->cfg);
+	}
+	scheduler->region_count = kept;
+}
+
+
+/**
+ * makes the sweep list on the device that of some configs, loading it
+ * only if it isn't already
+ *
+ * @param scheduler - the scheduler
+ * @param cfgs - the configs, in the order they're swept
+ * @param count - the number of configs
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_sweep_scheduler_load(struct wsa_sweep_scheduler *scheduler,
+		struct wsa_power_spectrum_config **cfgs, uint32_t count)
+{
+	struct wsa_power_spectrum_config **loaded;
+	int16_t result;
+
+	if (count == scheduler->loaded_count &&
+			memcmp(cfgs, scheduler->loaded, sizeof(*cfgs) * count) == 0)
+		return 0;
+
+	// the list on the device is gone, whether or not the new one loads
+	scheduler->loaded_count = 0;
+
+	loaded = (struct wsa_power_spectrum_config **) realloc(scheduler->loaded,
+		sizeof(*cfgs) * count);
+	if (loaded == NULL)
+		return WSA_ERR_MALLOCFAILED;
+	scheduler->loaded = loaded;
+
+	result = (int16_t) wsa_configure_sweeps(scheduler->sweep_device, cfgs, count);
+	if (result < 0)
+		return result;
+
+	memcpy(scheduler->loaded, cfgs, sizeof(*cfgs) * count);
+	scheduler->loaded_count = count;
+
+	return 0;
+}
+
+
+/**
+ * sweeps a batch of requests: merges their spans into regions, loads the
+ * regions as one sweep list and sweeps it once, and rebins each request's
+ * spectrum from its region's.  Only one client runs a batch at a time, so
+ * the regions need no lock.
+ *
+ * @param scheduler - the scheduler
+ * @param batch - the requests, linked by their next pointers
+ */
+static void wsa_sweep_scheduler_run(struct wsa_sweep_scheduler *scheduler,
+		struct wsa_sweep_request *batch)
+{
+	struct wsa_sweep_device *sweep_device = scheduler->sweep_device;
+	struct wsa_sweep_request **requests;
+	struct wsa_sweep_request *r;
+	struct wsa_sweep_region *regions;
+	struct wsa_sweep_region *region;
+	struct wsa_sweep_region *old;
+	struct wsa_power_spectrum_config **cfgs;
+	uint32_t *firsts;
+	uint32_t count = 0;
+	uint32_t region_count = 0;
+	uint32_t cfg_count = 0;
+	uint32_t number = scheduler->batches + 1;
+	uint32_t i, j;
+	int result;
+	uint64_t trace_ts;
+
+	WSA_TRACE_BEGIN(trace_ts);
+
+	for (r = batch; r != NULL; r = r->next)
+		count++;
+
+	// a batch's regions may all need new configs, kept with the others
+	requests = (struct wsa_sweep_request **) malloc(sizeof(struct wsa_sweep_request *) * count);
+	regions = (struct wsa_sweep_region *) malloc(sizeof(struct wsa_sweep_region) * count);
+	cfgs = (struct wsa_power_spectrum_config **) malloc(sizeof(struct wsa_power_spectrum_config *) * count);
+	firsts = (uint32_t *) malloc(sizeof(uint32_t) * (count + 1));
+	old = (struct wsa_sweep_region *) realloc(scheduler->regions,
+		sizeof(struct wsa_sweep_region) * (scheduler->region_count + count));
+	if (old != NULL)
+		scheduler->regions = old;
+	if (requests == NULL || regions == NULL || cfgs == NULL || firsts == NULL || old == NULL) {
+		for (r = batch; r != NULL; r = r->next)
+			r->result = WSA_ERR_MALLOCFAILED;
+		free(requests);
+		free(regions);
+		free(cfgs);
+		free(firsts);
+		WSA_TRACE_END(trace_ts, "sweep_batch", "sweep", NULL);
+		return;
+	}
+
+	count = 0;
+	for (r = batch; r != NULL; r = r->next)
+		requests[count++] = r;
+	qsort(requests, count, sizeof(struct wsa_sweep_request *), wsa_sweep_request_compare);
+
+	// merge the spans of a mode that overlap or nearly do, at the finest
+	// rbw any of them needs
+	for (i = 0; i < count; i++) {
+		r = requests[i];
+		region = region_count ? &regions[region_count - 1] : NULL;
+		if (region != NULL && strcmp(region->mode, r->mode) == 0 &&
+				r->fstart <= region->fstop + WSA_SWEEP_SCHEDULER_MERGE_GAP) {
+			if (r->fstop > region->fstop)
+				region->fstop = r->fstop;
+			if (r->rbw < region->rbw)
+				region->rbw = r->rbw;
+			continue;
+		}
+
+		region = &regions[region_count];
+		strcpy(region->mode, r->mode);
+		region->fstart = r->fstart;
+		region->fstop = r->fstop;
+		region->rbw = r->rbw;
+		region->cfg = NULL;
+		region->used = number;
+		firsts[region_count++] = i;
+	}
+	firsts[region_count] = count;
+
+	// take a kept config for each region where one will do, and plan the
+	// rest, keeping them for the batches after
+	for (i = 0; i < region_count; i++) {
+		region = &regions[i];
+		old = wsa_sweep_scheduler_find(scheduler, region, number);
+		if (old != NULL) {
+			old->used = number;
+			region->cfg = old->cfg;
+		} else {
+			result = wsa_power_spectrum_alloc(sweep_device, region->fstart,
+				region->fstop, region->rbw, region->mode, &region->cfg);
+			if (result < 0) {
+				region->cfg = NULL;
+				for (j = firsts[i]; j < firsts[i + 1]; j++)
+					requests[j]->result = (int16_t) result;
+				continue;
+			}
+			scheduler->regions[scheduler->region_count++] = *region;
+		}
+
+		cfgs[cfg_count++] = region->cfg;
+	}
+
+	// sweep all the regions at once
+	result = 0;
+	if (cfg_count > 0) {
+		result = wsa_sweep_scheduler_load(scheduler, cfgs, cfg_count);
+		if (result >= 0)
+			result = wsa_capture_power_spectra(sweep_device, cfgs, cfg_count);
+		scheduler->sweeps++;
+		doutf(DHIGH, "wsa_sweep_scheduler_run: swept %u requests in %u regions: %d\n",
+			count, cfg_count, result);
+	}
+
+	// and answer each region's requests from it
+	for (i = 0; i < region_count; i++) {
+		region = &regions[i];
+		if (region->cfg == NULL)
+			continue;
+
+		for (j = firsts[i]; j < firsts[i + 1]; j++) {
+			r = requests[j];
+			r->result = (int16_t) result;
+			if (result < 0)
+				continue;
+
+			wsa_sweep_rebin(r, region->cfg->buf, region->cfg->buflen,
+				region->cfg->fstart, region->cfg->rbw);
+			r->swept_rbw = region->cfg->rbw;
+		}
+	}
+
+	wsa_sweep_scheduler_expire(scheduler, number);
+
+	scheduler->batches++;
+	scheduler->requests += count;
+
+	free(requests);
+	free(regions);
+	free(cfgs);
+	free(firsts);
+
+	WSA_TRACE_END(trace_ts, "sweep_batch", "sweep", NULL);
+}
+
+
+/**
+ * captures the spectrum a request asks for, sweeping it along with any
+ * other client's requests pending.  Safe to call from several threads at
+ * once, each with a request of its own.
+ *
+ * @param scheduler - the scheduler
+ * @param request - the request, whose spectrum is filled in
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_sweep_scheduler_capture(struct wsa_sweep_scheduler *scheduler,
+		struct wsa_sweep_request *request)
+{
+	struct wsa_sweep_request *batch;
+	struct wsa_sweep_request *r;
+	struct wsa_sweep_request *next;
+
+	wsa_mutex_lock(&scheduler->lock);
+
+	request->next = NULL;
+	request->done = 0;
+	request->result = 0;
+	if (scheduler->pending_tail != NULL)
+		scheduler->pending_tail->next = request;
+	else
+		scheduler->pending = request;
+	scheduler->pending_tail = request;
+
+	while (!request->done) {
+		// another client is sweeping; this request goes in the next batch
+		// unless it's in that one
+		if (scheduler->running) {
+			wsa_cond_wait(&scheduler->batch_done, &scheduler->lock);
+			continue;
+		}
+
+		// otherwise sweep everything pending, this request among it
+		batch = scheduler->pending;
+		scheduler->pending = NULL;
+		scheduler->pending_tail = NULL;
+		scheduler->running = 1;
+		wsa_mutex_unlock(&scheduler->lock);
+
+		wsa_sweep_scheduler_run(scheduler, batch);
+
+		wsa_mutex_lock(&scheduler->lock);
+		for (r = batch; r != NULL; r = next) {
+			next = r->next;
+			r->next = NULL;
+			r->done = 1;
+		}
+		scheduler->running = 0;
+		wsa_cond_broadcast(&scheduler->batch_done);
+	}
+
+	wsa_mutex_unlock(&scheduler->lock);
+
+	return request->result;
+}
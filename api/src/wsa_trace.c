@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsa_trace.h"
+#include "wsa_atomic.h"
+#include "wsa_thread.h"
+#include "wsa_error.h"
+
+
+int wsa_trace_enabled = 0;
+
+static struct wsa_trace_event *wsa_trace_events = NULL;
+static uint32_t wsa_trace_capacity = 0;
+static volatile uint32_t wsa_trace_count = 0;
+static volatile uint32_t wsa_trace_dropped = 0;
+
+// whether wsa_trace_record() may write into the buffer, and the calls of
+// it that are, which the buffer must not be freed or reset under
+static volatile uint32_t wsa_trace_recording = 0;
+static volatile uint32_t wsa_trace_writers = 0;
+static uint64_t wsa_trace_origin_ns = 0;
+
+
+/**
+ * allocates the trace buffer and starts recording trace events.  Any
+ * events recorded by a previous session are discarded.
+ *
+ * @param max_events - the number of events the buffer holds, or 0 for
+ *		WSA_TRACE_DEFAULT_EVENTS.  Events past that are dropped and counted.
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_trace_start(uint32_t max_events)
+{
+	wsa_trace_stop();
+
+	if (max_events == 0)
+		max_events = WSA_TRACE_DEFAULT_EVENTS;
+
+	if (wsa_trace_capacity != max_events) {
+		wsa_trace_free();
+
+		wsa_trace_events = (struct wsa_trace_event *) malloc(
+			sizeof(struct wsa_trace_event) * max_events);
+		if (wsa_trace_events == NULL)
+			return WSA_ERR_MALLOCFAILED;
+		wsa_trace_capacity = max_events;
+	}
+
+	wsa_trace_count = 0;
+	wsa_trace_dropped = 0;
+	wsa_trace_origin_ns = wsa_perf_now();
+	wsa_atomic_store32(&wsa_trace_recording, 1);
+	wsa_trace_enabled = 1;
+
+	return 0;
+}
+
+
+/**
+ * stops recording trace events, and waits for any event being recorded by
+ * another thread to be stored.  The events recorded are kept until the
+ * next wsa_trace_start() or wsa_trace_free().
+ */
+void wsa_trace_stop(void)
+{
+	wsa_trace_enabled = 0;
+	wsa_atomic_store32(&wsa_trace_recording, 0);
+	wsa_atomic_fence();
+
+	while (wsa_atomic_load32(&wsa_trace_writers) != 0)
+		wsa_sleep_ms(0);
+}
+
+
+/**
+ * stops recording and frees the trace buffer
+ */
+void wsa_trace_free(void)
+{
+	wsa_trace_stop();
+
+	if (wsa_trace_events)
+		free(wsa_trace_events);
+
+	wsa_trace_events = NULL;
+	wsa_trace_capacity = 0;
+	wsa_trace_count = 0;
+}
+
+
+/**
+ * stores a trace event.  Use WSA_TRACE_BEGIN() and WSA_TRACE_END() rather
+ * than calling this directly, so nothing is recorded while disabled.
+ * Safe to call from several threads, and while another starts, stops or
+ * frees the trace.
+ *
+ * @param name - the operation's name, which must be a string constant
+ * @param category - the operation's category, which must be a string constant
+ * @param detail - optional text copied into the event, or NULL
+ * @param start_ns - the wsa_perf_now() time stamp taken when the operation began
+ * @param end_ns - the wsa_perf_now() time stamp taken when the operation ended
+ */
+void wsa_trace_record(const char *name, const char *category, const char *detail,
+		uint64_t start_ns, uint64_t end_ns)
+{
+	struct wsa_trace_event *event;
+	uint32_t index;
+
+	if (!wsa_trace_enabled)
+		return;
+
+	// hold wsa_trace_stop() off while writing into the buffer
+	wsa_atomic_add32(&wsa_trace_writers, 1);
+	if (!wsa_atomic_load32(&wsa_trace_recording)) {
+		wsa_atomic_add32(&wsa_trace_writers, (uint32_t) -1);
+		return;
+	}
+
+	// claim a slot, never counting past the end of the buffer, so that
+	// the count can't wrap around to slots already written
+	do {
+		index = wsa_atomic_load32(&wsa_trace_count);
+		if (index >= wsa_trace_capacity) {
+			wsa_atomic_add32(&wsa_trace_dropped, 1);
+			wsa_atomic_add32(&wsa_trace_writers, (uint32_t) -1);
+			return;
+		}
+	} while (!wsa_atomic_cas32(&wsa_trace_count, index, index + 1));
+
+	event = &wsa_trace_events[index];
+	event->name = name;
+	event->category = category;
+	event->start_ns = start_ns;
+	event->duration_ns = end_ns - start_ns;
+	event->thread_id = wsa_thread_id();
+
+	if (detail) {
+		strncpy(event->detail, detail, WSA_TRACE_DETAIL_LEN - 1);
+		event->detail[WSA_TRACE_DETAIL_LEN - 1] = '\0';
+	} else {
+		event->detail[0] = '\0';
+	}
+
+	wsa_atomic_add32(&wsa_trace_writers, (uint32_t) -1);
+}
+
+
+/**
+ * writes a JSON string, escaping what needs to be
+ *
+ * @param fp - the output file
+ * @param str - the string
+ */
+static void wsa_trace_write_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(fp, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned int) (unsigned char) *str);
+		else
+			fputc(*str, fp);
+	}
+
+	fputc('"', fp);
+}
+
+
+/**
+ * writes the recorded trace events to a file in the Chrome trace event
+ * JSON format.  Stop tracing first, or events recorded during the dump may
+ * be written incompletely.
+ *
+ * @param file_name - the name of the file to create
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_trace_dump(const char *file_name)
+{
+	FILE *fp;
+	struct wsa_trace_event *event;
+	uint32_t count;
+	uint32_t i;
+	uint64_t start;
+
+	if (file_name == NULL)
+		return WSA_ERR_INVINPUT;
+
+	fp = fopen(file_name, "w");
+	if (fp == NULL)
+		return WSA_ERR_FILECREATEFAILED;
+
+	count = wsa_atomic_load32(&wsa_trace_count);
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+
+	for (i = 0; i < count; i++) {
+		event = &wsa_trace_events[i];
+		start = event->start_ns - wsa_trace_origin_ns;
+
+		// trace event times are in microseconds
+		fprintf(fp, "{\"name\":");
+		wsa_trace_write_string(fp, event->name);
+		fprintf(fp, ",\"cat\":");
+		wsa_trace_write_string(fp, event->category);
+		fprintf(fp, ",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":1,\"tid\":%u",
+			start / 1000, (unsigned int) (start % 1000),
+			event->duration_ns / 1000, (unsigned int) (event->duration_ns % 1000),
+			event->thread_id);
+
+		if (event->detail[0] != '\0') {
+			fprintf(fp, ",\"args\":{\"detail\":");
+			wsa_trace_write_string(fp, event->detail);
+			fprintf(fp, "}");
+		}
+
+		fprintf(fp, "}%s\n", (i + 1 < count) ? "," : "");
+	}
+
+	fprintf(fp, "],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"dropped_events\":%u}}\n",
+		wsa_trace_dropped);
+
+	if (fclose(fp) != 0)
+		return WSA_ERR_FILEWRITEFAILED;
+
+	return 0;
+}
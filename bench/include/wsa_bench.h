@@ -0,0 +1,34 @@
+#ifndef __WSA_BENCH_H__
+#define __WSA_BENCH_H__
+
+#include "wsa_lib.h"
+
+// VRT words around the payload of an IF data packet: the header (including
+// its timestamps) and the trailer
+#define WSA_BENCH_IF_OVERHEAD_WORDS (VRT_HEADER_SIZE + VRT_TRAILER_SIZE)
+
+// words in a receiver context packet holding a frequency and a gain
+#define WSA_BENCH_RECEIVER_WORDS 9
+
+// words in a digitizer context packet holding a reference level
+#define WSA_BENCH_DIGITIZER_WORDS 7
+
+// words in an extension context packet holding a sweep start ID
+#define WSA_BENCH_EXTENSION_WORDS 7
+
+struct wsa_bench_loopback;
+
+int32_t wsa_bench_build_if_packet(uint8_t *packet, uint32_t stream_id,
+		uint32_t payload_words, uint8_t pkt_count, uint32_t sec, uint64_t psec);
+int32_t wsa_bench_build_receiver_packet(uint8_t *packet, uint8_t pkt_count,
+		uint32_t sec, uint64_t freq);
+int32_t wsa_bench_build_digitizer_packet(uint8_t *packet, uint8_t pkt_count,
+		uint32_t sec, int16_t reference_level);
+int32_t wsa_bench_build_extension_packet(uint8_t *packet, uint8_t pkt_count,
+		uint32_t sec, uint32_t sweep_start_id);
+
+int16_t wsa_bench_loopback_start(struct wsa_bench_loopback **loopback);
+void wsa_bench_loopback_intf_method(struct wsa_bench_loopback *loopback, char *intf_method);
+void wsa_bench_loopback_stop(struct wsa_bench_loopback *loopback);
+
+#endif
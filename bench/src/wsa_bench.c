@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsa_error.h"
+#include "wsa_lib.h"
+#include "wsa_dsp.h"
+#include "wsa_iq_codec.h"
+#include "wsa_perf.h"
+#include "wsa_sweep_device.h"
+#include "wsa_bench.h"
+
+// *****
+// Microbenchmarks of the capture and DSP hot paths.  Each benchmark runs at
+// the sample counts the sweep planner produces for WSA_BENCH_RBWS, and prints
+// one CSV line:
+//
+//	name,samples,iterations,ns_per_call,ns_per_sample,gb_per_s
+//
+// where gb_per_s is the input bytes consumed per second (10^9 bytes).
+// Usage: wsabench [minimum milliseconds per benchmark]
+// *****
+
+#define WSA_BENCH_DEFAULT_MIN_MS 100
+#define WSA_BENCH_MAX_SIZES 16
+
+// the sweep the planner is asked for, at each of the RBWs below
+#define WSA_BENCH_FSTART (100ULL * MHZ)
+#define WSA_BENCH_FSTOP (1100ULL * MHZ)
+#define WSA_BENCH_MODE "SH"
+static const uint32_t wsa_bench_rbws[] = {
+	1000000, 300000, 100000, 30000, 10000, 3000, 1000
+};
+
+/// the buffers a benchmark kernel works on
+struct wsa_bench_ctx {
+	// number of samples (time domain) or bins (frequency domain)
+	uint32_t size;
+
+	// the block as the device sends it: packets of spp samples, back to back
+	uint32_t spp;
+	uint32_t packets;
+
+	// synthetic packets
+	uint8_t *if_packet;
+	int32_t if_packet_bytes;
+	uint8_t *receiver_packet;
+	int32_t receiver_packet_bytes;
+	uint8_t *payload;
+
+	// decoded and processed data
+	int16_t *i16_buffer;
+	int16_t *q16_buffer;
+	int32_t *i32_buffer;
+	kiss_fft_scalar *idata;
+	kiss_fft_scalar *qdata;
+	kiss_fft_scalar *windowed;
+	kiss_fft_cpx *fftout;
+	float *spectrum;
+
+	// the Q channel, compressed, and decompressed again
+	uint8_t *encoded;
+	int32_t encoded_bytes;
+	int16_t *decoded;
+
+	struct wsa_vrt_packet_header header;
+	struct wsa_vrt_packet_trailer trailer;
+	struct wsa_receiver_packet receiver;
+	struct wsa_digitizer_packet digitizer;
+	struct wsa_extension_packet extension;
+
+	// keeps results alive, so the work isn't optimized out
+	float sink;
+};
+
+typedef void (*wsa_bench_kernel)(struct wsa_bench_ctx *ctx);
+
+static uint64_t wsa_bench_min_ns;
+
+
+static void bench_vrt_decode_if(struct wsa_bench_ctx *ctx)
+{
+	uint32_t stride = (ctx->spp + WSA_BENCH_IF_OVERHEAD_WORDS) * BYTES_PER_VRT_WORD;
+	uint32_t i;
+
+	for (i = 0; i < ctx->packets; i++)
+		wsa_decode_vrt_packet(ctx->if_packet + i * stride, &ctx->header, &ctx->trailer,
+			&ctx->receiver, &ctx->digitizer, &ctx->extension,
+			ctx->payload + i * ctx->spp * BYTES_PER_VRT_WORD);
+}
+
+static void bench_vrt_decode_receiver(struct wsa_bench_ctx *ctx)
+{
+	wsa_decode_vrt_packet(ctx->receiver_packet, &ctx->header, &ctx->trailer, &ctx->receiver,
+		&ctx->digitizer, &ctx->extension, ctx->payload);
+}
+
+static void bench_decode_zif_frame(struct wsa_bench_ctx *ctx)
+{
+	wsa_decode_zif_frame(ctx->payload, ctx->i16_buffer, ctx->q16_buffer, ctx->size);
+}
+
+static void bench_decode_i16_frame(struct wsa_bench_ctx *ctx)
+{
+	wsa_decode_i_only_frame(I16_DATA_STREAM_ID, ctx->payload, ctx->i16_buffer,
+		ctx->i32_buffer, ctx->size);
+}
+
+static void bench_decode_i32_frame(struct wsa_bench_ctx *ctx)
+{
+	wsa_decode_i_only_frame(I32_DATA_STREAM_ID, ctx->payload, ctx->i16_buffer,
+		ctx->i32_buffer, ctx->size);
+}
+
+static void bench_iq_encode_i16(struct wsa_bench_ctx *ctx)
+{
+	wsa_iq_encode_i16(ctx->q16_buffer, ctx->size, ctx->encoded,
+		WSA_IQ_CODEC_BOUND(ctx->size, 2));
+}
+
+static void bench_iq_decode_i16(struct wsa_bench_ctx *ctx)
+{
+	wsa_iq_decode_i16(ctx->encoded, ctx->encoded_bytes, ctx->decoded, ctx->size);
+}
+
+static void bench_normalize_iq_data(struct wsa_bench_ctx *ctx)
+{
+	normalize_iq_data(ctx->size, I16Q16_DATA_STREAM_ID, ctx->i16_buffer, ctx->q16_buffer,
+		ctx->i32_buffer, ctx->idata, ctx->qdata);
+}
+
+// windows a copy, as the capture path windows fresh samples each time,
+// which windowing in place over and over would decay to zeros
+static void bench_window_hanning(struct wsa_bench_ctx *ctx)
+{
+	memcpy(ctx->windowed, ctx->idata, sizeof(kiss_fft_scalar) * ctx->size);
+	window_hanning_scalar_array(ctx->windowed, ctx->size);
+}
+
+static void bench_rfft(struct wsa_bench_ctx *ctx)
+{
+	rfft(ctx->idata, ctx->fftout, ctx->size);
+}
+
+// the power and log conversion of wsa_capture_power_spectrum(), over the
+// size / 2 bins of a real FFT
+static void bench_log_power(struct wsa_bench_ctx *ctx)
+{
+	kiss_fft_scalar tmpscalar;
+	uint32_t i;
+
+	for (i = 0; i < ctx->size / 2; i++) {
+		tmpscalar = cpx_to_power(ctx->fftout[i]) / ctx->size;
+		tmpscalar = 2 * power_to_logpower(tmpscalar);
+		ctx->spectrum[i] = tmpscalar - (float) KISS_FFT_OFFSET;
+	}
+}
+
+static void bench_psd_peak_find(struct wsa_bench_ctx *ctx)
+{
+	uint64_t peak_freq;
+	float peak_power;
+
+	psd_peak_find(WSA_BENCH_FSTART, WSA_BENCH_FSTOP, 0, ctx->size / 2, ctx->spectrum,
+		&peak_freq, &peak_power);
+	ctx->sink += peak_power;
+}
+
+static void bench_psd_channel_power(struct wsa_bench_ctx *ctx)
+{
+	float power = 0;
+
+	psd_calculate_channel_power(ctx->size / 8, ctx->size * 3 / 8, ctx->spectrum,
+		ctx->size / 2, &power);
+	ctx->sink += power;
+}
+
+static void bench_psd_absolute_power(struct wsa_bench_ctx *ctx)
+{
+	float power = 0;
+
+	psd_calculate_absolute_power(ctx->size / 8, ctx->size * 3 / 8, ctx->spectrum,
+		ctx->size / 2, &power);
+	ctx->sink += power;
+}
+
+
+/**
+ * times a kernel, doubling the iteration count until a run lasts long enough,
+ * and prints its CSV line
+ *
+ * @param name - the benchmark name
+ * @param kernel - the kernel
+ * @param ctx - the kernel's buffers
+ * @param samples - the samples processed per call
+ * @param bytes - the input bytes consumed per call
+ */
+static void wsa_bench_run(const char *name, wsa_bench_kernel kernel,
+		struct wsa_bench_ctx *ctx, uint32_t samples, uint64_t bytes)
+{
+	uint64_t iterations = 1;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t i;
+	double ns_per_call;
+
+	// warm up the caches
+	kernel(ctx);
+
+	for (;;) {
+		start = wsa_perf_now();
+		for (i = 0; i < iterations; i++)
+			kernel(ctx);
+		elapsed = wsa_perf_now() - start;
+
+		if (elapsed >= wsa_bench_min_ns)
+			break;
+		iterations *= 2;
+	}
+
+	ns_per_call = (double) elapsed / (double) iterations;
+	printf("%s,%u,%llu,%.1f,%.3f,%.3f\n", name, samples, iterations, ns_per_call,
+		ns_per_call / samples, (double) bytes / ns_per_call);
+	fflush(stdout);
+}
+
+
+/**
+ * allocates and fills the buffers for a block
+ *
+ * @param ctx - the context to initialize
+ * @param spp - the samples per packet
+ * @param packets - the packets per block
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_bench_ctx_init(struct wsa_bench_ctx *ctx, uint32_t spp, uint32_t packets)
+{
+	uint32_t size = spp * packets;
+	uint32_t stride = (spp + WSA_BENCH_IF_OVERHEAD_WORDS) * BYTES_PER_VRT_WORD;
+	int32_t bytes;
+	uint32_t i;
+
+	memset(ctx, 0, sizeof(struct wsa_bench_ctx));
+	ctx->size = size;
+	ctx->spp = spp;
+	ctx->packets = packets;
+
+	ctx->if_packet = (uint8_t *) malloc(packets * stride);
+	ctx->receiver_packet = (uint8_t *) malloc(WSA_BENCH_RECEIVER_WORDS * BYTES_PER_VRT_WORD);
+	ctx->payload = (uint8_t *) malloc(size * BYTES_PER_VRT_WORD);
+	ctx->i16_buffer = (int16_t *) malloc(sizeof(int16_t) * size * 2);
+	ctx->q16_buffer = (int16_t *) malloc(sizeof(int16_t) * size);
+	ctx->i32_buffer = (int32_t *) malloc(sizeof(int32_t) * size);
+	ctx->idata = (kiss_fft_scalar *) malloc(sizeof(kiss_fft_scalar) * size);
+	ctx->qdata = (kiss_fft_scalar *) malloc(sizeof(kiss_fft_scalar) * size);
+	ctx->windowed = (kiss_fft_scalar *) malloc(sizeof(kiss_fft_scalar) * size);
+	ctx->fftout = (kiss_fft_cpx *) malloc(sizeof(kiss_fft_cpx) * size);
+	ctx->spectrum = (float *) malloc(sizeof(float) * size);
+	ctx->encoded = (uint8_t *) malloc(WSA_IQ_CODEC_BOUND(size, 2));
+	ctx->decoded = (int16_t *) malloc(sizeof(int16_t) * size);
+
+	if (!ctx->if_packet || !ctx->receiver_packet || !ctx->payload || !ctx->i16_buffer ||
+		!ctx->q16_buffer || !ctx->i32_buffer || !ctx->idata || !ctx->qdata ||
+		!ctx->windowed || !ctx->fftout || !ctx->spectrum || !ctx->encoded || !ctx->decoded)
+		return WSA_ERR_MALLOCFAILED;
+
+	// every stage starts from realistic data: the tone, decoded, and its spectrum.
+	// A block spans several packets, since one packet's size field tops out at
+	// VRT_MAX_PACKET_WORDS.
+	for (i = 0; i < packets; i++) {
+		bytes = wsa_bench_build_if_packet(ctx->if_packet + i * stride,
+			I16Q16_DATA_STREAM_ID, spp, (uint8_t) i, 0, 0);
+		if (bytes < 0)
+			return (int16_t) bytes;
+
+		ctx->if_packet_bytes += bytes;
+		memcpy(ctx->payload + i * spp * BYTES_PER_VRT_WORD,
+			ctx->if_packet + i * stride + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD,
+			spp * BYTES_PER_VRT_WORD);
+	}
+	ctx->receiver_packet_bytes = wsa_bench_build_receiver_packet(ctx->receiver_packet,
+		0, 0, 2400ULL * MHZ);
+
+	wsa_decode_zif_frame(ctx->payload, ctx->i16_buffer, ctx->q16_buffer, size);
+	normalize_iq_data(size, I16Q16_DATA_STREAM_ID, ctx->i16_buffer, ctx->q16_buffer,
+		ctx->i32_buffer, ctx->idata, ctx->qdata);
+	rfft(ctx->idata, ctx->fftout, size);
+	bench_log_power(ctx);
+	ctx->encoded_bytes = wsa_iq_encode_i16(ctx->q16_buffer, size, ctx->encoded,
+		WSA_IQ_CODEC_BOUND(size, 2));
+
+	return 0;
+}
+
+
+/**
+ * frees the buffers of a context
+ *
+ * @param ctx - the context
+ */
+static void wsa_bench_ctx_free(struct wsa_bench_ctx *ctx)
+{
+	free(ctx->if_packet);
+	free(ctx->receiver_packet);
+	free(ctx->payload);
+	free(ctx->i16_buffer);
+	free(ctx->q16_buffer);
+	free(ctx->i32_buffer);
+	free(ctx->idata);
+	free(ctx->qdata);
+	free(ctx->windowed);
+	free(ctx->fftout);
+	free(ctx->spectrum);
+	free(ctx->encoded);
+	free(ctx->decoded);
+}
+
+
+/**
+ * collects the distinct block sizes (samples per packet times packets per
+ * block) the planner produces for the benchmark RBWs, with and without
+ * tuning the blocks
+ *
+ * @param sizes - an array to store the sizes
+ * @param spps - an array to store the samples per packet of each size
+ *
+ * @return the number of sizes
+ */
+static int wsa_bench_planner_sizes(uint32_t *sizes, uint32_t *spps)
+{
+	struct wsa_sweep_device sweep_device;
+	struct wsa_power_spectrum_config *pscfg;
+	uint32_t size;
+	int count = 0;
+	int i;
+	int j;
+
+	memset(&sweep_device, 0, sizeof(struct wsa_sweep_device));
+
+	for (i = 0; i < 2 * (int) (sizeof(wsa_bench_rbws) / sizeof(wsa_bench_rbws[0])); i++) {
+		wsa_sweep_device_set_plan_tuning(&sweep_device, i & 1);
+		if (wsa_power_spectrum_alloc(&sweep_device, WSA_BENCH_FSTART, WSA_BENCH_FSTOP,
+			wsa_bench_rbws[i / 2], WSA_BENCH_MODE, &pscfg) < 0)
+			continue;
+
+		size = pscfg->samples_per_packet * pscfg->packets_per_block;
+
+		for (j = 0; j < count; j++)
+			if (sizes[j] == size)
+				break;
+		if (j == count && count < WSA_BENCH_MAX_SIZES) {
+			spps[count] = pscfg->samples_per_packet;
+			sizes[count++] = size;
+		}
+
+		wsa_power_spectrum_free(pscfg);
+	}
+
+	return count;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct wsa_bench_ctx ctx;
+	uint32_t sizes[WSA_BENCH_MAX_SIZES];
+	uint32_t spps[WSA_BENCH_MAX_SIZES];
+	uint32_t size;
+	int count;
+	int i;
+
+	wsa_bench_min_ns = (uint64_t) WSA_BENCH_DEFAULT_MIN_MS * 1000000ULL;
+	if (argc > 1 && atoi(argv[1]) > 0)
+		wsa_bench_min_ns = (uint64_t) atoi(argv[1]) * 1000000ULL;
+
+	count = wsa_bench_planner_sizes(sizes, spps);
+	if (count == 0) {
+		fprintf(stderr, "wsabench: the planner produced no block sizes\n");
+		return 1;
+	}
+
+	printf("name,samples,iterations,ns_per_call,ns_per_sample,gb_per_s\n");
+
+	for (i = 0; i < count; i++) {
+		size = sizes[i];
+		if (wsa_bench_ctx_init(&ctx, spps[i], size / spps[i]) < 0) {
+			fprintf(stderr, "wsabench: can't set up %u samples\n", size);
+			wsa_bench_ctx_free(&ctx);
+			return 1;
+		}
+
+		wsa_bench_run("vrt_decode_if_packet", bench_vrt_decode_if, &ctx,
+			size, ctx.if_packet_bytes);
+		wsa_bench_run("wsa_decode_zif_frame", bench_decode_zif_frame, &ctx,
+			size, size * 4);
+		wsa_bench_run("wsa_decode_i_only_frame_i16", bench_decode_i16_frame, &ctx,
+			size, size * 2);
+		wsa_bench_run("wsa_decode_i_only_frame_i32", bench_decode_i32_frame, &ctx,
+			size, size * 4);
+		wsa_bench_run("wsa_iq_encode_i16", bench_iq_encode_i16, &ctx,
+			size, size * 2);
+		wsa_bench_run("wsa_iq_decode_i16", bench_iq_decode_i16, &ctx,
+			size, ctx.encoded_bytes);
+		wsa_bench_run("normalize_iq_data", bench_normalize_iq_data, &ctx,
+			size, size * 4);
+		wsa_bench_run("window_hanning_scalar_array", bench_window_hanning, &ctx,
+			size, size * sizeof(kiss_fft_scalar));
+		wsa_bench_run("rfft", bench_rfft, &ctx,
+			size, size * sizeof(kiss_fft_scalar));
+		wsa_bench_run("log_power", bench_log_power, &ctx,
+			size / 2, (size / 2) * sizeof(kiss_fft_cpx));
+		wsa_bench_run("psd_peak_find", bench_psd_peak_find, &ctx,
+			size / 2, (size / 2) * sizeof(float));
+		wsa_bench_run("psd_calculate_channel_power", bench_psd_channel_power, &ctx,
+			size / 2, (size / 2) * sizeof(float));
+		wsa_bench_run("psd_calculate_absolute_power", bench_psd_absolute_power, &ctx,
+			size / 2, (size / 2) * sizeof(float));
+
+		wsa_bench_ctx_free(&ctx);
+	}
+
+	// context packets don't depend on the block size
+	wsa_bench_ctx_init(&ctx, spps[0], sizes[0] / spps[0]);
+	wsa_bench_run("vrt_decode_receiver_packet", bench_vrt_decode_receiver, &ctx,
+		1, ctx.receiver_packet_bytes);
+	wsa_bench_ctx_free(&ctx);
+
+	return 0;
+}
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET wsa_bench_socket;
+#define WSA_BENCH_SEND_FLAGS 0
+#define WSA_BENCH_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+typedef int wsa_bench_socket;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#define WSA_BENCH_SEND_FLAGS MSG_NOSIGNAL
+#define WSA_BENCH_WOULD_BLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
+#endif
+
+#include "wsa_error.h"
+#include "wsa_lib.h"
+#include "wsa_atomic.h"
+#include "wsa_thread.h"
+#include "wsa_bench.h"
+
+
+// *****
+// A stand-in for a device on 127.0.0.1: it answers the SCPI commands the
+// sweep device sends while loading a sweep plan, and on SWEEP:LIST:START
+// streams a receiver and a digitizer context packet followed by a block of
+// synthetic IF packets for every step of every saved sweep entry.  A sweep
+// started with an ID opens with an extension context packet holding it.
+// *****
+
+#define WSA_BENCH_LOOPBACK_IDN "ThinkRF,WSA5000-418 v3,000000000000,loopback"
+#define WSA_BENCH_LOOPBACK_MAX_ENTRIES 64
+#define WSA_BENCH_LOOPBACK_POLL_MS 100
+#define WSA_BENCH_LOOPBACK_REFLEVEL (-10)
+
+/// a saved sweep entry, or the entry template
+struct wsa_bench_loopback_entry {
+	uint64_t fcstart;
+	uint64_t fcstop;
+	uint64_t fstep;
+	uint32_t spp;
+	uint32_t ppb;
+	uint32_t stream_id;
+	uint8_t dd_mode;
+};
+
+struct wsa_bench_loopback {
+	wsa_bench_socket ctrl_listener;
+	wsa_bench_socket data_listener;
+	wsa_bench_socket ctrl;
+	wsa_bench_socket data;
+	uint16_t ctrl_port;
+	uint16_t data_port;
+
+	wsa_thread_t thread;
+	volatile uint32_t stop;
+
+	// the sweep list
+	struct wsa_bench_loopback_entry entry_template;
+	struct wsa_bench_loopback_entry entries[WSA_BENCH_LOOPBACK_MAX_ENTRIES];
+	uint32_t entry_count;
+
+	// position in the sweep being streamed: 0 is the receiver packet,
+	// 1 the digitizer packet and the rest are the IF packets of the block
+	uint32_t entry_index;
+	uint64_t step_index;
+	uint32_t block_packet;
+	uint8_t pkt_count[4];
+	uint32_t sec;
+
+	// the ID the sweep was started with, sent ahead of it when set
+	uint32_t sweep_start_id;
+	uint32_t send_sweep_start_id;
+
+	// the packet being sent, or NULL when idle
+	uint8_t *out;
+	int32_t out_len;
+	int32_t out_sent;
+	uint8_t context_packet[WSA_BENCH_RECEIVER_WORDS * BYTES_PER_VRT_WORD];
+
+	// IF packets are only rebuilt when their format changes
+	uint8_t *if_packet;
+	int32_t if_packet_len;
+	uint32_t if_stream_id;
+	uint32_t if_payload_words;
+
+	// the control line being received
+	char line[MAX_STR_LEN];
+	uint32_t line_len;
+};
+
+
+/**
+ * opens a socket listening on an ephemeral 127.0.0.1 port
+ *
+ * @param sock - where to store the socket
+ * @param port - where to store the port, in host byte order
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int16_t wsa_bench_loopback_listen(wsa_bench_socket *sock, uint16_t *port)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	*sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (*sock == INVALID_SOCKET)
+		return WSA_ERR_SOCKETSETFUPFAILED;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if (bind(*sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+		listen(*sock, 1) != 0 ||
+		getsockname(*sock, (struct sockaddr *) &addr, &addr_len) != 0) {
+		closesocket(*sock);
+		*sock = INVALID_SOCKET;
+		return WSA_ERR_SOCKETSETFUPFAILED;
+	}
+
+	*port = ntohs(addr.sin_port);
+
+	return 0;
+}
+
+
+/**
+ * sends a response line on the control socket
+ *
+ * @param lb - the loopback device
+ * @param response - the response, without its line feed
+ */
+static void wsa_bench_loopback_reply(struct wsa_bench_loopback *lb, const char *response)
+{
+	char line[MAX_STR_LEN];
+	int len;
+
+	len = sprintf(line, "%s\n", response);
+	send(lb->ctrl, line, len, WSA_BENCH_SEND_FLAGS);
+}
+
+
+/**
+ * the number of frequency steps a sweep entry makes, counted the way the
+ * sweep planner counts them
+ *
+ * @param entry - the sweep entry
+ *
+ * @return the number of steps
+ */
+static uint64_t wsa_bench_loopback_steps(struct wsa_bench_loopback_entry const *entry)
+{
+	if (entry->dd_mode || entry->fstep == 0 || entry->fcstop <= entry->fcstart ||
+		(entry->fcstop - entry->fcstart) <= entry->fstep)
+		return 1;
+
+	return (entry->fcstop - entry->fcstart) / entry->fstep + 1;
+}
+
+
+/**
+ * prepares the next packet of the sweep being streamed
+ *
+ * @param lb - the loopback device
+ *
+ * @return 1 if there is a packet to send, 0 once the sweep is done
+ */
+static int wsa_bench_loopback_next_packet(struct wsa_bench_loopback *lb)
+{
+	struct wsa_bench_loopback_entry *entry;
+	uint32_t payload_words;
+	uint8_t *packet;
+
+	lb->out = NULL;
+	lb->out_sent = 0;
+
+	if (lb->entry_index >= lb->entry_count)
+		return 0;
+
+	entry = &lb->entries[lb->entry_index];
+
+	// a sweep started with an ID opens with it
+	if (lb->send_sweep_start_id) {
+		lb->send_sweep_start_id = 0;
+		lb->out_len = wsa_bench_build_extension_packet(lb->context_packet, lb->pkt_count[3]++,
+			lb->sec, lb->sweep_start_id);
+		lb->out = lb->context_packet;
+		return 1;
+	}
+
+	if (lb->block_packet == 0) {
+		lb->out_len = wsa_bench_build_receiver_packet(lb->context_packet, lb->pkt_count[0]++,
+			lb->sec, entry->fcstart + lb->step_index * entry->fstep);
+		lb->out = lb->context_packet;
+	} else if (lb->block_packet == 1) {
+		lb->out_len = wsa_bench_build_digitizer_packet(lb->context_packet, lb->pkt_count[1]++,
+			lb->sec, WSA_BENCH_LOOPBACK_REFLEVEL);
+		lb->out = lb->context_packet;
+	} else {
+		// I16 packs two samples in a word
+		payload_words = entry->spp;
+		if (entry->stream_id == I16_DATA_STREAM_ID)
+			payload_words = entry->spp / 2;
+
+		if (lb->if_packet == NULL || lb->if_stream_id != entry->stream_id ||
+			lb->if_payload_words != payload_words) {
+			packet = (uint8_t *) realloc(lb->if_packet,
+				(payload_words + WSA_BENCH_IF_OVERHEAD_WORDS) * BYTES_PER_VRT_WORD);
+			if (packet == NULL) {
+				lb->entry_index = lb->entry_count;
+				return 0;
+			}
+
+			lb->if_packet = packet;
+			lb->if_stream_id = entry->stream_id;
+			lb->if_payload_words = payload_words;
+			lb->if_packet_len = wsa_bench_build_if_packet(lb->if_packet, entry->stream_id,
+				payload_words, 0, lb->sec, 0);
+		}
+
+		// only the packet count changes between IF packets
+		lb->if_packet[1] = (uint8_t) ((lb->if_packet[1] & 0xf0) | (lb->pkt_count[2]++ & 0x0f));
+		lb->out_len = lb->if_packet_len;
+		lb->out = lb->if_packet;
+	}
+
+	// move on to the next packet of the block, step and entry
+	lb->block_packet++;
+	if (lb->block_packet == entry->ppb + 2) {
+		lb->block_packet = 0;
+		lb->step_index++;
+		if (lb->step_index >= wsa_bench_loopback_steps(entry)) {
+			lb->step_index = 0;
+			lb->entry_index++;
+		}
+	}
+
+	return 1;
+}
+
+
+/**
+ * sends as much of the sweep as the data socket takes without blocking
+ *
+ * @param lb - the loopback device
+ *
+ * @return 0 on success, or a negative number if the connection failed
+ */
+static int16_t wsa_bench_loopback_send_data(struct wsa_bench_loopback *lb)
+{
+	int sent;
+
+	while (lb->out) {
+		sent = send(lb->data, (const char *) lb->out + lb->out_sent,
+			lb->out_len - lb->out_sent, WSA_BENCH_SEND_FLAGS);
+		if (sent < 0) {
+			if (WSA_BENCH_WOULD_BLOCK())
+				return 0;
+			return WSA_ERR_SOCKETERROR;
+		}
+
+		lb->out_sent += sent;
+		if (lb->out_sent == lb->out_len)
+			wsa_bench_loopback_next_packet(lb);
+	}
+
+	return 0;
+}
+
+
+/**
+ * checks whether a control line starts with a command, and if so finds its
+ * arguments
+ *
+ * @param line - the control line
+ * @param command - the command
+ * @param args - where to store a pointer to the arguments
+ *
+ * @return 1 if the line holds the command, 0 otherwise
+ */
+static int wsa_bench_loopback_match(char *line, const char *command, char **args)
+{
+	size_t len = strlen(command);
+
+	if (strncmp(line, command, len) != 0)
+		return 0;
+
+	*args = line + len;
+	while (**args == ' ')
+		(*args)++;
+
+	return 1;
+}
+
+
+/**
+ * handles a control line
+ *
+ * @param lb - the loopback device
+ * @param line - the line, without its line feed
+ */
+static void wsa_bench_loopback_command(struct wsa_bench_loopback *lb, char *line)
+{
+	struct wsa_bench_loopback_entry *entry = &lb->entry_template;
+	char reply[16];
+	char *args;
+	size_t len;
+
+	len = strlen(line);
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' '))
+		line[--len] = '\0';
+
+	if (line[0] == ':')
+		line++;
+
+	if (strcmp(line, "*IDN?") == 0) {
+		wsa_bench_loopback_reply(lb, WSA_BENCH_LOOPBACK_IDN);
+	} else if (strcmp(line, "*STB?") == 0) {
+		wsa_bench_loopback_reply(lb, "0");
+	} else if (strcmp(line, "*ESR?") == 0) {
+		wsa_bench_loopback_reply(lb, "1");
+	} else if (strcmp(line, "SYST:ERR?") == 0) {
+		wsa_bench_loopback_reply(lb, "0,\"No error\"");
+	} else if (strcmp(line, "SYST:CAPT:MODE?") == 0) {
+		wsa_bench_loopback_reply(lb, lb->out != NULL ?
+			WSA_SWEEP_CAPTURE_MODE : WSA_BLOCK_CAPTURE_MODE);
+	} else if (strcmp(line, "SWEEP:ENTRY:COUNT?") == 0) {
+		sprintf(reply, "%u", lb->entry_count);
+		wsa_bench_loopback_reply(lb, reply);
+	} else if (strcmp(line, "SWEEP:ENTRY:DELETE ALL") == 0) {
+		lb->entry_count = 0;
+	} else if (strcmp(line, "SWEEP:ENTRY:NEW") == 0) {
+		memset(entry, 0, sizeof(struct wsa_bench_loopback_entry));
+		entry->spp = WSA_MIN_SPP;
+		entry->ppb = 1;
+		entry->stream_id = I16_DATA_STREAM_ID;
+	} else if (wsa_bench_loopback_match(line, "SWEEP:ENTRY:MODE ", &args)) {
+		entry->dd_mode = (strcmp(args, "DD") == 0);
+		if (strcmp(args, "ZIF") == 0)
+			entry->stream_id = I16Q16_DATA_STREAM_ID;
+		else if (strcmp(args, "HDR") == 0)
+			entry->stream_id = I32_DATA_STREAM_ID;
+		else
+			entry->stream_id = I16_DATA_STREAM_ID;
+	} else if (wsa_bench_loopback_match(line, "SWEEP:ENTRY:FREQ:CENT ", &args)) {
+		entry->fcstart = strtoul(args, &args, 10);
+		args = strchr(args, ',');
+		entry->fcstop = args ? strtoul(args + 1, NULL, 10) : entry->fcstart;
+	} else if (wsa_bench_loopback_match(line, "SWEEP:ENTRY:FREQ:STEP ", &args)) {
+		entry->fstep = strtoul(args, NULL, 10);
+	} else if (wsa_bench_loopback_match(line, "SWEEP:ENTRY:SPPACKET ", &args)) {
+		entry->spp = (uint32_t) strtoul(args, NULL, 10);
+	} else if (wsa_bench_loopback_match(line, "SWEEP:ENTRY:PPBLOCK ", &args)) {
+		entry->ppb = (uint32_t) strtoul(args, NULL, 10);
+	} else if (wsa_bench_loopback_match(line, "SWEEP:ENTRY:SAVE", &args)) {
+		if (lb->entry_count < WSA_BENCH_LOOPBACK_MAX_ENTRIES)
+			lb->entries[lb->entry_count++] = *entry;
+	} else if (strcmp(line, "SWEEP:LIST:START") == 0 ||
+			wsa_bench_loopback_match(line, "SWEEP:LIST:START ", &args)) {
+		// a packet already on its way is finished first
+		lb->send_sweep_start_id = strcmp(line, "SWEEP:LIST:START") != 0;
+		if (lb->send_sweep_start_id)
+			lb->sweep_start_id = (uint32_t) strtoul(args, NULL, 10);
+		lb->entry_index = 0;
+		lb->step_index = 0;
+		lb->block_packet = 0;
+		lb->sec = (uint32_t) time(NULL);
+		if (lb->out == NULL)
+			wsa_bench_loopback_next_packet(lb);
+	} else if (strcmp(line, "SWEEP:LIST:STOP") == 0) {
+		lb->entry_index = lb->entry_count;
+	} else if (len > 0 && line[strlen(line) - 1] == '?') {
+		// any other setting reads back as zero
+		wsa_bench_loopback_reply(lb, "0");
+	}
+}
+
+
+/**
+ * handles the bytes waiting on the control socket
+ *
+ * @param lb - the loopback device
+ *
+ * @return 0 on success, or a negative number once the client is gone
+ */
+static int16_t wsa_bench_loopback_recv_ctrl(struct wsa_bench_loopback *lb)
+{
+	char buf[MAX_STR_LEN];
+	int received;
+	int i;
+
+	received = recv(lb->ctrl, buf, sizeof(buf), 0);
+	if (received <= 0)
+		return WSA_ERR_SOCKETDROPPED;
+
+	for (i = 0; i < received; i++) {
+		if (buf[i] == '\n') {
+			lb->line[lb->line_len] = '\0';
+			wsa_bench_loopback_command(lb, lb->line);
+			lb->line_len = 0;
+		} else if (lb->line_len < MAX_STR_LEN - 1) {
+			lb->line[lb->line_len++] = buf[i];
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * accepts a connection, with Nagle's algorithm off so each response goes
+ * out at once, and closes the socket it was listening on
+ *
+ * @param listener - the listening socket
+ *
+ * @return the connected socket, or INVALID_SOCKET on error
+ */
+static wsa_bench_socket wsa_bench_loopback_accept(wsa_bench_socket *listener)
+{
+	wsa_bench_socket sock;
+	int nodelay = 1;
+
+	sock = accept(*listener, NULL, NULL);
+	closesocket(*listener);
+	*listener = INVALID_SOCKET;
+
+	if (sock != INVALID_SOCKET)
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &nodelay, sizeof(nodelay));
+
+	return sock;
+}
+
+
+/**
+ * the loopback device's thread: serves one client until it disconnects or
+ * wsa_bench_loopback_stop() is called
+ *
+ * @param arg - the loopback device
+ */
+static void wsa_bench_loopback_run(void *arg)
+{
+	struct wsa_bench_loopback *lb = (struct wsa_bench_loopback *) arg;
+	fd_set read_fds;
+	fd_set write_fds;
+	struct timeval timer;
+	wsa_bench_socket max_fd;
+#ifdef _WIN32
+	u_long non_blocking = 1;
+#endif
+
+	while (!wsa_atomic_load32(&lb->stop)) {
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		max_fd = 0;
+
+		// the client connects the control socket first
+		if (lb->ctrl == INVALID_SOCKET) {
+			FD_SET(lb->ctrl_listener, &read_fds);
+			max_fd = lb->ctrl_listener;
+		} else if (lb->data == INVALID_SOCKET) {
+			FD_SET(lb->data_listener, &read_fds);
+			max_fd = lb->data_listener;
+		} else {
+			FD_SET(lb->ctrl, &read_fds);
+			max_fd = lb->ctrl;
+			if (lb->out) {
+				FD_SET(lb->data, &write_fds);
+				if (lb->data > max_fd)
+					max_fd = lb->data;
+			}
+		}
+
+		timer.tv_sec = 0;
+		timer.tv_usec = WSA_BENCH_LOOPBACK_POLL_MS * 1000;
+		if (select((int) max_fd + 1, &read_fds, &write_fds, NULL, &timer) < 0)
+			break;
+
+		if (lb->ctrl == INVALID_SOCKET) {
+			if (FD_ISSET(lb->ctrl_listener, &read_fds)) {
+				lb->ctrl = wsa_bench_loopback_accept(&lb->ctrl_listener);
+				if (lb->ctrl == INVALID_SOCKET)
+					break;
+			}
+		} else if (lb->data == INVALID_SOCKET) {
+			if (FD_ISSET(lb->data_listener, &read_fds)) {
+				lb->data = wsa_bench_loopback_accept(&lb->data_listener);
+				if (lb->data == INVALID_SOCKET)
+					break;
+
+				// the sweep is streamed without blocking control requests
+#ifdef _WIN32
+				ioctlsocket(lb->data, FIONBIO, &non_blocking);
+#else
+				fcntl(lb->data, F_SETFL, fcntl(lb->data, F_GETFL, 0) | O_NONBLOCK);
+#endif
+			}
+		} else {
+			if (FD_ISSET(lb->data, &write_fds) && wsa_bench_loopback_send_data(lb) < 0)
+				break;
+			if (FD_ISSET(lb->ctrl, &read_fds) && wsa_bench_loopback_recv_ctrl(lb) < 0)
+				break;
+		}
+	}
+}
+
+
+/**
+ * starts a loopback device on two ephemeral 127.0.0.1 ports.  Connect to
+ * it with the interface method from wsa_bench_loopback_intf_method().
+ *
+ * @param loopback - where to store the loopback device
+ *
+ * @return 0 on success, or a negative number on error
+ */
+int16_t wsa_bench_loopback_start(struct wsa_bench_loopback **loopback)
+{
+	struct wsa_bench_loopback *lb;
+	int16_t result;
+#ifdef _WIN32
+	WSADATA wsa_data;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+		return WSA_ERR_WINSOCKSTARTUPFAILED;
+#endif
+
+	lb = (struct wsa_bench_loopback *) calloc(1, sizeof(struct wsa_bench_loopback));
+	if (lb == NULL)
+		return WSA_ERR_MALLOCFAILED;
+
+	lb->ctrl = INVALID_SOCKET;
+	lb->data = INVALID_SOCKET;
+	lb->data_listener = INVALID_SOCKET;
+
+	result = wsa_bench_loopback_listen(&lb->ctrl_listener, &lb->ctrl_port);
+	if (result == 0)
+		result = wsa_bench_loopback_listen(&lb->data_listener, &lb->data_port);
+	if (result == 0)
+		result = wsa_thread_create(&lb->thread, wsa_bench_loopback_run, lb);
+
+	if (result < 0) {
+		if (lb->ctrl_listener != INVALID_SOCKET)
+			closesocket(lb->ctrl_listener);
+		if (lb->data_listener != INVALID_SOCKET)
+			closesocket(lb->data_listener);
+		free(lb);
+		return result;
+	}
+
+	*loopback = lb;
+
+	return 0;
+}
+
+
+/**
+ * writes the interface method to pass to wsa_open() for a loopback device
+ *
+ * @param lb - the loopback device
+ * @param intf_method - a buffer of at least 40 characters
+ */
+void wsa_bench_loopback_intf_method(struct wsa_bench_loopback *lb, char *intf_method)
+{
+	sprintf(intf_method, "TCPIP::127.0.0.1::%u,%u",
+		(unsigned int) lb->ctrl_port, (unsigned int) lb->data_port);
+}
+
+
+/**
+ * stops a loopback device and frees it
+ *
+ * @param lb - the loopback device
+ */
+void wsa_bench_loopback_stop(struct wsa_bench_loopback *lb)
+{
+	wsa_atomic_store32(&lb->stop, 1);
+	wsa_thread_join(lb->thread);
+
+	if (lb->ctrl_listener != INVALID_SOCKET)
+		closesocket(lb->ctrl_listener);
+	if (lb->data_listener != INVALID_SOCKET)
+		closesocket(lb->data_listener);
+	if (lb->ctrl != INVALID_SOCKET)
+		closesocket(lb->ctrl);
+	if (lb->data != INVALID_SOCKET)
+		closesocket(lb->data);
+
+	if (lb->if_packet)
+		free(lb->if_packet);
+	free(lb);
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_perf.h"
+#include "wsa_thread.h"
+#include "wsa_sweep_device.h"
+#include "wsa_sweep_scheduler.h"
+#include "wsa_bench.h"
+
+
+// *****
+// Sweep scheduler benchmark and check: four clients, each on a thread of
+// its own, capture spectra of their own spans and RBWs through one
+// scheduler sharing a loopback device, so their requests meet in batches
+// of changing composition.  Prints one CSV line per client, and the
+// batches, sweeps and kept configs the scheduler took.  Exits with 1 if
+// any capture failed or left a bin of a spectrum missed.
+//
+// Usage: wsaschedbench [captures per client]
+// *****
+
+#define WSA_BENCH_SCHEDULER_DEFAULT_CAPTURES 5
+#define WSA_BENCH_SCHEDULER_CLIENTS 4
+#define WSA_BENCH_SCHEDULER_MODE "SH"
+
+/// what each client asks for: two overlapping spans, one far off, and a
+/// coarse one inside the first
+static const struct {
+	uint64_t fstart;
+	uint64_t fstop;
+	uint32_t rbw;
+	uint8_t rebin;
+} wsa_bench_scheduler_requests[WSA_BENCH_SCHEDULER_CLIENTS] = {
+	{ 100ULL * MHZ, 600ULL * MHZ, 100000, WSA_REBIN_POWER },
+	{ 400ULL * MHZ, 900ULL * MHZ, 20000, WSA_REBIN_PEAK },
+	{ 2000ULL * MHZ, 2400ULL * MHZ, 100000, WSA_REBIN_PEAK },
+	{ 120ULL * MHZ, 300ULL * MHZ, 1000000, WSA_REBIN_PEAK }
+};
+
+/// a client, and what its captures came to
+struct wsa_bench_scheduler_client {
+	struct wsa_sweep_scheduler *scheduler;
+	struct wsa_sweep_request *request;
+	uint32_t captures;
+
+	uint32_t failures;
+	int16_t result;
+	uint64_t missed;
+	uint64_t elapsed;
+};
+
+
+/**
+ * a client's thread: captures its spectrum the given number of times,
+ * counting the captures that fail and the bins they miss
+ *
+ * @param arg - the client
+ */
+static void wsa_bench_scheduler_client_run(void *arg)
+{
+	struct wsa_bench_scheduler_client *client = (struct wsa_bench_scheduler_client *) arg;
+	uint64_t start;
+	uint32_t i, k;
+	int16_t result;
+
+	start = wsa_perf_now();
+	for (i = 0; i < client->captures; i++) {
+		result = wsa_sweep_scheduler_capture(client->scheduler, client->request);
+		if (result < 0) {
+			client->failures++;
+			client->result = result;
+			continue;
+		}
+
+		for (k = 0; k < client->request->buflen; k++) {
+			if (client->request->buf[k] == WSA_SPECTRUM_POISON)
+				client->missed++;
+		}
+	}
+	client->elapsed = wsa_perf_now() - start;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct wsa_bench_loopback *loopback;
+	struct wsa_device dev;
+	struct wsa_sweep_device *sweep_device;
+	struct wsa_sweep_scheduler *scheduler;
+	struct wsa_bench_scheduler_client clients[WSA_BENCH_SCHEDULER_CLIENTS];
+	wsa_thread_t threads[WSA_BENCH_SCHEDULER_CLIENTS];
+	char intf_method[64];
+	uint32_t captures = WSA_BENCH_SCHEDULER_DEFAULT_CAPTURES;
+	int16_t result;
+	int failed = 0;
+	int started = 0;
+	int i;
+
+	if (argc > 1 && atoi(argv[1]) > 0)
+		captures = (uint32_t) atoi(argv[1]);
+
+	result = wsa_bench_loopback_start(&loopback);
+	if (result < 0) {
+		fprintf(stderr, "wsaschedbench: can't start the loopback device: %s\n",
+			wsa_get_error_msg(result));
+		return 1;
+	}
+
+	memset(&dev, 0, sizeof(struct wsa_device));
+	wsa_bench_loopback_intf_method(loopback, intf_method);
+	result = wsa_open(&dev, intf_method);
+	if (result < 0) {
+		fprintf(stderr, "wsaschedbench: can't connect to the loopback device: %s\n",
+			wsa_get_error_msg(result));
+		wsa_bench_loopback_stop(loopback);
+		return 1;
+	}
+
+	sweep_device = wsa_sweep_device_new(&dev);
+	if (sweep_device == NULL || wsa_sweep_scheduler_new(sweep_device, &scheduler) < 0) {
+		fprintf(stderr, "wsaschedbench: out of memory\n");
+		if (sweep_device != NULL)
+			wsa_sweep_device_free(sweep_device);
+		wsa_close(&dev);
+		wsa_bench_loopback_stop(loopback);
+		return 1;
+	}
+	wsa_sweep_device_set_attenuator(sweep_device, 0);
+
+	memset(clients, 0, sizeof(clients));
+	for (i = 0; i < WSA_BENCH_SCHEDULER_CLIENTS; i++) {
+		clients[i].scheduler = scheduler;
+		clients[i].captures = captures;
+		result = wsa_sweep_request_alloc(wsa_bench_scheduler_requests[i].fstart,
+			wsa_bench_scheduler_requests[i].fstop, wsa_bench_scheduler_requests[i].rbw,
+			WSA_BENCH_SCHEDULER_MODE, wsa_bench_scheduler_requests[i].rebin,
+			&clients[i].request);
+		if (result < 0) {
+			fprintf(stderr, "wsaschedbench: can't allocate request %d: %s\n",
+				i, wsa_get_error_msg(result));
+			failed = 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < WSA_BENCH_SCHEDULER_CLIENTS && !failed; i++) {
+		result = wsa_thread_create(&threads[i], wsa_bench_scheduler_client_run, &clients[i]);
+		if (result < 0) {
+			fprintf(stderr, "wsaschedbench: can't start client %d: %s\n",
+				i, wsa_get_error_msg(result));
+			failed = 1;
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++)
+		wsa_thread_join(threads[i]);
+
+	if (started == WSA_BENCH_SCHEDULER_CLIENTS) {
+		printf("client,fstart_hz,fstop_hz,rbw_hz,swept_rbw_hz,captures,failures,"
+			"missed_bins,ms_per_capture\n");
+		for (i = 0; i < WSA_BENCH_SCHEDULER_CLIENTS; i++) {
+			printf("%d,%llu,%llu,%u,%llu,%u,%u,%llu,%.3f\n", i,
+				clients[i].request->fstart, clients[i].request->fstop,
+				clients[i].request->rbw, clients[i].request->swept_rbw,
+				clients[i].captures, clients[i].failures, clients[i].missed,
+				(double) clients[i].elapsed / clients[i].captures / 1e6);
+			if (clients[i].failures > 0) {
+				fprintf(stderr, "wsaschedbench: client %d failed: %s\n",
+					i, wsa_get_error_msg(clients[i].result));
+				failed = 1;
+			}
+			if (clients[i].missed > 0)
+				failed = 1;
+		}
+		printf("batches %u, requests %u, sweeps %u, configs kept %u\n",
+			scheduler->batches, scheduler->requests, scheduler->sweeps,
+			scheduler->region_count);
+	}
+
+	for (i = 0; i < WSA_BENCH_SCHEDULER_CLIENTS; i++) {
+		if (clients[i].request != NULL)
+			wsa_sweep_request_free(clients[i].request);
+	}
+	wsa_sweep_scheduler_free(scheduler);
+	wsa_sweep_device_free(sweep_device);
+	wsa_close(&dev);
+	wsa_bench_loopback_stop(loopback);
+
+	return failed;
+}
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "wsa_api.h"
+#include "wsa_error.h"
+#include "wsa_lib.h"
+#include "wsa_perf.h"
+#include "wsa_sweep_device.h"
+#include "wsa_uring.h"
+#include "wsa_bench.h"
+
+
+// *****
+// End-to-end sweep benchmark: plans, configures and captures power spectra
+// over a range of spans and RBWs against a loopback device serving
+// synthetic VRT, and prints one CSV line per span and RBW, timing whole
+// captures and refreshes of the steps due.  Pass "uring" to read the data
+// socket through io_uring, on builds that have it.
+//
+// Usage: wsasweepbench [minimum milliseconds of sweeps per configuration] [uring]
+// *****
+
+#define WSA_BENCH_SWEEP_DEFAULT_MIN_MS 1000
+#define WSA_BENCH_SWEEP_MIN_SWEEPS 3
+#define WSA_BENCH_SWEEP_CONFIGURES 5
+#define WSA_BENCH_SWEEP_MODE "SH"
+#define WSA_BENCH_SWEEP_FSTART (100ULL * MHZ)
+
+static const uint64_t wsa_bench_sweep_spans[] = {
+	40ULL * MHZ, 1000ULL * MHZ, 8000ULL * MHZ
+};
+static const uint32_t wsa_bench_sweep_rbws[] = {
+	1000000, 100000, 10000, 1000
+};
+
+
+/**
+ * the CPU time used by the calling thread, which excludes the loopback
+ * device's own work
+ *
+ * @return the CPU time in nanoseconds
+ */
+static uint64_t wsa_bench_thread_cpu_ns(void)
+{
+#ifdef _WIN32
+	FILETIME creation, exit_time, kernel, user;
+	ULARGE_INTEGER k, u;
+
+	GetThreadTimes(GetCurrentThread(), &creation, &exit_time, &kernel, &user);
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+
+	// FILETIME counts 100 ns intervals
+	return (k.QuadPart + u.QuadPart) * 100;
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+#endif
+}
+
+
+/**
+ * times a capture function over a config for at least a minimum time
+ *
+ * @param sweep_device - the sweep device connected to the loopback device
+ * @param pscfg - the config to capture, already configured
+ * @param capture - wsa_capture_power_spectrum() or wsa_refresh_power_spectrum()
+ * @param min_ns - the minimum time to spend sweeping
+ * @param sweeps - the number of captures is stored here
+ * @param elapsed - the time they took in nanoseconds is stored here
+ * @param cpu - the CPU time they took in nanoseconds is stored here
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int wsa_bench_sweep_time(struct wsa_sweep_device *sweep_device,
+		struct wsa_power_spectrum_config *pscfg,
+		int (*capture)(struct wsa_sweep_device *, struct wsa_power_spectrum_config *, float **),
+		uint64_t min_ns, uint32_t *sweeps, uint64_t *elapsed, uint64_t *cpu)
+{
+	float *buf = NULL;
+	uint64_t start;
+	uint64_t cpu_start;
+	int result;
+
+	*sweeps = 0;
+	cpu_start = wsa_bench_thread_cpu_ns();
+	start = wsa_perf_now();
+	do {
+		result = capture(sweep_device, pscfg, &buf);
+		if (result < 0)
+			return result;
+
+		(*sweeps)++;
+		*elapsed = wsa_perf_now() - start;
+	} while (*elapsed < min_ns || *sweeps < WSA_BENCH_SWEEP_MIN_SWEEPS);
+	*cpu = wsa_bench_thread_cpu_ns() - cpu_start;
+
+	return 0;
+}
+
+
+/**
+ * measures one span and RBW and prints its CSV line
+ *
+ * @param sweep_device - the sweep device connected to the loopback device
+ * @param span - the span to sweep, starting at WSA_BENCH_SWEEP_FSTART
+ * @param rbw - the RBW asked of the planner
+ * @param min_ns - the minimum time to spend sweeping
+ *
+ * @return 0 on success, or a negative number on error
+ */
+static int wsa_bench_sweep_run(struct wsa_sweep_device *sweep_device,
+		uint64_t span, uint32_t rbw, uint64_t min_ns)
+{
+	struct wsa_power_spectrum_config *pscfg;
+	float *buf = NULL;
+	uint64_t start;
+	uint64_t configure_ns = 0;
+	uint64_t elapsed;
+	uint64_t cpu;
+	uint32_t sweeps;
+	uint64_t refresh_elapsed;
+	uint64_t refresh_cpu;
+	uint32_t refreshes;
+	int result;
+	int i;
+
+	result = wsa_power_spectrum_alloc(sweep_device, WSA_BENCH_SWEEP_FSTART,
+		WSA_BENCH_SWEEP_FSTART + span, rbw, WSA_BENCH_SWEEP_MODE, &pscfg);
+	if (result < 0)
+		return result;
+
+	// configuring replaces the whole sweep list, so it can be repeated
+	for (i = 0; i < WSA_BENCH_SWEEP_CONFIGURES; i++) {
+		start = wsa_perf_now();
+		result = wsa_configure_sweeps(sweep_device, &pscfg, 1);
+		configure_ns += wsa_perf_now() - start;
+		if (result < 0) {
+			wsa_power_spectrum_free(pscfg);
+			return result;
+		}
+	}
+
+	// warm up
+	result = wsa_capture_power_spectrum(sweep_device, pscfg, &buf);
+	if (result < 0) {
+		wsa_power_spectrum_free(pscfg);
+		return result;
+	}
+
+	result = wsa_bench_sweep_time(sweep_device, pscfg, wsa_capture_power_spectrum,
+		min_ns, &sweeps, &elapsed, &cpu);
+	if (result == 0)
+		result = wsa_bench_sweep_time(sweep_device, pscfg, wsa_refresh_power_spectrum,
+			min_ns, &refreshes, &refresh_elapsed, &refresh_cpu);
+	if (result < 0) {
+		wsa_power_spectrum_free(pscfg);
+		return result;
+	}
+
+	printf("%llu,%llu,%u,%u,%u,%.3f,%u,%.2f,%.3f,%.3f,%u,%.3f,%.3f\n",
+		span, pscfg->rbw, pscfg->samples_per_packet, pscfg->packets_per_block,
+		pscfg->packet_total,
+		(double) configure_ns / WSA_BENCH_SWEEP_CONFIGURES / 1e6,
+		sweeps,
+		sweeps / ((double) elapsed / 1e9),
+		(double) elapsed / sweeps / 1e6,
+		(double) cpu / sweeps / 1e6,
+		refreshes,
+		(double) refresh_elapsed / refreshes / 1e6,
+		(double) refresh_cpu / refreshes / 1e6);
+	fflush(stdout);
+
+	wsa_power_spectrum_free(pscfg);
+
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct wsa_bench_loopback *loopback;
+	struct wsa_device dev;
+	struct wsa_sweep_device *sweep_device;
+	char intf_method[64];
+	uint64_t min_ns;
+	int16_t result = 0;
+	int i;
+	int j;
+
+	min_ns = (uint64_t) WSA_BENCH_SWEEP_DEFAULT_MIN_MS * 1000000ULL;
+	if (argc > 1 && atoi(argv[1]) > 0)
+		min_ns = (uint64_t) atoi(argv[1]) * 1000000ULL;
+
+	result = wsa_bench_loopback_start(&loopback);
+	if (result < 0) {
+		fprintf(stderr, "wsasweepbench: can't start the loopback device: %s\n",
+			wsa_get_error_msg(result));
+		return 1;
+	}
+
+	memset(&dev, 0, sizeof(struct wsa_device));
+	wsa_bench_loopback_intf_method(loopback, intf_method);
+	result = wsa_open(&dev, intf_method);
+	if (result < 0) {
+		fprintf(stderr, "wsasweepbench: can't connect to the loopback device: %s\n",
+			wsa_get_error_msg(result));
+		wsa_bench_loopback_stop(loopback);
+		return 1;
+	}
+
+	if (argc > 2 && strcmp(argv[2], "uring") == 0) {
+		result = wsa_uring_open(&dev, 0, 0);
+		if (result < 0) {
+			fprintf(stderr, "wsasweepbench: can't read through io_uring: %s\n",
+				wsa_get_error_msg(result));
+			wsa_close(&dev);
+			wsa_bench_loopback_stop(loopback);
+			return 1;
+		}
+	}
+
+	sweep_device = wsa_sweep_device_new(&dev);
+	if (sweep_device == NULL) {
+		fprintf(stderr, "wsasweepbench: out of memory\n");
+		wsa_close(&dev);
+		wsa_bench_loopback_stop(loopback);
+		return 1;
+	}
+	wsa_sweep_device_set_attenuator(sweep_device, 0);
+
+	printf("span_hz,rbw_hz,spp,ppb,packets,configure_ms,sweeps,sweeps_per_s,"
+		"ms_per_sweep,cpu_ms_per_sweep,refreshes,ms_per_refresh,cpu_ms_per_refresh\n");
+
+	// a sweep that fails, such as one whose list didn't load, leaves
+	// nothing the rest could be timed against
+	for (i = 0; i < (int) (sizeof(wsa_bench_sweep_spans) / sizeof(wsa_bench_sweep_spans[0])) &&
+			result >= 0; i++) {
+		for (j = 0; j < (int) (sizeof(wsa_bench_sweep_rbws) / sizeof(wsa_bench_sweep_rbws[0])); j++) {
+			result = (int16_t) wsa_bench_sweep_run(sweep_device,
+				wsa_bench_sweep_spans[i], wsa_bench_sweep_rbws[j], min_ns);
+			if (result < 0) {
+				fprintf(stderr, "wsasweepbench: span %llu Hz at rbw %u Hz failed: %s\n",
+					wsa_bench_sweep_spans[i], wsa_bench_sweep_rbws[j],
+					wsa_get_error_msg(result));
+				break;
+			}
+		}
+	}
+
+	wsa_sweep_device_free(sweep_device);
+	wsa_close(&dev);
+	wsa_bench_loopback_stop(loopback);
+
+	return result < 0;
+}
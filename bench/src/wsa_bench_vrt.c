@@ -0,0 +1,186 @@
+#include <math.h>
+#include <string.h>
+
+#include "wsa_error.h"
+#include "wsa_lib.h"
+#include "wsa_bench.h"
+
+// amplitude and period of the synthetic tone in the IF payloads
+#define WSA_BENCH_TONE_AMPLITUDE 4000.0
+#define WSA_BENCH_TONE_PERIOD 37.0
+
+
+/**
+ * stores a 32-bit word in network byte order
+ *
+ * @param dest - where to store the word
+ * @param word - the word
+ */
+static void wsa_bench_put_word(uint8_t *dest, uint32_t word)
+{
+	dest[0] = (uint8_t) (word >> 24);
+	dest[1] = (uint8_t) (word >> 16);
+	dest[2] = (uint8_t) (word >> 8);
+	dest[3] = (uint8_t) word;
+}
+
+
+/**
+ * writes the first five words of a VRT packet: the packet header, stream
+ * identifier and UTC/picosecond timestamps
+ *
+ * @param packet - the packet buffer
+ * @param packet_type - IF_PACKET_TYPE, CONTEXT_PACKET_TYPE...
+ * @param has_trailer - 1 if the packet ends with a trailer word
+ * @param pkt_count - the 4-bit packet count
+ * @param words - the packet size in words
+ * @param stream_id - the stream identifier
+ * @param sec - the UTC seconds timestamp
+ * @param psec - the picoseconds timestamp
+ */
+static void wsa_bench_put_header(uint8_t *packet, uint8_t packet_type, uint8_t has_trailer,
+		uint8_t pkt_count, uint32_t words, uint32_t stream_id, uint32_t sec, uint64_t psec)
+{
+	// TSI = UTC, TSF = real time (picoseconds)
+	wsa_bench_put_word(packet, ((uint32_t) packet_type << 28) | ((uint32_t) has_trailer << 26) |
+		(0x1 << 22) | (0x2 << 20) | ((uint32_t) (pkt_count & 0x0f) << 16) | (words & 0xffff));
+	wsa_bench_put_word(packet + 4, stream_id);
+	wsa_bench_put_word(packet + 8, sec);
+	wsa_bench_put_word(packet + 12, (uint32_t) (psec >> 32));
+	wsa_bench_put_word(packet + 16, (uint32_t) psec);
+}
+
+
+/**
+ * builds an IF data packet whose payload holds a tone, as the device sends it
+ *
+ * @param packet - a buffer of at least
+ *		(payload_words + WSA_BENCH_IF_OVERHEAD_WORDS) * BYTES_PER_VRT_WORD bytes
+ * @param stream_id - I16Q16_DATA_STREAM_ID, I16_DATA_STREAM_ID or I32_DATA_STREAM_ID
+ * @param payload_words - the number of 32-bit payload words, which with the
+ *		header and trailer must fit in VRT_MAX_PACKET_WORDS
+ * @param pkt_count - the 4-bit packet count
+ * @param sec - the UTC seconds timestamp
+ * @param psec - the picoseconds timestamp
+ *
+ * @return the packet size in bytes, or a negative number on error
+ */
+int32_t wsa_bench_build_if_packet(uint8_t *packet, uint32_t stream_id,
+		uint32_t payload_words, uint8_t pkt_count, uint32_t sec, uint64_t psec)
+{
+	uint32_t words = payload_words + WSA_BENCH_IF_OVERHEAD_WORDS;
+	uint8_t *payload = packet + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD;
+	double phase;
+	int16_t i_sample;
+	int16_t q_sample;
+	uint32_t i;
+
+	// the size field would wrap
+	if (payload_words > VRT_MAX_PACKET_WORDS - WSA_BENCH_IF_OVERHEAD_WORDS)
+		return WSA_ERR_VRTPACKETSIZE;
+
+	wsa_bench_put_header(packet, IF_PACKET_TYPE, 1, pkt_count, words, stream_id, sec, psec);
+
+	for (i = 0; i < payload_words; i++) {
+		phase = 2.0 * 3.14159265358979 * i / WSA_BENCH_TONE_PERIOD;
+		i_sample = (int16_t) (WSA_BENCH_TONE_AMPLITUDE * cos(phase));
+		q_sample = (int16_t) (WSA_BENCH_TONE_AMPLITUDE * sin(phase));
+
+		if (stream_id == I32_DATA_STREAM_ID)
+			wsa_bench_put_word(payload + i * 4, (uint32_t) ((int32_t) i_sample << 8));
+		else
+			wsa_bench_put_word(payload + i * 4,
+				((uint32_t) (uint16_t) i_sample << 16) | (uint16_t) q_sample);
+	}
+
+	// trailer: valid data
+	wsa_bench_put_word(payload + payload_words * 4, 0x40040000);
+
+	return (int32_t) (words * BYTES_PER_VRT_WORD);
+}
+
+
+/**
+ * builds a receiver context packet holding a center frequency and gains
+ *
+ * @param packet - a buffer of at least
+ *		WSA_BENCH_RECEIVER_WORDS * BYTES_PER_VRT_WORD bytes
+ * @param pkt_count - the 4-bit packet count
+ * @param sec - the UTC seconds timestamp
+ * @param freq - the center frequency in Hz
+ *
+ * @return the packet size in bytes
+ */
+int32_t wsa_bench_build_receiver_packet(uint8_t *packet, uint8_t pkt_count,
+		uint32_t sec, uint64_t freq)
+{
+	uint8_t *fields = packet + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD;
+
+	wsa_bench_put_header(packet, CONTEXT_PACKET_TYPE, 0, pkt_count,
+		WSA_BENCH_RECEIVER_WORDS, RECEIVER_STREAM_ID, sec, 0);
+
+	wsa_bench_put_word(fields, FREQ_INDICATOR_MASK | GAIN_INDICATOR_MASK);
+
+	// frequency in 64-bit, 20-bit radix point
+	wsa_bench_put_word(fields + 4, (uint32_t) (freq >> 12));
+	wsa_bench_put_word(fields + 8, (uint32_t) (freq << 20));
+
+	// no IF or RF gain
+	wsa_bench_put_word(fields + 12, 0);
+
+	return WSA_BENCH_RECEIVER_WORDS * BYTES_PER_VRT_WORD;
+}
+
+
+/**
+ * builds a digitizer context packet holding a reference level
+ *
+ * @param packet - a buffer of at least
+ *		WSA_BENCH_DIGITIZER_WORDS * BYTES_PER_VRT_WORD bytes
+ * @param pkt_count - the 4-bit packet count
+ * @param sec - the UTC seconds timestamp
+ * @param reference_level - the reference level in dBm
+ *
+ * @return the packet size in bytes
+ */
+int32_t wsa_bench_build_digitizer_packet(uint8_t *packet, uint8_t pkt_count,
+		uint32_t sec, int16_t reference_level)
+{
+	uint8_t *fields = packet + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD;
+
+	wsa_bench_put_header(packet, CONTEXT_PACKET_TYPE, 0, pkt_count,
+		WSA_BENCH_DIGITIZER_WORDS, DIGITIZER_STREAM_ID, sec, 0);
+
+	wsa_bench_put_word(fields, REF_LEVEL_INDICATOR_MASK);
+
+	// reference level in the low 16 bits, 7-bit radix point
+	wsa_bench_put_word(fields + 4, (uint32_t) (uint16_t) (reference_level << 7));
+
+	return WSA_BENCH_DIGITIZER_WORDS * BYTES_PER_VRT_WORD;
+}
+
+
+/**
+ * builds an extension context packet holding the ID a sweep was started with
+ *
+ * @param packet - a buffer of at least
+ *		WSA_BENCH_EXTENSION_WORDS * BYTES_PER_VRT_WORD bytes
+ * @param pkt_count - the 4-bit packet count
+ * @param sec - the UTC seconds timestamp
+ * @param sweep_start_id - the sweep start ID
+ *
+ * @return the packet size in bytes
+ */
+int32_t wsa_bench_build_extension_packet(uint8_t *packet, uint8_t pkt_count,
+		uint32_t sec, uint32_t sweep_start_id)
+{
+	uint8_t *fields = packet + VRT_HEADER_SIZE * BYTES_PER_VRT_WORD;
+
+	wsa_bench_put_header(packet, EXTENSION_PACKET_TYPE, 0, pkt_count,
+		WSA_BENCH_EXTENSION_WORDS, EXTENSION_STREAM_ID, sec, 0);
+
+	wsa_bench_put_word(fields, SWEEP_START_ID_INDICATOR_MASK);
+	wsa_bench_put_word(fields + 4, sweep_start_id);
+
+	return WSA_BENCH_EXTENSION_WORDS * BYTES_PER_VRT_WORD;
+}